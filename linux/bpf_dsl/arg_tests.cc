@@ -0,0 +1,172 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/arg_tests.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+const uint64_t kUpperHalf = 0xffffffff00000000ULL;
+const uint64_t kLowerHalf = 0x00000000ffffffffULL;
+const uint64_t kSignBit = 0x80000000ULL;
+
+uint64_t HighestBit(uint64_t x) {
+  DCHECK_NE(0U, x);
+  uint64_t bit = 1ULL << 63;
+  while (!(x & bit)) {
+    bit >>= 1;
+  }
+  return bit;
+}
+
+}  // namespace
+
+ArgTests::ArgTests() : tests_(), narrow_args_(0) {}
+
+ArgTests::~ArgTests() {}
+
+void ArgTests::AddInRange(int argno,
+                          size_t width,
+                          uint64_t mask,
+                          uint64_t lo,
+                          uint64_t hi) {
+  CHECK(argno >= 0 && argno < 6) << "Invalid argument number " << argno;
+  CHECK(width == 4 || width == 8) << "Invalid argument width " << width;
+  // PolicyCompiler doesn't even load the argument for a range of all
+  // values, so it doesn't check its width either.
+  const uint64_t max = width == 4 ? 0xffffffffULL : ~0ULL;
+  if (lo == 0 && hi == max) {
+    return;
+  }
+  if (width == 4) {
+    narrow_args_ |= 1U << argno;
+  }
+  tests_[argno].push_back(Test{mask, lo, hi});
+
+  // BPF compares the halves of a 64-bit argument one at a time, so a
+  // program can tell apart values that the test as a whole doesn't, e.g.
+  // by not comparing one of the halves. Splitting on each half of each
+  // bound as well catches such programs.
+  if (width == 8) {
+    if (lo == hi) {
+      AddHalfTests(argno, mask, lo, false);
+    } else {
+      if (lo != 0) {
+        AddHalfTests(argno, mask, lo, true);
+      }
+      if (hi != max) {
+        AddHalfTests(argno, mask, hi, true);
+      }
+    }
+  }
+}
+
+void ArgTests::AddHalfTests(int argno,
+                            uint64_t mask,
+                            uint64_t bound,
+                            bool ordered) {
+  for (uint64_t half : {kUpperHalf, kLowerHalf}) {
+    if (!(mask & half)) {
+      continue;
+    }
+    tests_[argno].push_back(Test{mask & half, bound & half, bound & half});
+    if (ordered) {
+      tests_[argno].push_back(Test{mask & half, bound & half, half});
+    }
+  }
+}
+
+std::vector<uint64_t> ArgTests::Partition(int argno) const {
+  CHECK(argno >= 0 && argno < 6) << "Invalid argument number " << argno;
+  std::vector<Test> tests = tests_[argno];
+  if (narrow_args_ & (1U << argno)) {
+    tests.push_back(Test{kUpperHalf, 0, 0});
+    tests.push_back(Test{kUpperHalf, kUpperHalf, kUpperHalf});
+    tests.push_back(Test{kSignBit, kSignBit, kSignBit});
+  }
+
+  // Tests whose masks don't overlap, directly or through other tests,
+  // have independent outcomes, so they're split separately and their
+  // classes combined in every way. Splitting them together would only
+  // enumerate the same combinations much more slowly.
+  std::vector<std::pair<uint64_t, std::vector<Test>>> components;
+  for (const Test& test : tests) {
+    std::pair<uint64_t, std::vector<Test>> merged(test.mask, {test});
+    for (size_t i = components.size(); i-- > 0;) {
+      if (components[i].first & test.mask) {
+        merged.first |= components[i].first;
+        merged.second.insert(merged.second.end(),
+                             components[i].second.begin(),
+                             components[i].second.end());
+        components.erase(components.begin() + i);
+      }
+    }
+    components.push_back(std::move(merged));
+  }
+
+  std::vector<uint64_t> values = {0};
+  for (const auto& component : components) {
+    std::map<std::vector<bool>, uint64_t> classes;
+    Split(component.second, 0, component.first, &classes);
+    std::vector<uint64_t> combined;
+    for (uint64_t value : values) {
+      for (const auto& c : classes) {
+        combined.push_back(value | c.second);
+      }
+    }
+    values.swap(combined);
+  }
+  std::sort(values.begin(), values.end());
+  return values;
+}
+
+void ArgTests::Split(const std::vector<Test>& tests,
+                     uint64_t value,
+                     uint64_t free,
+                     std::map<std::vector<bool>, uint64_t>* classes) {
+  // The values in question are |value| with any of the bits in |free|
+  // set. Setting bits only increases the masked value, so each test
+  // passes for all of them if it passes for the extremes, and fails for
+  // all of them if the extremes are on the same side of the range.
+  std::vector<bool> outcomes(tests.size());
+  uint64_t undecided = 0;
+  for (size_t i = 0; i < tests.size(); ++i) {
+    const Test& test = tests[i];
+    const uint64_t min = value & test.mask;
+    const uint64_t max = min | (free & test.mask);
+    if (test.lo <= min && max <= test.hi) {
+      outcomes[i] = true;
+    } else if (max < test.lo || min > test.hi) {
+      outcomes[i] = false;
+    } else {
+      undecided |= free & test.mask;
+    }
+  }
+  if (!undecided) {
+    // The bits that are still free don't matter, so leave them clear.
+    classes->insert(std::make_pair(outcomes, value));
+    return;
+  }
+
+  // Splitting on the highest bit first follows the boundaries of the
+  // ranges, so only the values along them are split further.
+  const uint64_t bit = HighestBit(undecided);
+  Split(tests, value, free & ~bit, classes);
+  Split(tests, value | bit, free & ~bit, classes);
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,83 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_ARG_TESTS_H_
+#define SANDBOX_LINUX_BPF_DSL_ARG_TESTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// ArgTests collects the tests that a result expression makes on system
+// call arguments, and splits each argument's values into the classes of
+// values that all of the tests treat the same.
+class SANDBOX_EXPORT ArgTests {
+ public:
+  ArgTests();
+  ~ArgTests();
+
+  // Partition returns one value from each class of values of argument
+  // |argno|, in ascending order. Values that only differ in bits that no
+  // test looks at are in the same class, and are represented with those
+  // bits cleared. If the argument is tested as a 32-bit value, the
+  // classes also tell apart whether its upper half is zero, all ones, or
+  // anything else, and whether bit 31 is set, which is all that matters
+  // to PolicyCompiler's check of the upper half. If it's tested as a
+  // 64-bit value, the classes also tell apart how each half compares to
+  // that half of each bound, since that's how BPF compares it.
+  std::vector<uint64_t> Partition(int argno) const;
+
+  // narrow_args returns a bitmask of the arguments that are tested as
+  // 32-bit values.
+  uint32_t narrow_args() const { return narrow_args_; }
+
+  // Functions below are meant for use within bpf_dsl itself.
+
+  // AddInRange adds a test of whether argument |argno| of |width| bytes,
+  // bitwise-AND'd with |mask|, is within the inclusive range [lo, hi].
+  // Equality tests have lo == hi. A range of all values isn't a test.
+  void AddInRange(int argno,
+                  size_t width,
+                  uint64_t mask,
+                  uint64_t lo,
+                  uint64_t hi);
+
+ private:
+  struct Test {
+    uint64_t mask;
+    uint64_t lo;
+    uint64_t hi;
+  };
+
+  // Adds tests of whether each half of argument |argno|, bitwise-AND'd
+  // with |mask|, equals that half of |bound|, and if |ordered|, whether
+  // it's at least that half of |bound|.
+  void AddHalfTests(int argno, uint64_t mask, uint64_t bound, bool ordered);
+
+  // Adds to |classes| a value for every combination of outcomes of
+  // |tests| among |value| with any of the bits in |free| set, keyed by the
+  // outcomes.
+  static void Split(const std::vector<Test>& tests,
+                    uint64_t value,
+                    uint64_t free,
+                    std::map<std::vector<bool>, uint64_t>* classes);
+
+  std::vector<Test> tests_[6];
+  uint32_t narrow_args_;
+
+  DISALLOW_COPY_AND_ASSIGN(ArgTests);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_ARG_TESTS_H_
@@ -0,0 +1,67 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/arg_tests.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Returns the classes of argument 0's values that |res| tells apart.
+std::vector<uint64_t> Partition(const ResultExpr& res) {
+  ArgTests tests;
+  res->AddArgTests(&tests);
+  return tests.Partition(0);
+}
+
+TEST(ArgTests, Partition) {
+  const Arg<int> fd(0);
+  const Arg<uint32_t> mode(0);
+  const Arg<uint64_t> addr(0);
+
+  EXPECT_EQ(std::vector<uint64_t>({0}), Partition(Allow()));
+  EXPECT_EQ(std::vector<uint64_t>({0, 3}),
+            Partition(If((addr & 0xff) == 3, Allow()).Else(Kill())));
+
+  // The halves of 64-bit bounds are compared separately, so values are
+  // also told apart by whether the upper half matches the bounds', and
+  // by how the lower half compares to each bound's.
+  EXPECT_EQ(std::vector<uint64_t>({0, 10, 11, 20, 21, 0x100000000ULL,
+                                   0x10000000aULL, 0x10000000bULL,
+                                   0x100000014ULL, 0x100000015ULL}),
+            Partition(If(AllOf(addr >= 10, addr <= 20), Allow()).Else(Kill())));
+
+  // PolicyCompiler doesn't compile a test of a 32-bit argument that all
+  // values pass, including the check of its upper half.
+  EXPECT_EQ(std::vector<uint64_t>({0}),
+            Partition(If(mode >= 0U, Allow()).Else(Kill())));
+
+  // Masks that don't overlap are combined in every way.
+  EXPECT_EQ(std::vector<uint64_t>({0, 1, 0x100, 0x101}),
+            Partition(If((addr & 0xf00) == 0x100, Allow())
+                          .ElseIf((addr & 0xf) == 1, Kill())
+                          .Else(Error(EPERM))));
+
+  // Values of a 32-bit argument are also told apart by whether the upper
+  // half is zero, all ones or anything else, and by the sign bit.
+  EXPECT_EQ(std::vector<uint64_t>({0, 3, 0x80000000, 0x100000000ULL,
+                                   0x100000003ULL, 0x180000000ULL,
+                                   0xffffffff00000000ULL,
+                                   0xffffffff00000003ULL,
+                                   0xffffffff80000000ULL}),
+            Partition(If(fd == 3, Allow()).Else(Kill())));
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,508 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_BATCH_EVALUATOR_H_
+#define SANDBOX_LINUX_BPF_DSL_BATCH_EVALUATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "build/build_config.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+
+// This header implements BatchVerifier::EvaluateBPF. It's included by
+// files that are compiled with different instruction sets, so it must
+// only contain templates that are instantiated with types specific to
+// each file, or inline functions that are only used by the portable
+// version. Otherwise, the linker might pick a copy of a function that
+// uses instructions the CPU doesn't support.
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace internal {
+
+// BatchInsn is a BPF instruction decoded for the batch evaluator.
+// Decoding checks everything about an instruction that doesn't depend
+// on the state of the machine, and resolves jump targets to absolute
+// instruction indices.
+struct BatchInsn {
+  enum Kind : uint8_t {
+    FAIL,     // Fails with |err|.
+    RET,      // Returns |k|.
+    LD_ABS,   // Loads the data word at offset |k| into the accumulator.
+    LD_IMM,   // Loads |k| into the accumulator.
+    LD_MEM,   // Loads scratch memory word |k| into the accumulator.
+    LDX_IMM,  // Loads |k| into the index register.
+    LDX_MEM,  // Loads scratch memory word |k| into the index register.
+    ST,       // Stores the accumulator in scratch memory word |k|.
+    STX,      // Stores the index register in scratch memory word |k|.
+    TAX,      // Copies the accumulator to the index register.
+    TXA,      // Copies the index register to the accumulator.
+    JA,       // Jumps to |jt|.
+    JMP,      // Jumps to |jt| if comparison |op| holds, or |jf| otherwise.
+    NEG,      // Negates the accumulator.
+    ALU,      // Applies arithmetic operation |op| to the accumulator.
+  };
+
+  Kind kind;
+  uint16_t op;  // BPF_OP of JMP and ALU instructions.
+  bool x;       // Whether JMP and ALU instructions use the index register
+                // rather than |k| as their operand.
+  uint32_t k;
+  uint32_t jt;
+  uint32_t jf;
+  const char* err;
+};
+
+// Decodes the instruction at |pc| of |program|. The checks mirror the
+// ones that Verifier::EvaluateBPF makes while executing it. JitProgram
+// decodes programs with this too.
+BatchInsn DecodeBatchInsn(const std::vector<struct sock_filter>& program,
+                          unsigned int pc);
+
+// The batch evaluator runs a program on several system calls at once,
+// one per lane of a vector. Each lane has its own registers and
+// instruction pointer. The evaluator steps through the program, and
+// executes each instruction for the lanes whose instruction pointer
+// is at it, masking out the others; lanes that branch differently
+// diverge, and wait for each other to catch up if their paths meet
+// again. Since BPF only jumps forward, every instruction is executed
+// at most once per batch.
+//
+// The Lanes template parameter implements the vector operations. It
+// provides a Vec type holding kLanes uint32_t values, and operations
+// on Vecs. Comparisons return Vecs of masks, where all bits of a lane
+// are set if the comparison holds. Bit i of a lane set (a uint32_t)
+// stands for lane i. Min returns the smallest value of any lane.
+
+// Executes arithmetic operations that have no vector versions, or
+// that may fail, one lane at a time.
+template <typename Lanes>
+typename Lanes::Vec AluByLane(const BatchInsn& insn,
+                              typename Lanes::Vec acc,
+                              typename Lanes::Vec index,
+                              const uint32_t* order,
+                              uint32_t* lanes,
+                              uint32_t* results,
+                              const char** errs) {
+  uint32_t accs[Lanes::kLanes];
+  uint32_t indexes[Lanes::kLanes];
+  Lanes::Store(accs, acc);
+  Lanes::Store(indexes, index);
+  for (size_t i = 0; i < Lanes::kLanes; ++i) {
+    if (!(*lanes & (1U << i))) {
+      continue;
+    }
+    // This mirrors the scalar Alu() in verifier.cc.
+    const char* err = nullptr;
+    uint32_t& accumulator = accs[i];
+    const uint32_t k = insn.x ? indexes[i] : insn.k;
+    switch (insn.op) {
+      case BPF_MUL:
+        accumulator *= k;
+        break;
+      case BPF_DIV:
+        if (!k) {
+          err = "Illegal division by zero";
+          break;
+        }
+        accumulator /= k;
+        break;
+      case BPF_MOD:
+        if (!k) {
+          err = "Illegal division by zero";
+          break;
+        }
+        accumulator %= k;
+        break;
+      case BPF_LSH:
+        if (k >= 32) {
+          err = "Illegal shift operation";
+          break;
+        }
+        accumulator <<= k;
+        break;
+      case BPF_RSH:
+        if (k >= 32) {
+          err = "Illegal shift operation";
+          break;
+        }
+        accumulator >>= k;
+        break;
+      default:
+        err = "Invalid operator in arithmetic operation";
+        break;
+    }
+    if (err) {
+      results[order[i]] = 0;
+      errs[order[i]] = err;
+      *lanes &= ~(1U << i);
+    }
+  }
+  return Lanes::Load(accs);
+}
+
+// Evaluates |program| for the system calls data[order[i]], for i less
+// than |count|, which is at most Lanes::kLanes.
+template <typename Lanes>
+void EvaluateBatchGroup(const BatchInsn* program,
+                        size_t length,
+                        const struct arch_seccomp_data* data,
+                        const uint32_t* order,
+                        size_t count,
+                        uint32_t* results,
+                        const char** errs) {
+  using Vec = typename Lanes::Vec;
+
+  uint32_t active = (1U << count) - 1;
+  const auto fail = [&](uint32_t lanes, const char* err) {
+    if (!lanes) {
+      return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (lanes & (1U << i)) {
+        results[order[i]] = 0;
+        errs[order[i]] = err;
+      }
+    }
+    active &= ~lanes;
+  };
+
+  // Lanes that are done are parked at UINT32_MAX, so that the smallest
+  // instruction pointer is the next instruction to execute.
+  const Vec zero = Lanes::Splat(0);
+  const Vec done = Lanes::Splat(UINT32_MAX);
+  Vec ip = Lanes::Select(Lanes::FromBits(active), zero, done);
+  Vec acc = zero;
+  Vec index = zero;
+  Vec mem[BPF_MEMWORDS];
+  for (size_t k = 0; k < BPF_MEMWORDS; ++k) {
+    mem[k] = zero;
+  }
+  // Lane sets of initialized registers and scratch memory words.
+  uint32_t acc_valid = 0;
+  uint32_t index_valid = 0;
+  uint32_t mem_valid[BPF_MEMWORDS] = {};
+
+  uint32_t pc = 0;
+  while (active) {
+    if (pc >= length) {
+      fail(active, "Invalid instruction pointer in BPF program");
+      break;
+    }
+    uint32_t here = Lanes::Bits(Lanes::Eq(ip, Lanes::Splat(pc)));
+
+    const BatchInsn& insn = program[pc];
+    Vec next = Lanes::Splat(pc + 1);
+    switch (insn.kind) {
+      case BatchInsn::FAIL:
+        fail(here, insn.err);
+        break;
+      case BatchInsn::RET:
+        for (size_t i = 0; i < count; ++i) {
+          if (here & (1U << i)) {
+            results[order[i]] = insn.k;
+            errs[order[i]] = nullptr;
+          }
+        }
+        active &= ~here;
+        break;
+      case BatchInsn::LD_ABS:
+        acc = Lanes::Select(Lanes::FromBits(here),
+                            Lanes::Gather(data, order, insn.k, here), acc);
+        acc_valid |= here;
+        break;
+      case BatchInsn::LD_IMM:
+        acc = Lanes::Select(Lanes::FromBits(here), Lanes::Splat(insn.k), acc);
+        acc_valid |= here;
+        break;
+      case BatchInsn::LD_MEM:
+        fail(here & ~mem_valid[insn.k],
+             "Invalid operand in BPF_LD instruction");
+        here &= mem_valid[insn.k];
+        acc = Lanes::Select(Lanes::FromBits(here), mem[insn.k], acc);
+        acc_valid |= here;
+        break;
+      case BatchInsn::LDX_IMM:
+        index =
+            Lanes::Select(Lanes::FromBits(here), Lanes::Splat(insn.k), index);
+        index_valid |= here;
+        break;
+      case BatchInsn::LDX_MEM:
+        fail(here & ~mem_valid[insn.k], "Invalid BPF_LDX instruction");
+        here &= mem_valid[insn.k];
+        index = Lanes::Select(Lanes::FromBits(here), mem[insn.k], index);
+        index_valid |= here;
+        break;
+      case BatchInsn::ST:
+        fail(here & ~acc_valid, "Invalid BPF_ST instruction");
+        here &= acc_valid;
+        mem[insn.k] = Lanes::Select(Lanes::FromBits(here), acc, mem[insn.k]);
+        mem_valid[insn.k] |= here;
+        break;
+      case BatchInsn::STX:
+        fail(here & ~index_valid, "Invalid BPF_STX instruction");
+        here &= index_valid;
+        mem[insn.k] =
+            Lanes::Select(Lanes::FromBits(here), index, mem[insn.k]);
+        mem_valid[insn.k] |= here;
+        break;
+      case BatchInsn::TAX:
+        fail(here & ~acc_valid, "Invalid BPF_MISC instruction");
+        here &= acc_valid;
+        index = Lanes::Select(Lanes::FromBits(here), acc, index);
+        index_valid |= here;
+        break;
+      case BatchInsn::TXA:
+        fail(here & ~index_valid, "Invalid BPF_MISC instruction");
+        here &= index_valid;
+        acc = Lanes::Select(Lanes::FromBits(here), index, acc);
+        acc_valid |= here;
+        break;
+      case BatchInsn::JA:
+        next = Lanes::Splat(insn.jt);
+        break;
+      case BatchInsn::JMP: {
+        const uint32_t valid = insn.x ? acc_valid & index_valid : acc_valid;
+        fail(here & ~valid, "Invalid BPF_JMP instruction");
+        here &= valid;
+        const Vec operand = insn.x ? index : Lanes::Splat(insn.k);
+        const Vec jt = Lanes::Splat(insn.jt);
+        const Vec jf = Lanes::Splat(insn.jf);
+        switch (insn.op) {
+          case BPF_JEQ:
+            next = Lanes::Select(Lanes::Eq(acc, operand), jt, jf);
+            break;
+          case BPF_JGT:
+            next = Lanes::Select(Lanes::Gt(acc, operand), jt, jf);
+            break;
+          case BPF_JGE:
+            next = Lanes::Select(Lanes::Gt(operand, acc), jf, jt);
+            break;
+          case BPF_JSET:
+            next = Lanes::Select(Lanes::Eq(Lanes::And(acc, operand), zero),
+                                 jf, jt);
+            break;
+        }
+        break;
+      }
+      case BatchInsn::NEG:
+        acc = Lanes::Select(Lanes::FromBits(here), Lanes::Sub(zero, acc), acc);
+        break;
+      case BatchInsn::ALU: {
+        if (insn.x) {
+          fail(here & ~index_valid,
+               "Unexpected source operand in arithmetic operation");
+          here &= index_valid;
+        }
+        const Vec operand = insn.x ? index : Lanes::Splat(insn.k);
+        const Vec mask = Lanes::FromBits(here);
+        switch (insn.op) {
+          case BPF_ADD:
+            acc = Lanes::Select(mask, Lanes::Add(acc, operand), acc);
+            break;
+          case BPF_SUB:
+            acc = Lanes::Select(mask, Lanes::Sub(acc, operand), acc);
+            break;
+          case BPF_OR:
+            acc = Lanes::Select(mask, Lanes::Or(acc, operand), acc);
+            break;
+          case BPF_XOR:
+            acc = Lanes::Select(mask, Lanes::Xor(acc, operand), acc);
+            break;
+          case BPF_AND:
+            acc = Lanes::Select(mask, Lanes::And(acc, operand), acc);
+            break;
+          default: {
+            uint32_t lanes = here;
+            acc = AluByLane<Lanes>(insn, acc, index, order, &lanes, results,
+                                   errs);
+            active &= ~(here & ~lanes);
+            break;
+          }
+        }
+        break;
+      }
+    }
+    ip = Lanes::Select(Lanes::FromBits(here), next, ip);
+    ip = Lanes::Select(Lanes::FromBits(active), ip, done);
+    // No lane can be behind, since jumps only go forward.
+    pc = Lanes::Min(ip);
+  }
+}
+
+// EvaluateBatch evaluates |program|, which has |length| instructions,
+// like Verifier::EvaluateBPF for the |count| system calls data[order[0]],
+// data[order[1]], etc., in that order. It stores the results and the
+// error strings in the corresponding elements of |results| and |errs|.
+template <typename Lanes>
+void EvaluateBatch(const BatchInsn* program,
+                   size_t length,
+                   const struct arch_seccomp_data* data,
+                   const uint32_t* order,
+                   size_t count,
+                   uint32_t* results,
+                   const char** errs) {
+  for (size_t i = 0; i < count; i += Lanes::kLanes) {
+    const size_t left = count - i;
+    EvaluateBatchGroup<Lanes>(program, length, data, order + i,
+                              left < Lanes::kLanes ? left : Lanes::kLanes,
+                              results, errs);
+  }
+}
+
+// PortableLanes implements the lane operations in plain C++.
+struct PortableLanes {
+  enum : size_t { kLanes = 4 };
+  struct Vec {
+    uint32_t v[kLanes];
+  };
+
+  static Vec Load(const uint32_t* src) {
+    Vec res;
+    memcpy(res.v, src, sizeof(res.v));
+    return res;
+  }
+  static void Store(uint32_t* dst, const Vec& a) {
+    memcpy(dst, a.v, sizeof(a.v));
+  }
+  static Vec Splat(uint32_t k) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = k;
+    }
+    return res;
+  }
+  static Vec Eq(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] == b.v[i] ? ~0U : 0;
+    }
+    return res;
+  }
+  static Vec Gt(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] > b.v[i] ? ~0U : 0;
+    }
+    return res;
+  }
+  static Vec Add(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] + b.v[i];
+    }
+    return res;
+  }
+  static Vec Sub(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] - b.v[i];
+    }
+    return res;
+  }
+  static Vec And(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] & b.v[i];
+    }
+    return res;
+  }
+  static Vec Or(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] | b.v[i];
+    }
+    return res;
+  }
+  static Vec Xor(const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = a.v[i] ^ b.v[i];
+    }
+    return res;
+  }
+  static Vec Select(const Vec& mask, const Vec& a, const Vec& b) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = (a.v[i] & mask.v[i]) | (b.v[i] & ~mask.v[i]);
+    }
+    return res;
+  }
+  static uint32_t Bits(const Vec& mask) {
+    uint32_t res = 0;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res |= (mask.v[i] & 1) << i;
+    }
+    return res;
+  }
+  static Vec FromBits(uint32_t lanes) {
+    Vec res;
+    for (size_t i = 0; i < kLanes; ++i) {
+      res.v[i] = (lanes & (1U << i)) ? ~0U : 0;
+    }
+    return res;
+  }
+  static uint32_t Min(const Vec& a) {
+    uint32_t res = a.v[0];
+    for (size_t i = 1; i < kLanes; ++i) {
+      res = a.v[i] < res ? a.v[i] : res;
+    }
+    return res;
+  }
+  // Loads the word at |offset| of data[order[i]] into each lane i in
+  // |lanes|, and 0 into the others.
+  static Vec Gather(const struct arch_seccomp_data* data,
+                    const uint32_t* order,
+                    uint32_t offset,
+                    uint32_t lanes) {
+    Vec res = Splat(0);
+    for (size_t i = 0; i < kLanes; ++i) {
+      if (lanes & (1U << i)) {
+        memcpy(&res.v[i],
+               reinterpret_cast<const char*>(&data[order[i]]) + offset,
+               sizeof(res.v[i]));
+      }
+    }
+    return res;
+  }
+};
+
+// BatchEvaluatorFn is the signature of EvaluateBatch's instantiations.
+using BatchEvaluatorFn = void (*)(const BatchInsn* program,
+                                  size_t length,
+                                  const struct arch_seccomp_data* data,
+                                  const uint32_t* order,
+                                  size_t count,
+                                  uint32_t* results,
+                                  const char** errs);
+
+#if defined(ARCH_CPU_X86_FAMILY) && !defined(OS_NACL_NONSFI)
+// Same as EvaluateBatch, but using SSE2 and AVX2 instructions
+// respectively.
+void EvaluateBatchSSE2(const BatchInsn* program,
+                       size_t length,
+                       const struct arch_seccomp_data* data,
+                       const uint32_t* order,
+                       size_t count,
+                       uint32_t* results,
+                       const char** errs);
+void EvaluateBatchAVX2(const BatchInsn* program,
+                       size_t length,
+                       const struct arch_seccomp_data* data,
+                       const uint32_t* order,
+                       size_t count,
+                       uint32_t* results,
+                       const char** errs);
+#endif
+
+}  // namespace internal
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_BATCH_EVALUATOR_H_
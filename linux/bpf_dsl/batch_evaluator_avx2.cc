@@ -0,0 +1,99 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file is compiled with -mavx2, so it must only be called on CPUs
+// that support AVX2, and it mustn't include headers that define inline
+// functions used elsewhere.
+
+#include "sandbox/linux/bpf_dsl/batch_evaluator.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace internal {
+
+namespace {
+
+static_assert(sizeof(struct arch_seccomp_data) % sizeof(uint32_t) == 0,
+              "System call data can't be gathered as words");
+
+struct AVX2Lanes {
+  enum : size_t { kLanes = 8 };
+  using Vec = __m256i;
+
+  static Vec Load(const uint32_t* src) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+  }
+  static void Store(uint32_t* dst, Vec a) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), a);
+  }
+  static Vec Splat(uint32_t k) { return _mm256_set1_epi32(k); }
+  static Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi32(a, b); }
+  static Vec Gt(Vec a, Vec b) {
+    // AVX2 only has signed comparisons, so flip the sign bits.
+    const Vec sign = _mm256_set1_epi32(0x80000000);
+    return _mm256_cmpgt_epi32(_mm256_xor_si256(a, sign),
+                              _mm256_xor_si256(b, sign));
+  }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm256_sub_epi32(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+  static Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+  static Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+  static Vec Select(Vec mask, Vec a, Vec b) {
+    return _mm256_blendv_epi8(b, a, mask);
+  }
+  static uint32_t Bits(Vec mask) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+  }
+  static Vec FromBits(uint32_t lanes) {
+    const Vec bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(lanes), bits),
+                              bits);
+  }
+  static uint32_t Min(Vec a) {
+    a = _mm256_min_epu32(a, _mm256_permute2x128_si256(a, a, 1));
+    a = _mm256_min_epu32(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm256_min_epu32(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm256_cvtsi256_si32(a);
+  }
+  static Vec Gather(const struct arch_seccomp_data* data,
+                    const uint32_t* order,
+                    uint32_t offset,
+                    uint32_t lanes) {
+    // Lanes that aren't in |lanes| are neither loaded from nor have
+    // their |order| read, so the last batch doesn't read past the end of
+    // either array.
+    const Vec mask = FromBits(lanes);
+    const int stride = sizeof(struct arch_seccomp_data) / sizeof(uint32_t);
+    const Vec indices = _mm256_mullo_epi32(
+        _mm256_maskload_epi32(reinterpret_cast<const int*>(order), mask),
+        _mm256_set1_epi32(stride));
+    return _mm256_mask_i32gather_epi32(
+        _mm256_setzero_si256(),
+        reinterpret_cast<const int*>(reinterpret_cast<const char*>(data) +
+                                     offset),
+        indices, mask, sizeof(uint32_t));
+  }
+};
+
+}  // namespace
+
+void EvaluateBatchAVX2(const BatchInsn* program,
+                       size_t length,
+                       const struct arch_seccomp_data* data,
+                       const uint32_t* order,
+                       size_t count,
+                       uint32_t* results,
+                       const char** errs) {
+  EvaluateBatch<AVX2Lanes>(program, length, data, order, count, results,
+                           errs);
+}
+
+}  // namespace internal
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,90 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/batch_evaluator.h"
+
+#include <emmintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace internal {
+
+namespace {
+
+struct SSE2Lanes {
+  enum : size_t { kLanes = 4 };
+  using Vec = __m128i;
+
+  static Vec Load(const uint32_t* src) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  }
+  static void Store(uint32_t* dst, Vec a) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), a);
+  }
+  static Vec Splat(uint32_t k) { return _mm_set1_epi32(k); }
+  static Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi32(a, b); }
+  static Vec Gt(Vec a, Vec b) {
+    // SSE2 only has signed comparisons, so flip the sign bits.
+    const Vec sign = _mm_set1_epi32(0x80000000);
+    return _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+  }
+  static Vec Add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+  static Vec Sub(Vec a, Vec b) { return _mm_sub_epi32(a, b); }
+  static Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+  static Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+  static Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+  static Vec Select(Vec mask, Vec a, Vec b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+  }
+  static uint32_t Bits(Vec mask) {
+    return _mm_movemask_ps(_mm_castsi128_ps(mask));
+  }
+  static Vec FromBits(uint32_t lanes) {
+    const Vec bits = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(lanes), bits), bits);
+  }
+  static uint32_t Min(Vec a) {
+    a = Select(Gt(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2))),
+               _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)), a);
+    a = Select(Gt(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1))),
+               _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)), a);
+    return _mm_cvtsi128_si32(a);
+  }
+  static Vec Gather(const struct arch_seccomp_data* data,
+                    const uint32_t* order,
+                    uint32_t offset,
+                    uint32_t lanes) {
+    // SSE2 has no gather instruction; the loads are cheap next to the
+    // interpretation, though.
+    uint32_t words[kLanes] = {};
+    for (size_t i = 0; i < kLanes; ++i) {
+      if (lanes & (1U << i)) {
+        memcpy(&words[i],
+               reinterpret_cast<const char*>(&data[order[i]]) + offset,
+               sizeof(words[i]));
+      }
+    }
+    return Load(words);
+  }
+};
+
+}  // namespace
+
+void EvaluateBatchSSE2(const BatchInsn* program,
+                       size_t length,
+                       const struct arch_seccomp_data* data,
+                       const uint32_t* order,
+                       size_t count,
+                       uint32_t* results,
+                       const char** errs) {
+  EvaluateBatch<SSE2Lanes>(program, length, data, order, count, results,
+                           errs);
+}
+
+}  // namespace internal
+}  // namespace bpf_dsl
+}  // namespace sandbox
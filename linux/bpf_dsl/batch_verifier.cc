@@ -0,0 +1,233 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/batch_verifier.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "build/build_config.h"
+#include "sandbox/linux/bpf_dsl/batch_evaluator.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+#if defined(ARCH_CPU_X86_FAMILY) && !defined(OS_NACL_NONSFI)
+#include "base/cpu.h"
+#endif
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+// Number of system calls that EvaluateBPF reorders at a time, and the
+// number of buckets that it sorts them into.
+const size_t kBatchChunkSize = 16384;
+const size_t kBatchBuckets = 1024;
+
+}  // namespace
+
+namespace internal {
+
+BatchInsn DecodeBatchInsn(const std::vector<struct sock_filter>& program,
+                          unsigned int pc) {
+  const struct sock_filter& insn = program[pc];
+  BatchInsn res = {BatchInsn::FAIL, static_cast<uint16_t>(BPF_OP(insn.code)),
+                   BPF_SRC(insn.code) == BPF_X, insn.k, 0, 0, nullptr};
+  switch (BPF_CLASS(insn.code)) {
+    case BPF_LD:
+      if (BPF_SIZE(insn.code) != BPF_W || insn.jt != 0 || insn.jf != 0) {
+        res.err = "Invalid BPF_LD instruction";
+      } else if (BPF_MODE(insn.code) == BPF_IMM) {
+        res.kind = BatchInsn::LD_IMM;
+      } else if (BPF_MODE(insn.code) == BPF_MEM) {
+        if (insn.k < BPF_MEMWORDS) {
+          res.kind = BatchInsn::LD_MEM;
+        } else {
+          res.err = "Invalid operand in BPF_LD instruction";
+        }
+      } else if (BPF_MODE(insn.code) != BPF_ABS) {
+        res.err = "Invalid BPF_LD instruction";
+      } else if (insn.k < sizeof(struct arch_seccomp_data) &&
+                 (insn.k & 3) == 0) {
+        res.kind = BatchInsn::LD_ABS;
+      } else {
+        res.err = "Invalid operand in BPF_LD instruction";
+      }
+      break;
+    case BPF_LDX:
+      if (BPF_SIZE(insn.code) == BPF_W && insn.jt == 0 && insn.jf == 0 &&
+          BPF_MODE(insn.code) == BPF_IMM) {
+        res.kind = BatchInsn::LDX_IMM;
+      } else if (BPF_SIZE(insn.code) == BPF_W && insn.jt == 0 &&
+                 insn.jf == 0 && BPF_MODE(insn.code) == BPF_MEM &&
+                 insn.k < BPF_MEMWORDS) {
+        res.kind = BatchInsn::LDX_MEM;
+      } else {
+        res.err = "Invalid BPF_LDX instruction";
+      }
+      break;
+    case BPF_ST:
+    case BPF_STX: {
+      const bool is_stx = BPF_CLASS(insn.code) == BPF_STX;
+      if (insn.code != (is_stx ? BPF_STX : BPF_ST) ||
+          insn.k >= BPF_MEMWORDS || insn.jt != 0 || insn.jf != 0) {
+        res.err = is_stx ? "Invalid BPF_STX instruction"
+                         : "Invalid BPF_ST instruction";
+      } else {
+        res.kind = is_stx ? BatchInsn::STX : BatchInsn::ST;
+      }
+      break;
+    }
+    case BPF_MISC:
+      switch (BPF_MISCOP(insn.code)) {
+        case BPF_TAX:
+          res.kind = BatchInsn::TAX;
+          break;
+        case BPF_TXA:
+          res.kind = BatchInsn::TXA;
+          break;
+        default:
+          res.err = "Invalid BPF_MISC instruction";
+          break;
+      }
+      break;
+    case BPF_JMP:
+      res.err = "Invalid BPF_JMP instruction";
+      if (BPF_OP(insn.code) == BPF_JA) {
+        const unsigned int target = pc + insn.k + 1;
+        if (target < program.size() && target > pc) {
+          res.kind = BatchInsn::JA;
+          res.jt = target;
+        }
+      } else if (pc + insn.jt + 1 < program.size() &&
+                 pc + insn.jf + 1 < program.size()) {
+        switch (BPF_OP(insn.code)) {
+          case BPF_JEQ:
+          case BPF_JGT:
+          case BPF_JGE:
+          case BPF_JSET:
+            res.kind = BatchInsn::JMP;
+            res.jt = pc + insn.jt + 1;
+            res.jf = pc + insn.jf + 1;
+            break;
+        }
+      }
+      if (res.kind != BatchInsn::FAIL) {
+        res.err = nullptr;
+      }
+      break;
+    case BPF_RET:
+      if (BPF_SRC(insn.code) != BPF_K) {
+        res.err = "Invalid BPF_RET instruction";
+        break;
+      }
+      switch (insn.k & SECCOMP_RET_ACTION) {
+        case SECCOMP_RET_ALLOW:
+        case SECCOMP_RET_ERRNO:
+        case SECCOMP_RET_KILL:
+        case SECCOMP_RET_TRACE:
+        case SECCOMP_RET_TRAP:
+          res.kind = BatchInsn::RET;
+          break;
+        default:
+          res.err = "Unexpected return code found in BPF program";
+          break;
+      }
+      break;
+    case BPF_ALU:
+      res.kind =
+          BPF_OP(insn.code) == BPF_NEG ? BatchInsn::NEG : BatchInsn::ALU;
+      break;
+    default:
+      res.err = "Unexpected instruction in BPF program";
+      break;
+  }
+  return res;
+}
+
+}  // namespace internal
+
+void BatchVerifier::EvaluateBPF(const std::vector<struct sock_filter>& program,
+                                const struct arch_seccomp_data* data,
+                                size_t count,
+                                uint32_t* results,
+                                const char** errs) {
+  EvaluateBPF(MaxSimdLevel(), program, data, count, results, errs);
+}
+
+void BatchVerifier::EvaluateBPF(SimdLevel level,
+                                const std::vector<struct sock_filter>& program,
+                                const struct arch_seccomp_data* data,
+                                size_t count,
+                                uint32_t* results,
+                                const char** errs) {
+  CHECK(level <= MaxSimdLevel());
+  if (program.size() < 1 || program.size() >= SECCOMP_MAX_PROGRAM_SIZE) {
+    for (size_t i = 0; i < count; ++i) {
+      results[i] = 0;
+      errs[i] = "Invalid program length";
+    }
+    return;
+  }
+
+  std::vector<internal::BatchInsn> decoded;
+  decoded.reserve(program.size());
+  for (unsigned int pc = 0; pc < program.size(); ++pc) {
+    decoded.push_back(internal::DecodeBatchInsn(program, pc));
+  }
+
+  internal::BatchEvaluatorFn evaluate =
+      &internal::EvaluateBatch<internal::PortableLanes>;
+#if defined(ARCH_CPU_X86_FAMILY) && !defined(OS_NACL_NONSFI)
+  if (level == SimdLevel::AVX2) {
+    evaluate = &internal::EvaluateBatchAVX2;
+  } else if (level == SimdLevel::SSE2) {
+    evaluate = &internal::EvaluateBatchSSE2;
+  }
+#endif
+
+  // Lanes that evaluate different system calls soon take different
+  // paths through the program, and have to wait for each other. So the
+  // system calls are evaluated in chunks, in an order that keeps the
+  // same system call numbers together, using a counting sort on their
+  // low bits.
+  std::vector<uint32_t> order(std::min(count, kBatchChunkSize));
+  for (size_t start = 0; start < count; start += kBatchChunkSize) {
+    const size_t size = std::min(count - start, kBatchChunkSize);
+    uint32_t offsets[kBatchBuckets + 1] = {};
+    for (size_t i = 0; i < size; ++i) {
+      ++offsets[(data[start + i].nr & (kBatchBuckets - 1)) + 1];
+    }
+    for (size_t bucket = 1; bucket <= kBatchBuckets; ++bucket) {
+      offsets[bucket] += offsets[bucket - 1];
+    }
+    for (size_t i = 0; i < size; ++i) {
+      order[offsets[data[start + i].nr & (kBatchBuckets - 1)]++] = i;
+    }
+    evaluate(decoded.data(), decoded.size(), data + start, order.data(), size,
+             results + start, errs + start);
+  }
+}
+
+BatchVerifier::SimdLevel BatchVerifier::MaxSimdLevel() {
+#if defined(ARCH_CPU_X86_FAMILY) && !defined(OS_NACL_NONSFI)
+  base::CPU cpu;
+  if (cpu.has_avx2()) {
+    return SimdLevel::AVX2;
+  }
+  if (cpu.has_sse2()) {
+    return SimdLevel::SSE2;
+  }
+#endif
+  return SimdLevel::NONE;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,60 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_BATCH_VERIFIER_H_
+#define SANDBOX_LINUX_BPF_DSL_BATCH_VERIFIER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+
+struct sock_filter;
+
+namespace sandbox {
+struct arch_seccomp_data;
+
+namespace bpf_dsl {
+
+// BatchVerifier evaluates BPF programs like Verifier::EvaluateBPF, but
+// for large numbers of system calls at once: it runs the program on
+// several system calls at a time, in the lanes of the widest SIMD
+// registers that the CPU supports. It's meant for tests and tools that
+// check programs against many system calls, not for the sandbox itself.
+class BatchVerifier {
+ public:
+  // Instruction sets that EvaluateBPF can use.
+  enum class SimdLevel { NONE, SSE2, AVX2 };
+
+  // EvaluateBPF evaluates |program| like Verifier::EvaluateBPF for each
+  // of the |count| system calls in |data|, and stores the results and
+  // error strings in the corresponding elements of |results| and |errs|.
+  static void EvaluateBPF(const std::vector<struct sock_filter>& program,
+                          const struct arch_seccomp_data* data,
+                          size_t count,
+                          uint32_t* results,
+                          const char** errs);
+
+  // Same as above, but uses the instructions of |level|, which mustn't
+  // exceed MaxSimdLevel(). SimdLevel::NONE uses portable code.
+  static void EvaluateBPF(SimdLevel level,
+                          const std::vector<struct sock_filter>& program,
+                          const struct arch_seccomp_data* data,
+                          size_t count,
+                          uint32_t* results,
+                          const char** errs);
+
+  // MaxSimdLevel returns the best SimdLevel that the CPU supports.
+  static SimdLevel MaxSimdLevel();
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(BatchVerifier);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_BATCH_VERIFIER_H_
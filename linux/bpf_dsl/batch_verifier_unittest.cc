@@ -0,0 +1,111 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/batch_verifier.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/random_program_generator.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Checks that BatchVerifier agrees with Verifier::EvaluateBPF on |program|
+// for each system call in |data|, at every SIMD level the CPU supports.
+void ExpectBatchMatches(const std::vector<sock_filter>& program,
+                        const std::vector<struct arch_seccomp_data>& data) {
+  const BatchVerifier::SimdLevel kLevels[] = {
+      BatchVerifier::SimdLevel::NONE, BatchVerifier::SimdLevel::SSE2,
+      BatchVerifier::SimdLevel::AVX2};
+  for (BatchVerifier::SimdLevel level : kLevels) {
+    if (level > BatchVerifier::MaxSimdLevel()) {
+      continue;
+    }
+    std::vector<uint32_t> results(data.size());
+    std::vector<const char*> errs(data.size());
+    BatchVerifier::EvaluateBPF(level, program, data.data(), data.size(),
+                               results.data(), errs.data());
+    for (size_t i = 0; i < data.size(); ++i) {
+      const char* err = nullptr;
+      const uint32_t expected = Verifier::EvaluateBPF(program, data[i], &err);
+      EXPECT_EQ(expected, results[i]) << "level " << static_cast<int>(level)
+                                      << ", system call " << i;
+      if (err && errs[i]) {
+        EXPECT_STREQ(err, errs[i]);
+      } else {
+        EXPECT_EQ(!!err, !!errs[i]) << "level " << static_cast<int>(level)
+                                    << ", system call " << i;
+      }
+    }
+  }
+}
+
+TEST(BatchVerifier, Evaluate) {
+  // System calls take different paths through the program depending on
+  // their arguments, through the index register, scratch memory and
+  // arithmetic, and fail with a division by zero if arg1 is 0.
+  const std::vector<sock_filter> program = {
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+      Insn(BPF_MISC + BPF_TAX, 0),
+      Insn(BPF_LD + BPF_W + BPF_IMM, 1),
+      Insn(BPF_ALU + BPF_LSH + BPF_X, 0),
+      Insn(BPF_JMP + BPF_JSET + BPF_K, 0x14, 4, 0),
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(1)),
+      Insn(BPF_ST, 0),
+      Insn(BPF_LD + BPF_W + BPF_MEM, 0),
+      Insn(BPF_ALU + BPF_DIV + BPF_K, 1),
+      Insn(BPF_JMP + BPF_JA, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+      Insn(BPF_MISC + BPF_TAX, 0),
+      Insn(BPF_ALU + BPF_DIV + BPF_X, 0),
+      Insn(BPF_ALU + BPF_MUL + BPF_X, 0),
+      Insn(BPF_ALU + BPF_OR + BPF_K, SECCOMP_RET_ERRNO),
+      Insn(BPF_MISC + BPF_TXA, 0),
+      Insn(BPF_JMP + BPF_JGE + BPF_K, SECCOMP_RET_ERRNO + 3, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_KILL),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO + 2),
+  };
+
+  // Use a number of system calls that doesn't fill the last vector.
+  std::vector<struct arch_seccomp_data> data;
+  for (uint64_t arg0 = 0; arg0 < 7; ++arg0) {
+    for (uint64_t arg1 = 0; arg1 < 5; ++arg1) {
+      struct arch_seccomp_data d = FakeSyscall(0, arg0);
+      d.args[1] = arg1;
+      data.push_back(d);
+    }
+  }
+  ExpectBatchMatches(program, data);
+}
+
+TEST(BatchVerifier, RandomPrograms) {
+  RandomProgramGenerator generator(1);
+  std::vector<struct arch_seccomp_data> data;
+  for (int i = 0; i < 61; ++i) {
+    data.push_back(generator.Syscall());
+  }
+  for (int i = 0; i < 1000; ++i) {
+    ExpectBatchMatches(generator.Program(), data);
+  }
+}
+
+TEST(BatchVerifier, InvalidLength) {
+  ExpectBatchMatches(std::vector<sock_filter>(),
+                     {FakeSyscall(0, 0), FakeSyscall(1, 0)});
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -7,13 +7,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <limits>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/arg_tests.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
 #include "sandbox/linux/bpf_dsl/errorcode.h"
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
+#include "sandbox/linux/bpf_dsl/intern_table.h"
 #include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/policy_fingerprint.h"
+#include "sandbox/linux/bpf_dsl/policy_oracle.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
 #include "sandbox/linux/system_headers/linux_seccomp.h"
 
 namespace sandbox {
@@ -29,6 +40,24 @@ class ReturnResultExprImpl : public internal::ResultExprImpl {
     return pc->Return(ret_);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Return");
+    fp->AddInteger(ret_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle) const override {
+    return oracle->Return(ret_);
+  }
+
+  const ResultExprImpl* Evaluate(
+      const struct arch_seccomp_data& data) const override {
+    return this;
+  }
+
+  void AddArgTests(ArgTests* tests) const override {}
+
+  uint32_t ReturnValue(TrapRegistry* registry) const override { return ret_; }
+
   bool IsAllow() const override { return IsAction(SECCOMP_RET_ALLOW); }
 
   bool IsDeny() const override {
@@ -57,6 +86,26 @@ class TrapResultExprImpl : public internal::ResultExprImpl {
     return pc->Trap(func_, arg_, safe_);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Trap");
+    fp->AddTrap(func_, arg_, safe_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle) const override {
+    return oracle->Trap(func_, arg_, safe_);
+  }
+
+  const ResultExprImpl* Evaluate(
+      const struct arch_seccomp_data& data) const override {
+    return this;
+  }
+
+  void AddArgTests(ArgTests* tests) const override {}
+
+  uint32_t ReturnValue(TrapRegistry* registry) const override {
+    return SECCOMP_RET_TRAP + registry->Add(func_, arg_, safe_);
+  }
+
   bool HasUnsafeTraps() const override { return safe_ == false; }
 
   bool IsDeny() const override { return true; }
@@ -87,6 +136,31 @@ class IfThenResultExprImpl : public internal::ResultExprImpl {
     return cond_->Compile(pc, then_node, else_node);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("IfThen");
+    fp->AddBool(cond_);
+    fp->AddResult(then_result_);
+    fp->AddResult(else_result_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle) const override {
+    const size_t then_node = then_result_->AddToOracle(oracle);
+    const size_t else_node = else_result_->AddToOracle(oracle);
+    return cond_->AddToOracle(oracle, then_node, else_node);
+  }
+
+  const ResultExprImpl* Evaluate(
+      const struct arch_seccomp_data& data) const override {
+    return cond_->Evaluate(data) ? then_result_->Evaluate(data)
+                                 : else_result_->Evaluate(data);
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    cond_->AddArgTests(tests);
+    then_result_->AddArgTests(tests);
+    else_result_->AddArgTests(tests);
+  }
+
   bool HasUnsafeTraps() const override {
     return then_result_->HasUnsafeTraps() || else_result_->HasUnsafeTraps();
   }
@@ -99,6 +173,103 @@ class IfThenResultExprImpl : public internal::ResultExprImpl {
   DISALLOW_COPY_AND_ASSIGN(IfThenResultExprImpl);
 };
 
+class SwitchResultExprImpl : public internal::ResultExprImpl {
+ public:
+  using Case = std::pair<uint64_t, ResultExpr>;
+
+  SwitchResultExprImpl(int argno,
+                       size_t width,
+                       uint64_t mask,
+                       std::vector<Case> cases,
+                       ResultExpr default_result)
+      : argno_(argno),
+        width_(width),
+        mask_(mask),
+        cases_(std::move(cases)),
+        default_result_(std::move(default_result)) {}
+  ~SwitchResultExprImpl() override {}
+
+  CodeGen::Node Compile(PolicyCompiler* pc) const override {
+    // Cases are compiled in order, so earlier clauses take precedence for
+    // repeated values, and unreachable clauses are not compiled at all.
+    std::map<uint64_t, CodeGen::Node> case_nodes;
+    for (const Case& c : cases_) {
+      if (case_nodes.find(c.first) == case_nodes.end()) {
+        case_nodes[c.first] = c.second->Compile(pc);
+      }
+    }
+    CodeGen::Node default_node = default_result_->Compile(pc);
+    return pc->MaskedSwitch(argno_, width_, mask_, case_nodes, default_node);
+  }
+
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Switch");
+    fp->AddInteger(argno_);
+    fp->AddInteger(width_);
+    fp->AddInteger(mask_);
+    fp->AddInteger(cases_.size());
+    for (const Case& c : cases_) {
+      fp->AddInteger(c.first);
+      fp->AddResult(c.second);
+    }
+    fp->AddResult(default_result_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle) const override {
+    // As in Compile, repeated values are unreachable.
+    std::map<uint64_t, size_t> case_nodes;
+    for (const Case& c : cases_) {
+      if (case_nodes.find(c.first) == case_nodes.end()) {
+        case_nodes[c.first] = c.second->AddToOracle(oracle);
+      }
+    }
+    const size_t default_node = default_result_->AddToOracle(oracle);
+    return oracle->MaskedSwitch(argno_, width_, mask_, case_nodes,
+                                default_node);
+  }
+
+  const ResultExprImpl* Evaluate(
+      const struct arch_seccomp_data& data) const override {
+    const uint64_t value = data.args[argno_] & mask_;
+    for (const Case& c : cases_) {
+      if (c.first == value) {
+        return c.second->Evaluate(data);
+      }
+    }
+    return default_result_->Evaluate(data);
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    // As in Compile, repeated values are unreachable.
+    std::set<uint64_t> values;
+    for (const Case& c : cases_) {
+      if (values.insert(c.first).second) {
+        tests->AddInRange(argno_, width_, mask_, c.first, c.first);
+        c.second->AddArgTests(tests);
+      }
+    }
+    default_result_->AddArgTests(tests);
+  }
+
+  bool HasUnsafeTraps() const override {
+    for (const Case& c : cases_) {
+      if (c.second->HasUnsafeTraps()) {
+        return true;
+      }
+    }
+    return default_result_->HasUnsafeTraps();
+  }
+
+ private:
+  int argno_;
+  size_t width_;
+  uint64_t mask_;
+  std::vector<Case> cases_;
+  ResultExpr default_result_;
+
+  DISALLOW_COPY_AND_ASSIGN(SwitchResultExprImpl);
+};
+
 class ConstBoolExprImpl : public internal::BoolExprImpl {
  public:
   ConstBoolExprImpl(bool value) : value_(value) {}
@@ -110,6 +281,25 @@ class ConstBoolExprImpl : public internal::BoolExprImpl {
     return value_ ? then_node : else_node;
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Const");
+    fp->AddInteger(value_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return value_ ? then_node : else_node;
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return value_;
+  }
+
+  void AddArgTests(ArgTests* tests) const override {}
+
+  bool IsConst(bool value) const override { return value_ == value; }
+
  private:
   bool value_;
 
@@ -131,6 +321,29 @@ class MaskedEqualBoolExprImpl : public internal::BoolExprImpl {
     return pc->MaskedEqual(argno_, width_, mask_, value_, then_node, else_node);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("MaskedEqual");
+    fp->AddInteger(argno_);
+    fp->AddInteger(width_);
+    fp->AddInteger(mask_);
+    fp->AddInteger(value_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return oracle->MaskedInRange(argno_, width_, mask_, value_, value_,
+                                 then_node, else_node);
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return (data.args[argno_] & mask_) == value_;
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    tests->AddInRange(argno_, width_, mask_, value_, value_);
+  }
+
  private:
   int argno_;
   size_t width_;
@@ -140,6 +353,114 @@ class MaskedEqualBoolExprImpl : public internal::BoolExprImpl {
   DISALLOW_COPY_AND_ASSIGN(MaskedEqualBoolExprImpl);
 };
 
+class InRangeBoolExprImpl : public internal::BoolExprImpl {
+ public:
+  InRangeBoolExprImpl(int argno,
+                      size_t width,
+                      uint64_t mask,
+                      uint64_t lo,
+                      uint64_t hi)
+      : argno_(argno), width_(width), mask_(mask), lo_(lo), hi_(hi) {}
+  ~InRangeBoolExprImpl() override {}
+
+  CodeGen::Node Compile(PolicyCompiler* pc,
+                        CodeGen::Node then_node,
+                        CodeGen::Node else_node) const override {
+    return pc->MaskedInRange(argno_, width_, mask_, lo_, hi_, then_node,
+                             else_node);
+  }
+
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("InRange");
+    fp->AddInteger(argno_);
+    fp->AddInteger(width_);
+    fp->AddInteger(mask_);
+    fp->AddInteger(lo_);
+    fp->AddInteger(hi_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return oracle->MaskedInRange(argno_, width_, mask_, lo_, hi_, then_node,
+                                 else_node);
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    const uint64_t value = data.args[argno_] & mask_;
+    return lo_ <= value && value <= hi_;
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    tests->AddInRange(argno_, width_, mask_, lo_, hi_);
+  }
+
+ private:
+  int argno_;
+  size_t width_;
+  uint64_t mask_;
+  uint64_t lo_;
+  uint64_t hi_;
+
+  DISALLOW_COPY_AND_ASSIGN(InRangeBoolExprImpl);
+};
+
+class InBoolExprImpl : public internal::BoolExprImpl {
+ public:
+  InBoolExprImpl(int argno,
+                 size_t width,
+                 uint64_t mask,
+                 const std::vector<uint64_t>& values)
+      : argno_(argno), width_(width), mask_(mask), values_(values) {}
+  ~InBoolExprImpl() override {}
+
+  CodeGen::Node Compile(PolicyCompiler* pc,
+                        CodeGen::Node then_node,
+                        CodeGen::Node else_node) const override {
+    return pc->MaskedIn(argno_, width_, mask_, values_, then_node, else_node);
+  }
+
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("In");
+    fp->AddInteger(argno_);
+    fp->AddInteger(width_);
+    fp->AddInteger(mask_);
+    fp->AddInteger(values_.size());
+    for (uint64_t value : values_) {
+      fp->AddInteger(value);
+    }
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    std::map<uint64_t, size_t> cases;
+    for (uint64_t value : values_) {
+      cases[value] = then_node;
+    }
+    return oracle->MaskedSwitch(argno_, width_, mask_, cases, else_node);
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return std::find(values_.begin(), values_.end(),
+                     data.args[argno_] & mask_) != values_.end();
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    for (uint64_t value : values_) {
+      tests->AddInRange(argno_, width_, mask_, value, value);
+    }
+  }
+
+ private:
+  int argno_;
+  size_t width_;
+  uint64_t mask_;
+  std::vector<uint64_t> values_;
+
+  DISALLOW_COPY_AND_ASSIGN(InBoolExprImpl);
+};
+
 class NegateBoolExprImpl : public internal::BoolExprImpl {
  public:
   explicit NegateBoolExprImpl(BoolExpr cond) : cond_(std::move(cond)) {}
@@ -151,6 +472,27 @@ class NegateBoolExprImpl : public internal::BoolExprImpl {
     return cond_->Compile(pc, else_node, then_node);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Negate");
+    fp->AddBool(cond_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return cond_->AddToOracle(oracle, else_node, then_node);
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return !cond_->Evaluate(data);
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    cond_->AddArgTests(tests);
+  }
+
+  BoolExpr Negated() const override { return cond_; }
+
  private:
   BoolExpr cond_;
 
@@ -170,6 +512,33 @@ class AndBoolExprImpl : public internal::BoolExprImpl {
                          else_node);
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("And");
+    fp->AddBool(lhs_);
+    fp->AddBool(rhs_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return lhs_->AddToOracle(
+        oracle, rhs_->AddToOracle(oracle, then_node, else_node), else_node);
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return lhs_->Evaluate(data) && rhs_->Evaluate(data);
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    lhs_->AddArgTests(tests);
+    rhs_->AddArgTests(tests);
+  }
+
+  bool HasConjunct(const BoolExpr& cond) const override {
+    return lhs_ == cond || rhs_ == cond || lhs_->HasConjunct(cond) ||
+           rhs_->HasConjunct(cond);
+  }
+
  private:
   BoolExpr lhs_;
   BoolExpr rhs_;
@@ -190,6 +559,33 @@ class OrBoolExprImpl : public internal::BoolExprImpl {
                          rhs_->Compile(pc, then_node, else_node));
   }
 
+  void Fingerprint(PolicyFingerprint* fp) const override {
+    fp->AddKind("Or");
+    fp->AddBool(lhs_);
+    fp->AddBool(rhs_);
+  }
+
+  size_t AddToOracle(PolicyOracle* oracle,
+                     size_t then_node,
+                     size_t else_node) const override {
+    return lhs_->AddToOracle(oracle, then_node,
+                             rhs_->AddToOracle(oracle, then_node, else_node));
+  }
+
+  bool Evaluate(const struct arch_seccomp_data& data) const override {
+    return lhs_->Evaluate(data) || rhs_->Evaluate(data);
+  }
+
+  void AddArgTests(ArgTests* tests) const override {
+    lhs_->AddArgTests(tests);
+    rhs_->AddArgTests(tests);
+  }
+
+  bool HasDisjunct(const BoolExpr& cond) const override {
+    return lhs_ == cond || rhs_ == cond || lhs_->HasDisjunct(cond) ||
+           rhs_->HasDisjunct(cond);
+  }
+
  private:
   BoolExpr lhs_;
   BoolExpr rhs_;
@@ -197,10 +593,103 @@ class OrBoolExprImpl : public internal::BoolExprImpl {
   DISALLOW_COPY_AND_ASSIGN(OrBoolExprImpl);
 };
 
+using internal::NodeKey;
+
+// Returns the table that expressions are interned in when no ExprArena
+// is active. It's intentionally leaked, as expressions may outlive
+// static destructors.
+template <typename Base>
+internal::InternTable<Base>* GlobalInternTable() {
+  static internal::InternTable<Base>* table = new internal::InternTable<Base>;
+  return table;
+}
+
+// MakeResult and MakeBool return the interned node for |key|, allocating
+// it in the current thread's ExprArena (if any) or on the heap.
+template <typename T, typename... Args>
+ResultExpr MakeResult(const NodeKey& key, Args&&... args) {
+  if (ExprArena* arena = ExprArena::Current()) {
+    return arena->results()->Get<T>(key, ExprArena::Allocator<T>(arena),
+                                    std::forward<Args>(args)...);
+  }
+  return GlobalInternTable<internal::ResultExprImpl>()->Get<T>(
+      key, std::allocator<T>(), std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+BoolExpr MakeBool(const NodeKey& key, Args&&... args) {
+  if (ExprArena* arena = ExprArena::Current()) {
+    return arena->bools()->Get<T>(key, ExprArena::Allocator<T>(arena),
+                                  std::forward<Args>(args)...);
+  }
+  return GlobalInternTable<internal::BoolExprImpl>()->Get<T>(
+      key, std::allocator<T>(), std::forward<Args>(args)...);
+}
+
+// Same as cons::Cons, except that the cell is allocated in the current
+// thread's ExprArena (if any).
+template <typename T>
+cons::List<T> ArenaCons(const T& head, cons::List<T> tail) {
+  if (ExprArena* arena = ExprArena::Current()) {
+    return cons::Cons(ExprArena::Allocator<cons::Cell<T>>(arena), head,
+                      std::move(tail));
+  }
+  return cons::Cons(head, std::move(tail));
+}
+
+ResultExpr MakeReturn(uint32_t ret) {
+  return MakeResult<ReturnResultExprImpl>(NodeKey('R').Add(ret), ret);
+}
+
+ResultExpr MakeTrap(TrapRegistry::TrapFnc trap_func,
+                    const void* aux,
+                    bool safe) {
+  return MakeResult<TrapResultExprImpl>(
+      NodeKey('T').Add(trap_func).Add(aux).Add(safe), trap_func, aux, safe);
+}
+
+// Returns the result expression for "if (cond) then_result else
+// else_result", folding conditions that are constant and branches that
+// are identical.
+ResultExpr MakeIfThen(const BoolExpr& cond,
+                      const ResultExpr& then_result,
+                      const ResultExpr& else_result) {
+  if (cond->IsConst(true) || then_result == else_result) {
+    return then_result;
+  }
+  if (cond->IsConst(false)) {
+    return else_result;
+  }
+  return MakeResult<IfThenResultExprImpl>(
+      NodeKey('I').Add(cond).Add(then_result).Add(else_result), cond,
+      then_result, else_result);
+}
+
 }  // namespace
 
 namespace internal {
 
+bool BoolExprImpl::IsConst(bool value) const {
+  return false;
+}
+
+BoolExpr BoolExprImpl::Negated() const {
+  return nullptr;
+}
+
+bool BoolExprImpl::HasConjunct(const BoolExpr& cond) const {
+  return false;
+}
+
+bool BoolExprImpl::HasDisjunct(const BoolExpr& cond) const {
+  return false;
+}
+
+uint32_t ResultExprImpl::ReturnValue(TrapRegistry* registry) const {
+  NOTREACHED() << "Not a Return or Trap expression";
+  return SECCOMP_RET_INVALID;
+}
+
 bool ResultExprImpl::HasUnsafeTraps() const {
   return false;
 }
@@ -230,43 +719,116 @@ BoolExpr ArgEq(int num, size_t size, uint64_t mask, uint64_t val) {
   // accordingly.
   CHECK(size == 4 || size == 8);
 
-  return std::make_shared<MaskedEqualBoolExprImpl>(num, size, mask, val);
+  return MakeBool<MaskedEqualBoolExprImpl>(
+      NodeKey('E').Add(num).Add(size).Add(mask).Add(val), num, size, mask,
+      val);
+}
+
+BoolExpr ArgInRange(int num,
+                    size_t size,
+                    uint64_t mask,
+                    uint64_t lo,
+                    uint64_t hi) {
+  CHECK(size == 4 || size == 8);
+
+  return MakeBool<InRangeBoolExprImpl>(
+      NodeKey('G').Add(num).Add(size).Add(mask).Add(lo).Add(hi), num, size,
+      mask, lo, hi);
+}
+
+BoolExpr ArgIn(int num,
+               size_t size,
+               uint64_t mask,
+               const std::vector<uint64_t>& values) {
+  CHECK(size == 4 || size == 8);
+
+  NodeKey key('N');
+  key.Add(num).Add(size).Add(mask).Add(values.size());
+  for (uint64_t value : values) {
+    key.Add(value);
+  }
+  return MakeBool<InBoolExprImpl>(key, num, size, mask, values);
+}
+
+cons::List<std::pair<uint64_t, ResultExpr>> ArgCase(
+    uint64_t value,
+    ResultExpr result,
+    cons::List<std::pair<uint64_t, ResultExpr>> cases) {
+  return ArenaCons(std::make_pair(value, std::move(result)), std::move(cases));
+}
+
+ResultExpr ArgSwitch(int num,
+                     size_t size,
+                     uint64_t mask,
+                     cons::List<std::pair<uint64_t, ResultExpr>> cases,
+                     ResultExpr default_result) {
+  CHECK(size == 4 || size == 8);
+
+  // |cases| lists the clauses in reverse order, so put them back in
+  // source order.
+  std::vector<std::pair<uint64_t, ResultExpr>> ordered;
+  for (const auto& c : cases) {
+    ordered.push_back(c);
+  }
+  std::reverse(ordered.begin(), ordered.end());
+
+  // A switch whose clauses all have the default result is redundant.
+  NodeKey key('S');
+  key.Add(num).Add(size).Add(mask).Add(ordered.size());
+  bool redundant = true;
+  for (const auto& c : ordered) {
+    key.Add(c.first).Add(c.second);
+    redundant = redundant && c.second == default_result;
+  }
+  if (redundant) {
+    return default_result;
+  }
+  key.Add(default_result);
+
+  return MakeResult<SwitchResultExprImpl>(key, num, size, mask,
+                                          std::move(ordered),
+                                          std::move(default_result));
 }
 
 }  // namespace internal
 
 ResultExpr Allow() {
-  return std::make_shared<ReturnResultExprImpl>(SECCOMP_RET_ALLOW);
+  return MakeReturn(SECCOMP_RET_ALLOW);
 }
 
 ResultExpr Error(int err) {
   CHECK(err >= ErrorCode::ERR_MIN_ERRNO && err <= ErrorCode::ERR_MAX_ERRNO);
-  return std::make_shared<ReturnResultExprImpl>(SECCOMP_RET_ERRNO + err);
+  return MakeReturn(SECCOMP_RET_ERRNO + err);
 }
 
 ResultExpr Kill() {
-  return std::make_shared<ReturnResultExprImpl>(SECCOMP_RET_KILL);
+  return MakeReturn(SECCOMP_RET_KILL);
 }
 
 ResultExpr Trace(uint16_t aux) {
-  return std::make_shared<ReturnResultExprImpl>(SECCOMP_RET_TRACE + aux);
+  return MakeReturn(SECCOMP_RET_TRACE + aux);
 }
 
 ResultExpr Trap(TrapRegistry::TrapFnc trap_func, const void* aux) {
-  return std::make_shared<TrapResultExprImpl>(trap_func, aux, true /* safe */);
+  return MakeTrap(trap_func, aux, true /* safe */);
 }
 
 ResultExpr UnsafeTrap(TrapRegistry::TrapFnc trap_func, const void* aux) {
-  return std::make_shared<TrapResultExprImpl>(trap_func, aux,
-                                              false /* unsafe */);
+  return MakeTrap(trap_func, aux, false /* unsafe */);
 }
 
 BoolExpr BoolConst(bool value) {
-  return std::make_shared<ConstBoolExprImpl>(value);
+  return MakeBool<ConstBoolExprImpl>(NodeKey('C').Add(value), value);
 }
 
 BoolExpr Not(BoolExpr cond) {
-  return std::make_shared<NegateBoolExprImpl>(std::move(cond));
+  if (cond->IsConst(false) || cond->IsConst(true)) {
+    return BoolConst(cond->IsConst(false));
+  }
+  if (BoolExpr negated = cond->Negated()) {
+    return negated;
+  }
+  return MakeBool<NegateBoolExprImpl>(NodeKey('!').Add(cond), cond);
 }
 
 BoolExpr AllOf() {
@@ -274,7 +836,14 @@ BoolExpr AllOf() {
 }
 
 BoolExpr AllOf(BoolExpr lhs, BoolExpr rhs) {
-  return std::make_shared<AndBoolExprImpl>(std::move(lhs), std::move(rhs));
+  if (lhs->IsConst(false) || rhs->IsConst(true) || lhs == rhs ||
+      lhs->HasConjunct(rhs)) {
+    return lhs;
+  }
+  if (rhs->IsConst(false) || lhs->IsConst(true) || rhs->HasConjunct(lhs)) {
+    return rhs;
+  }
+  return MakeBool<AndBoolExprImpl>(NodeKey('&').Add(lhs).Add(rhs), lhs, rhs);
 }
 
 BoolExpr AnyOf() {
@@ -282,7 +851,14 @@ BoolExpr AnyOf() {
 }
 
 BoolExpr AnyOf(BoolExpr lhs, BoolExpr rhs) {
-  return std::make_shared<OrBoolExprImpl>(std::move(lhs), std::move(rhs));
+  if (lhs->IsConst(true) || rhs->IsConst(false) || lhs == rhs ||
+      lhs->HasDisjunct(rhs)) {
+    return lhs;
+  }
+  if (rhs->IsConst(true) || lhs->IsConst(false) || rhs->HasDisjunct(lhs)) {
+    return rhs;
+  }
+  return MakeBool<OrBoolExprImpl>(NodeKey('|').Add(lhs).Add(rhs), lhs, rhs);
 }
 
 Elser If(BoolExpr cond, ResultExpr then_result) {
@@ -299,8 +875,8 @@ Elser::~Elser() {
 }
 
 Elser Elser::ElseIf(BoolExpr cond, ResultExpr then_result) const {
-  return Elser(Cons(std::make_pair(std::move(cond), std::move(then_result)),
-                    clause_list_));
+  return Elser(ArenaCons(
+      std::make_pair(std::move(cond), std::move(then_result)), clause_list_));
 }
 
 ResultExpr Elser::Else(ResultExpr else_result) const {
@@ -328,8 +904,7 @@ ResultExpr Elser::Else(ResultExpr else_result) const {
 
   ResultExpr expr = std::move(else_result);
   for (const Clause& clause : clause_list_) {
-    expr = std::make_shared<IfThenResultExprImpl>(clause.first, clause.second,
-                                                  std::move(expr));
+    expr = MakeIfThen(clause.first, clause.second, expr);
   }
   return expr;
 }
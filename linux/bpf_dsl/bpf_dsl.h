@@ -8,6 +8,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <limits>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -63,12 +64,18 @@
 //          | If(bool, result)[.ElseIf(bool, result)].Else(result)
 //          | Switch(arg)[.Case(val, result)].Default(result)
 //   bool   = BoolConst(boolean) | Not(bool) | AllOf(bool...) | AnyOf(bool...)
-//          | arg == val | arg != val
+//          | arg == val | arg != val | arg < val | arg <= val
+//          | arg > val | arg >= val | arg.InRange(lo, hi) | arg.In(vals)
 //   arg    = Arg<T>(num) | arg & mask
 //
 // The semantics of each function and operator are intended to be
 // intuitive, but are described in more detail below.
 //
+// Expressions are interned: structurally identical expressions are
+// represented by the same object, so they can be compared with ==.
+// Trivial expressions are simplified as they're built; e.g.,
+// AllOf(x, BoolConst(true)) is just x, and If(x, r).Else(r) is just r.
+//
 // (Credit to Sean Parent's "Inheritance is the Base Class of Evil"
 // talk at Going Native 2013 for promoting value semantics via shared
 // pointers to immutable state.)
@@ -160,14 +167,51 @@ class SANDBOX_EXPORT Arg {
   // (after applying any bitmasks, if appropriate) does not equal |rhs|.
   friend BoolExpr operator!=(const Arg& lhs, T rhs) { return Not(lhs == rhs); }
 
+  // Returns boolean expressions comparing the order of the system call
+  // argument (after applying any bitmasks, if appropriate) and |rhs|.
+  // Signed types are compared as signed values.
+  friend BoolExpr operator<(const Arg& lhs, T rhs) {
+    if (rhs == std::numeric_limits<T>::min()) {
+      return BoolConst(false);
+    }
+    return lhs.InRange(std::numeric_limits<T>::min(), rhs - 1);
+  }
+  friend BoolExpr operator<=(const Arg& lhs, T rhs) {
+    return lhs.InRange(std::numeric_limits<T>::min(), rhs);
+  }
+  friend BoolExpr operator>(const Arg& lhs, T rhs) {
+    if (rhs == std::numeric_limits<T>::max()) {
+      return BoolConst(false);
+    }
+    return lhs.InRange(rhs + 1, std::numeric_limits<T>::max());
+  }
+  friend BoolExpr operator>=(const Arg& lhs, T rhs) {
+    return lhs.InRange(rhs, std::numeric_limits<T>::max());
+  }
+
+  // Returns a boolean expression testing whether the system call argument
+  // (after applying any bitmasks, if appropriate) is within the inclusive
+  // range [lo, hi].
+  BoolExpr InRange(T lo, T hi) const;
+
+  // Returns a boolean expression testing whether the system call argument
+  // (after applying any bitmasks, if appropriate) equals any of |values|.
+  // Sets of small integers (e.g., command numbers) are tested with a
+  // constant number of instructions, regardless of their size.
+  BoolExpr In(const std::vector<T>& values) const;
+
  private:
   Arg(int num, uint64_t mask) : num_(num), mask_(mask) {}
 
   BoolExpr EqualTo(T val) const;
 
+  // Returns |val| as the unsigned value it is compared against.
+  static uint64_t RawValue(T val);
+
   int num_;
   uint64_t mask_;
 
+  friend class Caser<T>;
   DISALLOW_ASSIGN(Arg);
 };
 
@@ -196,8 +240,6 @@ class SANDBOX_EXPORT Elser {
   cons::List<Clause> clause_list_;
 
   friend Elser If(BoolExpr, ResultExpr);
-  template <typename T>
-  friend Caser<T> Switch(const Arg<T>&);
   DISALLOW_ASSIGN(Elser);
 };
 
@@ -209,7 +251,8 @@ SANDBOX_EXPORT Caser<T> Switch(const Arg<T>& arg);
 template <typename T>
 class SANDBOX_EXPORT Caser {
  public:
-  Caser(const Caser<T>& caser) : arg_(caser.arg_), elser_(caser.elser_) {}
+  Caser(const Caser<T>& caser)
+      : arg_(caser.arg_), clause_list_(caser.clause_list_) {}
   ~Caser() {}
 
   // Case adds a single-value "case" clause to the switch.
@@ -225,10 +268,13 @@ class SANDBOX_EXPORT Caser {
   ResultExpr Default(ResultExpr result) const;
 
  private:
-  Caser(const Arg<T>& arg, Elser elser) : arg_(arg), elser_(elser) {}
+  using Clause = std::pair<uint64_t, ResultExpr>;
+
+  Caser(const Arg<T>& arg, cons::List<Clause> clause_list)
+      : arg_(arg), clause_list_(clause_list) {}
 
   Arg<T> arg_;
-  Elser elser_;
+  cons::List<Clause> clause_list_;
 
   template <typename U>
   friend Caser<U> Switch(const Arg<U>&);
@@ -270,6 +316,41 @@ SANDBOX_EXPORT BoolExpr
 // Returns the default mask for a system call argument of the specified size.
 SANDBOX_EXPORT uint64_t DefaultMask(size_t size);
 
+// Returns a boolean expression that represents whether system call
+// argument |num| of size |size|, when masked according to |mask|, is
+// within the inclusive range [lo, hi] as an unsigned value. Users should
+// use the Arg template class below instead of using this API directly.
+SANDBOX_EXPORT BoolExpr
+    ArgInRange(int num, size_t size, uint64_t mask, uint64_t lo, uint64_t hi);
+
+// Returns a boolean expression that represents whether system call
+// argument |num| of size |size|, when masked according to |mask|, equals
+// any of |values|. Users should use the Arg template class below instead
+// of using this API directly.
+SANDBOX_EXPORT BoolExpr ArgIn(int num,
+                              size_t size,
+                              uint64_t mask,
+                              const std::vector<uint64_t>& values);
+
+// Returns |cases| with a clause mapping |value| to |result| prepended.
+// Users should use Switch instead of using this API directly.
+SANDBOX_EXPORT cons::List<std::pair<uint64_t, ResultExpr>> ArgCase(
+    uint64_t value,
+    ResultExpr result,
+    cons::List<std::pair<uint64_t, ResultExpr>> cases);
+
+// Returns a result expression that dispatches on system call argument
+// |num| of size |size|, when masked according to |mask|. |cases| maps
+// values to results in reverse order (i.e., later clauses are listed
+// first, and earlier clauses take precedence). Users should use Switch
+// instead of using this API directly.
+SANDBOX_EXPORT ResultExpr
+    ArgSwitch(int num,
+              size_t size,
+              uint64_t mask,
+              cons::List<std::pair<uint64_t, ResultExpr>> cases,
+              ResultExpr default_result);
+
 }  // namespace internal
 
 template <typename T>
@@ -286,16 +367,47 @@ Arg<T>::Arg(int num)
 // see http://www.parashift.com/c++-faq-lite/template-friends.html.
 template <typename T>
 BoolExpr Arg<T>::EqualTo(T val) const {
+  return internal::ArgEq(num_, sizeof(T), mask_, RawValue(val));
+}
+
+template <typename T>
+BoolExpr Arg<T>::InRange(T lo, T hi) const {
+  if (lo > hi) {
+    return BoolConst(false);
+  }
+  if (std::numeric_limits<T>::is_signed && lo < 0 && hi >= 0) {
+    // Negative values sort after non-negative ones when compared as
+    // unsigned values, so the range wraps around.
+    return AnyOf(internal::ArgInRange(num_, sizeof(T), mask_, RawValue(lo),
+                                      internal::DefaultMask(sizeof(T))),
+                 internal::ArgInRange(num_, sizeof(T), mask_, 0,
+                                      RawValue(hi)));
+  }
+  return internal::ArgInRange(num_, sizeof(T), mask_, RawValue(lo),
+                              RawValue(hi));
+}
+
+template <typename T>
+BoolExpr Arg<T>::In(const std::vector<T>& values) const {
+  std::vector<uint64_t> raw_values;
+  for (const T& value : values) {
+    raw_values.push_back(RawValue(value));
+  }
+  return internal::ArgIn(num_, sizeof(T), mask_, raw_values);
+}
+
+template <typename T>
+uint64_t Arg<T>::RawValue(T val) {
   if (sizeof(T) == 4) {
     // Prevent sign-extension of negative int32_t values.
-    return internal::ArgEq(num_, sizeof(T), mask_, static_cast<uint32_t>(val));
+    return static_cast<uint32_t>(val);
   }
-  return internal::ArgEq(num_, sizeof(T), mask_, static_cast<uint64_t>(val));
+  return static_cast<uint64_t>(val);
 }
 
 template <typename T>
 SANDBOX_EXPORT Caser<T> Switch(const Arg<T>& arg) {
-  return Caser<T>(arg, Elser(nullptr));
+  return Caser<T>(arg, nullptr);
 }
 
 template <typename T>
@@ -306,17 +418,20 @@ Caser<T> Caser<T>::Case(T value, ResultExpr result) const {
 template <typename T>
 template <typename... Values>
 Caser<T> Caser<T>::CasesImpl(ResultExpr result, const Values&... values) const {
-  // Theoretically we could evaluate arg_ just once and emit a more efficient
-  // dispatch table, but for now we simply translate into an equivalent
-  // If/ElseIf/Else chain.
-
-  return Caser<T>(arg_,
-                  elser_.ElseIf(AnyOf((arg_ == values)...), std::move(result)));
+  // We record each value separately, so that the compiler can evaluate
+  // arg_ just once and binary search over all of the switch's values.
+  cons::List<Clause> clause_list = clause_list_;
+  for (const T& value : {static_cast<T>(values)...}) {
+    clause_list = internal::ArgCase(Arg<T>::RawValue(value), result,
+                                    std::move(clause_list));
+  }
+  return Caser<T>(arg_, std::move(clause_list));
 }
 
 template <typename T>
 ResultExpr Caser<T>::Default(ResultExpr result) const {
-  return elser_.Else(std::move(result));
+  return internal::ArgSwitch(arg_.num_, sizeof(T), arg_.mask_, clause_list_,
+                             std::move(result));
 }
 
 template <typename... Rest>
@@ -5,20 +5,36 @@
 #ifndef SANDBOX_LINUX_BPF_DSL_BPF_DSL_IMPL_H_
 #define SANDBOX_LINUX_BPF_DSL_BPF_DSL_IMPL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <memory>
 
 #include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
 #include "sandbox/linux/bpf_dsl/codegen.h"
 #include "sandbox/sandbox_export.h"
 
 namespace sandbox {
+struct arch_seccomp_data;
+
 namespace bpf_dsl {
+class ArgTests;
 class ErrorCode;
 class PolicyCompiler;
+class PolicyFingerprint;
+class PolicyOracle;
+class TrapRegistry;
 
 namespace internal {
 
 // Internal interface implemented by BoolExpr implementations.
+//
+// The hooks that walk an expression (Compile, Fingerprint, Evaluate,
+// AddArgTests and AddToOracle) are pure virtual here and in
+// ResultExprImpl, so every kind of node must implement all of them. The
+// remaining queries have defaults that are only overridden by the kinds
+// of node that they're about.
 class BoolExprImpl {
  public:
   // Compile uses |pc| to emit a CodeGen::Node that conditionally continues
@@ -28,6 +44,39 @@ class BoolExprImpl {
                                 CodeGen::Node then_node,
                                 CodeGen::Node else_node) const = 0;
 
+  // Fingerprint adds a description of the represented boolean expression
+  // to |fp|.
+  virtual void Fingerprint(PolicyFingerprint* fp) const = 0;
+
+  // Evaluate returns whether the boolean expression holds for the system
+  // call |data|, whose 32-bit arguments must be properly extended.
+  virtual bool Evaluate(const struct arch_seccomp_data& data) const = 0;
+
+  // AddArgTests adds the argument tests that the boolean expression
+  // makes to |tests|.
+  virtual void AddArgTests(ArgTests* tests) const = 0;
+
+  // AddToOracle uses |oracle| to add a decision tree node that continues
+  // to either |then_node| or |else_node|, like Compile.
+  virtual size_t AddToOracle(PolicyOracle* oracle,
+                             size_t then_node,
+                             size_t else_node) const = 0;
+
+  // IsConst returns whether the boolean expression is the constant
+  // |value|. Only constants override it; the default returns false.
+  virtual bool IsConst(bool value) const;
+
+  // Negated returns the negated expression if the boolean expression is a
+  // negation, and nullptr otherwise. Only negations override it.
+  virtual BoolExpr Negated() const;
+
+  // HasConjunct (resp. HasDisjunct) returns whether |cond| is one of the
+  // operands of the boolean expression, if it is a chain of conjunctions
+  // (resp. disjunctions). Only conjunctions (resp. disjunctions) override
+  // them; the defaults return false.
+  virtual bool HasConjunct(const BoolExpr& cond) const;
+  virtual bool HasDisjunct(const BoolExpr& cond) const;
+
  protected:
   BoolExprImpl() {}
   virtual ~BoolExprImpl() {}
@@ -36,21 +85,50 @@ class BoolExprImpl {
   DISALLOW_COPY_AND_ASSIGN(BoolExprImpl);
 };
 
-// Internal interface implemented by ResultExpr implementations.
+// Internal interface implemented by ResultExpr implementations. See
+// BoolExprImpl for which hooks must be implemented.
 class ResultExprImpl {
  public:
   // Compile uses |pc| to emit a CodeGen::Node that executes the
   // represented result expression.
   virtual CodeGen::Node Compile(PolicyCompiler* pc) const = 0;
 
+  // Fingerprint adds a description of the represented result expression
+  // to |fp|.
+  virtual void Fingerprint(PolicyFingerprint* fp) const = 0;
+
+  // AddToOracle uses |oracle| to add a decision tree node that selects
+  // the represented result expression, like Compile.
+  virtual size_t AddToOracle(PolicyOracle* oracle) const = 0;
+
+  // Evaluate returns the Return or Trap expression that the result
+  // expression selects for the system call |data|, whose 32-bit
+  // arguments must be properly extended.
+  virtual const ResultExprImpl* Evaluate(
+      const struct arch_seccomp_data& data) const = 0;
+
+  // AddArgTests adds the argument tests that the result expression
+  // makes to |tests|.
+  virtual void AddArgTests(ArgTests* tests) const = 0;
+
+  // ReturnValue returns the seccomp return value of a Return or Trap
+  // expression, registering the trap handler with |registry| like
+  // PolicyCompiler does. Only Return and Trap expressions override it,
+  // and it mustn't be called on any others.
+  virtual uint32_t ReturnValue(TrapRegistry* registry) const;
+
   // HasUnsafeTraps returns whether the result expression is or recursively
-  // contains an unsafe trap expression.
+  // contains an unsafe trap expression. Traps and the expressions that
+  // contain others override it; the default returns false.
   virtual bool HasUnsafeTraps() const;
 
   // IsAllow returns whether the result expression is an "allow" result.
+  // Only Return expressions override it; the default returns false.
   virtual bool IsAllow() const;
 
-  // IsAllow returns whether the result expression is a "deny" result.
+  // IsDeny returns whether the result expression is a "deny" result.
+  // Only Return and Trap expressions override it; the default returns
+  // false.
   virtual bool IsDeny() const;
 
  protected:
@@ -0,0 +1,95 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+
+#include <errno.h>
+
+#include <string>
+
+#include "base/macros.h"
+#include "base/strings/string_number_conversions.h"
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// LargeSwitchPolicy dispatches every system call on its first argument,
+// with |num_cases| cases.
+class LargeSwitchPolicy : public Policy {
+ public:
+  explicit LargeSwitchPolicy(int num_cases) : num_cases_(num_cases) {}
+  ~LargeSwitchPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    return AddCases(Switch(Arg<int>(0)), 0);
+  }
+
+ private:
+  // Caser can't be assigned to, so the cases are added recursively.
+  ResultExpr AddCases(const Caser<int>& caser, int i) const {
+    if (i == num_cases_) {
+      return caser.Default(Allow());
+    }
+    return AddCases(caser.Case(i * 3, Error(1 + i % 64)), i + 1);
+  }
+
+  const int num_cases_;
+
+  DISALLOW_COPY_AND_ASSIGN(LargeSwitchPolicy);
+};
+
+// DeepIfPolicy checks every system call's arguments against a chain of
+// |depth| conditions. The system calls share four different chains, so
+// the program stays within the kernel's limits.
+class DeepIfPolicy : public Policy {
+ public:
+  explicit DeepIfPolicy(int depth) : depth_(depth) {}
+  ~DeepIfPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const int variant = sysno % 4;
+    const Arg<int> arg(variant);
+    return AddConditions(arg, variant, If(arg == variant, Error(EPERM)), 1);
+  }
+
+ private:
+  // Elser can't be assigned to, so the conditions are added recursively.
+  ResultExpr AddConditions(const Arg<int>& arg,
+                           int variant,
+                           const Elser& elser,
+                           int i) const {
+    if (i == depth_) {
+      return elser.Else(Allow());
+    }
+    return AddConditions(
+        arg, variant, elser.ElseIf(arg == i * 4 + variant, Error(1 + i % 64)),
+        i + 1);
+  }
+
+  const int depth_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeepIfPolicy);
+};
+
+TEST(BPFDSLPerfTest, LargeSwitch) {
+  for (int num_cases : {16, 128, 512}) {
+    MeasurePolicy("switch_" + base::IntToString(num_cases),
+                  LargeSwitchPolicy(num_cases));
+  }
+}
+
+TEST(BPFDSLPerfTest, DeepIf) {
+  for (int depth : {16, 128, 512}) {
+    MeasurePolicy("if_chain_" + base::IntToString(depth),
+                  DeepIfPolicy(depth));
+  }
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -8,9 +8,11 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <stdint.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <map>
@@ -23,9 +25,12 @@
 #include "sandbox/linux/bpf_dsl/codegen.h"
 #include "sandbox/linux/bpf_dsl/dump_bpf.h"
 #include "sandbox/linux/bpf_dsl/golden/golden_files.h"
+#include "sandbox/linux/bpf_dsl/linux_syscall_ranges.h"
 #include "sandbox/linux/bpf_dsl/policy.h"
 #include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
 #include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/static_program.h"
 #include "sandbox/linux/bpf_dsl/test_trap_registry.h"
 #include "sandbox/linux/bpf_dsl/verifier.h"
 #include "sandbox/linux/system_headers/linux_filter.h"
@@ -37,35 +42,38 @@ namespace sandbox {
 namespace bpf_dsl {
 namespace {
 
-// Helper function to construct fake arch_seccomp_data objects.
-struct arch_seccomp_data FakeSyscall(int nr,
-                                     uintptr_t p0 = 0,
-                                     uintptr_t p1 = 0,
-                                     uintptr_t p2 = 0,
-                                     uintptr_t p3 = 0,
-                                     uintptr_t p4 = 0,
-                                     uintptr_t p5 = 0) {
-  // Made up program counter for syscall address.
-  const uint64_t kFakePC = 0x543210;
-
-  struct arch_seccomp_data data = {
-      nr,
-      SECCOMP_ARCH,
-      kFakePC,
-      {
-       p0, p1, p2, p3, p4, p5,
-      },
-  };
-
+#if defined(SECCOMP_COMPAT_ARCH)
+// Same as FakeSyscall, but for the compatibility ABI.
+struct arch_seccomp_data FakeCompatSyscall(int nr, uint32_t p0 = 0) {
+  struct arch_seccomp_data data = FakeSyscall(nr, p0);
+  data.arch = SECCOMP_COMPAT_ARCH;
   return data;
 }
+#endif
 
 class PolicyEmulator {
  public:
   PolicyEmulator(const golden::Golden& golden, const Policy& policy)
+      : PolicyEmulator(golden, policy, nullptr) {}
+
+  // Compiles |policy| together with |compat_policy| (if not null); see
+  // PolicyCompiler::SetCompatPolicy.
+  PolicyEmulator(const golden::Golden& golden,
+                 const Policy& policy,
+                 const Policy* compat_policy)
       : program_() {
     TestTrapRegistry traps;
-    program_ = PolicyCompiler(&policy, &traps).Compile();
+    PolicyCompiler compiler(&policy, &traps);
+    if (compat_policy) {
+      compiler.SetCompatPolicy(compat_policy);
+    }
+    program_ = compiler.Compile();
+    if (!compat_policy) {
+      // Fixed policies can also be compiled when building, which must
+      // yield the same program.
+      EXPECT_EQ(DumpBPF::StringPrintProgram(program_),
+                DumpBPF::StringPrintProgram(CompileStaticProgram(&policy)));
+    }
 
     // TODO(mdempsky): Generalize to more arches.
     const char* expected = nullptr;
@@ -431,6 +439,182 @@ TEST(BPFDSL, SwitchTest) {
                        FakeSyscall(__NR_fcntl, kFakeSockFD, F_DUPFD, 0));
 }
 
+class RangePolicy : public Policy {
+ public:
+  RangePolicy() {}
+  ~RangePolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_fcntl) {
+      const Arg<int> fd(0);
+      return If(fd < 0, Error(EBADF))
+          .ElseIf(fd <= 2, Error(EPERM))
+          .ElseIf(fd.InRange(100, 199), Error(EACCES))
+          .Else(Allow());
+    }
+    if (sysno == __NR_kill) {
+      const Arg<pid_t> pid(0);
+      return If(pid.InRange(-10, 10), Error(EPERM)).Else(Allow());
+    }
+    if (sysno == __NR_munmap) {
+      const Arg<unsigned long> len(1);
+      return If(AllOf(len >= 0x1000, len < 0x40000000), Allow())
+          .Else(Error(EINVAL));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(RangePolicy);
+};
+
+TEST(BPFDSL, RangeTest) {
+  PolicyEmulator emulator(golden::kRangePolicy, RangePolicy());
+
+  emulator.ExpectErrno(EBADF, FakeSyscall(__NR_fcntl, -1, F_DUPFD));
+  emulator.ExpectErrno(EBADF, FakeSyscall(__NR_fcntl, -314, F_DUPFD));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_fcntl, 0, F_DUPFD));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_fcntl, 2, F_DUPFD));
+  emulator.ExpectAllow(FakeSyscall(__NR_fcntl, 3, F_DUPFD));
+  emulator.ExpectAllow(FakeSyscall(__NR_fcntl, 99, F_DUPFD));
+  emulator.ExpectErrno(EACCES, FakeSyscall(__NR_fcntl, 100, F_DUPFD));
+  emulator.ExpectErrno(EACCES, FakeSyscall(__NR_fcntl, 199, F_DUPFD));
+  emulator.ExpectAllow(FakeSyscall(__NR_fcntl, 200, F_DUPFD));
+
+  emulator.ExpectAllow(FakeSyscall(__NR_kill, -11, SIGKILL));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_kill, -10, SIGKILL));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_kill, 0, SIGKILL));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_kill, 10, SIGKILL));
+  emulator.ExpectAllow(FakeSyscall(__NR_kill, 11, SIGKILL));
+
+  emulator.ExpectErrno(EINVAL, FakeSyscall(__NR_munmap, 0, 0xfff));
+  emulator.ExpectAllow(FakeSyscall(__NR_munmap, 0, 0x1000));
+  emulator.ExpectAllow(FakeSyscall(__NR_munmap, 0, 0x3fffffff));
+  emulator.ExpectErrno(EINVAL, FakeSyscall(__NR_munmap, 0, 0x40000000));
+  emulator.ExpectErrno(EINVAL, FakeSyscall(__NR_munmap, 0, -1));
+}
+
+class MembershipPolicy : public Policy {
+ public:
+  MembershipPolicy() {}
+  ~MembershipPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_prctl) {
+      const Arg<int> option(0);
+      return If(option.In({PR_GET_NAME, PR_SET_NAME, PR_GET_DUMPABLE,
+                           PR_SET_DUMPABLE}),
+                Allow())
+          .Else(Error(EPERM));
+    }
+    if (sysno == __NR_clock_gettime) {
+      const Arg<clockid_t> clockid(0);
+      return If(clockid.In({CLOCK_REALTIME, CLOCK_MONOTONIC,
+                            CLOCK_PROCESS_CPUTIME_ID, CLOCK_THREAD_CPUTIME_ID,
+                            CLOCK_MONOTONIC_COARSE}),
+                Allow())
+          .Else(Error(EINVAL));
+    }
+    if (sysno == __NR_fcntl) {
+      // Too spread out for a bitmap.
+      const Arg<int> cmd(1);
+      return If(cmd.In({F_GETFL, F_GETFD, F_SETFD, F_DUPFD_CLOEXEC}), Allow())
+          .Else(Error(EACCES));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MembershipPolicy);
+};
+
+TEST(BPFDSL, MembershipTest) {
+  PolicyEmulator emulator(golden::kMembershipPolicy, MembershipPolicy());
+
+  emulator.ExpectAllow(FakeSyscall(__NR_prctl, PR_GET_NAME));
+  emulator.ExpectAllow(FakeSyscall(__NR_prctl, PR_SET_NAME));
+  emulator.ExpectAllow(FakeSyscall(__NR_prctl, PR_GET_DUMPABLE));
+  emulator.ExpectAllow(FakeSyscall(__NR_prctl, PR_SET_DUMPABLE));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_prctl, 0));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_prctl, PR_SET_PDEATHSIG));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_prctl, PR_SET_SECCOMP));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_prctl, PR_GET_NAME + 32));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_prctl, -1));
+
+  emulator.ExpectAllow(FakeSyscall(__NR_clock_gettime, CLOCK_REALTIME));
+  emulator.ExpectAllow(FakeSyscall(__NR_clock_gettime, CLOCK_MONOTONIC_COARSE));
+  emulator.ExpectErrno(EINVAL,
+                       FakeSyscall(__NR_clock_gettime, CLOCK_MONOTONIC_RAW));
+  emulator.ExpectErrno(EINVAL, FakeSyscall(__NR_clock_gettime, 32));
+  emulator.ExpectErrno(EINVAL, FakeSyscall(__NR_clock_gettime, -2));
+
+  emulator.ExpectAllow(FakeSyscall(__NR_fcntl, 0, F_GETFL));
+  emulator.ExpectAllow(FakeSyscall(__NR_fcntl, 0, F_DUPFD_CLOEXEC));
+  emulator.ExpectErrno(EACCES, FakeSyscall(__NR_fcntl, 0, F_SETFL));
+}
+
+#if defined(SECCOMP_COMPAT_ARCH)
+// Compatibility ABI system call numbers, which are the same for i386 and
+// ARM EABI.
+const int kCompatGetpid = 20;
+const int kCompatPtrace = 26;
+const int kCompatKill = 37;
+
+// Builds the same policy for the native and the compatibility ABI, given
+// their numbers for the system calls that it restricts.
+class ArchPolicy : public Policy {
+ public:
+  ArchPolicy(int getpid, int ptrace, int kill)
+      : getpid_(getpid), ptrace_(ptrace), kill_(kill) {}
+  ~ArchPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == getpid_) {
+      return Error(EPERM);
+    }
+    if (sysno == ptrace_) {
+      return Kill();
+    }
+    if (sysno == kill_) {
+      const Arg<pid_t> pid(0);
+      return If(pid == 0, Allow()).Else(Error(EPERM));
+    }
+    return Allow();
+  }
+
+ private:
+  const int getpid_;
+  const int ptrace_;
+  const int kill_;
+
+  DISALLOW_COPY_AND_ASSIGN(ArchPolicy);
+};
+
+TEST(BPFDSL, CompatTest) {
+  const ArchPolicy compat_policy(kCompatGetpid, kCompatPtrace, kCompatKill);
+  PolicyEmulator emulator(golden::kCompatPolicy,
+                          ArchPolicy(__NR_getpid, __NR_ptrace, __NR_kill),
+                          &compat_policy);
+
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_getpid));
+  emulator.ExpectKill(FakeSyscall(__NR_ptrace));
+  emulator.ExpectAllow(FakeSyscall(__NR_kill, 0));
+  emulator.ExpectErrno(EPERM, FakeSyscall(__NR_kill, 1));
+  emulator.ExpectErrno(ENOSYS, FakeSyscall(MAX_PUBLIC_SYSCALL + 1));
+
+  emulator.ExpectErrno(EPERM, FakeCompatSyscall(kCompatGetpid));
+  emulator.ExpectKill(FakeCompatSyscall(kCompatPtrace));
+  emulator.ExpectAllow(FakeCompatSyscall(kCompatKill, 0));
+  emulator.ExpectErrno(EPERM, FakeCompatSyscall(kCompatKill, 1));
+  emulator.ExpectErrno(ENOSYS,
+                       FakeCompatSyscall(MAX_PUBLIC_COMPAT_SYSCALL + 1));
+
+  // System call numbers are only meaningful together with their ABI.
+  emulator.ExpectAllow(FakeCompatSyscall(__NR_getpid));
+
+  struct arch_seccomp_data other_arch = FakeSyscall(__NR_getpid);
+  other_arch.arch = SECCOMP_ARCH ^ SECCOMP_COMPAT_ARCH;
+  emulator.ExpectKill(other_arch);
+}
+#endif  // defined(SECCOMP_COMPAT_ARCH)
+
 static intptr_t DummyTrap(const struct arch_seccomp_data& data, void* aux) {
   return 0;
 }
@@ -473,6 +657,53 @@ TEST(BPFDSL, HasUnsafeTraps) {
   EXPECT_TRUE(maybe->HasUnsafeTraps());
 }
 
+TEST(BPFDSL, Interning) {
+  EXPECT_EQ(Allow(), Allow());
+  EXPECT_EQ(Error(EPERM), Error(EPERM));
+  EXPECT_NE(Error(EPERM), Error(EACCES));
+  EXPECT_EQ(Trap(DummyTrap, nullptr), Trap(DummyTrap, nullptr));
+  EXPECT_NE(Trap(DummyTrap, nullptr), UnsafeTrap(DummyTrap, nullptr));
+
+  const Arg<int> fd(0);
+  const Arg<int> cmd(1);
+  EXPECT_EQ(fd == 0, fd == 0);
+  EXPECT_NE(fd == 0, cmd == 0);
+  EXPECT_EQ(cmd.In({1, 2, 3}), cmd.In({1, 2, 3}));
+  EXPECT_EQ(If(fd == 0, Allow()).Else(Error(EPERM)),
+            If(fd == 0, Allow()).Else(Error(EPERM)));
+  EXPECT_EQ(Switch(cmd).CASES((1, 2), Allow()).Default(Error(EPERM)),
+            Switch(cmd).CASES((1, 2), Allow()).Default(Error(EPERM)));
+}
+
+TEST(BPFDSL, Simplification) {
+  const Arg<int> fd(0);
+  const Arg<int> cmd(1);
+  const BoolExpr a = fd == 0;
+  const BoolExpr b = cmd == 0;
+
+  EXPECT_EQ(a, Not(Not(a)));
+  EXPECT_EQ(BoolConst(false), Not(BoolConst(true)));
+  EXPECT_EQ(a, AllOf(a, BoolConst(true)));
+  EXPECT_EQ(a, AllOf(BoolConst(true), a));
+  EXPECT_EQ(BoolConst(false), AllOf(a, BoolConst(false)));
+  EXPECT_EQ(a, AnyOf(a, BoolConst(false)));
+  EXPECT_EQ(BoolConst(true), AnyOf(BoolConst(true), a));
+  EXPECT_EQ(a, AnyOf(a, a));
+  EXPECT_EQ(AnyOf(b, a), AnyOf(a, b, a));
+  EXPECT_EQ(AllOf(a, b), AllOf(b, a, b));
+  EXPECT_NE(AnyOf(a, b), AllOf(a, b));
+
+  EXPECT_EQ(Allow(), If(a, Allow()).Else(Allow()));
+  EXPECT_EQ(Allow(), If(BoolConst(true), Allow()).Else(Error(EPERM)));
+  EXPECT_EQ(Error(EPERM), If(BoolConst(false), Allow()).Else(Error(EPERM)));
+  EXPECT_EQ(If(a, Allow()).ElseIf(b, Error(EACCES)).Else(Allow()),
+            If(a, Allow())
+                .ElseIf(BoolConst(false), Error(EPERM))
+                .ElseIf(b, Error(EACCES))
+                .Else(Allow()));
+  EXPECT_EQ(Allow(), Switch(cmd).CASES((1, 2), Allow()).Default(Allow()));
+}
+
 }  // namespace
 }  // namespace bpf_dsl
 }  // namespace sandbox
@@ -7,8 +7,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <limits>
+#include <map>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "sandbox/linux/system_headers/linux_filter.h"
@@ -42,6 +45,14 @@
 //      already be nearby as long as callers don't go out of their way
 //      to interleave MakeInstruction() calls for unrelated code
 //      sequences.
+//
+// Because instructions are emitted greedily, redundancy across
+// instructions (e.g., reloading a value that's already in the
+// accumulator) is left for CompileOptimized() to clean up. It runs a
+// single forward dataflow pass over the finished DAG, and then re-emits
+// the reachable instructions into a fresh CodeGen. Since it sees the
+// whole DAG, it also addresses weakness 2 by trying a depth-first
+// layout, which keeps most branch targets in range.
 
 namespace sandbox {
 
@@ -49,6 +60,12 @@ namespace sandbox {
 // sock_filter's 8-bit jt and jf fields.
 const size_t kBranchRange = std::numeric_limits<uint8_t>::max();
 
+// kMaxNodes bounds the size of the instruction DAG. The kernel limits the
+// total length of all of a thread's stacked filters to this many
+// instructions (MAX_INSNS_PER_PATH), so even policies that are split into
+// several filters never need more.
+const size_t kMaxNodes = (1 << 18) / sizeof(struct sock_filter);
+
 const CodeGen::Node CodeGen::kNullNode;
 
 CodeGen::CodeGen() : program_(), equivalent_(), memos_() {
@@ -61,6 +78,645 @@ CodeGen::Program CodeGen::Compile(CodeGen::Node head) {
   return Program(program_.rbegin() + Offset(head), program_.rend());
 }
 
+namespace {
+
+// kNoOffset marks accumulator contents that aren't known to be a
+// (possibly masked) 32-bit word of the seccomp data.
+const uint32_t kNoOffset = std::numeric_limits<uint32_t>::max();
+
+// kMaxExcluded limits how many values we remember a word to not equal.
+const size_t kMaxExcluded = 16;
+
+// AccKey describes a value the accumulator can hold: the 32-bit word at
+// |offset| within the (immutable) seccomp data, bitwise-and'd with |mask|.
+struct AccKey {
+  uint32_t offset;
+  uint32_t mask;
+
+  bool IsKnown() const { return offset != kNoOffset; }
+
+  friend bool operator==(const AccKey& lhs, const AccKey& rhs) {
+    return lhs.offset == rhs.offset && lhs.mask == rhs.mask;
+  }
+  friend bool operator!=(const AccKey& lhs, const AccKey& rhs) {
+    return !(lhs == rhs);
+  }
+  friend bool operator<(const AccKey& lhs, const AccKey& rhs) {
+    return std::make_pair(lhs.offset, lhs.mask) <
+           std::make_pair(rhs.offset, rhs.mask);
+  }
+};
+
+const AccKey kUnknownAcc = {kNoOffset, 0};
+
+// Fact summarizes what earlier branches have established about an
+// AccKey value: it's within [lo, hi], has all the |ones| bits set and
+// all the |zeros| bits clear, and doesn't equal any |excluded| value.
+struct Fact {
+  explicit Fact(uint32_t mask)
+      : lo(0), hi(mask), ones(0), zeros(~mask), excluded() {}
+
+  bool IsTrivial(uint32_t mask) const {
+    return lo == 0 && hi == mask && ones == 0 && zeros == ~mask &&
+           excluded.empty();
+  }
+
+  bool IsExcluded(uint32_t value) const {
+    return std::binary_search(excluded.begin(), excluded.end(), value);
+  }
+
+  bool IsConsistent() const {
+    if (lo > hi || (ones & zeros) != 0) {
+      return false;
+    }
+    if (lo == hi) {
+      return (lo & ones) == ones && (lo & zeros) == 0 && !IsExcluded(lo);
+    }
+    return true;
+  }
+
+  uint32_t lo;
+  uint32_t hi;
+  uint32_t ones;
+  uint32_t zeros;
+  std::vector<uint32_t> excluded;  // Sorted.
+};
+
+enum class Outcome { UNKNOWN, TAKEN, NOT_TAKEN };
+
+Outcome Known(bool taken) {
+  return taken ? Outcome::TAKEN : Outcome::NOT_TAKEN;
+}
+
+// Decide returns the outcome of the conditional branch |op| with
+// constant |k| if it's implied by |fact|.
+Outcome Decide(uint16_t op, uint32_t k, const Fact& fact) {
+  if (fact.lo == fact.hi) {
+    const uint32_t value = fact.lo;
+    switch (op) {
+      case BPF_JEQ:
+        return Known(value == k);
+      case BPF_JGE:
+        return Known(value >= k);
+      case BPF_JGT:
+        return Known(value > k);
+      case BPF_JSET:
+        return Known((value & k) != 0);
+    }
+    return Outcome::UNKNOWN;
+  }
+
+  switch (op) {
+    case BPF_JEQ:
+      if (k < fact.lo || k > fact.hi || (k & fact.zeros) != 0 ||
+          (~k & fact.ones) != 0 || fact.IsExcluded(k)) {
+        return Outcome::NOT_TAKEN;
+      }
+      break;
+    case BPF_JGE:
+      if (fact.lo >= k) {
+        return Outcome::TAKEN;
+      }
+      if (fact.hi < k) {
+        return Outcome::NOT_TAKEN;
+      }
+      break;
+    case BPF_JGT:
+      if (fact.lo > k) {
+        return Outcome::TAKEN;
+      }
+      if (fact.hi <= k) {
+        return Outcome::NOT_TAKEN;
+      }
+      break;
+    case BPF_JSET:
+      if ((fact.ones & k) != 0) {
+        return Outcome::TAKEN;
+      }
+      if ((fact.zeros & k) == k) {
+        return Outcome::NOT_TAKEN;
+      }
+      break;
+  }
+  return Outcome::UNKNOWN;
+}
+
+// Refine updates |fact| to account for the conditional branch |op| with
+// constant |k| having (or not having) been taken, and returns whether
+// the result is still satisfiable.
+bool Refine(uint16_t op, uint32_t k, bool taken, Fact* fact) {
+  switch (op) {
+    case BPF_JEQ:
+      if (taken) {
+        fact->lo = std::max(fact->lo, k);
+        fact->hi = std::min(fact->hi, k);
+        fact->ones |= k;
+        fact->zeros |= ~k;
+      } else {
+        auto it =
+            std::lower_bound(fact->excluded.begin(), fact->excluded.end(), k);
+        if ((it == fact->excluded.end() || *it != k) &&
+            fact->excluded.size() < kMaxExcluded) {
+          fact->excluded.insert(it, k);
+        }
+        if (fact->lo == k && fact->lo < fact->hi) {
+          ++fact->lo;
+        } else if (fact->hi == k && fact->lo < fact->hi) {
+          --fact->hi;
+        }
+      }
+      break;
+    case BPF_JGE:
+      if (taken) {
+        fact->lo = std::max(fact->lo, k);
+      } else if (k == 0) {
+        return false;
+      } else {
+        fact->hi = std::min(fact->hi, k - 1);
+      }
+      break;
+    case BPF_JGT:
+      if (!taken) {
+        fact->hi = std::min(fact->hi, k);
+      } else if (k == std::numeric_limits<uint32_t>::max()) {
+        return false;
+      } else {
+        fact->lo = std::max(fact->lo, k + 1);
+      }
+      break;
+    case BPF_JSET:
+      if (!taken) {
+        fact->zeros |= k;
+      } else if ((fact->zeros & k) == k) {
+        return false;
+      } else if ((k & (k - 1)) == 0) {
+        fact->ones |= k;
+      }
+      break;
+  }
+  return fact->IsConsistent();
+}
+
+// MeetFacts sets |dst| to the facts implied by both |dst| and |src|.
+void MeetFacts(Fact* dst, const Fact& src) {
+  dst->lo = std::min(dst->lo, src.lo);
+  dst->hi = std::max(dst->hi, src.hi);
+  dst->ones &= src.ones;
+  dst->zeros &= src.zeros;
+  std::vector<uint32_t> excluded;
+  std::set_intersection(dst->excluded.begin(), dst->excluded.end(),
+                        src.excluded.begin(), src.excluded.end(),
+                        std::back_inserter(excluded));
+  dst->excluded.swap(excluded);
+}
+
+// State describes what's known at the start of an instruction.
+struct State {
+  State() : reachable(false), acc(kUnknownAcc), facts() {}
+
+  Fact FactFor(const AccKey& key) const {
+    auto it = facts.find(key);
+    return it != facts.end() ? it->second : Fact(key.mask);
+  }
+
+  void SetFact(const AccKey& key, const Fact& fact) {
+    if (fact.IsTrivial(key.mask)) {
+      facts.erase(key);
+    } else {
+      auto res = facts.insert(std::make_pair(key, fact));
+      if (!res.second) {
+        res.first->second = fact;
+      }
+    }
+  }
+
+  // Meet merges in the state from another incoming edge.
+  void Meet(const State& src) {
+    if (!src.reachable) {
+      return;
+    }
+    if (!reachable) {
+      *this = src;
+      return;
+    }
+    if (acc != src.acc) {
+      acc = kUnknownAcc;
+    }
+    for (auto it = facts.begin(); it != facts.end();) {
+      auto jt = src.facts.find(it->first);
+      if (jt == src.facts.end()) {
+        it = facts.erase(it);
+        continue;
+      }
+      MeetFacts(&it->second, jt->second);
+      if (it->second.IsTrivial(it->first.mask)) {
+        it = facts.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  bool reachable;
+  AccKey acc;
+  std::map<AccKey, Fact> facts;
+};
+
+bool IsConditionalJump(const sock_filter& insn) {
+  return BPF_CLASS(insn.code) == BPF_JMP && BPF_OP(insn.code) != BPF_JA &&
+         BPF_SRC(insn.code) == BPF_K;
+}
+
+bool IsLoadAbs(const sock_filter& insn) {
+  return insn.code == BPF_LD + BPF_W + BPF_ABS;
+}
+
+}  // namespace
+
+// Optimizer implements CompileOptimized(). It first walks the input DAG
+// in topological order (i.e., from the logical beginning of the program
+// to its end), computing for each instruction the State common to all of
+// its incoming edges. While doing so, each edge is "threaded" past any
+// instructions that it doesn't need to execute: loads of the value
+// that's already in the accumulator, and branches (together with the
+// load feeding them) whose outcome the edge's State already implies.
+// Finally, the instructions that remain reachable are re-emitted into
+// the output CodeGen in a given order, dropping loads whose result is
+// never used.
+class CodeGen::Optimizer {
+ public:
+  Optimizer(const CodeGen& in, Node head)
+      : in_(in), out_(nullptr), states_(), edges_(), emitted_(), entry_() {
+    entry_ = Analyze(head);
+  }
+
+  // OriginalOrder returns the reachable instructions in their original
+  // order, so that the output's layout stays close to the input's.
+  std::vector<Node> OriginalOrder() const {
+    std::vector<Node> order;
+    for (Node node = 0; node <= entry_.target; ++node) {
+      if (states_[node].reachable) {
+        order.push_back(node);
+      }
+    }
+    return order;
+  }
+
+  // LinearOrder returns the reachable instructions in depth-first
+  // postorder, which places instructions right before the first of
+  // their successors that isn't shared with an earlier one. Of a
+  // branch's two successors, the one leading to more |weights| goes
+  // last (and thus right after the branch), or otherwise the one with
+  // the smaller subtree, which keeps the other one as close as possible.
+  std::vector<Node> LinearOrder(const NodeWeights& weights) const {
+    // Successors always have smaller node values than their
+    // predecessors, so we can compute subtree sizes and weights in a
+    // single pass. Sizes are capped at one past the branch range, since
+    // beyond that they're all equally far away.
+    std::vector<size_t> sizes(entry_.target + 1, 0);
+    std::vector<uint64_t> heat(entry_.target + 1, 0);
+    for (Node node = 0; node <= entry_.target; ++node) {
+      if (!states_[node].reachable) {
+        continue;
+      }
+      auto it = weights.find(node);
+      heat[node] = it != weights.end() ? it->second : 0;
+      sizes[node] = 1;
+      for (const Edge& edge : edges_[node]) {
+        if (edge.valid) {
+          heat[node] = std::max(heat[node], heat[edge.target]);
+          sizes[node] = std::min(sizes[node] + sizes[edge.target],
+                                 kBranchRange + 1);
+        }
+      }
+    }
+
+    std::vector<Node> order;
+    std::vector<bool> visited(entry_.target + 1, false);
+    Visit(entry_.target, sizes, heat, &visited, &order);
+    return order;
+  }
+
+  // Run emits the reachable instructions into |out| in |order|, which
+  // must list successors before their predecessors, and returns the
+  // emitted program's head.
+  Node Run(const std::vector<Node>& order, CodeGen* out) {
+    out_ = out;
+    emitted_.clear();
+    for (Node node : order) {
+      Emit(node);
+    }
+    return EmitEdge(entry_);
+  }
+
+ private:
+  // Edge represents a (threaded) edge to |target|. If |preload| isn't
+  // kNoOffset, the accumulator still needs to be loaded from that offset
+  // before executing |target|.
+  struct Edge {
+    Edge() : valid(false), target(kNullNode), preload(kNoOffset) {}
+
+    bool valid;
+    Node target;
+    uint32_t preload;
+  };
+
+  const sock_filter& Insn(Node node) const { return in_.program_.at(node); }
+
+  // Next returns the node that |node| continues to, taking |skip|
+  // additional instructions into account.
+  Node Next(Node node, uint32_t skip) const {
+    CHECK_LT(skip, node) << "Jump out of program bounds";
+    return node - 1 - skip;
+  }
+
+  // Thread computes where an edge to |target| with the given |state| can
+  // jump to directly.
+  Edge Thread(Node target, State* state) const {
+    Edge edge;
+    edge.valid = true;
+    // |actual| is what the accumulator holds if |edge.preload| ends up not
+    // being materialized.
+    const AccKey actual = state->acc;
+    for (;;) {
+      const sock_filter& insn = Insn(target);
+      if (BPF_CLASS(insn.code) == BPF_JMP && BPF_OP(insn.code) == BPF_JA) {
+        target = Next(target, insn.k);
+        continue;
+      }
+      if (IsLoadAbs(insn)) {
+        const AccKey loaded = {insn.k, std::numeric_limits<uint32_t>::max()};
+        if (state->acc == loaded) {
+          // Redundant load.
+          target = Next(target, 0);
+          continue;
+        }
+        if (actual == loaded) {
+          // Redundant load, if we don't materialize the skipped one.
+          state->acc = actual;
+          edge.preload = kNoOffset;
+          target = Next(target, 0);
+          continue;
+        }
+
+        // Skip the load if the branch it feeds is already decided; the
+        // load is re-materialized at the end if it turns out to be needed.
+        Node next = Next(target, 0);
+        while (BPF_CLASS(Insn(next).code) == BPF_JMP &&
+               BPF_OP(Insn(next).code) == BPF_JA) {
+          next = Next(next, Insn(next).k);
+        }
+        if (!IsConditionalJump(Insn(next)) ||
+            Decide(BPF_OP(Insn(next).code), Insn(next).k,
+                   state->FactFor(loaded)) == Outcome::UNKNOWN) {
+          break;
+        }
+        state->acc = loaded;
+        edge.preload = insn.k;
+        target = next;
+        continue;
+      }
+      if (insn.code == BPF_ALU + BPF_AND + BPF_K && state->acc.IsKnown() &&
+          (state->acc.mask & insn.k) == state->acc.mask) {
+        // Redundant mask.
+        target = Next(target, 0);
+        continue;
+      }
+      if (IsConditionalJump(insn) && state->acc.IsKnown()) {
+        const Outcome outcome = Decide(BPF_OP(insn.code), insn.k,
+                                       state->FactFor(state->acc));
+        if (outcome != Outcome::UNKNOWN) {
+          target = Next(target, outcome == Outcome::TAKEN ? insn.jt : insn.jf);
+          continue;
+        }
+      }
+      break;
+    }
+    edge.target = target;
+    return edge;
+  }
+
+  // AddEdge threads an edge to |target| and records its |state|.
+  Edge AddEdge(Node target, State state) {
+    Edge edge = Thread(target, &state);
+    states_.at(edge.target).Meet(state);
+    return edge;
+  }
+
+  // Analyze computes |states_| and |edges_| for the DAG rooted at |head|,
+  // and returns the entry edge.
+  Edge Analyze(Node head) {
+    states_.assign(head + 1, State());
+    edges_.assign(head + 1, std::vector<Edge>());
+
+    State initial;
+    initial.reachable = true;
+    const Edge entry = AddEdge(head, initial);
+
+    for (Node node = entry.target + 1; node-- > 0;) {
+      const State& state = states_[node];
+      if (!state.reachable) {
+        continue;
+      }
+      const sock_filter& insn = Insn(node);
+      std::vector<Edge>& edges = edges_[node];
+      switch (BPF_CLASS(insn.code)) {
+        case BPF_RET:
+          break;
+        case BPF_JMP: {
+          if (BPF_OP(insn.code) == BPF_JA) {
+            edges.push_back(AddEdge(Next(node, insn.k), state));
+            break;
+          }
+          const Outcome outcome =
+              IsConditionalJump(insn) && state.acc.IsKnown()
+                  ? Decide(BPF_OP(insn.code), insn.k,
+                           state.FactFor(state.acc))
+                  : Outcome::UNKNOWN;
+          for (bool taken : {true, false}) {
+            const Node target = Next(node, taken ? insn.jt : insn.jf);
+            if (outcome != Outcome::UNKNOWN && outcome != Known(taken)) {
+              edges.push_back(Edge());
+              continue;
+            }
+            State branch = state;
+            if (IsConditionalJump(insn) && state.acc.IsKnown()) {
+              Fact fact = branch.FactFor(branch.acc);
+              if (!Refine(BPF_OP(insn.code), insn.k, taken, &fact)) {
+                edges.push_back(Edge());
+                continue;
+              }
+              branch.SetFact(branch.acc, fact);
+            }
+            edges.push_back(AddEdge(target, branch));
+          }
+          if (!edges[0].valid && !edges[1].valid) {
+            // The facts rule out both outcomes, so they contradict each
+            // other in a way that Fact doesn't notice, and the branch is
+            // actually unreachable. Keep it well-formed anyway by
+            // following both outcomes without refining anything.
+            edges.clear();
+            for (bool taken : {true, false}) {
+              edges.push_back(
+                  AddEdge(Next(node, taken ? insn.jt : insn.jf), state));
+            }
+          }
+          break;
+        }
+        default: {
+          State next = state;
+          if (IsLoadAbs(insn)) {
+            next.acc = {insn.k, std::numeric_limits<uint32_t>::max()};
+          } else if (insn.code == BPF_ALU + BPF_AND + BPF_K &&
+                     state.acc.IsKnown()) {
+            next.acc.mask &= insn.k;
+          } else {
+            next.acc = kUnknownAcc;
+          }
+          edges.push_back(AddEdge(Next(node, 0), next));
+          break;
+        }
+      }
+    }
+    return entry;
+  }
+
+  // Visit appends |node|'s successors and then |node| itself to |order|,
+  // unless they've been visited already.
+  void Visit(Node node,
+             const std::vector<size_t>& sizes,
+             const std::vector<uint64_t>& heat,
+             std::vector<bool>* visited,
+             std::vector<Node>* order) const {
+    if ((*visited)[node]) {
+      return;
+    }
+    (*visited)[node] = true;
+
+    std::vector<Node> targets;
+    for (const Edge& edge : edges_[node]) {
+      if (edge.valid) {
+        targets.push_back(edge.target);
+      }
+    }
+    if (targets.size() == 2) {
+      const Node jt = targets[0];
+      const Node jf = targets[1];
+      if (heat[jt] != heat[jf] ? heat[jt] > heat[jf] : sizes[jt] < sizes[jf]) {
+        std::swap(targets[0], targets[1]);
+      }
+    }
+    for (Node target : targets) {
+      Visit(target, sizes, heat, visited, order);
+    }
+    order->push_back(node);
+  }
+
+  // KillsAccumulator returns whether the emitted node |node| overwrites
+  // the accumulator without reading it first.
+  bool KillsAccumulator(Node node) const {
+    const sock_filter& insn = out_->program_.at(node);
+    return BPF_CLASS(insn.code) == BPF_LD || insn.code == BPF_RET + BPF_K;
+  }
+
+  Node EmitEdge(const Edge& edge) {
+    CHECK(edge.valid);
+    Node node = Emit(edge.target);
+    if (edge.preload != kNoOffset && !KillsAccumulator(node)) {
+      node = out_->MakeInstruction(BPF_LD + BPF_W + BPF_ABS, edge.preload,
+                                   node);
+    }
+    return node;
+  }
+
+  Node Emit(Node node) {
+    auto it = emitted_.find(node);
+    if (it != emitted_.end()) {
+      return it->second;
+    }
+
+    const sock_filter& insn = Insn(node);
+    const std::vector<Edge>& edges = edges_.at(node);
+    Node res = kNullNode;
+    if (BPF_CLASS(insn.code) == BPF_RET) {
+      res = out_->MakeInstruction(insn.code, insn.k);
+    } else if (BPF_CLASS(insn.code) == BPF_JMP &&
+               BPF_OP(insn.code) == BPF_JA) {
+      res = EmitEdge(edges.at(0));
+    } else if (BPF_CLASS(insn.code) == BPF_JMP) {
+      const Edge& jt = edges.at(0);
+      const Edge& jf = edges.at(1);
+      if (!jt.valid || !jf.valid) {
+        // The branch's outcome is already known.
+        res = EmitEdge(jt.valid ? jt : jf);
+      } else {
+        const Node jt_node = EmitEdge(jt);
+        const Node jf_node = EmitEdge(jf);
+        res = jt_node == jf_node ? jt_node
+                                 : out_->MakeInstruction(insn.code, insn.k,
+                                                         jt_node, jf_node);
+      }
+    } else {
+      const Node next = EmitEdge(edges.at(0));
+      if ((BPF_CLASS(insn.code) == BPF_LD ||
+           BPF_CLASS(insn.code) == BPF_ALU) &&
+          KillsAccumulator(next)) {
+        // Dead load or arithmetic.
+        res = next;
+      } else {
+        res = out_->MakeInstruction(insn.code, insn.k, next);
+      }
+    }
+
+    emitted_[node] = res;
+    return res;
+  }
+
+ private:
+  const CodeGen& in_;
+  CodeGen* out_;
+  std::vector<State> states_;
+  std::vector<std::vector<Edge>> edges_;
+  std::map<Node, Node> emitted_;
+  Edge entry_;
+
+  DISALLOW_COPY_AND_ASSIGN(Optimizer);
+};
+
+CodeGen::Program CodeGen::CompileOptimized(Node head) {
+  return CompileOptimized(head, NodeWeights(), nullptr);
+}
+
+CodeGen::Program CodeGen::CompileOptimized(Node head,
+                                           const NodeWeights& weights,
+                                           size_t* jumps_saved) {
+  Optimizer optimizer(*this, head);
+
+  // Emitting the instructions in their original order is usually fine,
+  // but callers tend to emit shared code (e.g., a jump table's targets)
+  // long before the branches to it, which then need jumps to reach it.
+  // Since the layouts only differ in their jumps, we keep whichever is
+  // shorter, preferring the linear order on ties if it has |weights| to
+  // favor.
+  CodeGen original;
+  Program program = original.Compile(
+      optimizer.Run(optimizer.OriginalOrder(), &original));
+  CodeGen linear;
+  Program linear_program =
+      linear.Compile(optimizer.Run(optimizer.LinearOrder(weights), &linear));
+
+  size_t saved = 0;
+  if (linear_program.size() < program.size() ||
+      (linear_program.size() == program.size() && !weights.empty())) {
+    saved = program.size() - linear_program.size();
+    program.swap(linear_program);
+  }
+  if (jumps_saved) {
+    *jumps_saved = saved;
+  }
+  return program;
+}
+
 CodeGen::Node CodeGen::MakeInstruction(uint16_t code,
                                        uint32_t k,
                                        Node jt,
@@ -83,9 +739,12 @@ CodeGen::Node CodeGen::AppendInstruction(uint16_t code,
     CHECK_NE(BPF_JA, BPF_OP(code)) << "CodeGen inserts JAs as needed";
 
     // Optimally adding jumps is rather tricky, so we use a quick
-    // approximation: by artificially reducing |jt|'s range, |jt| will
-    // stay within its true range even if we add a jump for |jf|.
-    jt = WithinRange(jt, kBranchRange - 1);
+    // approximation: if |jf| might need a jump, we artificially reduce
+    // |jt|'s range, so that |jt| stays within its true range even if we
+    // add one. This errs on the safe side, since adding a jump for |jt|
+    // moves |jf| one instruction further away.
+    const bool jf_may_need_jump = Distance(jf) >= kBranchRange;
+    jt = WithinRange(jt, jf_may_need_jump ? kBranchRange - 1 : kBranchRange);
     jf = WithinRange(jf, kBranchRange);
     return Append(code, k, Offset(jt), Offset(jf));
   }
@@ -129,7 +788,7 @@ CodeGen::Node CodeGen::Append(uint16_t code, uint32_t k, size_t jt, size_t jf) {
     CHECK_EQ(0U, jf);
   }
 
-  CHECK_LT(program_.size(), static_cast<size_t>(BPF_MAXINSNS));
+  CHECK_LT(program_.size(), kMaxNodes);
   CHECK_EQ(program_.size(), equivalent_.size());
 
   Node res = program_.size();
@@ -139,6 +798,35 @@ CodeGen::Node CodeGen::Append(uint16_t code, uint32_t k, size_t jt, size_t jf) {
   return res;
 }
 
+size_t CodeGen::num_nodes() const {
+  return program_.size();
+}
+
+void CodeGen::Truncate(size_t num_nodes) {
+  CHECK_LE(num_nodes, program_.size());
+  program_.resize(num_nodes);
+  equivalent_.resize(num_nodes);
+
+  // Jumps that were added for earlier nodes may have been dropped, in
+  // which case the nodes are only known to be equivalent to themselves.
+  for (Node node = 0; node < num_nodes; ++node) {
+    if (equivalent_[node] >= num_nodes) {
+      equivalent_[node] = node;
+    }
+  }
+  for (auto it = memos_.begin(); it != memos_.end();) {
+    if (it->second >= num_nodes) {
+      it = memos_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t CodeGen::Distance(Node target) const {
+  return std::min(Offset(target), Offset(equivalent_.at(target)));
+}
+
 size_t CodeGen::Offset(Node target) const {
   CHECK_LT(target, program_.size()) << "Bogus offset target node";
   return (program_.size() - 1) - target;
@@ -76,10 +76,44 @@ class SANDBOX_EXPORT CodeGen {
                        Node jf = kNullNode);
 
   // Compile linearizes the instruction DAG rooted at |head| into a
-  // program that can be executed by a BPF virtual machine.
+  // program that can be executed by a BPF virtual machine. Neither the
+  // DAG nor the program are limited to BPF_MAXINSNS instructions, so
+  // it's up to the caller to check the program's length. The DAG is
+  // still limited to the 32768 instructions that the kernel accepts for
+  // all of a thread's stacked filters together.
   Program Compile(Node head);
 
+  // CompileOptimized is like Compile, but first runs a peephole pass
+  // over the DAG rooted at |head|: loads whose value is already in the
+  // accumulator are eliminated, and branches whose outcome is already
+  // known from earlier branches are threaded through to their target.
+  // The remaining instructions are then laid out to need fewer jumps
+  // for branches whose targets are out of range.
+  Program CompileOptimized(Node head);
+
+  // NodeWeights maps nodes to their relative execution frequencies.
+  using NodeWeights = std::map<Node, uint64_t>;
+
+  // Same as above, except that the layout favors branches on the way to
+  // nodes with larger |weights|. If |jumps_saved| is non-null, it's set
+  // to the number of jumps that the layout saved compared to keeping the
+  // instructions in their original order.
+  Program CompileOptimized(Node head,
+                           const NodeWeights& weights,
+                           size_t* jumps_saved);
+
+  // num_nodes returns the number of nodes made so far. Nodes are
+  // numbered in the order they were made.
+  size_t num_nodes() const;
+
+  // Truncate drops all but the first |num_nodes| nodes, so that nodes
+  // that are no longer needed don't take up space. Dropped nodes must not
+  // be used anymore; MakeInstruction makes them again if needed.
+  void Truncate(size_t num_nodes);
+
  private:
+  class Optimizer;
+
   using MemoKey = std::tuple<uint16_t, uint32_t, Node, Node>;
 
   // AppendInstruction adds a new instruction, ensuring that |jt| and
@@ -95,6 +129,11 @@ class SANDBOX_EXPORT CodeGen {
   // logical beginning) of |program_|.
   Node Append(uint16_t code, uint32_t k, size_t jt, size_t jf);
 
+  // Distance returns how many instructions exist in |program_| after
+  // the closest node equivalent to |target|, i.e. the smallest range
+  // that WithinRange() can satisfy without emitting a jump.
+  size_t Distance(Node target) const;
+
   // Offset returns how many instructions exist in |program_| after |target|.
   size_t Offset(Node target) const;
 
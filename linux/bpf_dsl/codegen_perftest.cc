@@ -0,0 +1,74 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/codegen.h"
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "base/time/time.h"
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_test.h"
+
+namespace sandbox {
+namespace {
+
+// Number of conditional jumps in the chains built below; as many as the
+// kernel accepts in a single program.
+const uint32_t kChainLength = BPF_MAXINSNS;
+
+// MakeChain builds a chain of kChainLength conditional jumps, which
+// are all distinct, and returns its head.
+CodeGen::Node MakeChain(CodeGen* gen) {
+  const CodeGen::Node ret = gen->MakeInstruction(BPF_RET + BPF_K, 0);
+  CodeGen::Node head = gen->MakeInstruction(BPF_RET + BPF_K, 1);
+  for (uint32_t i = 0; i < kChainLength; ++i) {
+    head = gen->MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, i, ret, head);
+  }
+  return head;
+}
+
+double NanosecondsPerInstruction(base::TimeDelta elapsed) {
+  return elapsed.InMicrosecondsF() * 1000 / kChainLength;
+}
+
+TEST(CodeGenPerfTest, MakeInstruction) {
+  // Every instruction is new, so every call misses the memo.
+  std::unique_ptr<CodeGen> gen;
+  CodeGen::Node head = CodeGen::kNullNode;
+  const base::TimeDelta misses = bpf_dsl::FastestRun([&]() {
+    gen.reset(new CodeGen());
+    head = MakeChain(gen.get());
+  });
+  perf_test::PrintResult("codegen_make_instruction", "", "memo_miss",
+                         NanosecondsPerInstruction(misses), "ns", true);
+
+  // Building the same chain again only hits the memo.
+  const base::TimeDelta hits = bpf_dsl::FastestRun(
+      [&]() { EXPECT_EQ(head, MakeChain(gen.get())); });
+  perf_test::PrintResult("codegen_make_instruction", "", "memo_hit",
+                         NanosecondsPerInstruction(hits), "ns", true);
+}
+
+TEST(CodeGenPerfTest, Compile) {
+  CodeGen gen;
+  const CodeGen::Node head = MakeChain(&gen);
+
+  CodeGen::Program program;
+  const base::TimeDelta compile =
+      bpf_dsl::FastestRun([&]() { program = gen.Compile(head); });
+  perf_test::PrintResult("codegen_compile", "", "chain",
+                         NanosecondsPerInstruction(compile), "ns", true);
+
+  const base::TimeDelta optimized =
+      bpf_dsl::FastestRun([&]() { program = gen.CompileOptimized(head); });
+  perf_test::PrintResult("codegen_compile", "", "chain_optimized",
+                         NanosecondsPerInstruction(optimized), "ns", true);
+}
+
+}  // namespace
+}  // namespace sandbox
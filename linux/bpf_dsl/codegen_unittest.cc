@@ -14,6 +14,9 @@
 #include "base/macros.h"
 #include "base/md5.h"
 #include "base/strings/string_piece.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
 #include "sandbox/linux/system_headers/linux_filter.h"
 #include "testing/gtest/include/gtest/gtest.h"
 
@@ -131,7 +134,12 @@ class ProgramTest : public ::testing::Test {
   void RunTest(CodeGen::Node head) {
     // Compile the program
     CodeGen::Program program = gen_.Compile(head);
+    ExpectMatches(head, program);
+  }
 
+  // ExpectMatches verifies that |program| matches the DAG rooted at
+  // |head|.
+  void ExpectMatches(CodeGen::Node head, const CodeGen::Program& program) {
     // Walk the program backwards, and compute the hash for each instruction.
     std::vector<Hash> prog_hashes(program.size());
     for (size_t i = program.size(); i > 0; --i) {
@@ -156,6 +164,8 @@ class ProgramTest : public ::testing::Test {
     EXPECT_EQ(Lookup(head), prog_hashes.at(0));
   }
 
+  CodeGen* gen() { return &gen_; }
+
  private:
   const Hash& Lookup(CodeGen::Node next) const {
     if (next == CodeGen::kNullNode) {
@@ -400,5 +410,209 @@ TEST_F(ProgramTest, JumpReuse) {
   RunTest(two);
 }
 
+// CountJumps returns the number of JA instructions in |program|.
+size_t CountJumps(const CodeGen::Program& program) {
+  size_t jumps = 0;
+  for (const sock_filter& insn : program) {
+    if (insn.code == BPF_JMP + BPF_JA) {
+      ++jumps;
+    }
+  }
+  return jumps;
+}
+
+// Runs |program|, which may only contain JA, JGE, LD and RET
+// instructions, with |value| as the loaded word, and returns the value
+// it returns. Also counts the JA instructions executed in |jumps|.
+uint32_t RunSearch(const CodeGen::Program& program,
+                   uint32_t value,
+                   size_t* jumps) {
+  *jumps = 0;
+  for (size_t pc = 0; pc < program.size(); ++pc) {
+    const sock_filter& insn = program[pc];
+    if (insn.code == BPF_JMP + BPF_JA) {
+      ++*jumps;
+      pc += insn.k;
+    } else if (insn.code == BPF_JMP + BPF_JGE + BPF_K) {
+      pc += value >= insn.k ? insn.jt : insn.jf;
+    } else if (insn.code == BPF_RET + BPF_K) {
+      return insn.k;
+    }
+  }
+  ADD_FAILURE() << "Fell off the end of the program";
+  return 0;
+}
+
+TEST_F(ProgramTest, LayoutSavesJumps) {
+  // A search tree whose leaves are all created up front needs jumps to
+  // reach most of them in the original order, but hardly any if each
+  // leaf is placed next to its branch.
+  const uint32_t kNumLeaves = 300;
+  std::vector<CodeGen::Node> leaves;
+  for (uint32_t i = 0; i < kNumLeaves; ++i) {
+    leaves.push_back(MakeInstruction(BPF_RET + BPF_K, i));
+  }
+
+  // Pair up subtrees level by level; |lows| holds the smallest value
+  // that reaches each subtree.
+  std::vector<CodeGen::Node> nodes = leaves;
+  std::vector<uint32_t> lows;
+  for (uint32_t i = 0; i < kNumLeaves; ++i) {
+    lows.push_back(i);
+  }
+  while (nodes.size() > 1) {
+    std::vector<CodeGen::Node> parents;
+    std::vector<uint32_t> parent_lows;
+    for (size_t i = 0; i < nodes.size(); i += 2) {
+      if (i + 1 < nodes.size()) {
+        parents.push_back(MakeInstruction(BPF_JMP + BPF_JGE + BPF_K,
+                                          lows[i + 1], nodes[i + 1],
+                                          nodes[i]));
+      } else {
+        parents.push_back(nodes[i]);
+      }
+      parent_lows.push_back(lows[i]);
+    }
+    nodes.swap(parents);
+    lows.swap(parent_lows);
+  }
+  const CodeGen::Node head =
+      MakeInstruction(BPF_LD + BPF_W + BPF_ABS, 0, nodes[0]);
+
+  const CodeGen::Program original = gen()->Compile(head);
+  size_t saved = 0;
+  const CodeGen::Program program =
+      gen()->CompileOptimized(head, CodeGen::NodeWeights(), &saved);
+  ExpectMatches(head, program);
+  EXPECT_LT(0U, saved);
+  EXPECT_EQ(CountJumps(original) - saved, CountJumps(program));
+  EXPECT_EQ(original.size() - saved, program.size());
+
+  // Weighting a leaf places every branch on its way right in front of
+  // the subtree it continues to, so none of them need a jump.
+  for (uint32_t hot : {0U, 150U, kNumLeaves - 1}) {
+    CodeGen::NodeWeights weights;
+    weights[leaves[hot]] = 1;
+    const CodeGen::Program weighted =
+        gen()->CompileOptimized(head, weights, nullptr);
+    ExpectMatches(head, weighted);
+    size_t jumps = 0;
+    EXPECT_EQ(hot, RunSearch(weighted, hot, &jumps));
+    EXPECT_EQ(0U, jumps) << "leaf " << hot;
+  }
+}
+
+TEST(CodeGen, OptimizerThreadsBranches) {
+  // Reloading the same word and repeating a comparison whose outcome is
+  // already known should both be optimized away:
+  //
+  //   LD 0; JEQ 1 ? (LD 0; JEQ 1 ? RET 1 : RET 2) : (LD 0; RET 3)
+  CodeGen gen;
+  CodeGen::Node inner = gen.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS, 0,
+      gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 1,
+                          gen.MakeInstruction(BPF_RET + BPF_K, 1),
+                          gen.MakeInstruction(BPF_RET + BPF_K, 2)));
+  CodeGen::Node other =
+      gen.MakeInstruction(BPF_LD + BPF_W + BPF_ABS, 0,
+                          gen.MakeInstruction(BPF_RET + BPF_K, 3));
+  CodeGen::Node head = gen.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS, 0,
+      gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 1, inner, other));
+
+  CodeGen::Program program = gen.CompileOptimized(head);
+  ASSERT_EQ(4U, program.size());
+  EXPECT_EQ(BPF_LD + BPF_W + BPF_ABS, program[0].code);
+  EXPECT_EQ(BPF_JMP + BPF_JEQ + BPF_K, program[1].code);
+  EXPECT_EQ(1U, program[1].k);
+  EXPECT_EQ(BPF_RET + BPF_K, program[2 + program[1].jt].code);
+  EXPECT_EQ(1U, program[2 + program[1].jt].k);
+  EXPECT_EQ(BPF_RET + BPF_K, program[2 + program[1].jf].code);
+  EXPECT_EQ(3U, program[2 + program[1].jf].k);
+}
+
+TEST(CodeGen, OptimizerKeepsUsefulLoads) {
+  // Loads of different words must be preserved, even when an earlier
+  // branch already constrained the accumulator.
+  //
+  //   LD 0; JEQ 1 ? (LD 4; JEQ 1 ? RET 1 : RET 2) : RET 2
+  CodeGen gen;
+  CodeGen::Node ret2 = gen.MakeInstruction(BPF_RET + BPF_K, 2);
+  CodeGen::Node inner = gen.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS, 4,
+      gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 1,
+                          gen.MakeInstruction(BPF_RET + BPF_K, 1), ret2));
+  CodeGen::Node head = gen.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS, 0,
+      gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 1, inner, ret2));
+
+  CodeGen::Program program = gen.CompileOptimized(head);
+  EXPECT_EQ(gen.Compile(head).size(), program.size());
+}
+
+TEST(CodeGen, OptimizerUnreachableBranch) {
+  // Neither outcome of the last branch is consistent with the earlier
+  // ones, but the facts about the accumulator don't show that until
+  // both outcomes are refined:
+  //
+  //   LD 0; JEQ 4 ? RET 1 : JEQ 5 ? RET 1 :
+  //       JGE 4 ? (JGT 5 ? RET 2 : JGE 5 ? RET 3 : RET 4) : RET 5
+  CodeGen gen;
+  CodeGen::Node ret1 = gen.MakeInstruction(BPF_RET + BPF_K, 1);
+  CodeGen::Node last = gen.MakeInstruction(
+      BPF_JMP + BPF_JGE + BPF_K, 5, gen.MakeInstruction(BPF_RET + BPF_K, 3),
+      gen.MakeInstruction(BPF_RET + BPF_K, 4));
+  CodeGen::Node range = gen.MakeInstruction(
+      BPF_JMP + BPF_JGE + BPF_K, 4,
+      gen.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K, 5,
+                          gen.MakeInstruction(BPF_RET + BPF_K, 2), last),
+      gen.MakeInstruction(BPF_RET + BPF_K, 5));
+  CodeGen::Node head = gen.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS, 0,
+      gen.MakeInstruction(
+          BPF_JMP + BPF_JEQ + BPF_K, 4, ret1,
+          gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 5, ret1, range)));
+
+  CodeGen::Program program = gen.CompileOptimized(head);
+  const CodeGen::Program unoptimized = gen.Compile(head);
+  EXPECT_LE(program.size(), unoptimized.size());
+
+  // Pruning the branch mustn't change what the program returns.
+  for (int nr = 0; nr <= 8; ++nr) {
+    const char* err = nullptr;
+    const struct arch_seccomp_data data = bpf_dsl::FakeSyscall(nr);
+    const uint32_t expected =
+        bpf_dsl::Verifier::EvaluateBPF(unoptimized, data, &err);
+    ASSERT_FALSE(err) << err;
+    EXPECT_EQ(expected, bpf_dsl::Verifier::EvaluateBPF(program, data, &err))
+        << "system call " << nr;
+    EXPECT_FALSE(err) << err;
+  }
+}
+
+TEST(CodeGen, Truncate) {
+  CodeGen gen;
+  CodeGen::Node ret = gen.MakeInstruction(BPF_RET + BPF_K, 1);
+  CodeGen::Node jeq =
+      gen.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, 2, ret,
+                          gen.MakeInstruction(BPF_RET + BPF_K, 2));
+  const size_t num_nodes = gen.num_nodes();
+  CodeGen::Node head = gen.MakeInstruction(BPF_LD + BPF_W + BPF_ABS, 0, jeq);
+  const CodeGen::Program program = gen.Compile(head);
+
+  // Dropped nodes are made again, and kept ones are still shared.
+  gen.Truncate(num_nodes);
+  EXPECT_EQ(num_nodes, gen.num_nodes());
+  EXPECT_EQ(ret, gen.MakeInstruction(BPF_RET + BPF_K, 1));
+  head = gen.MakeInstruction(BPF_LD + BPF_W + BPF_ABS, 0, jeq);
+  EXPECT_EQ(num_nodes + 1, gen.num_nodes());
+  const CodeGen::Program again = gen.Compile(head);
+  ASSERT_EQ(program.size(), again.size());
+  for (size_t i = 0; i < program.size(); ++i) {
+    EXPECT_EQ(program[i].code, again[i].code);
+    EXPECT_EQ(program[i].k, again[i].k);
+  }
+}
+
 }  // namespace
 }  // namespace sandbox
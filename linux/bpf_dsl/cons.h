@@ -69,6 +69,12 @@ List<T> Cons(const T& head, List<T> tail) {
   return std::make_shared<Cell<T>>(head, std::move(tail));
 }
 
+// Same as above, except that the new cell is allocated with |alloc|.
+template <typename Alloc, typename T>
+List<T> Cons(const Alloc& alloc, const T& head, List<T> tail) {
+  return std::allocate_shared<Cell<T>>(alloc, head, std::move(tail));
+}
+
 // Cell represents an individual "cons cell" within a cons list.
 template <typename T>
 class Cell {
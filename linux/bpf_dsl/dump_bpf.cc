@@ -58,6 +58,8 @@ const char* JmpOpToken(uint32_t code) {
       return "==";
     case BPF_JGE:
       return ">=";
+    case BPF_JGT:
+      return ">";
     default:
       return "???";
   }
@@ -95,13 +97,45 @@ void AppendInstruction(std::string* dst, size_t pc, const sock_filter& insn) {
         } else {
           base::StringAppendF(dst, "%s\n", DataOffsetName(insn.k));
         }
+      } else if (insn.code == BPF_LD + BPF_W + BPF_IMM) {
+        base::StringAppendF(dst, "A := 0x%" PRIx32 "\n", insn.k);
+      } else if (insn.code == BPF_LD + BPF_W + BPF_MEM) {
+        base::StringAppendF(dst, "A := M[%" PRIu32 "]\n", insn.k);
       } else {
         base::StringAppendF(dst, "Load ???\n");
       }
       break;
+    case BPF_LDX:
+      if (insn.code == BPF_LDX + BPF_W + BPF_IMM) {
+        base::StringAppendF(dst, "X := 0x%" PRIx32 "\n", insn.k);
+      } else if (insn.code == BPF_LDX + BPF_W + BPF_MEM) {
+        base::StringAppendF(dst, "X := M[%" PRIu32 "]\n", insn.k);
+      } else {
+        base::StringAppendF(dst, "Load ???\n");
+      }
+      break;
+    case BPF_ST:
+      base::StringAppendF(dst, "M[%" PRIu32 "] := A\n", insn.k);
+      break;
+    case BPF_STX:
+      base::StringAppendF(dst, "M[%" PRIu32 "] := X\n", insn.k);
+      break;
+    case BPF_MISC:
+      if (BPF_MISCOP(insn.code) == BPF_TAX) {
+        base::StringAppendF(dst, "X := A\n");
+      } else if (BPF_MISCOP(insn.code) == BPF_TXA) {
+        base::StringAppendF(dst, "A := X\n");
+      } else {
+        base::StringAppendF(dst, "Misc ???\n");
+      }
+      break;
     case BPF_JMP:
       if (BPF_OP(insn.code) == BPF_JA) {
         base::StringAppendF(dst, "JMP %zu\n", pc + insn.k + 1);
+      } else if (BPF_SRC(insn.code) == BPF_X) {
+        base::StringAppendF(dst, "if A %s X; then JMP %zu else JMP %zu\n",
+                            JmpOpToken(insn.code), pc + insn.jt + 1,
+                            pc + insn.jf + 1);
       } else {
         base::StringAppendF(
             dst, "if A %s 0x%" PRIx32 "; then JMP %zu else JMP %zu\n",
@@ -130,6 +164,8 @@ void AppendInstruction(std::string* dst, size_t pc, const sock_filter& insn) {
     case BPF_ALU:
       if (BPF_OP(insn.code) == BPF_NEG) {
         base::StringAppendF(dst, "A := -A\n");
+      } else if (BPF_SRC(insn.code) == BPF_X) {
+        base::StringAppendF(dst, "A := A %s X\n", AluOpToken(insn.code));
       } else {
         base::StringAppendF(dst, "A := A %s 0x%" PRIx32 "\n",
                             AluOpToken(insn.code), insn.k);
@@ -0,0 +1,101 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "base/lazy_instance.h"
+#include "base/logging.h"
+#include "base/threading/thread_local.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+// Size of the blocks that the arena carves allocations out of. Larger
+// allocations get a block of their own.
+const size_t kBlockSize = 16 * 1024;
+
+base::LazyInstance<base::ThreadLocalPointer<ExprArena>>::Leaky g_current_arena =
+    LAZY_INSTANCE_INITIALIZER;
+
+}  // namespace
+
+ExprArena::Scope::Scope(ExprArena* arena)
+    : outer_(g_current_arena.Get().Get()) {
+  g_current_arena.Get().Set(arena);
+}
+
+ExprArena::Scope::~Scope() {
+  g_current_arena.Get().Set(outer_);
+}
+
+ExprArena::ExprArena()
+    : blocks_(),
+      next_(nullptr),
+      remaining_(0),
+      bytes_reserved_(0),
+      live_allocations_(0),
+      num_allocations_(0),
+      results_(),
+      bools_() {
+}
+
+ExprArena::~ExprArena() {
+  CHECK_NE(this, Current()) << "ExprArena destroyed while in use";
+
+  // The intern tables' weak references keep allocations alive too, so
+  // drop them before checking that everything has been released.
+  results_.Clear();
+  bools_.Clear();
+  CHECK_EQ(0U, live_allocations_)
+      << "bpf_dsl expressions outlived their ExprArena";
+}
+
+// static
+ExprArena* ExprArena::Current() {
+  return g_current_arena.Get().Get();
+}
+
+void* ExprArena::Allocate(size_t size, size_t align) {
+  DCHECK_LE(align, alignof(max_align_t));
+  ++live_allocations_;
+  ++num_allocations_;
+
+  if (size > kBlockSize / 4) {
+    // Give large allocations their own block, rather than wasting the
+    // rest of the current one.
+    blocks_.emplace_back(new char[size]);
+    bytes_reserved_ += size;
+    return blocks_.back().get();
+  }
+
+  size_t padding = (align - reinterpret_cast<uintptr_t>(next_) % align) % align;
+  if (padding + size > remaining_) {
+    // Fresh blocks are suitably aligned for anything.
+    blocks_.emplace_back(new char[kBlockSize]);
+    bytes_reserved_ += kBlockSize;
+    next_ = blocks_.back().get();
+    remaining_ = kBlockSize;
+    padding = 0;
+  }
+
+  void* ptr = next_ + padding;
+  next_ += padding + size;
+  remaining_ -= padding + size;
+  return ptr;
+}
+
+void ExprArena::Deallocate(void* ptr) {
+  DCHECK_GT(live_allocations_, 0U);
+  --live_allocations_;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,134 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_EXPR_ARENA_H_
+#define SANDBOX_LINUX_BPF_DSL_EXPR_ARENA_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "sandbox/linux/bpf_dsl/intern_table.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// ExprArena is a bump allocator for bpf_dsl expressions. While an
+// ExprArena::Scope is active on a thread, the expressions built on that
+// thread (including the clauses of pending If and Switch statements) are
+// allocated in the arena, and interned separately from expressions built
+// elsewhere. The arena's memory is released all at once when it's
+// destroyed.
+//
+// This is meant for building a policy's expressions just for the
+// purpose of compiling it:
+//
+//   ExprArena arena;
+//   {
+//     ExprArena::Scope scope(&arena);
+//     PolicyCompiler compiler(policy, registry);
+//     program = compiler.Compile();
+//   }
+//
+// All expressions allocated in an arena must be destroyed before the
+// arena itself, which CHECKs that this is the case; so policies that
+// keep the expressions they return beyond the call mustn't be compiled
+// in an arena. An arena must only be used by one thread at a time.
+class SANDBOX_EXPORT ExprArena {
+ public:
+  // Scope makes |arena| the current thread's arena for its lifetime.
+  class SANDBOX_EXPORT Scope {
+   public:
+    explicit Scope(ExprArena* arena);
+    ~Scope();
+
+   private:
+    ExprArena* outer_;
+
+    DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+
+  // Allocator is a standard allocator that allocates in an ExprArena.
+  template <typename T>
+  class Allocator {
+   public:
+    using value_type = T;
+
+    explicit Allocator(ExprArena* arena) : arena_(arena) {}
+    template <typename U>
+    Allocator(const Allocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+      return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* ptr, size_t n) { arena_->Deallocate(ptr); }
+
+    ExprArena* arena() const { return arena_; }
+
+   private:
+    ExprArena* arena_;
+  };
+
+  ExprArena();
+  ~ExprArena();
+
+  // Current returns the current thread's arena, or nullptr if none.
+  static ExprArena* Current();
+
+  // Allocate returns |size| bytes of memory aligned to |align|, which
+  // must be at most alignof(max_align_t). The memory remains valid until
+  // the arena is destroyed.
+  void* Allocate(size_t size, size_t align);
+
+  // Deallocate releases memory returned by Allocate. The memory isn't
+  // reused; this just keeps track of the number of live allocations.
+  void Deallocate(void* ptr);
+
+  // Returns the total number of bytes reserved for allocations.
+  size_t bytes_reserved() const { return bytes_reserved_; }
+
+  // Returns the total number of allocations made in the arena.
+  size_t num_allocations() const { return num_allocations_; }
+
+  // Functions below are meant for use within bpf_dsl itself.
+
+  // Tables that expressions allocated in the arena are interned in.
+  internal::InternTable<internal::ResultExprImpl>* results() {
+    return &results_;
+  }
+  internal::InternTable<internal::BoolExprImpl>* bools() { return &bools_; }
+
+ private:
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* next_;
+  size_t remaining_;
+  size_t bytes_reserved_;
+  size_t live_allocations_;
+  size_t num_allocations_;
+  internal::InternTable<internal::ResultExprImpl> results_;
+  internal::InternTable<internal::BoolExprImpl> bools_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExprArena);
+};
+
+template <typename T, typename U>
+bool operator==(const ExprArena::Allocator<T>& lhs,
+                const ExprArena::Allocator<U>& rhs) {
+  return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ExprArena::Allocator<T>& lhs,
+                const ExprArena::Allocator<U>& rhs) {
+  return !(lhs == rhs);
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_EXPR_ARENA_H_
@@ -0,0 +1,136 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+class ArgPolicy : public Policy {
+ public:
+  ArgPolicy() {}
+  ~ArgPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> arg(0);
+    if (sysno == __NR_fcntl) {
+      return Switch(arg)
+          .CASES((1, 2, 3), Allow())
+          .CASES((4, 5), Error(EPERM))
+          .Default(Error(EINVAL));
+    }
+    if (sysno == __NR_ioctl) {
+      return If(AnyOf(arg == 1, arg == 3), Allow())
+          .ElseIf(arg.InRange(10, 20), Error(EACCES))
+          .Else(Error(EPERM));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ArgPolicy);
+};
+
+TEST(ExprArena, Scope) {
+  EXPECT_EQ(nullptr, ExprArena::Current());
+  ExprArena outer;
+  {
+    ExprArena::Scope outer_scope(&outer);
+    EXPECT_EQ(&outer, ExprArena::Current());
+    ExprArena inner;
+    {
+      ExprArena::Scope inner_scope(&inner);
+      EXPECT_EQ(&inner, ExprArena::Current());
+    }
+    EXPECT_EQ(&outer, ExprArena::Current());
+  }
+  EXPECT_EQ(nullptr, ExprArena::Current());
+}
+
+TEST(ExprArena, Allocate) {
+  ExprArena arena;
+  EXPECT_EQ(0U, arena.bytes_reserved());
+  EXPECT_EQ(0U, arena.num_allocations());
+
+  void* a = arena.Allocate(1, 1);
+  void* b = arena.Allocate(8, 8);
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(b) % 8);
+  EXPECT_LT(a, b);
+  const size_t reserved = arena.bytes_reserved();
+  EXPECT_LT(0U, reserved);
+
+  // Small allocations share a block; large ones get their own.
+  void* c = arena.Allocate(64, 8);
+  EXPECT_EQ(reserved, arena.bytes_reserved());
+  void* d = arena.Allocate(1 << 20, 8);
+  EXPECT_EQ(reserved + (1 << 20), arena.bytes_reserved());
+  EXPECT_EQ(4U, arena.num_allocations());
+
+  // Everything must be deallocated before the arena is destroyed.
+  for (void* ptr : {a, b, c, d}) {
+    arena.Deallocate(ptr);
+  }
+}
+
+TEST(ExprArena, Expressions) {
+  const ResultExpr heap_allow = Allow();
+
+  ExprArena arena;
+  {
+    ExprArena::Scope scope(&arena);
+    const ResultExpr allow = Allow();
+    EXPECT_LT(0U, arena.bytes_reserved());
+
+    // Expressions are interned separately within the arena.
+    EXPECT_EQ(allow, Allow());
+    EXPECT_NE(heap_allow, allow);
+
+    // Expressions built outside the arena may be used in it.
+    const Arg<int> arg(0);
+    const BoolExpr cond = arg == 0;
+    EXPECT_EQ(heap_allow, If(cond, heap_allow).Else(heap_allow));
+  }
+}
+
+TEST(ExprArena, Compile) {
+  ArgPolicy policy;
+
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+  const CodeGen::Program expected = compiler.Compile();
+
+  ExprArena arena;
+  CodeGen::Program program;
+  {
+    ExprArena::Scope scope(&arena);
+    TestTrapRegistry arena_registry;
+    PolicyCompiler arena_compiler(&policy, &arena_registry);
+    program = arena_compiler.Compile();
+  }
+  EXPECT_LT(0U, arena.bytes_reserved());
+
+  ExpectSamePrograms(expected, program);
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
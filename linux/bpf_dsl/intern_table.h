@@ -0,0 +1,142 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_INTERN_TABLE_H_
+#define SANDBOX_LINUX_BPF_DSL_INTERN_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace internal {
+
+// NodeKey describes an expression node by its kind, its parameters and
+// the identities of its operands. Operands are interned themselves, so
+// structurally identical expressions have identical keys.
+class NodeKey {
+ public:
+  explicit NodeKey(char kind) : key_(1, kind) {}
+  ~NodeKey() {}
+
+  NodeKey& Add(uint64_t value) {
+    key_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    return *this;
+  }
+  NodeKey& Add(const void* ptr) {
+    return Add(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)));
+  }
+  NodeKey& Add(TrapRegistry::TrapFnc fnc) {
+    return Add(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(fnc)));
+  }
+  NodeKey& Add(const BoolExpr& cond) { return Add(cond.get()); }
+  NodeKey& Add(const ResultExpr& res) { return Add(res.get()); }
+
+  const std::string& str() const { return key_; }
+
+ private:
+  std::string key_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeKey);
+};
+
+// InternTable hash-conses expression nodes of type |Base|, so that a
+// policy's expressions form a DAG and PolicyCompiler can memoize their
+// compilation. The table only holds weak references; entries for nodes
+// that have been destroyed are swept out as the table grows. Nodes are
+// allocated separately from their shared_ptr control blocks, which the
+// weak references keep alive, so that a node's memory is released as
+// soon as it's destroyed.
+template <typename Base>
+class InternTable {
+ public:
+  InternTable() : lock_(), nodes_(), sweep_threshold_(kMinSweepThreshold) {}
+  ~InternTable() {}
+
+  // Get returns the node for |key|, constructing a new T from |args|
+  // with |alloc|, a standard allocator for T, if there is none yet.
+  template <typename T, typename Alloc, typename... Args>
+  std::shared_ptr<const Base> Get(const NodeKey& key,
+                                  const Alloc& alloc,
+                                  Args&&... args) {
+    base::AutoLock lock(lock_);
+    std::weak_ptr<const Base>& entry = nodes_[key.str()];
+    std::shared_ptr<const Base> node = entry.lock();
+    if (!node) {
+      Alloc node_alloc(alloc);
+      T* ptr = node_alloc.allocate(1);
+      new (ptr) T(std::forward<Args>(args)...);
+      node = std::shared_ptr<const Base>(ptr, Deleter<T, Alloc>(alloc), alloc);
+      entry = node;
+      MaybeSweep();
+    }
+    return node;
+  }
+
+  // Clear forgets about all nodes.
+  void Clear() {
+    base::AutoLock lock(lock_);
+    nodes_.clear();
+    sweep_threshold_ = kMinSweepThreshold;
+  }
+
+ private:
+  static const size_t kMinSweepThreshold = 1024;
+
+  // Deleter destroys nodes and returns their memory to an |Alloc|.
+  template <typename T, typename Alloc>
+  class Deleter {
+   public:
+    explicit Deleter(const Alloc& alloc) : alloc_(alloc) {}
+
+    void operator()(T* node) {
+      node->~T();
+      alloc_.deallocate(node, 1);
+    }
+
+   private:
+    Alloc alloc_;
+  };
+
+  void MaybeSweep() {
+    if (nodes_.size() < sweep_threshold_) {
+      return;
+    }
+    for (auto it = nodes_.begin(); it != nodes_.end();) {
+      if (it->second.expired()) {
+        it = nodes_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    sweep_threshold_ = std::max(kMinSweepThreshold, 2 * nodes_.size());
+  }
+
+  base::Lock lock_;
+  std::unordered_map<std::string, std::weak_ptr<const Base>> nodes_;
+  size_t sweep_threshold_;
+
+  DISALLOW_COPY_AND_ASSIGN(InternTable);
+};
+
+template <typename Base>
+const size_t InternTable<Base>::kMinSweepThreshold;
+
+}  // namespace internal
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_INTERN_TABLE_H_
@@ -0,0 +1,549 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/jit.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <initializer_list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "build/build_config.h"
+#include "sandbox/linux/bpf_dsl/batch_evaluator.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+#if defined(ARCH_CPU_X86_64) && !defined(OS_NACL_NONSFI) && \
+    !defined(MEMORY_SANITIZER)
+#define SANDBOX_BPF_DSL_JIT 1
+#endif
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+#if defined(SANDBOX_BPF_DSL_JIT)
+
+using internal::BatchInsn;
+
+// Validity bits of the machine state. Like EvaluateBPF, the generated
+// code fails if a program reads a register or scratch memory word that
+// it hasn't written yet. Bit k stands for scratch memory word k.
+const uint32_t kAccValid = 1U << BPF_MEMWORDS;
+const uint32_t kIndexValid = 1U << (BPF_MEMWORDS + 1);
+const uint32_t kAllValid = (1U << (BPF_MEMWORDS + 2)) - 1;
+
+// Code offset of labels that haven't been bound yet.
+const size_t kUnbound = static_cast<size_t>(-1);
+
+// Condition codes of x86 conditional jumps.
+enum Cond : uint8_t {
+  kBelow = 0x2,
+  kAboveOrEqual = 0x3,
+  kEqual = 0x4,
+  kNotEqual = 0x5,
+  kBelowOrEqual = 0x6,
+  kAbove = 0x7,
+};
+
+// NativeCompiler translates a BPF program into x86-64 code for a
+// function with the signature of JitProgram::NativeFn, following the
+// System V calling convention: |data| is in rdi and |err| in rsi.
+//
+// The accumulator lives in eax and the index register in ecx, which
+// suits division and shifts. Scratch memory lives in the red zone below
+// the stack pointer, as the function never calls anything. r9d holds
+// the validity bits, but only if the program reads any register or
+// scratch memory word that it might not have written: programs from
+// PolicyCompiler never do.
+//
+// Every instruction is checked as in EvaluateBPF, but the checks that
+// don't depend on the data are made while compiling, so a statically
+// invalid instruction compiles into a jump to an error stub.
+class NativeCompiler {
+ public:
+  explicit NativeCompiler(const CodeGen::Program& program)
+      : program_(program),
+        labels_(program.size() + 1, kUnbound),
+        fixups_(),
+        error_labels_(),
+        must_be_valid_(program.size() + 1, kAllValid),
+        track_validity_(false),
+        code_() {}
+
+  std::vector<uint8_t> Compile() {
+    // mov qword ptr [rsi], 0; xor eax, eax; xor ecx, ecx; xor r9d, r9d
+    Emit({0x48, 0xc7, 0x06, 0x00, 0x00, 0x00, 0x00});
+    Emit({0x31, 0xc0, 0x31, 0xc9, 0x45, 0x31, 0xc9});
+
+    if (program_.size() < 1 || program_.size() >= SECCOMP_MAX_PROGRAM_SIZE) {
+      Jump(ErrorLabel("Invalid program length"));
+    } else {
+      std::vector<BatchInsn> decoded;
+      for (unsigned int pc = 0; pc < program_.size(); ++pc) {
+        decoded.push_back(internal::DecodeBatchInsn(program_, pc));
+      }
+      AnalyzeValidity(decoded);
+      for (unsigned int pc = 0; pc < decoded.size(); ++pc) {
+        Bind(pc);
+        CompileInsn(pc, decoded[pc]);
+      }
+    }
+
+    // Programs that fall off their end fail.
+    Bind(program_.size());
+    Jump(ErrorLabel("Invalid instruction pointer in BPF program"));
+
+    for (const auto& error : error_labels_) {
+      // mov rax, imm64; mov [rsi], rax; xor eax, eax; ret
+      Bind(error.second);
+      Emit({0x48, 0xb8});
+      Emit64(reinterpret_cast<uintptr_t>(error.first));
+      Emit({0x48, 0x89, 0x06, 0x31, 0xc0, 0xc3});
+    }
+
+    for (const auto& fixup : fixups_) {
+      const size_t target = labels_[fixup.second];
+      DCHECK_NE(kUnbound, target);
+      const uint32_t rel = target - (fixup.first + 4);
+      memcpy(&code_[fixup.first], &rel, sizeof(rel));
+    }
+    return code_;
+  }
+
+ private:
+  // Computes the validity bits that are set on every path to each
+  // instruction. Since BPF only jumps forward, one pass in program order
+  // sees all of an instruction's predecessors before it.
+  void AnalyzeValidity(const std::vector<BatchInsn>& decoded) {
+    must_be_valid_[0] = 0;
+    for (unsigned int pc = 0; pc < decoded.size(); ++pc) {
+      const BatchInsn& insn = decoded[pc];
+      if (Uses(insn) & ~must_be_valid_[pc]) {
+        track_validity_ = true;
+      }
+      const uint32_t valid = must_be_valid_[pc] | Defines(insn);
+      switch (insn.kind) {
+        case BatchInsn::FAIL:
+        case BatchInsn::RET:
+          break;
+        case BatchInsn::JA:
+          must_be_valid_[insn.jt] &= valid;
+          break;
+        case BatchInsn::JMP:
+          must_be_valid_[insn.jt] &= valid;
+          must_be_valid_[insn.jf] &= valid;
+          break;
+        default:
+          must_be_valid_[pc + 1] &= valid;
+          break;
+      }
+    }
+  }
+
+  // Returns the validity bits that |insn| checks.
+  static uint32_t Uses(const BatchInsn& insn) {
+    switch (insn.kind) {
+      case BatchInsn::LD_MEM:
+      case BatchInsn::LDX_MEM:
+        return 1U << insn.k;
+      case BatchInsn::ST:
+      case BatchInsn::TAX:
+        return kAccValid;
+      case BatchInsn::STX:
+      case BatchInsn::TXA:
+        return kIndexValid;
+      case BatchInsn::JMP:
+        return kAccValid | (insn.x ? kIndexValid : 0);
+      case BatchInsn::ALU:
+        return insn.x ? kIndexValid : 0;
+      default:
+        return 0;
+    }
+  }
+
+  // Returns the validity bits that |insn| sets.
+  static uint32_t Defines(const BatchInsn& insn) {
+    switch (insn.kind) {
+      case BatchInsn::LD_ABS:
+      case BatchInsn::LD_IMM:
+      case BatchInsn::LD_MEM:
+      case BatchInsn::TXA:
+        return kAccValid;
+      case BatchInsn::LDX_IMM:
+      case BatchInsn::LDX_MEM:
+      case BatchInsn::TAX:
+        return kIndexValid;
+      case BatchInsn::ST:
+      case BatchInsn::STX:
+        return 1U << insn.k;
+      default:
+        return 0;
+    }
+  }
+
+  void CompileInsn(unsigned int pc, const BatchInsn& insn) {
+    Check(pc, insn);
+    if (track_validity_ && Defines(insn)) {
+      // or r9d, imm32
+      Emit({0x41, 0x81, 0xc9});
+      Emit32(Defines(insn));
+    }
+    switch (insn.kind) {
+      case BatchInsn::FAIL:
+        Jump(ErrorLabel(insn.err));
+        break;
+      case BatchInsn::RET:
+        // mov eax, imm32; ret
+        Emit({0xb8});
+        Emit32(insn.k);
+        Emit({0xc3});
+        break;
+      case BatchInsn::LD_ABS:
+        // mov eax, [rdi + disp8]
+        Emit({0x8b, 0x47, static_cast<uint8_t>(insn.k)});
+        break;
+      case BatchInsn::LD_IMM:
+        // mov eax, imm32
+        Emit({0xb8});
+        Emit32(insn.k);
+        break;
+      case BatchInsn::LD_MEM:
+        // mov eax, [rsp + disp8]
+        Emit({0x8b, 0x44, 0x24, ScratchDisp(insn.k)});
+        break;
+      case BatchInsn::LDX_IMM:
+        // mov ecx, imm32
+        Emit({0xb9});
+        Emit32(insn.k);
+        break;
+      case BatchInsn::LDX_MEM:
+        // mov ecx, [rsp + disp8]
+        Emit({0x8b, 0x4c, 0x24, ScratchDisp(insn.k)});
+        break;
+      case BatchInsn::ST:
+        // mov [rsp + disp8], eax
+        Emit({0x89, 0x44, 0x24, ScratchDisp(insn.k)});
+        break;
+      case BatchInsn::STX:
+        // mov [rsp + disp8], ecx
+        Emit({0x89, 0x4c, 0x24, ScratchDisp(insn.k)});
+        break;
+      case BatchInsn::TAX:
+        // mov ecx, eax
+        Emit({0x89, 0xc1});
+        break;
+      case BatchInsn::TXA:
+        // mov eax, ecx
+        Emit({0x89, 0xc8});
+        break;
+      case BatchInsn::JA:
+        JumpToInsn(pc, insn.jt);
+        break;
+      case BatchInsn::JMP:
+        CompileJmp(pc, insn);
+        break;
+      case BatchInsn::NEG:
+        // neg eax
+        Emit({0xf7, 0xd8});
+        break;
+      case BatchInsn::ALU:
+        CompileAlu(insn);
+        break;
+    }
+  }
+
+  // Emits the checks of the validity bits that |insn| uses, where they
+  // might not be set, in the same order as EvaluateBPF.
+  void Check(unsigned int pc, const BatchInsn& insn) {
+    const char* err = nullptr;
+    switch (insn.kind) {
+      case BatchInsn::LD_MEM:
+        err = "Invalid operand in BPF_LD instruction";
+        break;
+      case BatchInsn::LDX_MEM:
+        err = "Invalid BPF_LDX instruction";
+        break;
+      case BatchInsn::ST:
+        err = "Invalid BPF_ST instruction";
+        break;
+      case BatchInsn::STX:
+        err = "Invalid BPF_STX instruction";
+        break;
+      case BatchInsn::TAX:
+      case BatchInsn::TXA:
+        err = "Invalid BPF_MISC instruction";
+        break;
+      case BatchInsn::JMP:
+        err = "Invalid BPF_JMP instruction";
+        break;
+      case BatchInsn::ALU:
+        err = "Unexpected source operand in arithmetic operation";
+        break;
+      default:
+        return;
+    }
+    const uint32_t unknown = Uses(insn) & ~must_be_valid_[pc];
+    for (uint32_t bit = 1; bit && bit <= unknown; bit <<= 1) {
+      if (unknown & bit) {
+        // test r9d, imm32; jz err
+        Emit({0x41, 0xf7, 0xc1});
+        Emit32(bit);
+        Jump(ErrorLabel(err), kEqual);
+      }
+    }
+  }
+
+  void CompileJmp(unsigned int pc, const BatchInsn& insn) {
+    if (insn.jt == insn.jf) {
+      JumpToInsn(pc, insn.jt);
+      return;
+    }
+    Cond cond;
+    Cond inverse;
+    if (insn.op == BPF_JSET) {
+      // test eax, ecx / test eax, imm32
+      if (insn.x) {
+        Emit({0x85, 0xc8});
+      } else {
+        Emit({0xa9});
+        Emit32(insn.k);
+      }
+      cond = kNotEqual;
+      inverse = kEqual;
+    } else {
+      // cmp eax, ecx / cmp eax, imm32
+      if (insn.x) {
+        Emit({0x39, 0xc8});
+      } else {
+        Emit({0x3d});
+        Emit32(insn.k);
+      }
+      switch (insn.op) {
+        case BPF_JEQ:
+          cond = kEqual;
+          inverse = kNotEqual;
+          break;
+        case BPF_JGT:
+          cond = kAbove;
+          inverse = kBelowOrEqual;
+          break;
+        default:
+          DCHECK_EQ(BPF_JGE, insn.op);
+          cond = kAboveOrEqual;
+          inverse = kBelow;
+          break;
+      }
+    }
+    if (insn.jt == pc + 1) {
+      Jump(insn.jf, inverse);
+    } else {
+      Jump(insn.jt, cond);
+      JumpToInsn(pc, insn.jf);
+    }
+  }
+
+  void CompileAlu(const BatchInsn& insn) {
+    switch (insn.op) {
+      case BPF_ADD:
+        AluOp(0x01, 0x05, insn);
+        break;
+      case BPF_SUB:
+        AluOp(0x29, 0x2d, insn);
+        break;
+      case BPF_OR:
+        AluOp(0x09, 0x0d, insn);
+        break;
+      case BPF_XOR:
+        AluOp(0x31, 0x35, insn);
+        break;
+      case BPF_AND:
+        AluOp(0x21, 0x25, insn);
+        break;
+      case BPF_MUL:
+        if (insn.x) {
+          // imul eax, ecx
+          Emit({0x0f, 0xaf, 0xc1});
+        } else {
+          // imul eax, eax, imm32
+          Emit({0x69, 0xc0});
+          Emit32(insn.k);
+        }
+        break;
+      case BPF_DIV:
+      case BPF_MOD:
+        if (insn.x) {
+          // test ecx, ecx; jz err; xor edx, edx; div ecx
+          Emit({0x85, 0xc9});
+          Jump(ErrorLabel("Illegal division by zero"), kEqual);
+          Emit({0x31, 0xd2, 0xf7, 0xf1});
+        } else if (!insn.k) {
+          Jump(ErrorLabel("Illegal division by zero"));
+          break;
+        } else {
+          // mov r8d, imm32; xor edx, edx; div r8d
+          Emit({0x41, 0xb8});
+          Emit32(insn.k);
+          Emit({0x31, 0xd2, 0x41, 0xf7, 0xf0});
+        }
+        if (insn.op == BPF_MOD) {
+          // mov eax, edx
+          Emit({0x89, 0xd0});
+        }
+        break;
+      case BPF_LSH:
+      case BPF_RSH: {
+        // Like the interpreter, reject shifts by 32 or more, which the
+        // kernel doesn't accept either, so that x86 only using the low 5
+        // bits of shift counts doesn't matter.
+        const uint8_t reg = insn.op == BPF_LSH ? 0xe0 : 0xe8;
+        if (insn.x) {
+          // cmp ecx, 31; ja err; shl/shr eax, cl
+          Emit({0x83, 0xf9, 0x1f});
+          Jump(ErrorLabel("Illegal shift operation"), kAbove);
+          Emit({0xd3, reg});
+        } else if (insn.k >= 32) {
+          Jump(ErrorLabel("Illegal shift operation"));
+        } else {
+          // shl/shr eax, imm8
+          Emit({0xc1, reg, static_cast<uint8_t>(insn.k)});
+        }
+        break;
+      }
+      default:
+        Jump(ErrorLabel("Invalid operator in arithmetic operation"));
+        break;
+    }
+  }
+
+  // Emits "op eax, ecx" or "op eax, imm32".
+  void AluOp(uint8_t reg_opcode, uint8_t imm_opcode, const BatchInsn& insn) {
+    if (insn.x) {
+      Emit({reg_opcode, 0xc8});
+    } else {
+      Emit({imm_opcode});
+      Emit32(insn.k);
+    }
+  }
+
+  // Returns the displacement from rsp of scratch memory word |k|.
+  static uint8_t ScratchDisp(uint32_t k) {
+    return static_cast<uint8_t>(-4 * BPF_MEMWORDS + 4 * k);
+  }
+
+  size_t ErrorLabel(const char* err) {
+    auto it = error_labels_.find(err);
+    if (it == error_labels_.end()) {
+      labels_.push_back(kUnbound);
+      it = error_labels_.insert(std::make_pair(err, labels_.size() - 1)).first;
+    }
+    return it->second;
+  }
+
+  // Jumps to instruction |target| from the end of instruction |pc|,
+  // unless it's the next one.
+  void JumpToInsn(unsigned int pc, unsigned int target) {
+    if (target != pc + 1) {
+      Jump(target);
+    }
+  }
+
+  // Emits a jump to |label| that's taken if |cond| holds, or always if
+  // |cond| is zero.
+  void Jump(size_t label, uint8_t cond = 0) {
+    if (cond) {
+      Emit({0x0f, static_cast<uint8_t>(0x80 + cond)});
+    } else {
+      Emit({0xe9});
+    }
+    fixups_.push_back(std::make_pair(code_.size(), label));
+    Emit32(0);
+  }
+
+  void Bind(size_t label) { labels_[label] = code_.size(); }
+
+  void Emit(std::initializer_list<uint8_t> bytes) {
+    code_.insert(code_.end(), bytes.begin(), bytes.end());
+  }
+
+  void Emit32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code_.push_back(value >> (8 * i));
+    }
+  }
+
+  void Emit64(uint64_t value) {
+    Emit32(value);
+    Emit32(value >> 32);
+  }
+
+  const CodeGen::Program& program_;
+
+  // Code offsets of the instructions, the end of the program, and the
+  // error stubs, in that order.
+  std::vector<size_t> labels_;
+
+  // Offsets of the rel32 operands of jumps, and the labels they jump to.
+  std::vector<std::pair<size_t, size_t>> fixups_;
+
+  std::map<const char*, size_t> error_labels_;
+  std::vector<uint32_t> must_be_valid_;
+  bool track_validity_;
+  std::vector<uint8_t> code_;
+
+  DISALLOW_COPY_AND_ASSIGN(NativeCompiler);
+};
+
+#endif  // defined(SANDBOX_BPF_DSL_JIT)
+
+}  // namespace
+
+JitProgram::JitProgram(const CodeGen::Program& program)
+    : program_(program), code_(nullptr), code_size_(0), fn_(nullptr) {
+#if defined(SANDBOX_BPF_DSL_JIT)
+  const std::vector<uint8_t> code = NativeCompiler(program).Compile();
+  void* const mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return;
+  }
+  memcpy(mem, code.data(), code.size());
+  // Processes that may not map executable memory keep using the
+  // interpreter.
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    PCHECK(munmap(mem, code.size()) == 0);
+    return;
+  }
+  code_ = mem;
+  code_size_ = code.size();
+  fn_ = reinterpret_cast<NativeFn>(mem);
+#endif
+}
+
+JitProgram::~JitProgram() {
+  if (code_) {
+    PCHECK(munmap(code_, code_size_) == 0);
+  }
+}
+
+uint32_t JitProgram::Evaluate(const struct arch_seccomp_data& data,
+                              const char** err) const {
+  if (fn_) {
+    return fn_(&data, err);
+  }
+  return Verifier::EvaluateBPF(program_, data, err);
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
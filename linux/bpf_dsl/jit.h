@@ -0,0 +1,57 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_JIT_H_
+#define SANDBOX_LINUX_BPF_DSL_JIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+
+namespace sandbox {
+struct arch_seccomp_data;
+
+namespace bpf_dsl {
+
+// JitProgram compiles a BPF program into native code, for tools and
+// tests that evaluate the same program against very many system calls
+// on the host (it has nothing to do with installing the program). It
+// gives the same results and error strings as Verifier::EvaluateBPF,
+// including for invalid programs, but each evaluation costs a few
+// nanoseconds instead of a walk through the interpreter.
+//
+// Native code is only generated on x86-64, only if the process may map
+// executable memory, and not under MemorySanitizer, which can't see the
+// generated code's loads and stores. Otherwise, Evaluate() falls back to
+// Verifier::EvaluateBPF, so callers needn't care.
+class JitProgram {
+ public:
+  explicit JitProgram(const CodeGen::Program& program);
+  ~JitProgram();
+
+  // Evaluate runs the program for |data| like Verifier::EvaluateBPF.
+  uint32_t Evaluate(const struct arch_seccomp_data& data,
+                    const char** err) const;
+
+  // is_native returns whether Evaluate() runs native code.
+  bool is_native() const { return fn_ != nullptr; }
+
+ private:
+  using NativeFn = uint32_t (*)(const struct arch_seccomp_data* data,
+                                const char** err);
+
+  const CodeGen::Program program_;
+  void* code_;
+  size_t code_size_;
+  NativeFn fn_;
+
+  DISALLOW_COPY_AND_ASSIGN(JitProgram);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_JIT_H_
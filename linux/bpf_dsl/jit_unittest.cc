@@ -0,0 +1,162 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/jit.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "build/build_config.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/random_program_generator.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Checks that JitProgram agrees with Verifier::EvaluateBPF on |program|
+// for each system call in |data|.
+void ExpectMatches(const CodeGen::Program& program,
+                   const std::vector<struct arch_seccomp_data>& data) {
+  const JitProgram jit(program);
+  for (size_t i = 0; i < data.size(); ++i) {
+    const char* expected_err = nullptr;
+    const uint32_t expected =
+        Verifier::EvaluateBPF(program, data[i], &expected_err);
+    const char* err = nullptr;
+    EXPECT_EQ(expected, jit.Evaluate(data[i], &err)) << "system call " << i;
+    if (expected_err && err) {
+      EXPECT_STREQ(expected_err, err) << "system call " << i;
+    } else {
+      EXPECT_EQ(!!expected_err, !!err) << "system call " << i;
+    }
+  }
+}
+
+// JitTestPolicy uses every kind of argument test that PolicyCompiler
+// generates code for.
+class JitTestPolicy : public Policy {
+ public:
+  JitTestPolicy() {}
+  ~JitTestPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> fd(0);
+    const Arg<int> flags(1);
+    switch (sysno % 4) {
+      case 0:
+        return Allow();
+      case 1:
+        return If(AnyOf(fd == sysno % 8, fd == -1), Allow()).Else(Error(EPERM));
+      case 2:
+        return If((flags & 0xff00) == 0x100, Error(EACCES))
+            .ElseIf((flags & 0x3) != 0, Allow())
+            .Else(Kill());
+      default:
+        return Switch(fd).CASES((1, 2, 3, 5), Allow()).Default(Error(EBADF));
+    }
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(JitTestPolicy);
+};
+
+TEST(JitProgram, Native) {
+#if defined(ARCH_CPU_X86_64) && !defined(MEMORY_SANITIZER)
+  EXPECT_TRUE(JitProgram({Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW)})
+                  .is_native());
+#else
+  EXPECT_FALSE(JitProgram({Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW)})
+                   .is_native());
+#endif
+}
+
+TEST(JitProgram, Policy) {
+  JitTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  const uint64_t kArgs[] = {0,     1,          2,          3,
+                            5,     0x100,      0x103,      0xffffffff,
+                            0x100000000ULL,    0xffffffffffffffffULL};
+  std::vector<struct arch_seccomp_data> data;
+  for (uint32_t nr : SyscallSet::All()) {
+    data.push_back(FakeSyscall(nr, nr % 8, 0));
+    for (uint64_t arg : kArgs) {
+      // Set the arguments directly, as uintptr_t might not hold them.
+      struct arch_seccomp_data d = FakeSyscall(nr);
+      d.args[0] = arg;
+      d.args[1] = arg;
+      data.push_back(d);
+    }
+  }
+  struct arch_seccomp_data other_arch = FakeSyscall(0, 0, 0);
+  other_arch.arch = ~SECCOMP_ARCH;
+  data.push_back(other_arch);
+  ExpectMatches(program, data);
+}
+
+TEST(JitProgram, DynamicErrors) {
+  // Whether these programs fail depends on the system call: they divide
+  // by arg0, shift by it, or read scratch memory that they only wrote if
+  // arg0 is 1.
+  const std::vector<struct arch_seccomp_data> data = {
+      FakeSyscall(0, 0, 0), FakeSyscall(0, 1, 0), FakeSyscall(0, 31, 0),
+      FakeSyscall(0, 32, 0), FakeSyscall(0, 33, 0)};
+  for (uint16_t op : {BPF_DIV, BPF_MOD, BPF_LSH, BPF_RSH}) {
+    ExpectMatches(
+        {
+            Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+            Insn(BPF_MISC + BPF_TAX, 0),
+            Insn(BPF_LD + BPF_W + BPF_IMM, 0x12345678),
+            Insn(BPF_ALU + op + BPF_X, 0),
+            Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO + 1),
+        },
+        data);
+  }
+  ExpectMatches(
+      {
+          Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+          Insn(BPF_JMP + BPF_JEQ + BPF_K, 1, 0, 1),
+          Insn(BPF_ST, 7),
+          Insn(BPF_LDX + BPF_W + BPF_MEM, 7),
+          Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+      },
+      data);
+}
+
+TEST(JitProgram, InvalidLength) {
+  ExpectMatches(CodeGen::Program(), {FakeSyscall(0, 0, 0)});
+}
+
+TEST(JitProgram, RandomPrograms) {
+  RandomProgramGenerator generator(2);
+  std::vector<struct arch_seccomp_data> data;
+  for (int i = 0; i < 61; ++i) {
+    data.push_back(generator.Syscall());
+  }
+  for (int i = 0; i < 5000; ++i) {
+    ExpectMatches(generator.Program(), data);
+  }
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
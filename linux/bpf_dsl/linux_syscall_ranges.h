@@ -11,6 +11,11 @@
 #define MAX_PUBLIC_SYSCALL  1024u
 #define MAX_SYSCALL         MAX_PUBLIC_SYSCALL
 
+// The i386 compatibility ABI (SECCOMP_COMPAT_ARCH).
+#define MIN_COMPAT_SYSCALL         0u
+#define MAX_PUBLIC_COMPAT_SYSCALL  1024u
+#define MAX_COMPAT_SYSCALL         MAX_PUBLIC_COMPAT_SYSCALL
+
 #elif defined(__i386__)
 
 #define MIN_SYSCALL         0u
@@ -50,6 +55,15 @@
 #define MAX_PUBLIC_SYSCALL 279u
 #define MAX_SYSCALL MAX_PUBLIC_SYSCALL
 
+// The ARM EABI compatibility ABI (SECCOMP_COMPAT_ARCH), which has the
+// same private and ghost system calls as on ARM itself.
+#define MIN_COMPAT_SYSCALL 0u
+#define MAX_PUBLIC_COMPAT_SYSCALL (MIN_COMPAT_SYSCALL + 1024u)
+#define MIN_PRIVATE_COMPAT_SYSCALL 0xf0000u
+#define MAX_PRIVATE_COMPAT_SYSCALL (MIN_PRIVATE_COMPAT_SYSCALL + 16u)
+#define MIN_GHOST_COMPAT_SYSCALL (MIN_PRIVATE_COMPAT_SYSCALL + 0xfff0u)
+#define MAX_COMPAT_SYSCALL (MIN_GHOST_COMPAT_SYSCALL + 4u)
+
 #else
 #error "Unsupported architecture"
 #endif
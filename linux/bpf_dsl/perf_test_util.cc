@@ -0,0 +1,82 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/sys_info.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_checker.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_test.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+void MeasurePolicy(const std::string& trace, const Policy& policy) {
+  // Build the expressions in a fresh arena each time, so that nothing is
+  // already interned and the arena's statistics only cover this policy.
+  size_t num_allocations = 0;
+  size_t bytes_reserved = 0;
+  const base::TimeDelta construction = FastestRun([&]() {
+    ExprArena arena;
+    {
+      ExprArena::Scope scope(&arena);
+      std::vector<ResultExpr> results;
+      for (uint32_t sysnum : SyscallSet::All()) {
+        results.push_back(SyscallSet::IsValid(sysnum)
+                              ? policy.EvaluateSyscall(sysnum)
+                              : policy.InvalidSyscall());
+      }
+    }
+    num_allocations = arena.num_allocations();
+    bytes_reserved = arena.bytes_reserved();
+  });
+  perf_test::PrintResult("policy_construction", "", trace,
+                         construction.InMillisecondsF(), "ms", true);
+  perf_test::PrintResult("policy_allocations", "", trace, num_allocations,
+                         "allocations", false);
+  perf_test::PrintResult("policy_arena_bytes", "", trace, bytes_reserved,
+                         "bytes", false);
+
+  CodeGen::Program program;
+  const base::TimeDelta compile = FastestRun([&]() {
+    TestTrapRegistry traps;
+    program = PolicyCompiler(&policy, &traps).Compile();
+  });
+  ASSERT_FALSE(program.empty());
+  perf_test::PrintResult("policy_compile", "", trace,
+                         compile.InMillisecondsF(), "ms", true);
+  perf_test::PrintResult("policy_program_size", "", trace, program.size(),
+                         "instructions", false);
+
+  // The compiled program must use the registry that the checker resolves
+  // trap handlers with.
+  TestTrapRegistry traps;
+  program = PolicyCompiler(&policy, &traps).Compile();
+  PolicyChecker checker(&policy, &traps);
+  checker.SetNumThreads(base::SysInfo::NumberOfProcessors());
+  std::vector<PolicyChecker::Mismatch> mismatches;
+  const base::TimeDelta check =
+      FastestRun([&]() { mismatches = checker.Check(program); });
+  EXPECT_TRUE(mismatches.empty()) << mismatches.size() << " mismatches";
+  perf_test::PrintResult("policy_check", "", trace, check.InMillisecondsF(),
+                         "ms", true);
+  perf_test::PrintResult("policy_check_classes", "", trace,
+                         checker.num_classes(), "classes", false);
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
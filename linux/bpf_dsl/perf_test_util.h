@@ -0,0 +1,56 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_PERF_TEST_UTIL_H_
+#define SANDBOX_LINUX_BPF_DSL_PERF_TEST_UTIL_H_
+
+#include <algorithm>
+#include <string>
+
+#include "base/time/time.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+class Policy;
+
+// Number of times each measurement is repeated; the fastest run is
+// reported, since slower runs mostly measure noise from the rest of the
+// system.
+const int kPerfTestRuns = 5;
+
+// FastestRun calls |fn| kPerfTestRuns times and returns the duration of
+// the fastest call.
+template <typename Fn>
+base::TimeDelta FastestRun(Fn fn) {
+  base::TimeDelta best = base::TimeDelta::Max();
+  for (int run = 0; run < kPerfTestRuns; ++run) {
+    const base::TimeTicks start = base::TimeTicks::Now();
+    fn();
+    best = std::min(best, base::TimeTicks::Now() - start);
+  }
+  return best;
+}
+
+// MeasurePolicy measures the cost of compiling |policy| and reports it
+// with perf_test::PrintResult, using |trace| as the trace name:
+//
+//   policy_construction   Time to build the policy's expressions for
+//                         every system call, in ms.
+//   policy_allocations    Number of expression allocations made while
+//                         building them.
+//   policy_arena_bytes    Bytes of memory the allocations took up.
+//   policy_compile        Time for PolicyCompiler::Compile, in ms.
+//   policy_program_size   Number of instructions in the program.
+//   policy_check          Time for PolicyChecker::Check to check the
+//                         program on all cores, in ms.
+//   policy_check_classes  Number of system call classes it checked.
+//
+// The output is in the format that the perf dashboard scripts parse, so
+// regressions can be tracked across releases.
+void MeasurePolicy(const std::string& trace, const Policy& policy);
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_PERF_TEST_UTIL_H_
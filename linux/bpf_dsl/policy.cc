@@ -6,6 +6,7 @@
 
 #include <errno.h>
 
+#include "base/logging.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl.h"
 
 namespace sandbox {
@@ -15,5 +16,15 @@ ResultExpr Policy::InvalidSyscall() const {
   return Error(ENOSYS);
 }
 
+int Policy::ClassifySyscall(int sysno) const {
+  return -1;
+}
+
+ResultExpr Policy::EvaluateSyscallClass(int syscall_class) const {
+  NOTREACHED() << "ClassifySyscall returned class " << syscall_class
+               << " without overriding EvaluateSyscallClass";
+  return InvalidSyscall();
+}
+
 }  // namespace bpf_dsl
 }  // namespace sandbox
@@ -21,12 +21,29 @@ class SANDBOX_EXPORT Policy {
   // User extension point for writing custom sandbox policies.
   // The returned ResultExpr will control how the kernel responds to the
   // specified system call number.
+  //
+  // Policies may hold on to the expressions they return, e.g. to reuse
+  // them across calls, unless they're compiled in a bpf_dsl::ExprArena
+  // (see SandboxBPF::SetCompileInArena()). In that case every expression
+  // built by this or any of the other hooks below must be released
+  // before the arena is destroyed, i.e. once the policy is compiled.
   virtual ResultExpr EvaluateSyscall(int sysno) const = 0;
 
   // Optional overload for specifying alternate behavior for invalid
   // system calls.  The default is to return ENOSYS.
   virtual ResultExpr InvalidSyscall() const;
 
+  // Optional extension for policies that treat whole classes of system
+  // calls identically (e.g., everything in SyscallSets::IsFileSystem).
+  // ClassifySyscall returns a non-negative identifier for the class that
+  // |sysno| belongs to, or a negative value (the default) if |sysno|
+  // should be evaluated individually. EvaluateSyscallClass is then called
+  // just once per class instead of calling EvaluateSyscall for every
+  // member, and must return exactly the same result as EvaluateSyscall
+  // would for each of them. Debug builds verify this.
+  virtual int ClassifySyscall(int sysno) const;
+  virtual ResultExpr EvaluateSyscallClass(int syscall_class) const;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(Policy);
 };
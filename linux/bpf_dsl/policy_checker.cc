@@ -0,0 +1,348 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_checker.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/threading/simple_thread.h"
+#include "sandbox/linux/bpf_dsl/arg_tests.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "sandbox/linux/bpf_dsl/jit.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+#if defined(__i386__) || defined(__x86_64__)
+const bool kIsIntel = true;
+#else
+const bool kIsIntel = false;
+#endif
+#if defined(__x86_64__) && defined(__ILP32__)
+const bool kIsX32 = true;
+#else
+const bool kIsX32 = false;
+#endif
+
+// The bit that x32 system call numbers have set, and others don't.
+const uint32_t kX32Bit = 0x40000000;
+
+const uint64_t kUpperHalf = 0xffffffff00000000ULL;
+const uint64_t kSignBit = 0x80000000ULL;
+
+// Returns whether a 32-bit argument's upper half passes PolicyCompiler's
+// check; see PolicyCompiler::CheckArgumentWidth.
+bool IsExtended(uint64_t arg) {
+  if (sizeof(void*) == 4) {
+    return (arg & kUpperHalf) == 0;
+  }
+  return (arg & kUpperHalf) == 0 ||
+         ((arg & kUpperHalf) == kUpperHalf && (arg & kSignBit));
+}
+
+// Outcome is what a program returned for a system call, and the Return or
+// Trap expression that the policy selects for it.
+struct Outcome {
+  struct arch_seccomp_data data;
+  const internal::ResultExprImpl* expected;
+  uint32_t actual;
+  const char* error;
+};
+
+}  // namespace
+
+// Group is the system calls that the policy gives the same result, with
+// the classes of values of each argument that the result tells apart.
+struct PolicyChecker::Group {
+  ResultExpr result;
+  std::vector<std::pair<uint32_t, uint32_t>> syscalls;  // (arch, nr)
+  std::vector<uint64_t> args[6];
+  uint32_t narrow_args;
+};
+
+// Worker evaluates a program for every class of system calls in
+// every |stride|-th group, starting at index |first|, and records the
+// distinct outcomes for each system call number.
+class PolicyChecker::Worker : public base::DelegateSimpleThread::Delegate {
+ public:
+  Worker(const std::vector<std::unique_ptr<Group>>& groups,
+         const std::vector<uint64_t> (&sweeps)[6],
+         const ResultExpr& unexpected_64bit,
+         const JitProgram& program,
+         size_t first,
+         size_t stride,
+         std::vector<std::vector<Outcome>>* outcomes)
+      : groups_(groups),
+        sweeps_(sweeps),
+        unexpected_64bit_(unexpected_64bit),
+        program_(program),
+        first_(first),
+        stride_(stride),
+        outcomes_(outcomes) {}
+  ~Worker() override {}
+
+  void Run() override {
+    for (size_t i = first_; i < groups_.size(); i += stride_) {
+      const Group& group = *groups_[i];
+      std::vector<Outcome>* outcomes = &(*outcomes_)[i];
+      for (const auto& syscall : group.syscalls) {
+        const size_t first_outcome = outcomes->size();
+        struct arch_seccomp_data data = {};
+        data.arch = syscall.first;
+        data.nr = static_cast<int>(syscall.second);
+        // Count through the combinations of argument classes like an
+        // odometer.
+        size_t index[6] = {};
+        size_t argno;
+        do {
+          for (argno = 0; argno < 6; ++argno) {
+            data.args[argno] = group.args[argno][index[argno]];
+          }
+          Evaluate(group, data, first_outcome, outcomes);
+          for (argno = 0; argno < 6; ++argno) {
+            if (++index[argno] < group.args[argno].size()) {
+              break;
+            }
+            index[argno] = 0;
+          }
+        } while (argno < 6);
+
+        // A program that dispatches the system call to code for another
+        // one makes tests that the classes above may not tell apart, so
+        // also sweep each argument through the classes of every test in
+        // the policy.
+        for (argno = 0; argno < 6; ++argno) {
+          for (uint64_t value : sweeps_[argno]) {
+            data.args[argno] = value;
+            Evaluate(group, data, first_outcome, outcomes);
+          }
+          data.args[argno] = group.args[argno][0];
+        }
+      }
+    }
+  }
+
+ private:
+  // Evaluates the program for |data|, and appends the outcome to
+  // |outcomes| unless it's among the ones from |first_outcome| on.
+  void Evaluate(const Group& group,
+                const struct arch_seccomp_data& data,
+                size_t first_outcome,
+                std::vector<Outcome>* outcomes) const {
+    Outcome outcome;
+    outcome.data = data;
+    outcome.expected = Expected(group, data);
+    outcome.error = nullptr;
+    outcome.actual = program_.Evaluate(data, &outcome.error);
+    if (std::none_of(outcomes->begin() + first_outcome, outcomes->end(),
+                     [&outcome](const Outcome& o) {
+                       return o.expected == outcome.expected &&
+                              o.actual == outcome.actual &&
+                              o.error == outcome.error;
+                     })) {
+      outcomes->push_back(outcome);
+    }
+  }
+
+  // Returns the leaf of the policy's result for |data|, which panics if
+  // a 32-bit argument isn't properly extended.
+  const internal::ResultExprImpl* Expected(
+      const Group& group,
+      const struct arch_seccomp_data& data) const {
+    for (int argno = 0; argno < 6; ++argno) {
+      if ((group.narrow_args & (1U << argno)) &&
+          !IsExtended(data.args[argno])) {
+        return unexpected_64bit_->Evaluate(data);
+      }
+    }
+    return group.result->Evaluate(data);
+  }
+
+  const std::vector<std::unique_ptr<Group>>& groups_;
+  const std::vector<uint64_t> (&sweeps_)[6];
+  const ResultExpr& unexpected_64bit_;
+  const JitProgram& program_;
+  size_t first_;
+  size_t stride_;
+  std::vector<std::vector<Outcome>>* outcomes_;
+
+  DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+PolicyChecker::PolicyChecker(const Policy* policy, TrapRegistry* registry)
+    : policy_(policy),
+      registry_(registry),
+      panic_func_(PolicyCompiler::DefaultPanic),
+      num_threads_(1),
+      unexpected_64bit_(),
+      groups_(),
+      sweeps_(),
+      num_classes_(0) {
+  DCHECK(policy);
+}
+
+PolicyChecker::~PolicyChecker() {}
+
+std::vector<PolicyChecker::Mismatch> PolicyChecker::Check(
+    const CodeGen::Program& program) {
+  if (groups_.empty()) {
+    EvaluatePolicy();
+  }
+
+  // Each thread (including this one) takes every |num_threads_|-th group,
+  // and only writes to its own elements of |outcomes|.
+  const JitProgram jit(program);
+  std::vector<std::vector<Outcome>> outcomes(groups_.size());
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 1; i < num_threads_; ++i) {
+    workers.emplace_back(new Worker(groups_, sweeps_, unexpected_64bit_, jit, i,
+                                         num_threads_, &outcomes));
+    threads.emplace_back(
+        new base::DelegateSimpleThread(workers.back().get(), "PolicyChecker"));
+    threads.back()->Start();
+  }
+  Worker(groups_, sweeps_, unexpected_64bit_, jit, 0, num_threads_,
+         &outcomes)
+      .Run();
+  for (const auto& thread : threads) {
+    thread->Join();
+  }
+
+  // Registering trap handlers isn't thread-safe, so the expected return
+  // values are only determined here.
+  std::map<const internal::ResultExprImpl*, uint32_t> return_values;
+  std::vector<Mismatch> mismatches;
+  num_classes_ = 0;
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    size_t num_classes = groups_[i]->syscalls.size();
+    for (const std::vector<uint64_t>& values : groups_[i]->args) {
+      num_classes *= values.size();
+    }
+    num_classes_ += num_classes;
+
+    for (const Outcome& outcome : outcomes[i]) {
+      auto it = return_values.find(outcome.expected);
+      if (it == return_values.end()) {
+        it = return_values
+                 .insert(std::make_pair(outcome.expected,
+                                        outcome.expected->ReturnValue(
+                                            registry_)))
+                 .first;
+      }
+      if (outcome.error || outcome.actual != it->second) {
+        mismatches.push_back(Mismatch{outcome.data, it->second,
+                                      outcome.actual, outcome.error});
+      }
+    }
+  }
+  std::stable_sort(mismatches.begin(), mismatches.end(),
+                   [](const Mismatch& a, const Mismatch& b) {
+                     return static_cast<uint32_t>(a.data.nr) <
+                            static_cast<uint32_t>(b.data.nr);
+                   });
+  return mismatches;
+}
+
+uint32_t PolicyChecker::Evaluate(const struct arch_seccomp_data& data) {
+  const ResultExpr result =
+      SyscallResult(data.arch, static_cast<uint32_t>(data.nr));
+  CHECK(!result->HasUnsafeTraps())
+      << "PolicyChecker doesn't support unsafe traps";
+  ArgTests tests;
+  result->AddArgTests(&tests);
+  for (int argno = 0; argno < 6; ++argno) {
+    if ((tests.narrow_args() & (1U << argno)) &&
+        !IsExtended(data.args[argno])) {
+      return panic_func_(PolicyCompiler::kUnexpected64bitMessage)
+          ->Evaluate(data)
+          ->ReturnValue(registry_);
+    }
+  }
+  return result->Evaluate(data)->ReturnValue(registry_);
+}
+
+void PolicyChecker::SetNumThreads(size_t num_threads) {
+  CHECK_GE(num_threads, 1U);
+  num_threads_ = num_threads;
+}
+
+void PolicyChecker::SetPanicFunc(PolicyCompiler::PanicFunc panic_func) {
+  DCHECK(groups_.empty()) << "Policy was already evaluated";
+  panic_func_ = panic_func;
+}
+
+void PolicyChecker::EvaluatePolicy() {
+  std::map<ResultExpr, size_t> indices;
+  auto add = [this, &indices](uint32_t arch, uint32_t nr,
+                              const ResultExpr& result) {
+    CHECK(!result->HasUnsafeTraps())
+        << "PolicyChecker doesn't support unsafe traps";
+    auto it = indices.find(result);
+    if (it == indices.end()) {
+      it = indices.insert(std::make_pair(result, groups_.size())).first;
+      groups_.emplace_back(new Group);
+      groups_.back()->result = result;
+    }
+    groups_[it->second]->syscalls.push_back(std::make_pair(arch, nr));
+  };
+
+  // The program checks the architecture before anything else, and then
+  // whether the system call number belongs to the right x86 ABI.
+  add(~SECCOMP_ARCH, 0, SyscallResult(~SECCOMP_ARCH, 0));
+  if (kIsIntel) {
+    add(SECCOMP_ARCH, kIsX32 ? 0 : kX32Bit,
+        SyscallResult(SECCOMP_ARCH, kIsX32 ? 0 : kX32Bit));
+  }
+  for (uint32_t sysnum : SyscallSet::All()) {
+    add(SECCOMP_ARCH, sysnum, SyscallResult(SECCOMP_ARCH, sysnum));
+  }
+  unexpected_64bit_ = panic_func_(PolicyCompiler::kUnexpected64bitMessage);
+
+  ArgTests all_tests;
+  for (const auto& group : groups_) {
+    ArgTests tests;
+    group->result->AddArgTests(&tests);
+    group->result->AddArgTests(&all_tests);
+    for (int argno = 0; argno < 6; ++argno) {
+      group->args[argno] = tests.Partition(argno);
+    }
+    group->narrow_args = tests.narrow_args();
+  }
+  unexpected_64bit_->AddArgTests(&all_tests);
+  for (int argno = 0; argno < 6; ++argno) {
+    sweeps_[argno] = all_tests.Partition(argno);
+  }
+}
+
+ResultExpr PolicyChecker::SyscallResult(uint32_t arch, uint32_t sysnum) const {
+  if (arch != SECCOMP_ARCH) {
+    return panic_func_(PolicyCompiler::kInvalidArchMessage);
+  }
+  if (kIsIntel && !!(sysnum & kX32Bit) != kIsX32) {
+    return panic_func_(PolicyCompiler::kInvalidX32Message);
+  }
+  if (SyscallSet::IsValid(sysnum)) {
+    return policy_->EvaluateSyscall(static_cast<int>(sysnum));
+  }
+  return policy_->InvalidSyscall();
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
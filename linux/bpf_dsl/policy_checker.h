@@ -0,0 +1,113 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_POLICY_CHECKER_H_
+#define SANDBOX_LINUX_BPF_DSL_POLICY_CHECKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+class Policy;
+
+// PolicyChecker proves that a BPF program implements a policy, such as
+// one compiled by PolicyCompiler with different optimizations. Rather
+// than trying hand-picked system calls, it splits the system calls into
+// equivalence classes using the masks and constants that the policy's
+// expressions test arguments with (see ArgTests), and the checks that
+// PolicyCompiler adds for the architecture, x32 system call numbers and
+// 32-bit arguments. Then it evaluates the program for one system call
+// from each class, through JitProgram (which behaves exactly like
+// Verifier::EvaluateBPF), and compares the result with that of the
+// policy's expressions.
+//
+// This is exhaustive as long as the program only compares the halves of
+// a system call's arguments with the halves of the constants that the
+// system call's result tests them with, however it lays out and combines
+// the comparisons. To also catch programs that dispatch a system call to
+// another one's tests, each argument is swept through the classes of all
+// tests in the policy as well. Arguments that a system call's result
+// doesn't test are otherwise 0, and the instruction pointer isn't
+// considered, so policies with unsafe traps aren't supported. Neither are
+// compatibility ABI policies.
+class PolicyChecker {
+ public:
+  // Mismatch describes a system call for which the program doesn't return
+  // what the policy does. If the program fails, |error| describes the
+  // failure; otherwise it's nullptr.
+  struct Mismatch {
+    struct arch_seccomp_data data;
+    uint32_t expected;
+    uint32_t actual;
+    const char* error;
+  };
+
+  // |registry| must be the one that the checked programs were compiled
+  // with, so that trap handlers have the same IDs.
+  PolicyChecker(const Policy* policy, TrapRegistry* registry);
+  ~PolicyChecker();
+
+  // Check evaluates |program| for every class of system calls, and
+  // returns one mismatch for each system call number, expected result
+  // and actual result that disagree, in order of system call numbers.
+  // The policy is only evaluated by the first call.
+  std::vector<Mismatch> Check(const CodeGen::Program& program);
+
+  // Evaluate returns what a program that implements the policy returns
+  // for |data|, by evaluating the policy's expressions directly. Unlike
+  // Check, this only evaluates the policy for |data|'s system call.
+  uint32_t Evaluate(const struct arch_seccomp_data& data);
+
+  // SetNumThreads makes Check evaluate the classes on |num_threads|
+  // threads (including the calling one). The policy is still evaluated
+  // on the calling thread only. The default is 1.
+  void SetNumThreads(size_t num_threads);
+
+  // SetPanicFunc sets the panic function that the program was compiled
+  // with; see PolicyCompiler::SetPanicFunc.
+  void SetPanicFunc(PolicyCompiler::PanicFunc panic_func);
+
+  // num_classes returns the number of classes that the last Check
+  // evaluated the program for.
+  size_t num_classes() const { return num_classes_; }
+
+ private:
+  struct Group;
+  class Worker;
+
+  // Evaluates the policy for every system call number, groups the
+  // numbers by result, and splits the arguments of each result.
+  void EvaluatePolicy();
+
+  // Returns the policy's result for system call number |sysnum| on
+  // architecture |arch|, including the checks that PolicyCompiler adds
+  // before dispatching on the number.
+  ResultExpr SyscallResult(uint32_t arch, uint32_t sysnum) const;
+
+  const Policy* policy_;
+  TrapRegistry* registry_;
+  PolicyCompiler::PanicFunc panic_func_;
+  size_t num_threads_;
+  ResultExpr unexpected_64bit_;
+  std::vector<std::unique_ptr<Group>> groups_;
+  std::vector<uint64_t> sweeps_[6];
+  size_t num_classes_;
+
+  DISALLOW_COPY_AND_ASSIGN(PolicyChecker);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_POLICY_CHECKER_H_
@@ -0,0 +1,247 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_checker.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+intptr_t PanicHandler(const struct arch_seccomp_data&, void*) {
+  return -1;
+}
+
+ResultExpr TrapPanic(const char* error) {
+  return Trap(PanicHandler, error);
+}
+
+// CheckerTestPolicy uses every kind of argument test, with masks that
+// overlap and masks that don't. Only the first few system calls test
+// arguments, to keep the program short.
+class CheckerTestPolicy : public Policy {
+ public:
+  CheckerTestPolicy() {}
+  ~CheckerTestPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> fd(0);
+    const Arg<int> flags(1);
+    const Arg<uint64_t> addr(2);
+    if (sysno >= 30) {
+      return Allow();
+    }
+    switch (sysno % 6) {
+      case 0:
+        return Allow();
+      case 1:
+        return If(AnyOf(fd == sysno % 8, fd == -1), Allow()).Else(Error(EPERM));
+      case 2:
+        return If((flags & 0xff00) == 0x100, Error(EACCES))
+            .ElseIf((flags & 0x3) != 0, Allow())
+            .Else(Kill());
+      case 3:
+        return Switch(fd).CASES((1, 2, 3, 5), Allow()).Default(Error(EBADF));
+      case 4:
+        return If(AllOf(fd >= 3, fd < 100, (flags & 0x40) == 0), Allow())
+            .Else(Error(EMFILE));
+      default:
+        return If((addr & 0xfff) == 0, Allow())
+            .ElseIf(addr > 0x7fffffffffffULL, Error(EFAULT))
+            .Else(Error(EINVAL));
+    }
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CheckerTestPolicy);
+};
+
+// MaskedArgPolicy allows system calls whose first argument,
+// bitwise-AND'd with |mask|, is |value|.
+class MaskedArgPolicy : public Policy {
+ public:
+  MaskedArgPolicy(uint64_t mask, uint64_t value)
+      : mask_(mask), value_(value) {}
+  ~MaskedArgPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<uint64_t> arg(0);
+    return If((arg & mask_) == value_, Allow()).Else(Error(EPERM));
+  }
+
+ private:
+  const uint64_t mask_;
+  const uint64_t value_;
+
+  DISALLOW_COPY_AND_ASSIGN(MaskedArgPolicy);
+};
+
+TEST(PolicyChecker, CompiledPolicy) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  PolicyChecker checker(&policy, &traps);
+  EXPECT_TRUE(checker.Check(program).empty());
+  const size_t num_classes = checker.num_classes();
+  EXPECT_GT(num_classes, 0U);
+
+  checker.SetNumThreads(4);
+  EXPECT_TRUE(checker.Check(program).empty());
+  EXPECT_EQ(num_classes, checker.num_classes());
+}
+
+TEST(PolicyChecker, Evaluate) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+  PolicyChecker checker(&policy, &traps);
+
+  const uint64_t kArgs[] = {0,     1,          3,          0x100,
+                            0x141, 0xffffffff, 0x100000000ULL,
+                            0xffffffff80000000ULL};
+  std::vector<struct arch_seccomp_data> data;
+  for (uint32_t nr : SyscallSet::All()) {
+    for (uint64_t arg : kArgs) {
+      data.push_back({static_cast<int>(nr), SECCOMP_ARCH, 0,
+                      {arg, arg, arg, 0, 0, 0}});
+    }
+  }
+  data.push_back({0, ~SECCOMP_ARCH, 0, {}});
+  for (const struct arch_seccomp_data& syscall : data) {
+    const char* err = nullptr;
+    EXPECT_EQ(Verifier::EvaluateBPF(program, syscall, &err),
+              checker.Evaluate(syscall))
+        << "system call " << syscall.nr;
+  }
+}
+
+TEST(PolicyChecker, PanicFunc) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&policy, &traps);
+  compiler.SetPanicFunc(TrapPanic);
+  const CodeGen::Program program = compiler.Compile();
+
+  PolicyChecker checker(&policy, &traps);
+  checker.SetPanicFunc(TrapPanic);
+  EXPECT_TRUE(checker.Check(program).empty());
+
+  // The default panic function kills the process instead.
+  PolicyChecker default_checker(&policy, &traps);
+  const std::vector<PolicyChecker::Mismatch> mismatches =
+      default_checker.Check(program);
+  ASSERT_FALSE(mismatches.empty());
+  for (const PolicyChecker::Mismatch& mismatch : mismatches) {
+    EXPECT_EQ(SECCOMP_RET_KILL, mismatch.expected);
+    EXPECT_EQ(SECCOMP_RET_TRAP, mismatch.actual & SECCOMP_RET_ACTION);
+  }
+}
+
+TEST(PolicyChecker, ChangedReturnValues) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+  PolicyChecker checker(&policy, &traps);
+
+  // Every instruction is reachable, so changing any return value must be
+  // noticed.
+  const uint32_t kChanged = SECCOMP_RET_ERRNO + 4095;
+  for (size_t pc = 0; pc < program.size(); ++pc) {
+    if (BPF_CLASS(program[pc].code) != BPF_RET) {
+      continue;
+    }
+    CodeGen::Program changed = program;
+    changed[pc].k = kChanged;
+    const std::vector<PolicyChecker::Mismatch> mismatches =
+        checker.Check(changed);
+    ASSERT_FALSE(mismatches.empty()) << "instruction " << pc;
+    for (const PolicyChecker::Mismatch& mismatch : mismatches) {
+      EXPECT_EQ(kChanged, mismatch.actual) << "instruction " << pc;
+      EXPECT_EQ(program[pc].k, mismatch.expected) << "instruction " << pc;
+      EXPECT_EQ(nullptr, mismatch.error) << "instruction " << pc;
+    }
+  }
+}
+
+TEST(PolicyChecker, ChangedConstants) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+  PolicyChecker checker(&policy, &traps);
+
+  // Comparing against a slightly different constant moves the boundary
+  // between two classes, which must be noticed. (The compiler also emits
+  // JGT for upper bounds that another comparison implies, so changing
+  // those doesn't change the program's behavior.)
+  for (size_t pc = 0; pc < program.size(); ++pc) {
+    const uint16_t code = program[pc].code;
+    if (code != BPF_JMP + BPF_JEQ + BPF_K &&
+        code != BPF_JMP + BPF_JGE + BPF_K) {
+      continue;
+    }
+    CodeGen::Program changed = program;
+    ++changed[pc].k;
+    EXPECT_FALSE(checker.Check(changed).empty()) << "instruction " << pc;
+  }
+}
+
+TEST(PolicyChecker, HalvesOf64bitArguments) {
+  // The program only compares the lower half, which agrees with the
+  // policy for 0x100000005 and for values whose lower half isn't 5, but
+  // not for 5.
+  MaskedArgPolicy policy(~0ULL, 0x100000005ULL);
+  MaskedArgPolicy lower_half(0xffffffff, 5);
+  TestTrapRegistry traps;
+  const CodeGen::Program program =
+      PolicyCompiler(&lower_half, &traps).Compile();
+  EXPECT_TRUE(PolicyChecker(&lower_half, &traps).Check(program).empty());
+
+  const std::vector<PolicyChecker::Mismatch> mismatches =
+      PolicyChecker(&policy, &traps).Check(program);
+  ASSERT_FALSE(mismatches.empty());
+  for (const PolicyChecker::Mismatch& mismatch : mismatches) {
+    EXPECT_EQ(5U, mismatch.data.args[0] & 0xffffffff);
+    EXPECT_NE(1U, mismatch.data.args[0] >> 32);
+    EXPECT_EQ(SECCOMP_RET_ERRNO + EPERM, mismatch.expected);
+    EXPECT_EQ(SECCOMP_RET_ALLOW, mismatch.actual);
+  }
+}
+
+TEST(PolicyChecker, FailingProgram) {
+  CheckerTestPolicy policy;
+  TestTrapRegistry traps;
+  PolicyChecker checker(&policy, &traps);
+
+  const std::vector<PolicyChecker::Mismatch> mismatches =
+      checker.Check({{BPF_LD + BPF_W + BPF_IMM, 0, 0, 1},
+                     {BPF_LDX + BPF_W + BPF_IMM, 0, 0, 0},
+                     {BPF_ALU + BPF_DIV + BPF_X, 0, 0, 0},
+                     {BPF_RET + BPF_K, 0, 0, SECCOMP_RET_ALLOW}});
+  ASSERT_FALSE(mismatches.empty());
+  EXPECT_STREQ("Illegal division by zero", mismatches[0].error);
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
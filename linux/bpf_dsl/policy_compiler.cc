@@ -9,16 +9,27 @@
 #include <stdint.h>
 #include <sys/syscall.h>
 
+#include <algorithm>
 #include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "base/macros.h"
+#include "base/threading/simple_thread.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
 #include "sandbox/linux/bpf_dsl/codegen.h"
 #include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_fingerprint.h"
+#include "sandbox/linux/bpf_dsl/program_cache.h"
 #include "sandbox/linux/bpf_dsl/seccomp_macros.h"
 #include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
 #include "sandbox/linux/system_headers/linux_filter.h"
 #include "sandbox/linux/system_headers/linux_seccomp.h"
 #include "sandbox/linux/system_headers/linux_syscalls.h"
@@ -28,6 +39,21 @@ namespace bpf_dsl {
 
 namespace {
 
+// Version of the compiled programs, as far as PolicyCompiler::Fingerprint
+// is concerned. This must be bumped whenever a change to the compiler
+// changes the programs it emits for existing policies.
+const uint64_t kFingerprintVersion = 3;
+
+// Messages passed to the panic function.
+const char* const kPanicMessages[] = {
+    PolicyCompiler::kInvalidArchMessage, PolicyCompiler::kInvalidX32Message,
+    PolicyCompiler::kUnexpected64bitMessage,
+};
+
+// Switches with at most this many values are compiled into a chain of
+// equality tests instead of a search tree.
+const size_t kMaxLinearSwitchCases = 3;
+
 #if defined(__i386__) || defined(__x86_64__)
 const bool kIsIntel = true;
 #else
@@ -38,6 +64,11 @@ const bool kIsX32 = true;
 #else
 const bool kIsX32 = false;
 #endif
+#if defined(SECCOMP_COMPAT_ARCH)
+const uint32_t kCompatArch = SECCOMP_COMPAT_ARCH;
+#else
+const uint32_t kCompatArch = 0;
+#endif
 
 const int kSyscallsRequiredForUnsafeTraps[] = {
     __NR_rt_sigprocmask,
@@ -55,10 +86,6 @@ bool HasExactlyOneBit(uint64_t x) {
   return x != 0 && (x & (x - 1)) == 0;
 }
 
-ResultExpr DefaultPanic(const char* error) {
-  return Kill();
-}
-
 // A Trap() handler that returns an "errno" value. The value is encoded
 // in the "aux" parameter.
 intptr_t ReturnErrno(const struct arch_seccomp_data&, void* aux) {
@@ -70,18 +97,83 @@ intptr_t ReturnErrno(const struct arch_seccomp_data&, void* aux) {
   return -err;
 }
 
-bool HasUnsafeTraps(const Policy* policy) {
-  DCHECK(policy);
-  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
-    if (policy->EvaluateSyscall(sysnum)->HasUnsafeTraps()) {
-      return true;
-    }
+// Sanity checks that an argument specification makes sense.
+void CheckArgument(int argno, size_t width, uint64_t mask) {
+  CHECK(argno >= 0 && argno < 6) << "Invalid argument number " << argno;
+  CHECK(width == 4 || width == 8) << "Invalid argument width " << width;
+  CHECK_NE(0U, mask) << "Zero mask is invalid";
+  if (sizeof(void*) == 4) {
+    CHECK_EQ(4U, width) << "Invalid width on 32-bit platform";
+  }
+  if (width == 4) {
+    CHECK_EQ(0U, mask >> 32) << "Mask exceeds argument size";
   }
-  return policy->InvalidSyscall()->HasUnsafeTraps();
 }
 
+// Bitmap dispatch tests system call numbers in aligned buckets of this
+// many numbers, i.e. one per bit of register A.
+const uint32_t kBitmapBucketSize = 32;
+
+// Returns the number of instructions that AssembleBitmapBucket emits for
+// the bucket at |base|. The first bucket needn't mask off its base.
+uint32_t BitmapTestLength(uint32_t base) {
+  return base == 0 ? 4 : 5;
+}
+
+// Returns ceil(log2(x)) for x >= 1.
+uint32_t CeilLog2(uint64_t x) {
+  uint32_t n = 0;
+  while ((uint64_t{1} << n) < x) {
+    ++n;
+  }
+  return n;
+}
+
+// EvaluationWorker evaluates a policy for every |stride|-th system call
+// number in |sysnums|, starting at index |first|, except for the ones
+// that belong to a class.
+class EvaluationWorker : public base::DelegateSimpleThread::Delegate {
+ public:
+  EvaluationWorker(const Policy* policy,
+                   const std::vector<uint32_t>& sysnums,
+                   size_t first,
+                   size_t stride,
+                   std::vector<ResultExpr>* results)
+      : policy_(policy),
+        sysnums_(sysnums),
+        first_(first),
+        stride_(stride),
+        results_(results) {}
+  ~EvaluationWorker() override {}
+
+  void Run() override {
+    for (size_t i = first_; i < sysnums_.size(); i += stride_) {
+      const int sysnum = static_cast<int>(sysnums_[i]);
+      if (policy_->ClassifySyscall(sysnum) < 0) {
+        (*results_)[i] = policy_->EvaluateSyscall(sysnum);
+      }
+    }
+  }
+
+ private:
+  const Policy* policy_;
+  const std::vector<uint32_t>& sysnums_;
+  size_t first_;
+  size_t stride_;
+  std::vector<ResultExpr>* results_;
+
+  DISALLOW_COPY_AND_ASSIGN(EvaluationWorker);
+};
+
 }  // namespace
 
+const char PolicyCompiler::kInvalidArchMessage[] =
+    "Invalid audit architecture in BPF filter";
+const char PolicyCompiler::kInvalidX32Message[] =
+    "Illegal mixing of system call ABIs";
+const char PolicyCompiler::kUnexpected64bitMessage[] =
+    "Unexpected 64bit argument detected";
+
 struct PolicyCompiler::Range {
   uint32_t from;
   CodeGen::Node node;
@@ -92,24 +184,146 @@ PolicyCompiler::PolicyCompiler(const Policy* policy, TrapRegistry* registry)
       registry_(registry),
       escapepc_(0),
       panic_func_(DefaultPanic),
+      profile_(),
+      optimize_for_action_cache_(false),
       gen_(),
-      has_unsafe_traps_(HasUnsafeTraps(policy_)) {
+      has_unsafe_traps_(false),
+      num_threads_(1),
+      abi_(SyscallSet::Abi::NATIVE),
+      compat_(),
+      policy_evaluated_(false),
+      syscall_results_(),
+      overrides_(),
+      base_ranges_(),
+      class_results_(),
+      compiled_results_(),
+      unexpected_64bit_argument_(CodeGen::kNullNode),
+      first_sysnum_(0),
+      last_sysnum_(std::numeric_limits<uint32_t>::max()),
+      num_ranges_(0),
+      layout_weights_(),
+      jumps_saved_(0),
+      narrow_args_(0) {
   DCHECK(policy);
 }
 
 PolicyCompiler::~PolicyCompiler() {
 }
 
+PolicyCompiler::AbiState::AbiState()
+    : abi(SyscallSet::Abi::COMPAT),
+      policy(nullptr),
+      policy_evaluated(false),
+      syscall_results(),
+      class_results(),
+      base_ranges(),
+      overrides(),
+      profile() {
+}
+
+PolicyCompiler::AbiState::~AbiState() {
+}
+
+PolicyCompiler::Stats::Stats()
+    : instructions(0),
+      jump_trampolines(0),
+      jump_trampolines_saved(0),
+      ranges(0),
+      path_lengths() {
+}
+
+PolicyCompiler::Stats::~Stats() {
+}
+
+PolicyCompiler::Filter::Filter() : first(0), last(0), program() {
+}
+
+PolicyCompiler::Filter::~Filter() {
+}
+
 CodeGen::Program PolicyCompiler::Compile() {
+  CodeGen::Program program =
+      CompileRange(0, std::numeric_limits<uint32_t>::max());
+  CHECK_LE(program.size(), static_cast<size_t>(BPF_MAXINSNS))
+      << "Policy is too large for a single BPF program";
+  return program;
+}
+
+std::vector<PolicyCompiler::Filter> PolicyCompiler::CompileSplit(
+    size_t max_instructions) {
+  CHECK_LE(max_instructions, static_cast<size_t>(BPF_MAXINSNS));
+  const uint32_t kMaxSysnum = std::numeric_limits<uint32_t>::max();
+
+  std::vector<Filter> filters(1);
+  filters[0].first = 0;
+  filters[0].last = kMaxSysnum;
+  filters[0].program = CompileRange(0, kMaxSysnum);
+  if (filters[0].program.size() <= max_instructions) {
+    return filters;
+  }
+  filters.clear();
+
+  // Split between the ranges that the whole program's jump table
+  // distinguishes. Greedily taking as many ranges as fit into each
+  // filter minimizes the number of filters, assuming that programs only
+  // get longer with more ranges.
+  Ranges ranges;
+  FindRanges(&ranges);
+  auto last_sysnum = [&ranges](size_t end) {
+    return end < ranges.size() ? ranges[end].from - 1
+                               : std::numeric_limits<uint32_t>::max();
+  };
+  size_t begin = 0;
+  while (begin < ranges.size()) {
+    Filter filter;
+    filter.first = ranges[begin].from;
+    filter.last = last_sysnum(begin + 1);
+    filter.program = CompileRange(filter.first, filter.last);
+    CHECK_LE(filter.program.size(), max_instructions)
+        << "System calls " << filter.first << " to " << filter.last
+        << " are too large for a single BPF program";
+
+    // Binary search for the end of the longest run of ranges that fits.
+    size_t fits = begin + 1;
+    size_t too_long = ranges.size() + 1;
+    while (fits + 1 < too_long) {
+      const size_t end = fits + (too_long - fits) / 2;
+      CodeGen::Program program = CompileRange(filter.first, last_sysnum(end));
+      if (program.size() <= max_instructions) {
+        fits = end;
+        filter.last = last_sysnum(end);
+        filter.program.swap(program);
+      } else {
+        too_long = end;
+      }
+    }
+
+    filters.push_back(filter);
+    begin = fits;
+  }
+  return filters;
+}
+
+CodeGen::Program PolicyCompiler::CompileRange(uint32_t first, uint32_t last) {
+  EvaluatePolicy();
   CHECK(policy_->InvalidSyscall()->IsDeny())
       << "Policies should deny invalid system calls";
+  if (compat_.policy) {
+    SwapAbi();
+    EvaluatePolicy();
+    CHECK(policy_->InvalidSyscall()->IsDeny())
+        << "Policies should deny invalid system calls";
+    SwapAbi();
+    CHECK(!has_unsafe_traps_)
+        << "UnsafeTrap() can't be used together with a compat policy";
+  }
 
   // If our BPF program has unsafe traps, enable support for them.
   if (has_unsafe_traps_) {
     CHECK_NE(0U, escapepc_) << "UnsafeTrap() requires a valid escape PC";
 
     for (int sysnum : kSyscallsRequiredForUnsafeTraps) {
-      CHECK(policy_->EvaluateSyscall(sysnum)->IsAllow())
+      CHECK(EvaluateSyscall(sysnum)->IsAllow())
           << "Policies that use UnsafeTrap() must unconditionally allow all "
              "required system calls";
     }
@@ -119,7 +333,263 @@ CodeGen::Program PolicyCompiler::Compile() {
   }
 
   // Assemble the BPF filter program.
-  return gen_.Compile(AssemblePolicy());
+  first_sysnum_ = first;
+  last_sysnum_ = last;
+  const CodeGen::Node head = AssemblePolicy();
+  first_sysnum_ = 0;
+  last_sysnum_ = std::numeric_limits<uint32_t>::max();
+  return gen_.CompileOptimized(head, layout_weights_, &jumps_saved_);
+}
+
+CodeGen::Program PolicyCompiler::Compile(Stats* stats) {
+  CodeGen::Program program = Compile();
+
+  stats->instructions = program.size();
+  stats->jump_trampolines = 0;
+  for (const struct sock_filter& insn : program) {
+    if (insn.code == BPF_JMP + BPF_JA) {
+      ++stats->jump_trampolines;
+    }
+  }
+  stats->jump_trampolines_saved = jumps_saved_;
+  stats->ranges = num_ranges_;
+
+  stats->path_lengths.clear();
+  for (uint32_t sysnum : SyscallSet::All()) {
+    Stats::PathLength& length = stats->path_lengths[sysnum];
+    const char* err = nullptr;
+    Verifier::PathLengths(program, SECCOMP_ARCH, sysnum, &length.min,
+                          &length.max, &err);
+    CHECK(!err) << err;
+  }
+
+  return program;
+}
+
+CodeGen::Program PolicyCompiler::CompileCached(ProgramCache* cache) {
+  EvaluatePolicy();
+  if (has_unsafe_traps_) {
+    return Compile();
+  }
+  CHECK(policy_->InvalidSyscall()->IsDeny())
+      << "Policies should deny invalid system calls";
+
+  PolicyFingerprint fp;
+  Fingerprint(&fp);
+  const std::string key = fp.Digest();
+  const std::vector<PolicyFingerprint::Trap>& traps = fp.traps();
+
+  // Cached programs refer to trap handlers by their canonical IDs, i.e.
+  // their index in |traps| plus one, which need to be mapped to the IDs
+  // that |registry_| assigns them in this process.
+  ProgramCache::Entry entry;
+  if (cache->Load(key, &entry) && entry.num_traps == traps.size()) {
+    std::vector<uint16_t> trap_ids;
+    for (const PolicyFingerprint::Trap& trap : traps) {
+      trap_ids.push_back(registry_->Add(trap.fnc, trap.aux, trap.safe));
+    }
+    bool valid = true;
+    for (struct sock_filter& insn : entry.program) {
+      if (insn.code != BPF_RET + BPF_K ||
+          (insn.k & SECCOMP_RET_ACTION) != SECCOMP_RET_TRAP) {
+        continue;
+      }
+      const uint32_t canonical_id = insn.k & SECCOMP_RET_DATA;
+      if (canonical_id == 0 || canonical_id > trap_ids.size()) {
+        valid = false;
+        break;
+      }
+      insn.k = SECCOMP_RET_TRAP + trap_ids[canonical_id - 1];
+    }
+    if (valid) {
+      return entry.program;
+    }
+  }
+
+  CodeGen::Program program = Compile();
+
+  std::map<uint32_t, uint32_t> canonical_ids;
+  for (size_t i = 0; i < traps.size(); ++i) {
+    const uint16_t trap_id =
+        registry_->Add(traps[i].fnc, traps[i].aux, traps[i].safe);
+    canonical_ids.insert(std::make_pair(trap_id, i + 1));
+  }
+  entry.program = program;
+  entry.num_traps = traps.size();
+  for (struct sock_filter& insn : entry.program) {
+    if (insn.code != BPF_RET + BPF_K ||
+        (insn.k & SECCOMP_RET_ACTION) != SECCOMP_RET_TRAP) {
+      continue;
+    }
+    auto it = canonical_ids.find(insn.k & SECCOMP_RET_DATA);
+    if (it == canonical_ids.end()) {
+      // Only happens if Fingerprint() misses a trap; don't cache a
+      // program that can't be mapped back.
+      NOTREACHED();
+      return program;
+    }
+    insn.k = SECCOMP_RET_TRAP + it->second;
+  }
+  cache->Store(key, entry);
+
+  return program;
+}
+
+void PolicyCompiler::Fingerprint(PolicyFingerprint* fp) {
+  EvaluatePolicy();
+
+  fp->AddKind("PolicyCompiler");
+  fp->AddInteger(kFingerprintVersion);
+  fp->AddInteger(SECCOMP_ARCH);
+  fp->AddInteger(optimize_for_action_cache_);
+
+  fp->AddInteger(profile_.size());
+  for (const auto& entry : profile_) {
+    fp->AddInteger(static_cast<uint32_t>(entry.first));
+    fp->AddInteger(entry.second);
+  }
+
+  for (const char* msg : kPanicMessages) {
+    fp->AddResult(panic_func_(msg));
+  }
+  fp->AddResult(policy_->InvalidSyscall());
+  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+    fp->AddInteger(sysnum);
+    fp->AddResult(EvaluateSyscall(sysnum));
+  }
+
+  if (compat_.policy) {
+    SwapAbi();
+    EvaluatePolicy();
+    fp->AddKind("CompatPolicy");
+    fp->AddInteger(kCompatArch);
+    fp->AddResult(policy_->InvalidSyscall());
+    for (uint32_t sysnum : SyscallSet::ValidOnly(abi_)) {
+      fp->AddInteger(sysnum);
+      fp->AddResult(EvaluateSyscall(sysnum));
+    }
+    SwapAbi();
+  }
+}
+
+CodeGen::Program PolicyCompiler::CompileVariant(const Policy* delta) {
+  DCHECK(delta);
+  EvaluatePolicy();
+
+  std::map<uint32_t, ResultExpr> overrides;
+  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+    ResultExpr result = delta->EvaluateSyscall(sysnum);
+    if (!result || result == syscall_results_[sysnum]) {
+      continue;
+    }
+    // Return() compiles errors differently with unsafe traps, and the
+    // memoized nodes were compiled for the policy's setting.
+    CHECK(has_unsafe_traps_ || !result->HasUnsafeTraps())
+        << "Variants may only use UnsafeTrap() if the policy does";
+    overrides.insert(std::make_pair(sysnum, result));
+  }
+
+  // Only the policy's own nodes are kept for later variants, so that
+  // compiling many variants doesn't grow the instruction DAG without
+  // bound. The policy's ranges are found first, since the nodes they
+  // lead to must come before the variant's.
+  FindAllBaseRanges();
+  const size_t num_nodes = gen_.num_nodes();
+  overrides_.swap(overrides);
+  CodeGen::Program program = Compile();
+  overrides_.clear();
+  DropNodes(num_nodes);
+  return program;
+}
+
+void PolicyCompiler::EvaluatePolicy() {
+  if (policy_evaluated_) {
+    return;
+  }
+
+  std::vector<uint32_t> sysnums;
+  for (uint32_t sysnum : SyscallSet::ValidOnly(abi_)) {
+    sysnums.push_back(sysnum);
+  }
+
+  // Evaluate system calls that aren't part of a class on |num_threads_|
+  // threads (including this one), each taking every |num_threads_|-th
+  // system call number so that expensive runs are spread out. Every
+  // thread only writes its own elements of |results|.
+  std::vector<ResultExpr> results(sysnums.size());
+  std::vector<std::unique_ptr<EvaluationWorker>> workers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 1; i < num_threads_; ++i) {
+    workers.emplace_back(
+        new EvaluationWorker(policy_, sysnums, i, num_threads_, &results));
+    threads.emplace_back(
+        new base::DelegateSimpleThread(workers.back().get(), "PolicyCompiler"));
+    threads.back()->Start();
+  }
+  EvaluationWorker(policy_, sysnums, 0, num_threads_, &results).Run();
+  for (const auto& thread : threads) {
+    thread->Join();
+  }
+
+  // Merging in order of system call numbers makes the outcome
+  // independent of the number of threads. Classes are evaluated here.
+  for (size_t i = 0; i < sysnums.size(); ++i) {
+    if (!results[i]) {
+      results[i] = EvaluateSyscall(sysnums[i]);
+    }
+    has_unsafe_traps_ = has_unsafe_traps_ || results[i]->HasUnsafeTraps();
+    syscall_results_.insert(std::make_pair(sysnums[i], results[i]));
+  }
+  has_unsafe_traps_ =
+      has_unsafe_traps_ || policy_->InvalidSyscall()->HasUnsafeTraps();
+  policy_evaluated_ = true;
+}
+
+ResultExpr PolicyCompiler::EvaluateSyscall(int sysnum) {
+  auto override_result = overrides_.find(sysnum);
+  if (override_result != overrides_.end()) {
+    return override_result->second;
+  }
+
+  auto result = syscall_results_.find(sysnum);
+  if (result != syscall_results_.end()) {
+    return result->second;
+  }
+
+  const int syscall_class = policy_->ClassifySyscall(sysnum);
+  if (syscall_class < 0) {
+    return policy_->EvaluateSyscall(sysnum);
+  }
+
+  auto it = class_results_.find(syscall_class);
+  if (it == class_results_.end()) {
+    it = class_results_
+             .insert(std::make_pair(
+                 syscall_class, policy_->EvaluateSyscallClass(syscall_class)))
+             .first;
+  }
+  // Expressions are interned, so identical results are the same object.
+  DCHECK(it->second == policy_->EvaluateSyscall(sysnum))
+      << "EvaluateSyscallClass(" << syscall_class
+      << ") doesn't match EvaluateSyscall(" << sysnum << ")";
+  return it->second;
+}
+
+void PolicyCompiler::SetNumThreads(size_t num_threads) {
+  CHECK_GE(num_threads, 1U);
+  num_threads_ = num_threads;
+}
+
+void PolicyCompiler::SetCompatPolicy(const Policy* compat_policy) {
+  CHECK(SyscallSet::HasCompatAbi())
+      << "There's no compatibility ABI on this architecture";
+  DCHECK(abi_ == SyscallSet::Abi::NATIVE);
+  DCHECK(compat_policy);
+  compat_.policy = compat_policy;
+  compat_.policy_evaluated = false;
+  compat_.syscall_results.clear();
+  compat_.class_results.clear();
+  compat_.base_ranges.clear();
 }
 
 void PolicyCompiler::DangerousSetEscapePC(uint64_t escapepc) {
@@ -130,6 +600,25 @@ void PolicyCompiler::SetPanicFunc(PanicFunc panic_func) {
   panic_func_ = panic_func;
 }
 
+void PolicyCompiler::SetSyscallProfile(const SyscallProfile& profile) {
+  profile_ = profile;
+}
+
+void PolicyCompiler::SetOptimizeForActionCache(bool optimize) {
+  optimize_for_action_cache_ = optimize;
+}
+
+void PolicyCompiler::SwapAbi() {
+  std::swap(abi_, compat_.abi);
+  std::swap(policy_, compat_.policy);
+  std::swap(policy_evaluated_, compat_.policy_evaluated);
+  syscall_results_.swap(compat_.syscall_results);
+  class_results_.swap(compat_.class_results);
+  base_ranges_.swap(compat_.base_ranges);
+  overrides_.swap(compat_.overrides);
+  profile_.swap(compat_.profile);
+}
+
 CodeGen::Node PolicyCompiler::AssemblePolicy() {
   // A compiled policy consists of three logical parts:
   //   1. Check that the "arch" field matches the expected architecture.
@@ -137,17 +626,40 @@ CodeGen::Node PolicyCompiler::AssemblePolicy() {
   //      invoked by Syscall::Call, and then allow it unconditionally.
   //   3. Check the system call number and jump to the appropriate compiled
   //      system call policy number.
-  return CheckArch(MaybeAddEscapeHatch(DispatchSyscall()));
+  //
+  // When optimizing for the kernel's action cache, steps 2 and 3 are
+  // swapped for all system calls that aren't unconditionally allowed; see
+  // AddEscapeHatchToRanges().
+  //
+  // With a compat policy, step 1 instead picks which of two jump tables
+  // step 3 uses. Unsafe traps aren't supported then, so there's no step 2.
+  // The compat jump table is dispatched first, so that the stats that
+  // DispatchSyscall() records are the native one's.
+  CodeGen::Node compat = CodeGen::kNullNode;
+  if (compat_.policy) {
+    SwapAbi();
+    compat = DispatchSyscall();
+    SwapAbi();
+  }
+  if (optimize_for_action_cache_) {
+    return CheckArch(DispatchSyscall(), compat);
+  }
+  return CheckArch(MaybeAddEscapeHatch(DispatchSyscall()), compat);
 }
 
-CodeGen::Node PolicyCompiler::CheckArch(CodeGen::Node passed) {
-  // If the architecture doesn't match SECCOMP_ARCH, disallow the
-  // system call.
+CodeGen::Node PolicyCompiler::CheckArch(CodeGen::Node passed,
+                                        CodeGen::Node compat) {
+  // If the architecture doesn't match SECCOMP_ARCH (or the compatibility
+  // ABI's), disallow the system call.
+  CodeGen::Node invalid = CompileResult(panic_func_(kInvalidArchMessage));
+  if (compat != CodeGen::kNullNode) {
+    invalid = gen_.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, kCompatArch,
+                                   compat, invalid);
+  }
   return gen_.MakeInstruction(
       BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARCH_IDX,
       gen_.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, SECCOMP_ARCH, passed,
-                           CompileResult(panic_func_(
-                               "Invalid audit architecture in BPF filter"))));
+                           invalid));
 }
 
 CodeGen::Node PolicyCompiler::MaybeAddEscapeHatch(CodeGen::Node rest) {
@@ -187,9 +699,48 @@ CodeGen::Node PolicyCompiler::DispatchSyscall() {
   // ranges of identical codes.
   Ranges ranges;
   FindRanges(&ranges);
+  const bool all_sysnums = first_sysnum_ == 0 &&
+                           last_sysnum_ == std::numeric_limits<uint32_t>::max();
+  if (!all_sysnums) {
+    // Only system calls within the bounds checked below reach the jump
+    // table, so the first and last range can be widened to cover all
+    // the others.
+    Ranges clipped;
+    ClipRanges(ranges, first_sysnum_, uint64_t{last_sysnum_} + 1, &clipped);
+    clipped[0].from = 0;
+    ranges.swap(clipped);
+  }
+  num_ranges_ = ranges.size();
+  if (optimize_for_action_cache_) {
+    AddEscapeHatchToRanges(&ranges);
+  }
+
+  layout_weights_.clear();
 
-  // Compile the system call ranges to an optimized BPF jumptable
-  CodeGen::Node jumptable = AssembleJumpTable(ranges.begin(), ranges.end());
+  // Compile the system call ranges to an optimized BPF jumptable. Bitmap
+  // tests use register X and shifts, which the kernel's action cache
+  // emulator doesn't support, so they're only used without it.
+  CodeGen::Node jumptable;
+  if (!profile_.empty()) {
+    jumptable = AssembleWeightedJumpTable(ranges);
+  } else if (optimize_for_action_cache_) {
+    jumptable = AssembleJumpTable(ranges.begin(), ranges.end());
+  } else {
+    jumptable = AssembleBitmapJumpTable(ranges);
+  }
+
+  // Allow all other system calls; they're decided by other filters.
+  if (!all_sysnums) {
+    const CodeGen::Node allow = CompileResult(Allow());
+    if (last_sysnum_ != std::numeric_limits<uint32_t>::max()) {
+      jumptable = gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K,
+                                       last_sysnum_, allow, jumptable);
+    }
+    if (first_sysnum_ != 0) {
+      jumptable = gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K,
+                                       first_sysnum_, jumptable, allow);
+    }
+  }
 
   // Grab the system call number, so that we can check it and then
   // execute the jump table.
@@ -197,13 +748,35 @@ CodeGen::Node PolicyCompiler::DispatchSyscall() {
       BPF_LD + BPF_W + BPF_ABS, SECCOMP_NR_IDX, CheckSyscallNumber(jumptable));
 }
 
+void PolicyCompiler::AddEscapeHatchToRanges(Ranges* ranges) {
+  if (!has_unsafe_traps_) {
+    return;
+  }
+
+  // The kernel can only cache a system call's result if the filter never
+  // loads anything but the "arch" and "nr" fields on its way to returning
+  // SECCOMP_RET_ALLOW. The escape hatch needs to load the instruction
+  // pointer, but it's redundant for allowed system calls anyway, so we only
+  // emit it in front of the remaining ranges.
+  const CodeGen::Node allow = CompileResult(Allow());
+  for (Range& range : *ranges) {
+    if (range.node != allow) {
+      range.node = MaybeAddEscapeHatch(range.node);
+    }
+  }
+}
+
 CodeGen::Node PolicyCompiler::CheckSyscallNumber(CodeGen::Node passed) {
   if (kIsIntel) {
     // On Intel architectures, verify that system call numbers are in the
     // expected number range.
     CodeGen::Node invalidX32 =
-        CompileResult(panic_func_("Illegal mixing of system call ABIs"));
-    if (kIsX32) {
+        CompileResult(panic_func_(kInvalidX32Message));
+    if (optimize_for_action_cache_) {
+      // The escape hatch hasn't been checked yet at this point.
+      invalidX32 = MaybeAddEscapeHatch(invalidX32);
+    }
+    if (kIsX32 && abi_ == SyscallSet::Abi::NATIVE) {
       // The newer x32 API always sets bit 30.
       return gen_.MakeInstruction(
           BPF_JMP + BPF_JSET + BPF_K, 0x40000000, passed, invalidX32);
@@ -219,33 +792,98 @@ CodeGen::Node PolicyCompiler::CheckSyscallNumber(CodeGen::Node passed) {
 }
 
 void PolicyCompiler::FindRanges(Ranges* ranges) {
+  if (base_ranges_.empty()) {
+    FindBaseRanges();
+  }
+  if (overrides_.empty()) {
+    *ranges = base_ranges_;
+    return;
+  }
+
+  // Split the policy's ranges around the overridden system calls,
+  // coalescing neighbours that lead to the same node as in
+  // FindValueRanges. This yields the same ranges as evaluating the
+  // variant from scratch, but only compiles the overridden results.
+  auto append = [ranges](uint32_t from, CodeGen::Node node) {
+    if (ranges->empty() || ranges->back().node != node) {
+      ranges->push_back(Range{from, node});
+    }
+  };
+  auto it = overrides_.begin();
+  for (size_t i = 0; i < base_ranges_.size(); ++i) {
+    const uint64_t end = i + 1 < base_ranges_.size()
+                             ? base_ranges_[i + 1].from
+                             : uint64_t{1} << 32;
+    uint64_t next = base_ranges_[i].from;
+    for (; it != overrides_.end() && it->first < end; ++it) {
+      if (it->first > next) {
+        append(next, base_ranges_[i].node);
+      }
+      append(it->first, CompileResult(it->second));
+      next = uint64_t{it->first} + 1;
+    }
+    if (next < end) {
+      append(next, base_ranges_[i].node);
+    }
+  }
+}
+
+void PolicyCompiler::FindBaseRanges() {
   // Please note that "struct seccomp_data" defines system calls as a signed
   // int32_t, but BPF instructions always operate on unsigned quantities. We
   // deal with this disparity by enumerating from MIN_SYSCALL to MAX_SYSCALL,
   // and then verifying that the rest of the number range (both positive and
   // negative) all return the same Node.
   const CodeGen::Node invalid_node = CompileResult(policy_->InvalidSyscall());
+  auto node_for = [this, invalid_node](uint32_t sysnum) {
+    return SyscallSet::IsValid(sysnum, abi_)
+               ? CompileResult(syscall_results_[sysnum])
+               : invalid_node;
+  };
   uint32_t old_sysnum = 0;
-  CodeGen::Node old_node =
-      SyscallSet::IsValid(old_sysnum)
-          ? CompileResult(policy_->EvaluateSyscall(old_sysnum))
-          : invalid_node;
+  CodeGen::Node old_node = node_for(old_sysnum);
 
-  for (uint32_t sysnum : SyscallSet::All()) {
-    CodeGen::Node node =
-        SyscallSet::IsValid(sysnum)
-            ? CompileResult(policy_->EvaluateSyscall(static_cast<int>(sysnum)))
-            : invalid_node;
+  for (uint32_t sysnum : SyscallSet::All(abi_)) {
+    CodeGen::Node node = node_for(sysnum);
     // N.B., here we rely on CodeGen folding (i.e., returning the same
     // node value for) identical code sequences, otherwise our jump
     // table will blow up in size.
     if (node != old_node) {
-      ranges->push_back(Range{old_sysnum, old_node});
+      base_ranges_.push_back(Range{old_sysnum, old_node});
       old_sysnum = sysnum;
       old_node = node;
     }
   }
-  ranges->push_back(Range{old_sysnum, old_node});
+  base_ranges_.push_back(Range{old_sysnum, old_node});
+}
+
+void PolicyCompiler::FindAllBaseRanges() {
+  if (base_ranges_.empty()) {
+    FindBaseRanges();
+  }
+  if (compat_.policy) {
+    SwapAbi();
+    EvaluatePolicy();
+    if (base_ranges_.empty()) {
+      FindBaseRanges();
+    }
+    SwapAbi();
+  }
+}
+
+void PolicyCompiler::DropNodes(size_t num_nodes) {
+  gen_.Truncate(num_nodes);
+  for (auto it = compiled_results_.begin(); it != compiled_results_.end();) {
+    if (it->second >= num_nodes) {
+      it = compiled_results_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (unexpected_64bit_argument_ >= num_nodes) {
+    unexpected_64bit_argument_ = CodeGen::kNullNode;
+  }
+  layout_weights_.clear();
 }
 
 CodeGen::Node PolicyCompiler::AssembleJumpTable(Ranges::const_iterator start,
@@ -274,8 +912,289 @@ CodeGen::Node PolicyCompiler::AssembleJumpTable(Ranges::const_iterator start,
   return gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, mid->from, jt, jf);
 }
 
+CodeGen::Node PolicyCompiler::AssembleWeightedJumpTable(const Ranges& ranges) {
+  CHECK(!ranges.empty()) << "Invalid range list";
+  const size_t n = ranges.size();
+
+  // Accumulate the profile's frequencies into per-range weights. Every
+  // range gets a base weight of 1 so that cold ranges are still laid out
+  // as a balanced tree, while scaling the profiled frequencies by |n|
+  // ensures that a single hot range outweighs all the cold ones together.
+  std::vector<uint64_t> weights(n, 1);
+  for (const auto& entry : profile_) {
+    const uint32_t sysnum = static_cast<uint32_t>(entry.first);
+    auto it = std::upper_bound(
+        ranges.begin(), ranges.end(), sysnum,
+        [](uint32_t num, const Range& range) { return num < range.from; });
+    CHECK(it != ranges.begin());
+    weights[(it - ranges.begin()) - 1] += entry.second * n;
+    layout_weights_[(it - 1)->node] += entry.second;
+  }
+
+  std::vector<uint64_t> prefix(n + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    prefix[i + 1] = prefix[i] + weights[i];
+  }
+
+  // Each leaf's cost is its weight times its depth (i.e., the number of
+  // comparisons needed to reach it), so finding the cheapest layout is
+  // the classic optimal binary search tree problem with all weight on
+  // the leaves. We solve it with Knuth's O(n^2) dynamic programming
+  // algorithm, which relies on the optimal split point of [i, j) lying
+  // between those of [i, j - 1) and [i + 1, j).
+  //
+  // cost[i * (n + 1) + j] is the minimal cost of a search tree over
+  // ranges [i, j), and roots[i * (n + 1) + j] is the range at which that
+  // tree compares first.
+  std::vector<uint64_t> cost((n + 1) * (n + 1), 0);
+  std::vector<size_t> roots((n + 1) * (n + 1), 0);
+  auto index = [n](size_t i, size_t j) { return i * (n + 1) + j; };
+  for (size_t len = 2; len <= n; ++len) {
+    for (size_t i = 0; i + len <= n; ++i) {
+      const size_t j = i + len;
+      const size_t lo = len == 2 ? i + 1 : roots[index(i, j - 1)];
+      const size_t hi = len == 2 ? i + 1 : roots[index(i + 1, j)];
+      uint64_t best = std::numeric_limits<uint64_t>::max();
+      for (size_t k = lo; k <= hi; ++k) {
+        const uint64_t c = cost[index(i, k)] + cost[index(k, j)];
+        if (c < best) {
+          best = c;
+          roots[index(i, j)] = k;
+        }
+      }
+      cost[index(i, j)] = best + (prefix[j] - prefix[i]);
+    }
+  }
+
+  return AssembleSearchTree(ranges, roots, 0, n);
+}
+
+CodeGen::Node PolicyCompiler::AssembleSearchTree(
+    const Ranges& ranges,
+    const std::vector<size_t>& roots,
+    size_t begin,
+    size_t end) {
+  CHECK_LT(begin, end) << "Invalid range indices";
+  if (end - begin == 1) {
+    return ranges[begin].node;
+  }
+
+  // Same as AssembleJumpTable, except that the split point comes from
+  // the precomputed table instead of always being the mid point.
+  const size_t mid = roots[begin * (ranges.size() + 1) + end];
+  CodeGen::Node jf = AssembleSearchTree(ranges, roots, begin, mid);
+  CodeGen::Node jt = AssembleSearchTree(ranges, roots, mid, end);
+  return gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, ranges[mid].from, jt,
+                              jf);
+}
+
+CodeGen::Node PolicyCompiler::AssembleBitmapJumpTable(const Ranges& ranges) {
+  // Buckets qualify for a bitmap test if their system calls lead to just
+  // two distinct nodes, and if the test is no longer than the binary
+  // search it replaces (which also means it's much shorter overall).
+  std::vector<std::pair<size_t, uint32_t>> candidates;
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    const uint32_t base = ranges[i].from & ~(kBitmapBucketSize - 1);
+    if (i > 1 && (ranges[i - 1].from & ~(kBitmapBucketSize - 1)) == base) {
+      continue;
+    }
+    Ranges pieces;
+    ClipRanges(ranges, base, uint64_t{base} + kBitmapBucketSize, &pieces);
+    std::set<CodeGen::Node> nodes;
+    for (const Range& piece : pieces) {
+      nodes.insert(piece.node);
+    }
+    if (nodes.size() == 2 &&
+        CeilLog2(pieces.size()) >= BitmapTestLength(base)) {
+      candidates.push_back(std::make_pair(pieces.size(), base));
+    }
+  }
+
+  // Start out converting all of them, and then give up on the buckets
+  // with the fewest ranges until the worst-case path through the jump
+  // table is no longer than without any bitmap tests.
+  std::sort(candidates.begin(), candidates.end());
+  std::set<uint32_t> buckets;
+  for (const auto& candidate : candidates) {
+    buckets.insert(candidate.second);
+  }
+  const uint32_t max_depth = CeilLog2(ranges.size());
+  for (const auto& candidate : candidates) {
+    Ranges items;
+    std::vector<uint64_t> slots;
+    LayoutBitmapJumpTable(ranges, buckets, &items, &slots);
+    if (CeilLog2(slots.back()) <= max_depth) {
+      break;
+    }
+    buckets.erase(candidate.second);
+  }
+
+  if (buckets.empty()) {
+    return AssembleJumpTable(ranges.begin(), ranges.end());
+  }
+
+  Ranges items;
+  std::vector<uint64_t> slots;
+  LayoutBitmapJumpTable(ranges, buckets, &items, &slots);
+  for (Range& item : items) {
+    if (item.node == CodeGen::kNullNode) {
+      Ranges pieces;
+      ClipRanges(ranges, item.from, uint64_t{item.from} + kBitmapBucketSize,
+                 &pieces);
+      item.node = AssembleBitmapBucket(pieces);
+    }
+  }
+  return AssembleBitmapSearchTree(items, slots, 0, items.size(), 0,
+                                  uint64_t{1} << CeilLog2(slots.back()));
+}
+
+void PolicyCompiler::ClipRanges(const Ranges& ranges,
+                                uint64_t lo,
+                                uint64_t hi,
+                                Ranges* pieces) {
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), lo,
+      [](uint64_t num, const Range& range) { return num < range.from; });
+  CHECK(it != ranges.begin());
+  pieces->push_back(Range{static_cast<uint32_t>(lo), (it - 1)->node});
+  for (; it != ranges.end() && it->from < hi; ++it) {
+    pieces->push_back(*it);
+  }
+}
+
+void PolicyCompiler::LayoutBitmapJumpTable(const Ranges& ranges,
+                                           const std::set<uint32_t>& buckets,
+                                           Ranges* items,
+                                           std::vector<uint64_t>* slots) {
+  // Each bucket becomes a single item, with a null node as placeholder
+  // for its bitmap test; the ranges around it are clipped to its bounds.
+  uint64_t pos = 0;
+  for (uint32_t base : buckets) {
+    if (pos < base) {
+      ClipRanges(ranges, pos, base, items);
+    }
+    items->push_back(Range{base, CodeGen::kNullNode});
+    pos = uint64_t{base} + kBitmapBucketSize;
+  }
+  if (pos <= std::numeric_limits<uint32_t>::max()) {
+    ClipRanges(ranges, pos, uint64_t{1} << 32, items);
+  }
+
+  // Think of the leaves of a complete binary search tree as slots. An
+  // item that takes n more instructions after the search must be at
+  // least n levels further up, i.e. occupy 2^n slots (aligned to that
+  // size). Packing the items into the leftmost possible slots yields the
+  // shallowest such tree.
+  slots->clear();
+  uint64_t slot = 0;
+  for (const Range& item : *items) {
+    const uint64_t size =
+        uint64_t{1}
+        << (item.node == CodeGen::kNullNode ? BitmapTestLength(item.from) : 0);
+    slot = (slot + size - 1) & ~(size - 1);
+    slots->push_back(slot);
+    slot += size;
+  }
+  slots->push_back(slot);
+}
+
+CodeGen::Node PolicyCompiler::AssembleBitmapBucket(const Ranges& pieces) {
+  // Register A holds a system call number within the bucket starting at
+  // |pieces|[0].from, which has been checked to only lead to two distinct
+  // nodes. Set a bit for every number that leads to the first one.
+  const uint32_t base = pieces[0].from;
+  const CodeGen::Node passed = pieces[0].node;
+  CodeGen::Node failed = CodeGen::kNullNode;
+  uint32_t bitmap = 0;
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    if (pieces[i].node != passed) {
+      failed = pieces[i].node;
+      continue;
+    }
+    const uint32_t end =
+        i + 1 < pieces.size() ? pieces[i + 1].from - base : kBitmapBucketSize;
+    for (uint32_t bit = pieces[i].from - base; bit < end; ++bit) {
+      bitmap |= 1U << bit;
+    }
+  }
+  CHECK_NE(CodeGen::kNullNode, failed);
+
+  CodeGen::Node test = BitmapTest(bitmap, passed, failed);
+  if (base != 0) {
+    test = gen_.MakeInstruction(BPF_ALU + BPF_AND + BPF_K,
+                                kBitmapBucketSize - 1, test);
+  }
+  return test;
+}
+
+CodeGen::Node PolicyCompiler::AssembleBitmapSearchTree(
+    const Ranges& items,
+    const std::vector<uint64_t>& slots,
+    size_t begin,
+    size_t end,
+    uint64_t first_slot,
+    uint64_t num_slots) {
+  CHECK_LT(begin, end) << "Invalid range indices";
+  if (end - begin == 1) {
+    return items[begin].node;
+  }
+
+  // Split the slots in half. If all the items are on one side, there's
+  // no need to compare against anything.
+  const uint64_t half = num_slots / 2;
+  size_t mid = begin;
+  while (mid < end && slots[mid] < first_slot + half) {
+    ++mid;
+  }
+  if (mid == end) {
+    return AssembleBitmapSearchTree(items, slots, begin, end, first_slot,
+                                    half);
+  }
+  if (mid == begin) {
+    return AssembleBitmapSearchTree(items, slots, begin, end,
+                                    first_slot + half, half);
+  }
+  CodeGen::Node jf =
+      AssembleBitmapSearchTree(items, slots, begin, mid, first_slot, half);
+  CodeGen::Node jt = AssembleBitmapSearchTree(items, slots, mid, end,
+                                              first_slot + half, half);
+  return gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, items[mid].from, jt,
+                              jf);
+}
+
+CodeGen::Node PolicyCompiler::BitmapTest(uint32_t bitmap,
+                                         CodeGen::Node passed,
+                                         CodeGen::Node failed) {
+  return gen_.MakeInstruction(
+      BPF_MISC + BPF_TAX, 0,
+      gen_.MakeInstruction(
+          BPF_LD + BPF_W + BPF_IMM, 1,
+          gen_.MakeInstruction(BPF_ALU + BPF_LSH + BPF_X, 0,
+                               gen_.MakeInstruction(BPF_JMP + BPF_JSET + BPF_K,
+                                                    bitmap, passed, failed))));
+}
+
 CodeGen::Node PolicyCompiler::CompileResult(const ResultExpr& res) {
-  return res->Compile(this);
+  auto it = compiled_results_.find(res);
+  if (it != compiled_results_.end()) {
+    return it->second;
+  }
+
+  // Compiling the result records which 32-bit arguments it inspects, so
+  // that we can validate their upper halves just once up front, rather
+  // than before every comparison. Result expressions may be compiled
+  // recursively (e.g., for the panic handler), so save the outer set.
+  const uint32_t outer_narrow_args = narrow_args_;
+  narrow_args_ = 0;
+  CodeGen::Node node = res->Compile(this);
+  for (int argno = 5; argno >= 0; --argno) {
+    if (narrow_args_ & (1U << argno)) {
+      node = CheckArgumentWidth(argno, node);
+    }
+  }
+  narrow_args_ = outer_narrow_args;
+  compiled_results_.insert(std::make_pair(res, node));
+  return node;
 }
 
 CodeGen::Node PolicyCompiler::MaskedEqual(int argno,
@@ -297,6 +1216,14 @@ CodeGen::Node PolicyCompiler::MaskedEqual(int argno,
     CHECK_EQ(0U, value >> 32) << "Value exceeds argument size";
   }
 
+  // The upper 32-bits of 32-bit arguments are validated once by
+  // CompileResult, so only the lower 32-bits need to be tested here.
+  if (width == 4) {
+    narrow_args_ |= 1U << argno;
+    return MaskedEqualHalf(argno, width, mask, value, ArgHalf::LOWER, passed,
+                           failed);
+  }
+
   // We want to emit code to check "(arg & mask) == value" where arg, mask, and
   // value are 64-bit values, but the BPF machine is only 32-bit. We implement
   // this by independently testing the upper and lower 32-bits and continuing to
@@ -314,56 +1241,7 @@ CodeGen::Node PolicyCompiler::MaskedEqualHalf(int argno,
                                               ArgHalf half,
                                               CodeGen::Node passed,
                                               CodeGen::Node failed) {
-  if (width == 4 && half == ArgHalf::UPPER) {
-    // Special logic for sanity checking the upper 32-bits of 32-bit system
-    // call arguments.
-
-    // TODO(mdempsky): Compile Unexpected64bitArgument() just per program.
-    CodeGen::Node invalid_64bit = Unexpected64bitArgument();
-
-    const uint32_t upper = SECCOMP_ARG_MSB_IDX(argno);
-    const uint32_t lower = SECCOMP_ARG_LSB_IDX(argno);
-
-    if (sizeof(void*) == 4) {
-      // On 32-bit platforms, the upper 32-bits should always be 0:
-      //   LDW  [upper]
-      //   JEQ  0, passed, invalid
-      return gen_.MakeInstruction(
-          BPF_LD + BPF_W + BPF_ABS,
-          upper,
-          gen_.MakeInstruction(
-              BPF_JMP + BPF_JEQ + BPF_K, 0, passed, invalid_64bit));
-    }
-
-    // On 64-bit platforms, the upper 32-bits may be 0 or ~0; but we only allow
-    // ~0 if the sign bit of the lower 32-bits is set too:
-    //   LDW  [upper]
-    //   JEQ  0, passed, (next)
-    //   JEQ  ~0, (next), invalid
-    //   LDW  [lower]
-    //   JSET (1<<31), passed, invalid
-    //
-    // TODO(mdempsky): The JSET instruction could perhaps jump to passed->next
-    // instead, as the first instruction of passed should be "LDW [lower]".
-    return gen_.MakeInstruction(
-        BPF_LD + BPF_W + BPF_ABS,
-        upper,
-        gen_.MakeInstruction(
-            BPF_JMP + BPF_JEQ + BPF_K,
-            0,
-            passed,
-            gen_.MakeInstruction(
-                BPF_JMP + BPF_JEQ + BPF_K,
-                std::numeric_limits<uint32_t>::max(),
-                gen_.MakeInstruction(
-                    BPF_LD + BPF_W + BPF_ABS,
-                    lower,
-                    gen_.MakeInstruction(BPF_JMP + BPF_JSET + BPF_K,
-                                         1U << 31,
-                                         passed,
-                                         invalid_64bit)),
-                invalid_64bit)));
-  }
+  DCHECK(width == 8 || half == ArgHalf::LOWER);
 
   const uint32_t idx = (half == ArgHalf::UPPER) ? SECCOMP_ARG_MSB_IDX(argno)
                                                 : SECCOMP_ARG_LSB_IDX(argno);
@@ -424,8 +1302,381 @@ CodeGen::Node PolicyCompiler::MaskedEqualHalf(int argno,
               BPF_JMP + BPF_JEQ + BPF_K, value, passed, failed)));
 }
 
+CodeGen::Node PolicyCompiler::MaskedSwitch(
+    int argno,
+    size_t width,
+    uint64_t mask,
+    const std::map<uint64_t, CodeGen::Node>& cases,
+    CodeGen::Node default_node) {
+  CheckArgument(argno, width, mask);
+  for (const auto& c : cases) {
+    CHECK_EQ(c.first, c.first & mask) << "Value contains masked out bits";
+  }
+
+  if (cases.empty()) {
+    return default_node;
+  }
+
+  // As in MaskedEqual, the upper 32-bits of 32-bit arguments are
+  // validated once by CompileResult.
+  if (width == 4) {
+    narrow_args_ |= 1U << argno;
+    std::map<uint32_t, CodeGen::Node> lower_cases;
+    for (const auto& c : cases) {
+      lower_cases[c.first] = c.second;
+    }
+    return MaskedSwitchHalf(SECCOMP_ARG_LSB_IDX(argno),
+                            static_cast<uint32_t>(mask), lower_cases,
+                            default_node);
+  }
+
+  // For 64-bit arguments, first dispatch on the upper 32-bits, and then
+  // on the lower 32-bits among the values that share them.
+  std::map<uint32_t, std::map<uint32_t, CodeGen::Node>> lower_cases;
+  for (const auto& c : cases) {
+    lower_cases[c.first >> 32][static_cast<uint32_t>(c.first)] = c.second;
+  }
+  std::map<uint32_t, CodeGen::Node> upper_cases;
+  for (const auto& group : lower_cases) {
+    upper_cases[group.first] =
+        MaskedSwitchHalf(SECCOMP_ARG_LSB_IDX(argno),
+                         static_cast<uint32_t>(mask), group.second,
+                         default_node);
+  }
+  return MaskedSwitchHalf(SECCOMP_ARG_MSB_IDX(argno), mask >> 32, upper_cases,
+                          default_node);
+}
+
+CodeGen::Node PolicyCompiler::MaskedSwitchHalf(
+    uint32_t idx,
+    uint32_t mask,
+    const std::map<uint32_t, CodeGen::Node>& cases,
+    CodeGen::Node default_node) {
+  // If the half is masked out entirely, its value is always 0.
+  if (mask == 0) {
+    CHECK_EQ(1U, cases.size());
+    CHECK_EQ(0U, cases.begin()->first);
+    return cases.begin()->second;
+  }
+
+  CodeGen::Node search;
+  if (cases.size() <= kMaxLinearSwitchCases) {
+    // For a handful of values, a chain of equality tests is no slower
+    // than a search tree, and shorter:
+    //   JEQ  value1, node1, (next)
+    //   JEQ  value2, node2, (next)
+    //   ...
+    search = default_node;
+    for (auto it = cases.rbegin(); it != cases.rend(); ++it) {
+      if (it->second == default_node) {
+        continue;
+      }
+      search = gen_.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, it->first,
+                                    it->second, search);
+    }
+  } else {
+    Ranges ranges;
+    FindValueRanges(cases, default_node, &ranges);
+    search = AssembleValueSearch(ranges, 0, ranges.size());
+  }
+
+  if (search == default_node) {
+    return search;
+  }
+  return LoadArgHalf(idx, mask, search);
+}
+
+void PolicyCompiler::FindValueRanges(
+    const std::map<uint32_t, CodeGen::Node>& cases,
+    CodeGen::Node default_node,
+    Ranges* ranges) {
+  // Partition the 32-bit value space into ranges, coalescing adjacent
+  // values (and gaps) that lead to the same node.
+  auto append = [ranges](uint32_t from, CodeGen::Node node) {
+    if (ranges->empty() || ranges->back().node != node) {
+      ranges->push_back(Range{from, node});
+    }
+  };
+  uint64_t next = 0;
+  for (const auto& c : cases) {
+    if (c.first > next) {
+      append(next, default_node);
+    }
+    append(c.first, c.second);
+    next = static_cast<uint64_t>(c.first) + 1;
+  }
+  if (next <= std::numeric_limits<uint32_t>::max()) {
+    append(next, default_node);
+  }
+}
+
+CodeGen::Node PolicyCompiler::AssembleValueSearch(const Ranges& ranges,
+                                                  size_t begin,
+                                                  size_t end) {
+  CHECK_LT(begin, end) << "Invalid range indices";
+  if (end - begin == 1) {
+    return ranges[begin].node;
+  }
+
+  // A single value surrounded by ranges that lead to the same node only
+  // needs an equality test:
+  //   JEQ  value, node, surrounding
+  if (end - begin == 3 && ranges[begin].node == ranges[begin + 2].node &&
+      ranges[begin + 1].from + 1 == ranges[begin + 2].from) {
+    return gen_.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K,
+                                ranges[begin + 1].from, ranges[begin + 1].node,
+                                ranges[begin].node);
+  }
+
+  // Otherwise, split in half as in AssembleJumpTable. Keeping an odd
+  // number of ranges on the left side preserves the "gap, value, gap"
+  // triples that the special case above handles.
+  size_t mid = begin + (end - begin) / 2;
+  if ((mid - begin) % 2 == 0 && mid - begin > 1) {
+    --mid;
+  }
+  CodeGen::Node jf = AssembleValueSearch(ranges, begin, mid);
+  CodeGen::Node jt = AssembleValueSearch(ranges, mid, end);
+  return gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, ranges[mid].from, jt,
+                              jf);
+}
+
+CodeGen::Node PolicyCompiler::MaskedInRange(int argno,
+                                            size_t width,
+                                            uint64_t mask,
+                                            uint64_t lo,
+                                            uint64_t hi,
+                                            CodeGen::Node passed,
+                                            CodeGen::Node failed) {
+  CheckArgument(argno, width, mask);
+  CHECK_LE(lo, hi) << "Empty range";
+  const uint64_t max = (width == 4) ? std::numeric_limits<uint32_t>::max()
+                                    : std::numeric_limits<uint64_t>::max();
+  CHECK_LE(hi, max) << "Range exceeds argument size";
+
+  if (lo == 0 && hi == max) {
+    return passed;
+  }
+
+  if (width == 4) {
+    // As in MaskedEqual, the upper 32-bits of 32-bit arguments are
+    // validated once by CompileResult.
+    narrow_args_ |= 1U << argno;
+
+    CodeGen::Node test;
+    if (lo == hi) {
+      //   JEQ  lo, passed, failed
+      test = gen_.MakeInstruction(BPF_JMP + BPF_JEQ + BPF_K, lo, passed,
+                                  failed);
+    } else if (lo == 0) {
+      //   JGT  hi, failed, passed
+      test = gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K, hi, failed,
+                                  passed);
+    } else if (hi == max) {
+      //   JGE  lo, passed, failed
+      test = gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, lo, passed,
+                                  failed);
+    } else {
+      //   JGE  lo, (next), failed
+      //   JGT  hi, failed, passed
+      test = gen_.MakeInstruction(
+          BPF_JMP + BPF_JGE + BPF_K, lo,
+          gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K, hi, failed, passed),
+          failed);
+    }
+    return LoadArgHalf(SECCOMP_ARG_LSB_IDX(argno), mask, test);
+  }
+
+  // For 64-bit arguments, test each bound separately across both halves.
+  CodeGen::Node node = passed;
+  if (hi != max) {
+    node = ArgAtMost(argno, mask, hi, node, failed);
+  }
+  if (lo != 0) {
+    node = ArgAtLeast(argno, mask, lo, node, failed);
+  }
+  return node;
+}
+
+CodeGen::Node PolicyCompiler::MaskedIn(int argno,
+                                       size_t width,
+                                       uint64_t mask,
+                                       const std::vector<uint64_t>& values,
+                                       CodeGen::Node passed,
+                                       CodeGen::Node failed) {
+  CheckArgument(argno, width, mask);
+  std::map<uint64_t, CodeGen::Node> cases;
+  for (uint64_t value : values) {
+    CHECK_EQ(value, value & mask) << "Value contains masked out bits";
+    cases[value] = passed;
+  }
+
+  if (width != 4 || cases.size() <= kMaxLinearSwitchCases ||
+      cases.rbegin()->first - cases.begin()->first >= 32) {
+    return MaskedSwitch(argno, width, mask, cases, failed);
+  }
+
+  // As in MaskedEqual, the upper 32-bits of 32-bit arguments are
+  // validated once by CompileResult.
+  narrow_args_ |= 1U << argno;
+
+  // The values all fit within a 32-bit window starting at |base|, so we
+  // test for membership by shifting a bit into place:
+  //   LDW  [lower]
+  //   AND  mask            (if needed)
+  //   SUB  base            (if needed)
+  //   JGT  span, failed, (next)
+  //   TAX
+  //   LD   #1
+  //   LSH  X
+  //   JSET bitmap, passed, failed
+  const uint32_t base = cases.begin()->first;
+  const uint32_t span = cases.rbegin()->first - base;
+  uint32_t bitmap = 0;
+  for (const auto& c : cases) {
+    bitmap |= 1U << (c.first - base);
+  }
+
+  CodeGen::Node test = BitmapTest(bitmap, passed, failed);
+  // Subtracting |base| wraps values below it around to large ones, so the
+  // bounds check below still rejects them.
+  test = gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K, span, failed, test);
+  if (base != 0) {
+    test = gen_.MakeInstruction(BPF_ALU + BPF_SUB + BPF_K, base, test);
+  }
+  return LoadArgHalf(SECCOMP_ARG_LSB_IDX(argno), mask, test);
+}
+
+CodeGen::Node PolicyCompiler::ArgAtLeast(int argno,
+                                         uint64_t mask,
+                                         uint64_t value,
+                                         CodeGen::Node passed,
+                                         CodeGen::Node failed) {
+  const uint32_t upper = value >> 32;
+  const uint32_t lower = value;
+
+  // If the lower 32-bits don't matter, emit:
+  //   LDW  [upper]
+  //   JGE  upper, passed, failed
+  if (lower == 0) {
+    return LoadArgHalf(
+        SECCOMP_ARG_MSB_IDX(argno), mask >> 32,
+        gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K, upper, passed, failed));
+  }
+
+  // Otherwise, only compare the lower 32-bits if the upper 32-bits tie:
+  //   LDW  [upper]
+  //   JGT  upper, passed, (next)
+  //   JEQ  upper, (next), failed
+  //   LDW  [lower]
+  //   JGE  lower, passed, failed
+  return LoadArgHalf(
+      SECCOMP_ARG_MSB_IDX(argno), mask >> 32,
+      gen_.MakeInstruction(
+          BPF_JMP + BPF_JGT + BPF_K, upper, passed,
+          gen_.MakeInstruction(
+              BPF_JMP + BPF_JEQ + BPF_K, upper,
+              LoadArgHalf(SECCOMP_ARG_LSB_IDX(argno), mask,
+                          gen_.MakeInstruction(BPF_JMP + BPF_JGE + BPF_K,
+                                               lower, passed, failed)),
+              failed)));
+}
+
+CodeGen::Node PolicyCompiler::ArgAtMost(int argno,
+                                        uint64_t mask,
+                                        uint64_t value,
+                                        CodeGen::Node passed,
+                                        CodeGen::Node failed) {
+  const uint32_t upper = value >> 32;
+  const uint32_t lower = value;
+
+  // If the lower 32-bits don't matter, emit:
+  //   LDW  [upper]
+  //   JGT  upper, failed, passed
+  if (lower == std::numeric_limits<uint32_t>::max()) {
+    return LoadArgHalf(
+        SECCOMP_ARG_MSB_IDX(argno), mask >> 32,
+        gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K, upper, failed, passed));
+  }
+
+  // Otherwise, only compare the lower 32-bits if the upper 32-bits tie:
+  //   LDW  [upper]
+  //   JGT  upper, failed, (next)
+  //   JEQ  upper, (next), passed
+  //   LDW  [lower]
+  //   JGT  lower, failed, passed
+  return LoadArgHalf(
+      SECCOMP_ARG_MSB_IDX(argno), mask >> 32,
+      gen_.MakeInstruction(
+          BPF_JMP + BPF_JGT + BPF_K, upper, failed,
+          gen_.MakeInstruction(
+              BPF_JMP + BPF_JEQ + BPF_K, upper,
+              LoadArgHalf(SECCOMP_ARG_LSB_IDX(argno), mask,
+                          gen_.MakeInstruction(BPF_JMP + BPF_JGT + BPF_K,
+                                               lower, failed, passed)),
+              passed)));
+}
+
+CodeGen::Node PolicyCompiler::LoadArgHalf(uint32_t idx,
+                                          uint32_t mask,
+                                          CodeGen::Node next) {
+  if (mask != std::numeric_limits<uint32_t>::max()) {
+    next = gen_.MakeInstruction(BPF_ALU + BPF_AND + BPF_K, mask, next);
+  }
+  return gen_.MakeInstruction(BPF_LD + BPF_W + BPF_ABS, idx, next);
+}
+
+CodeGen::Node PolicyCompiler::CheckArgumentWidth(int argno,
+                                                 CodeGen::Node passed) {
+  CodeGen::Node invalid_64bit = Unexpected64bitArgument();
+
+  const uint32_t upper = SECCOMP_ARG_MSB_IDX(argno);
+  const uint32_t lower = SECCOMP_ARG_LSB_IDX(argno);
+
+  if (sizeof(void*) == 4) {
+    // On 32-bit platforms, the upper 32-bits should always be 0:
+    //   LDW  [upper]
+    //   JEQ  0, passed, invalid
+    return gen_.MakeInstruction(
+        BPF_LD + BPF_W + BPF_ABS,
+        upper,
+        gen_.MakeInstruction(
+            BPF_JMP + BPF_JEQ + BPF_K, 0, passed, invalid_64bit));
+  }
+
+  // On 64-bit platforms, the upper 32-bits may be 0 or ~0; but we only allow
+  // ~0 if the sign bit of the lower 32-bits is set too:
+  //   LDW  [upper]
+  //   JEQ  0, passed, (next)
+  //   JEQ  ~0, (next), invalid
+  //   LDW  [lower]
+  //   JSET (1<<31), passed, invalid
+  return gen_.MakeInstruction(
+      BPF_LD + BPF_W + BPF_ABS,
+      upper,
+      gen_.MakeInstruction(
+          BPF_JMP + BPF_JEQ + BPF_K,
+          0,
+          passed,
+          gen_.MakeInstruction(
+              BPF_JMP + BPF_JEQ + BPF_K,
+              std::numeric_limits<uint32_t>::max(),
+              gen_.MakeInstruction(
+                  BPF_LD + BPF_W + BPF_ABS,
+                  lower,
+                  gen_.MakeInstruction(BPF_JMP + BPF_JSET + BPF_K,
+                                       1U << 31,
+                                       passed,
+                                       invalid_64bit)),
+              invalid_64bit)));
+}
+
 CodeGen::Node PolicyCompiler::Unexpected64bitArgument() {
-  return CompileResult(panic_func_("Unexpected 64bit argument detected"));
+  if (unexpected_64bit_argument_ == CodeGen::kNullNode) {
+    unexpected_64bit_argument_ =
+        CompileResult(panic_func_(kUnexpected64bitMessage));
+  }
+  return unexpected_64bit_argument_;
 }
 
 CodeGen::Node PolicyCompiler::Return(uint32_t ret) {
@@ -453,6 +1704,10 @@ CodeGen::Node PolicyCompiler::Trap(TrapRegistry::TrapFnc fnc,
   return gen_.MakeInstruction(BPF_RET + BPF_K, SECCOMP_RET_TRAP + trap_id);
 }
 
+ResultExpr PolicyCompiler::DefaultPanic(const char* error) {
+  return Kill();
+}
+
 bool PolicyCompiler::IsRequiredForUnsafeTrap(int sysno) {
   for (size_t i = 0; i < arraysize(kSyscallsRequiredForUnsafeTraps); ++i) {
     if (sysno == kSyscallsRequiredForUnsafeTraps[i]) {
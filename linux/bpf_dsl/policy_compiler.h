@@ -8,17 +8,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <map>
+#include <set>
 #include <vector>
 
 #include "base/macros.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
 #include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
 #include "sandbox/linux/bpf_dsl/trap_registry.h"
 #include "sandbox/sandbox_export.h"
 
 namespace sandbox {
 namespace bpf_dsl {
 class Policy;
+class PolicyFingerprint;
+class ProgramCache;
 
 // PolicyCompiler implements the bpf_dsl compiler, allowing users to
 // transform bpf_dsl policies into BPF programs to be executed by the
@@ -27,6 +32,55 @@ class SANDBOX_EXPORT PolicyCompiler {
  public:
   using PanicFunc = bpf_dsl::ResultExpr (*)(const char* error);
 
+  // SyscallProfile maps system call numbers to their relative invocation
+  // frequencies (e.g., counts sampled from a representative workload).
+  // System calls that are absent from the profile are assumed to be cold.
+  using SyscallProfile = std::map<int, uint64_t>;
+
+  // Stats describes the cost of a compiled program.
+  struct SANDBOX_EXPORT Stats {
+    // PathLength is the number of instructions executed along the
+    // shortest and the longest path for a system call number.
+    struct PathLength {
+      size_t min;
+      size_t max;
+    };
+
+    Stats();
+    ~Stats();
+
+    // Total number of instructions in the program.
+    size_t instructions;
+
+    // Number of JA instructions that CodeGen inserted as trampolines for
+    // branches whose targets were out of range.
+    size_t jump_trampolines;
+
+    // Number of JA instructions that laying out the program saved,
+    // compared to emitting its instructions in the order that the
+    // compiler created them in.
+    size_t jump_trampolines_saved;
+
+    // Number of system call number ranges that the jump table
+    // distinguishes between.
+    size_t ranges;
+
+    // Path lengths for every system call number in SyscallSet::All(), as
+    // computed by Verifier::PathLengths.
+    std::map<uint32_t, PathLength> path_lengths;
+  };
+
+  // Filter is one of the programs that CompileSplit returns, which
+  // decides system call numbers [first, last] and allows all others.
+  struct SANDBOX_EXPORT Filter {
+    Filter();
+    ~Filter();
+
+    uint32_t first;
+    uint32_t last;
+    CodeGen::Program program;
+  };
+
   PolicyCompiler(const Policy* policy, TrapRegistry* registry);
   ~PolicyCompiler();
 
@@ -34,6 +88,73 @@ class SANDBOX_EXPORT PolicyCompiler {
   // compiles the policy to a BPF program, which it returns.
   CodeGen::Program Compile();
 
+  // Same as above, but also fills in |stats| for the compiled program.
+  // Computing the path lengths walks the program once for every system
+  // call, so this is meant for tests and tools rather than sandbox
+  // startup.
+  CodeGen::Program Compile(Stats* stats);
+
+  // CompileSplit is like Compile, except that if the program would be
+  // longer than |max_instructions| (at most BPF_MAXINSNS), it splits the
+  // system call numbers into ranges and returns a Filter for each, in
+  // ascending order. Every system call number is decided by exactly one
+  // of the filters like the whole program would, and allowed by all the
+  // others, so installed as stacked seccomp filters, they behave the same
+  // as the whole program. Since every system call passes through all of
+  // them, the ranges are made as large as possible to keep their number
+  // low; the other filters only take a few instructions to allow a
+  // system call. It's a fatal error if a single range of system calls
+  // that share a result doesn't fit.
+  std::vector<Filter> CompileSplit(size_t max_instructions);
+
+  // CompileCached is like Compile, except that it first looks for a
+  // program compiled from an identical policy in |cache|, and stores the
+  // compiled program there otherwise. The policy still needs to be
+  // evaluated for every system call to look it up, but it isn't compiled.
+  // Policies with unsafe traps depend on the process's escape PC, so they
+  // are always compiled from scratch.
+  CodeGen::Program CompileCached(ProgramCache* cache);
+
+  // Fingerprint adds everything that the compiled program depends on to
+  // |fp|: the policy, the compiler's settings and version, and the
+  // architecture. Trap handlers are added in the order that CompileCached
+  // assigns them canonical IDs in.
+  void Fingerprint(PolicyFingerprint* fp);
+
+  // CompileVariant compiles a variant of the policy, in which |delta|
+  // overrides the result for every system call that its EvaluateSyscall
+  // returns a non-null ResultExpr for; all other system calls keep the
+  // policy's result. The compiler's nodes and system call ranges are
+  // reused, so only the overridden results are compiled, and compiling
+  // many variants with one compiler costs about one full compile plus a
+  // small one per variant. Only the policy's own nodes are kept between
+  // variants, so any number of them can be compiled. The program behaves
+  // like one compiled from the merged policy from scratch, though its
+  // layout may differ. The variant inherits the policy's InvalidSyscall
+  // and its use of unsafe traps: if the policy doesn't use any, neither
+  // may |delta|.
+  CodeGen::Program CompileVariant(const Policy* delta);
+
+  // SetNumThreads makes the compiler evaluate the policy on |num_threads|
+  // threads, which requires that the policy's EvaluateSyscall and
+  // ClassifySyscall can safely be called concurrently. The compiled
+  // program is the same regardless of the number of threads. This is
+  // meant for processes that build policies for others, since the
+  // process that starts the sandbox must usually remain single-threaded.
+  // The default is 1, i.e., to only use the calling thread.
+  void SetNumThreads(size_t num_threads);
+
+  // SetCompatPolicy makes the program also decide the system calls that
+  // are made through the architecture's compatibility ABI (i.e., i386 on
+  // x86-64 and ARM on ARM64; see SyscallSet::HasCompatAbi), according to
+  // |compat_policy| and that ABI's system call numbers. Rather than
+  // needing a filter per architecture, the program checks the "arch"
+  // field once and then dispatches into a jump table for either ABI,
+  // which share the code for results that the policies have in common.
+  // The escape hatch and trap handlers only work for native code, so
+  // neither policy may use unsafe traps.
+  void SetCompatPolicy(const Policy* compat_policy);
+
   // DangerousSetEscapePC sets the "escape PC" that is allowed to issue any
   // system calls, regardless of policy.
   void DangerousSetEscapePC(uint64_t escapepc);
@@ -44,10 +165,36 @@ class SANDBOX_EXPORT PolicyCompiler {
   // TODO(mdempsky): Move this into Policy?
   void SetPanicFunc(PanicFunc panic_func);
 
+  // SetSyscallProfile makes Compile() lay out the system call jump table as
+  // an optimal weighted search tree for |profile|, so that frequently
+  // invoked system calls are dispatched with fewer comparisons. The
+  // default (i.e., an empty profile) is a balanced binary search.
+  void SetSyscallProfile(const SyscallProfile& profile);
+
+  // SetOptimizeForActionCache controls whether Compile() lays out the
+  // program so that system calls the policy unconditionally allows are
+  // decided by looking only at the "arch" and "nr" fields. This keeps them
+  // eligible for the kernel's seccomp action cache (Linux 5.11+), at the
+  // cost of duplicating the escape hatch (if any) for every other system
+  // call range. The default is false.
+  void SetOptimizeForActionCache(bool optimize);
+
   // UnsafeTraps require some syscalls to always be allowed.
   // This helper function returns true for these calls.
   static bool IsRequiredForUnsafeTrap(int sysno);
 
+  // DefaultPanic is the panic function that's used unless SetPanicFunc is
+  // called. It kills the process.
+  static ResultExpr DefaultPanic(const char* error);
+
+  // Messages that the compiled program passes to the panic function when
+  // the architecture doesn't match, when x86 system call ABIs are mixed,
+  // and when a 32-bit argument's upper half is neither zero nor the sign
+  // extension of its lower half.
+  static const char kInvalidArchMessage[];
+  static const char kInvalidX32Message[];
+  static const char kUnexpected64bitMessage[];
+
   // Functions below are meant for use within bpf_dsl itself.
 
   // Return returns a CodeGen::Node that returns the specified seccomp
@@ -63,7 +210,9 @@ class SANDBOX_EXPORT PolicyCompiler {
   // to "value"; if equal, then "passed" will be executed, otherwise "failed".
   // If "width" is 4, the argument must in the range of 0x0..(1u << 32 - 1)
   // If it is outside this range, the sandbox treats the system call just
-  // the same as any other ABI violation (i.e., it panics).
+  // the same as any other ABI violation (i.e., it panics). This check is
+  // emitted just once per argument, at the start of the enclosing result
+  // expression, so MaskedEqual must only be called while compiling one.
   CodeGen::Node MaskedEqual(int argno,
                             size_t width,
                             uint64_t mask,
@@ -71,10 +220,64 @@ class SANDBOX_EXPORT PolicyCompiler {
                             CodeGen::Node passed,
                             CodeGen::Node failed);
 
+  // MaskedSwitch returns a CodeGen::Node that dispatches on the value of
+  // argument "argno" bitwise-AND'd with "mask": if it equals one of the
+  // keys in "cases", control passes to the corresponding node, otherwise
+  // to "default_node". The values are found by binary search, so this is
+  // much cheaper than a chain of MaskedEqual comparisons for large
+  // switches. "width" is handled the same as for MaskedEqual.
+  CodeGen::Node MaskedSwitch(int argno,
+                             size_t width,
+                             uint64_t mask,
+                             const std::map<uint64_t, CodeGen::Node>& cases,
+                             CodeGen::Node default_node);
+
+  // MaskedInRange returns a CodeGen::Node that represents a conditional
+  // branch. Argument "argno" will be bitwise-AND'd with "mask" and
+  // compared to the inclusive range ["lo", "hi"] as an unsigned value; if
+  // within the range, then "passed" will be executed, otherwise "failed".
+  // "width" is handled the same as for MaskedEqual.
+  CodeGen::Node MaskedInRange(int argno,
+                              size_t width,
+                              uint64_t mask,
+                              uint64_t lo,
+                              uint64_t hi,
+                              CodeGen::Node passed,
+                              CodeGen::Node failed);
+
+  // MaskedIn returns a CodeGen::Node that represents a conditional branch.
+  // Argument "argno" will be bitwise-AND'd with "mask" and compared to
+  // each of "values"; if equal to any of them, then "passed" will be
+  // executed, otherwise "failed". Sets of small integers are tested with a
+  // bitmap, the rest like MaskedSwitch. "width" is handled the same as for
+  // MaskedEqual.
+  CodeGen::Node MaskedIn(int argno,
+                         size_t width,
+                         uint64_t mask,
+                         const std::vector<uint64_t>& values,
+                         CodeGen::Node passed,
+                         CodeGen::Node failed);
+
  private:
   struct Range;
   typedef std::vector<Range> Ranges;
 
+  // AbiState holds the policy for one ABI's system calls, and what the
+  // compiler derived from it; see SwapAbi().
+  struct AbiState {
+    AbiState();
+    ~AbiState();
+
+    SyscallSet::Abi abi;
+    const Policy* policy;
+    bool policy_evaluated;
+    std::map<uint32_t, ResultExpr> syscall_results;
+    std::map<int, ResultExpr> class_results;
+    Ranges base_ranges;
+    std::map<uint32_t, ResultExpr> overrides;
+    SyscallProfile profile;
+  };
+
   // Used by MaskedEqualHalf to track which half of the argument it's
   // emitting instructions for.
   enum class ArgHalf {
@@ -82,19 +285,44 @@ class SANDBOX_EXPORT PolicyCompiler {
     UPPER,
   };
 
+  // Evaluates the policy for every valid system call number, unless
+  // that's been done already, and determines whether it uses any unsafe
+  // traps.
+  void EvaluatePolicy();
+
+  // Returns the policy's result for |sysnum|, which must be a valid
+  // system call number. Results for system call classes (see
+  // Policy::ClassifySyscall) are evaluated just once.
+  ResultExpr EvaluateSyscall(int sysnum);
+
+  // Compiles the program for system call numbers [first, last], which
+  // allows all others, without checking its length.
+  CodeGen::Program CompileRange(uint32_t first, uint32_t last);
+
+  // Exchanges the members below that depend on the ABI with |compat_|,
+  // so that the functions evaluating and dispatching system calls work on
+  // the compat policy until it's called again.
+  void SwapAbi();
+
   // Compile the configured policy into a complete instruction sequence.
   CodeGen::Node AssemblePolicy();
 
   // Return an instruction sequence that checks the
   // arch_seccomp_data's "arch" field is valid, and then passes
-  // control to |passed| if so.
-  CodeGen::Node CheckArch(CodeGen::Node passed);
+  // control to |passed| if so, or to |compat| if it's the compatibility
+  // ABI's and |compat| isn't null.
+  CodeGen::Node CheckArch(CodeGen::Node passed, CodeGen::Node compat);
 
   // If |has_unsafe_traps_| is true, returns an instruction sequence
   // that allows all system calls from |escapepc_|, and otherwise
   // passes control to |rest|. Otherwise, simply returns |rest|.
   CodeGen::Node MaybeAddEscapeHatch(CodeGen::Node rest);
 
+  // Moves the escape hatch (if any) past the system call dispatch by
+  // prefixing it to every range in |ranges| that isn't unconditionally
+  // allowed anyway.
+  void AddEscapeHatchToRanges(Ranges* ranges);
+
   // Return an instruction sequence that loads and checks the system
   // call number, performs a binary search, and then dispatches to an
   // appropriate instruction sequence compiled from the current
@@ -110,16 +338,89 @@ class SANDBOX_EXPORT PolicyCompiler {
   // sorted in ascending order of system call numbers. There are no gaps in the
   // ranges. System calls with identical CodeGen::Nodes are coalesced into a
   // single
-  // range.
+  // range. The policy's own ranges are computed just once, and patched
+  // with |overrides_| (if any).
   void FindRanges(Ranges* ranges);
 
+  // Computes the ranges for the policy's own results into |base_ranges_|.
+  void FindBaseRanges();
+
+  // Computes |base_ranges_| for the compat policy too, if there is one
+  // and they haven't been computed yet.
+  void FindAllBaseRanges();
+
+  // Drops all but the first |num_nodes| nodes, and forgets the results
+  // that were compiled into the dropped ones.
+  void DropNodes(size_t num_nodes);
+
   // Returns a BPF program snippet that implements a jump table for the
   // given range of system call numbers. This function runs recursively.
   CodeGen::Node AssembleJumpTable(Ranges::const_iterator start,
                                   Ranges::const_iterator stop);
 
+  // Returns a BPF program snippet that implements a jump table for
+  // |ranges|, minimizing the number of comparisons weighted by
+  // |profile_|.
+  CodeGen::Node AssembleWeightedJumpTable(const Ranges& ranges);
+
+  // Recursively emits the search tree for ranges [begin, end), using
+  // |roots| (as computed by AssembleWeightedJumpTable) to pick each
+  // split point.
+  CodeGen::Node AssembleSearchTree(const Ranges& ranges,
+                                   const std::vector<size_t>& roots,
+                                   size_t begin,
+                                   size_t end);
+
+  // Returns a BPF program snippet that implements a jump table for
+  // |ranges| like AssembleJumpTable, except that buckets of 32 system
+  // call numbers with just two distinct outcomes may be dispatched with
+  // a bitmap test instead, where that doesn't lengthen the worst-case
+  // path through the jump table.
+  CodeGen::Node AssembleBitmapJumpTable(const Ranges& ranges);
+
+  // Appends the parts of |ranges| that overlap system call numbers
+  // [lo, hi) to |pieces|, with the first one clipped to start at |lo|.
+  void ClipRanges(const Ranges& ranges,
+                  uint64_t lo,
+                  uint64_t hi,
+                  Ranges* pieces);
+
+  // Lays out the items of a jump table for |ranges| that dispatches the
+  // given |buckets| with bitmap tests, whose nodes are left null. Stores
+  // the first leaf slot of each item in |slots|, followed by the total
+  // number of slots used, whose log2 is the longest path through the
+  // jump table.
+  void LayoutBitmapJumpTable(const Ranges& ranges,
+                             const std::set<uint32_t>& buckets,
+                             Ranges* items,
+                             std::vector<uint64_t>* slots);
+
+  // Returns an instruction sequence that dispatches the system call
+  // number in register A, which is known to lie within the bucket
+  // covered by |pieces|, to the pieces' nodes using a bitmap test.
+  CodeGen::Node AssembleBitmapBucket(const Ranges& pieces);
+
+  // Recursively emits the search tree for items [begin, end) of a jump
+  // table laid out by LayoutBitmapJumpTable, which occupy |num_slots|
+  // slots starting at |first_slot|.
+  CodeGen::Node AssembleBitmapSearchTree(const Ranges& items,
+                                         const std::vector<uint64_t>& slots,
+                                         size_t begin,
+                                         size_t end,
+                                         uint64_t first_slot,
+                                         uint64_t num_slots);
+
+  // Returns an instruction sequence that continues to |passed| if bit A
+  // of |bitmap| is set, or to |failed| otherwise. Register A must be
+  // less than 32.
+  CodeGen::Node BitmapTest(uint32_t bitmap,
+                           CodeGen::Node passed,
+                           CodeGen::Node failed);
+
   // CompileResult compiles an individual result expression into a
-  // CodeGen node.
+  // CodeGen node, preceded by range checks for any 32-bit arguments that
+  // it inspects. Result expressions are interned, so the nodes are
+  // memoized per expression.
   CodeGen::Node CompileResult(const ResultExpr& res);
 
   // Returns a BPF program that evaluates half of a conditional expression;
@@ -132,6 +433,53 @@ class SANDBOX_EXPORT PolicyCompiler {
                                 CodeGen::Node passed,
                                 CodeGen::Node failed);
 
+  // Return instruction sequences that compare the 64-bit argument
+  // |argno| (bitwise-AND'd with |mask|) against |value|, and continue to
+  // |passed| if it is at least (respectively, at most) |value|, or to
+  // |failed| otherwise.
+  CodeGen::Node ArgAtLeast(int argno,
+                           uint64_t mask,
+                           uint64_t value,
+                           CodeGen::Node passed,
+                           CodeGen::Node failed);
+  CodeGen::Node ArgAtMost(int argno,
+                          uint64_t mask,
+                          uint64_t value,
+                          CodeGen::Node passed,
+                          CodeGen::Node failed);
+
+  // Returns an instruction sequence that loads the 32-bit word at |idx|
+  // into register A, bitwise-AND's it with |mask| if necessary, and then
+  // passes control to |next|.
+  CodeGen::Node LoadArgHalf(uint32_t idx, uint32_t mask, CodeGen::Node next);
+
+  // Returns an instruction sequence that checks the upper 32-bits of
+  // 32-bit argument |argno| are valid, and then passes control to
+  // |passed| if so.
+  CodeGen::Node CheckArgumentWidth(int argno, CodeGen::Node passed);
+
+  // Returns a BPF program that dispatches on the 32-bit word at |idx|
+  // bitwise-AND'd with |mask|; it should only ever be called from
+  // MaskedSwitch().
+  CodeGen::Node MaskedSwitchHalf(uint32_t idx,
+                                 uint32_t mask,
+                                 const std::map<uint32_t, CodeGen::Node>& cases,
+                                 CodeGen::Node default_node);
+
+  // Finds the ranges of 32-bit values that lead to the same node, given
+  // the nodes for individual values in |cases| and |default_node| for all
+  // other values.
+  void FindValueRanges(const std::map<uint32_t, CodeGen::Node>& cases,
+                       CodeGen::Node default_node,
+                       Ranges* ranges);
+
+  // Returns a search tree over ranges [begin, end) of the value in
+  // register A. Unlike AssembleJumpTable, it tests for single values
+  // with JEQ where possible.
+  CodeGen::Node AssembleValueSearch(const Ranges& ranges,
+                                    size_t begin,
+                                    size_t end);
+
   // Returns the fatal CodeGen::Node that is used to indicate that somebody
   // attempted to pass a 64bit value in a 32bit system call argument.
   CodeGen::Node Unexpected64bitArgument();
@@ -140,10 +488,62 @@ class SANDBOX_EXPORT PolicyCompiler {
   TrapRegistry* registry_;
   uint64_t escapepc_;
   PanicFunc panic_func_;
+  SyscallProfile profile_;
+  bool optimize_for_action_cache_;
 
   CodeGen gen_;
   bool has_unsafe_traps_;
 
+  // Number of threads that EvaluatePolicy() uses.
+  size_t num_threads_;
+
+  // ABI whose system call numbers the policy decides; see SwapAbi().
+  SyscallSet::Abi abi_;
+
+  // The state for the compatibility ABI while compiling the native
+  // policy, and vice versa. The compat policy never has overrides or a
+  // profile.
+  AbiState compat_;
+
+  // Results of EvaluatePolicy(), keyed by system call number.
+  bool policy_evaluated_;
+  std::map<uint32_t, ResultExpr> syscall_results_;
+
+  // Results that CompileVariant() overrides the policy's with, keyed by
+  // system call number. Empty while compiling the policy itself.
+  std::map<uint32_t, ResultExpr> overrides_;
+
+  // Ranges of the policy's own results, as found by FindBaseRanges().
+  Ranges base_ranges_;
+
+  // Results of Policy::EvaluateSyscallClass, keyed by system call class.
+  std::map<int, ResultExpr> class_results_;
+
+  // Nodes compiled by CompileResult(), keyed by result expression.
+  std::map<ResultExpr, CodeGen::Node> compiled_results_;
+
+  // Lazily compiled by Unexpected64bitArgument().
+  CodeGen::Node unexpected_64bit_argument_;
+
+  // System call numbers that DispatchSyscall decides; all others are
+  // allowed. See CompileSplit.
+  uint32_t first_sysnum_;
+  uint32_t last_sysnum_;
+
+  // Number of system call ranges found by DispatchSyscall.
+  size_t num_ranges_;
+
+  // Profiled frequencies of the system call ranges' nodes, which the
+  // program's layout favors; see CodeGen::CompileOptimized.
+  CodeGen::NodeWeights layout_weights_;
+
+  // Number of jumps that the last compiled program's layout saved.
+  size_t jumps_saved_;
+
+  // Bitmask of the 32-bit arguments inspected by the result expression
+  // that CompileResult is currently compiling.
+  uint32_t narrow_args_;
+
   DISALLOW_COPY_AND_ASSIGN(PolicyCompiler);
 };
 
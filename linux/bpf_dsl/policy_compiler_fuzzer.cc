@@ -0,0 +1,470 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Fuzzes PolicyCompiler and CodeGen with random policies. Each input is
+// decoded into a policy that uses nested If and Switch statements, masked
+// argument comparisons, traps and errnos, which is compiled and then run
+// through Verifier::EvaluateBPF for random system calls, and compared with
+// what PolicyChecker gets by evaluating the policy's expressions directly,
+// and what PolicyOracle gets from its decision trees.
+// Nothing is installed in the kernel and nothing forks, so each input only
+// takes a few milliseconds.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_checker.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/policy_oracle.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Limits on the size of each result expression. |kMaxCost| roughly
+// bounds the number of instructions, and is enough for a Switch whose
+// jumps span more than 255 instructions.
+const int kMaxDepth = 4;
+const int kMaxCost = 600;
+const uint32_t kMaxClauses = 4;
+const uint32_t kMaxCases = 300;
+const uint32_t kMaxValues = 40;
+
+// Limits on the policy as a whole. Policies are compiled with
+// CompileSplit, into filters of at most |kMinSplit| (which any single
+// result fits in) to BPF_MAXINSNS instructions, as chosen by the input.
+const uint32_t kMaxResults = 8;
+const size_t kMinSplit = 1024;
+const size_t kNumSyscalls = 64;
+
+// Values that argument tests are likely to have boundaries at.
+const uint64_t kInterestingValues[] = {
+    0,
+    1,
+    2,
+    0x7f,
+    0x80,
+    0xff,
+    0x100,
+    0xfff,
+    0x7fffffff,
+    0x80000000,
+    0xfffffffe,
+    0xffffffff,
+    0x100000000ULL,
+    0x7fffffffffffffffULL,
+    0x8000000000000000ULL,
+    0xffffffff80000000ULL,
+    0xffffffffffffffffULL,
+};
+
+const int kTrapAux[4] = {};
+
+intptr_t FuzzTrapHandler(const struct arch_seccomp_data&, void*) {
+  return 0;
+}
+
+// FuzzInput hands out the fuzzer's input as numbers. Once the input runs
+// out, it continues with a pseudo-random sequence that only depends on
+// the input, so that short inputs still produce varied policies.
+class FuzzInput {
+ public:
+  FuzzInput(const uint8_t* data, size_t size)
+      : data_(data), size_(size), pos_(0), seed_(static_cast<uint32_t>(size)) {
+    for (size_t i = 0; i < size; ++i) {
+      seed_ = seed_ * 31 + data[i];
+    }
+  }
+  ~FuzzInput() {}
+
+  // Returns a number in [0, n).
+  uint32_t Next(uint32_t n) {
+    DCHECK_GT(n, 0U);
+    uint32_t value = Byte();
+    if (n > 0x100) {
+      value = value << 8 | Byte();
+    }
+    return value % n;
+  }
+
+  // Returns a 64-bit value, preferring values that tests are likely to
+  // have boundaries at.
+  uint64_t Value() {
+    switch (Next(4)) {
+      case 0:
+        return kInterestingValues[Next(arraysize(kInterestingValues))];
+      case 1:
+        return Next(16);
+      default: {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+          value = value << 8 | Byte();
+        }
+        return value;
+      }
+    }
+  }
+
+ private:
+  uint8_t Byte() {
+    if (pos_ < size_) {
+      return data_[pos_++];
+    }
+    seed_ = seed_ * 1103515245 + 12345;
+    return static_cast<uint8_t>(seed_ >> 16);
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+  uint32_t seed_;
+
+  DISALLOW_COPY_AND_ASSIGN(FuzzInput);
+};
+
+// FuzzPolicy builds its results from a FuzzInput. System calls get their
+// results from a pool, in runs of consecutive numbers, so that the
+// compiler sees both long ranges and many short ones.
+class FuzzPolicy : public Policy {
+ public:
+  explicit FuzzPolicy(FuzzInput* input) : input_(input), budget_(0) {
+    std::vector<ResultExpr> pool;
+    const uint32_t num_results = 1 + input_->Next(kMaxResults);
+    for (uint32_t i = 0; i < num_results; ++i) {
+      budget_ = kMaxCost;
+      pool.push_back(Result(0));
+    }
+    size_t index = 0;
+    for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+      if (input_->Next(8) == 0) {
+        index = input_->Next(num_results);
+      }
+      results_[static_cast<int>(sysnum)] = pool[index];
+    }
+    invalid_ = Leaf(true);
+  }
+  ~FuzzPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const auto it = results_.find(sysno);
+    CHECK(it != results_.end());
+    return it->second;
+  }
+
+  ResultExpr InvalidSyscall() const override { return invalid_; }
+
+  // values returns the values that argument |argno| is compared with
+  // anywhere in the policy, and their neighbors.
+  const std::vector<uint64_t>& values(int argno) const {
+    return values_[argno];
+  }
+
+ private:
+  // Returns a Return or Trap expression. Only the ones that deny the
+  // system call are chosen if |deny|.
+  ResultExpr Leaf(bool deny) {
+    budget_ -= 1;
+    switch (input_->Next(deny ? 3 : 5)) {
+      case 0:
+        return Error(1 + input_->Next(0xfff));
+      case 1:
+        return Kill();
+      case 2:
+        return Trap(FuzzTrapHandler, &kTrapAux[input_->Next(4)]);
+      case 3:
+        return Trace(input_->Next(0x10000));
+      default:
+        return Allow();
+    }
+  }
+
+  ResultExpr Result(int depth) {
+    if (depth >= kMaxDepth || budget_ <= 0) {
+      return Leaf(false);
+    }
+    switch (input_->Next(4)) {
+      case 0:
+        return Leaf(false);
+      case 1:
+        return Chain(depth, 1 + input_->Next(kMaxClauses));
+      case 2:
+        if (sizeof(void*) == 8 && input_->Next(2)) {
+          return Switch<uint64_t>(depth);
+        }
+        return Switch<uint32_t>(depth);
+      default:
+        return If(Bool(depth), Result(depth + 1)).Else(Result(depth + 1));
+    }
+  }
+
+  // Returns an If statement with |clauses| clauses before the Else.
+  ResultExpr Chain(int depth, uint32_t clauses) {
+    if (clauses == 1) {
+      return If(Bool(depth), Result(depth + 1)).Else(Result(depth + 1));
+    }
+    return If(Bool(depth), Result(depth + 1))
+        .ElseIf(Bool(depth), Result(depth + 1))
+        .Else(Chain(depth, clauses - 1));
+  }
+
+  // Returns a Switch on a random argument of type |T|, whose cases mostly
+  // share a few results.
+  template <typename T>
+  ResultExpr Switch(int depth) {
+    int argno;
+    uint64_t mask;
+    const Arg<T> arg = MaskedArg<T>(&argno, &mask);
+    const uint32_t cases = 1 + input_->Next(kMaxCases);
+    std::vector<std::pair<ResultExpr, int>> shared;
+    return Cases(depth, bpf_dsl::Switch(arg), argno, mask, cases, &shared);
+  }
+
+  // Adds up to |cases| cases to |caser| and returns the finished Switch.
+  // Each of |shared| is a result and its cost, which is charged again
+  // whenever it's reused, since the compiler and PolicyChecker walk it
+  // again.
+  template <typename T>
+  ResultExpr Cases(int depth,
+                   const Caser<T>& caser,
+                   int argno,
+                   uint64_t mask,
+                   uint32_t cases,
+                   std::vector<std::pair<ResultExpr, int>>* shared) {
+    if (cases == 0 || budget_ <= 0) {
+      return caser.Default(Result(depth + 1));
+    }
+    budget_ -= 2;
+    size_t index;
+    if (shared->empty() || input_->Next(8) == 0) {
+      const int budget = budget_;
+      const ResultExpr result = Result(depth + 1);
+      index = shared->size();
+      shared->push_back(std::make_pair(result, budget - budget_));
+    } else {
+      index = input_->Next(shared->size());
+      budget_ -= (*shared)[index].second;
+    }
+    return Cases(depth,
+                 caser.Case(Value<T>(argno, mask), (*shared)[index].first),
+                 argno, mask, cases - 1, shared);
+  }
+
+  BoolExpr Bool(int depth) {
+    if (depth >= kMaxDepth || budget_ <= 0) {
+      return Compare<uint32_t>();
+    }
+    switch (input_->Next(8)) {
+      case 0:
+        return BoolConst(input_->Next(2));
+      case 1:
+        return Not(Bool(depth + 1));
+      case 2:
+        return AllOf(Bool(depth + 1), Bool(depth + 1));
+      case 3:
+        return AnyOf(Bool(depth + 1), Bool(depth + 1));
+      case 4:
+        return Compare<int>();
+      case 5:
+        if (sizeof(void*) == 8) {
+          return Compare<uint64_t>();
+        }
+        return Compare<uint32_t>();
+      default:
+        return Compare<uint32_t>();
+    }
+  }
+
+  // Returns a random comparison of a random argument of type |T|.
+  template <typename T>
+  BoolExpr Compare() {
+    int argno;
+    uint64_t mask;
+    const Arg<T> arg = MaskedArg<T>(&argno, &mask);
+    budget_ -= sizeof(T) == 8 ? 8 : 4;
+    switch (input_->Next(8)) {
+      case 0:
+        return arg == Value<T>(argno, mask);
+      case 1:
+        return arg != Value<T>(argno, mask);
+      case 2:
+        return arg < Value<T>(argno, ~0ULL);
+      case 3:
+        return arg <= Value<T>(argno, ~0ULL);
+      case 4:
+        return arg > Value<T>(argno, ~0ULL);
+      case 5:
+        return arg >= Value<T>(argno, ~0ULL);
+      case 6:
+        return arg.InRange(Value<T>(argno, ~0ULL), Value<T>(argno, ~0ULL));
+      default: {
+        // Small values are tested with a bitmap, others one by one.
+        const uint32_t num_values = input_->Next(kMaxValues);
+        const uint64_t small = input_->Next(2) ? 0x3f : ~0ULL;
+        budget_ -= 2 * num_values;
+        std::vector<T> values;
+        for (uint32_t i = 0; i < num_values; ++i) {
+          values.push_back(Value<T>(argno, mask & small));
+        }
+        return arg.In(values);
+      }
+    }
+  }
+
+  // Returns a random argument of type |T|, usually with a mask. Its
+  // number is stored in |argno| and its mask in |mask|.
+  template <typename T>
+  Arg<T> MaskedArg(int* argno, uint64_t* mask) {
+    const uint64_t all = sizeof(T) == 8 ? ~0ULL : 0xffffffffULL;
+    *mask = all;
+    if (input_->Next(2)) {
+      *mask = input_->Value() & all;
+      if (!*mask) {
+        *mask = all;
+      }
+    }
+    *argno = input_->Next(6);
+    return Arg<T>(*argno) & *mask;
+  }
+
+  // Returns a random value of type |T| that only has bits in |mask|, to
+  // compare argument |argno| with. The value and its neighbors are added
+  // to the argument's values.
+  template <typename T>
+  T Value(int argno, uint64_t mask) {
+    const uint64_t value = input_->Value() & mask;
+    const uint64_t all = sizeof(T) == 8 ? ~0ULL : 0xffffffffULL;
+    values_[argno].push_back(value);
+    values_[argno].push_back((value - 1) & all);
+    values_[argno].push_back((value + 1) & all);
+    return static_cast<T>(value);
+  }
+
+  FuzzInput* input_;
+  int budget_;
+  std::vector<uint64_t> values_[6];
+  std::map<int, ResultExpr> results_;
+  ResultExpr invalid_;
+
+  DISALLOW_COPY_AND_ASSIGN(FuzzPolicy);
+};
+
+// Returns a system call for checking the programs, usually one whose
+// number the policy evaluates, with the architecture or the x32 bit
+// occasionally wrong. The arguments are mostly combinations of the
+// values that the policy compares them with, so that most branches are
+// taken by some of the system calls, with various upper halves.
+struct arch_seccomp_data Syscall(FuzzInput* input,
+                                 const FuzzPolicy& policy,
+                                 const std::vector<uint32_t>& sysnums) {
+  struct arch_seccomp_data data = {};
+  data.arch = SECCOMP_ARCH;
+  if (input->Next(16) == 0) {
+    data.arch = static_cast<uint32_t>(input->Value());
+  }
+  uint32_t nr = sysnums[input->Next(sysnums.size())];
+  switch (input->Next(16)) {
+    case 0:
+      nr ^= 0x40000000;
+      break;
+    case 1:
+      nr = static_cast<uint32_t>(input->Value());
+      break;
+  }
+  data.nr = static_cast<int>(nr);
+
+  for (int argno = 0; argno < 6; ++argno) {
+    const std::vector<uint64_t>& values = policy.values(argno);
+    uint64_t arg = 0;
+    if (values.empty() || input->Next(4) == 0) {
+      arg = input->Value();
+    } else {
+      for (uint32_t n = 1 + input->Next(3); n > 0; --n) {
+        arg |= values[input->Next(values.size())];
+      }
+    }
+    switch (input->Next(8)) {
+      case 0:
+        arg |= 0xffffffff00000000ULL;
+        break;
+      case 1:
+        arg ^= input->Value() << 32;
+        break;
+    }
+    data.args[argno] = arg;
+  }
+  return data;
+}
+
+// Compiles the policy that |data| describes, and checks the programs.
+void CheckPolicy(const uint8_t* data, size_t size) {
+  static const std::vector<uint32_t>* const sysnums = [] {
+    std::vector<uint32_t>* all = new std::vector<uint32_t>;
+    for (uint32_t sysnum : SyscallSet::All()) {
+      all->push_back(sysnum);
+    }
+    return all;
+  }();
+
+  // The policy's expressions are allocated in an arena for just this
+  // input, and must be destroyed before it.
+  ExprArena arena;
+  ExprArena::Scope scope(&arena);
+  FuzzInput input(data, size);
+  FuzzPolicy policy(&input);
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&policy, &traps);
+  const size_t max_instructions =
+      kMinSplit + input.Next(BPF_MAXINSNS - kMinSplit + 1);
+  const std::vector<PolicyCompiler::Filter> filters =
+      compiler.CompileSplit(max_instructions);
+  PolicyChecker checker(&policy, &traps);
+  const PolicyOracle oracle(&policy, &traps);
+
+  // Installed as stacked filters, the one that covers a system call
+  // decides it, and the others must allow it, or panic the same way if
+  // the architecture or ABI is wrong.
+  for (size_t i = 0; i < kNumSyscalls; ++i) {
+    const struct arch_seccomp_data syscall = Syscall(&input, policy, *sysnums);
+    const uint32_t expected = checker.Evaluate(syscall);
+    const uint32_t nr = static_cast<uint32_t>(syscall.nr);
+    CHECK_EQ(expected, oracle.Evaluate(syscall)) << "system call " << nr;
+    for (const PolicyCompiler::Filter& filter : filters) {
+      const char* err = nullptr;
+      const uint32_t actual =
+          Verifier::EvaluateBPF(filter.program, syscall, &err);
+      CHECK(!err) << err;
+      if (filter.first <= nr && nr <= filter.last) {
+        CHECK_EQ(expected, actual) << "system call " << nr;
+      } else {
+        CHECK(actual == SECCOMP_RET_ALLOW || actual == expected)
+            << "system call " << nr;
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  sandbox::bpf_dsl::CheckPolicy(data, size);
+  return 0;
+}
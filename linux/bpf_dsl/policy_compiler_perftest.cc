@@ -0,0 +1,101 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/sys_info.h"
+#include "base/time/time.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_test.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Number of times each configuration is compiled; the fastest run is
+// reported.
+const int kRuns = 5;
+
+// ExpensivePolicy spends a while building a large expression for every
+// system call, like policies that consult long chains of system call
+// sets, but only has a handful of distinct results.
+class ExpensivePolicy : public Policy {
+ public:
+  ExpensivePolicy() {}
+  ~ExpensivePolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> fd(0);
+    const Arg<int> cmd(1);
+    BoolExpr cond = BoolConst(false);
+    for (int i = 0; i < 64; ++i) {
+      cond = AnyOf(AllOf(fd == i, cmd == (sysno % 2) * 64 + i), cond);
+    }
+    return If(cond, Error(EPERM)).Else(Allow());
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ExpensivePolicy);
+};
+
+// Compiles |policy| with |num_threads| threads and returns the fastest
+// of kRuns compile times in milliseconds.
+double TimeCompile(const Policy& policy,
+                   size_t num_threads,
+                   CodeGen::Program* program) {
+  double best = 0;
+  for (int run = 0; run < kRuns; ++run) {
+    TestTrapRegistry traps;
+    PolicyCompiler compiler(&policy, &traps);
+    compiler.SetNumThreads(num_threads);
+    const base::TimeTicks start = base::TimeTicks::Now();
+    *program = compiler.Compile();
+    const double elapsed = (base::TimeTicks::Now() - start).InMillisecondsF();
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+TEST(PolicyCompilerPerfTest, NumThreads) {
+  ExpensivePolicy policy;
+  CodeGen::Program serial;
+  const double serial_ms = TimeCompile(policy, 1, &serial);
+  perf_test::PrintResult("policy_compile", "", "threads_1", serial_ms, "ms",
+                         true);
+
+  const size_t num_cpus = base::SysInfo::NumberOfProcessors();
+  for (size_t num_threads = 2; num_threads <= num_cpus; num_threads *= 2) {
+    CodeGen::Program program;
+    const double ms = TimeCompile(policy, num_threads, &program);
+    const std::string trace =
+        "threads_" + base::SizeTToString(num_threads);
+    perf_test::PrintResult("policy_compile", "", trace, ms, "ms", true);
+    perf_test::PrintResult("policy_compile_speedup", "", trace,
+                           serial_ms / ms, "x", false);
+
+    // The program must not depend on the number of threads.
+    ExpectSamePrograms(serial, program);
+  }
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,1071 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/linux_syscall_ranges.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// CountInstructions returns how many instructions |program| executes
+// before returning a result for |data|. It only supports the subset of
+// BPF needed by the policies below.
+size_t CountInstructions(const CodeGen::Program& program,
+                         const struct arch_seccomp_data& data) {
+  uint32_t acc = 0;
+  uint32_t index = 0;
+  size_t count = 0;
+  for (size_t ip = 0; ip < program.size(); ++ip) {
+    const struct sock_filter& insn = program[ip];
+    ++count;
+    switch (BPF_CLASS(insn.code)) {
+      case BPF_LD:
+        if (BPF_MODE(insn.code) == BPF_IMM) {
+          acc = insn.k;
+        } else {
+          memcpy(&acc, reinterpret_cast<const char*>(&data) + insn.k, 4);
+        }
+        break;
+      case BPF_MISC:
+        EXPECT_EQ(BPF_TAX, BPF_MISCOP(insn.code));
+        index = acc;
+        break;
+      case BPF_ALU:
+        if (BPF_OP(insn.code) == BPF_AND) {
+          acc &= insn.k;
+        } else {
+          EXPECT_EQ(BPF_ALU + BPF_LSH + BPF_X, insn.code);
+          acc <<= index;
+        }
+        break;
+      case BPF_JMP:
+        if (BPF_OP(insn.code) == BPF_JA) {
+          ip += insn.k;
+        } else if (BPF_OP(insn.code) == BPF_JGE) {
+          ip += acc >= insn.k ? insn.jt : insn.jf;
+        } else if (BPF_OP(insn.code) == BPF_JEQ) {
+          ip += acc == insn.k ? insn.jt : insn.jf;
+        } else {
+          EXPECT_EQ(BPF_JSET, BPF_OP(insn.code));
+          ip += (acc & insn.k) ? insn.jt : insn.jf;
+        }
+        break;
+      case BPF_RET:
+        return count;
+      default:
+        ADD_FAILURE() << "Unexpected instruction " << insn.code;
+        return 0;
+    }
+  }
+  ADD_FAILURE() << "Fell off the end of the program";
+  return 0;
+}
+
+// Alternating policy creates a large number of syscall ranges, so that
+// the jump table needs to be fairly deep.
+class AlternatingPolicy : public Policy {
+ public:
+  AlternatingPolicy() {}
+  ~AlternatingPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_read || sysno == __NR_write) {
+      return Allow();
+    }
+    return (sysno & 1) ? Error(EPERM) : Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AlternatingPolicy);
+};
+
+TEST(PolicyCompiler, WeightedJumpTable) {
+  AlternatingPolicy policy;
+
+  TestTrapRegistry balanced_traps;
+  CodeGen::Program balanced =
+      PolicyCompiler(&policy, &balanced_traps).Compile();
+
+  PolicyCompiler::SyscallProfile profile;
+  profile[__NR_read] = 1000;
+  profile[__NR_write] = 1000;
+
+  TestTrapRegistry weighted_traps;
+  PolicyCompiler compiler(&policy, &weighted_traps);
+  compiler.SetSyscallProfile(profile);
+  CodeGen::Program weighted = compiler.Compile();
+
+  // The hot system calls should need strictly fewer instructions.
+  uint64_t balanced_cost = 0;
+  uint64_t weighted_cost = 0;
+  for (const auto& entry : profile) {
+    const struct arch_seccomp_data data = FakeSyscall(entry.first);
+    const size_t balanced_insns = CountInstructions(balanced, data);
+    const size_t weighted_insns = CountInstructions(weighted, data);
+    EXPECT_LT(weighted_insns, balanced_insns);
+    balanced_cost += entry.second * balanced_insns;
+    weighted_cost += entry.second * weighted_insns;
+  }
+  EXPECT_LT(weighted_cost, balanced_cost);
+
+  // Both layouts must still implement the same policy.
+  for (uint32_t sysnum : SyscallSet::All()) {
+    const struct arch_seccomp_data data =
+        FakeSyscall(static_cast<int>(sysnum));
+    const char* err = nullptr;
+    const uint32_t expected = Verifier::EvaluateBPF(balanced, data, &err);
+    ASSERT_FALSE(err) << err;
+    EXPECT_EQ(expected, Verifier::EvaluateBPF(weighted, data, &err))
+        << "sysnum " << sysnum;
+    ASSERT_FALSE(err) << err;
+  }
+}
+
+TEST(PolicyCompiler, EmptyProfileIsBalanced) {
+  AlternatingPolicy policy;
+
+  TestTrapRegistry traps1;
+  CodeGen::Program balanced = PolicyCompiler(&policy, &traps1).Compile();
+
+  TestTrapRegistry traps2;
+  PolicyCompiler compiler(&policy, &traps2);
+  compiler.SetSyscallProfile(PolicyCompiler::SyscallProfile());
+  CodeGen::Program program = compiler.Compile();
+
+  ASSERT_EQ(balanced.size(), program.size());
+  EXPECT_EQ(0, memcmp(&balanced[0], &program[0],
+                      balanced.size() * sizeof(balanced[0])));
+}
+
+// Like AlternatingPolicy, but only for the first 256 system calls, which
+// is more typical of real allow lists.
+class LowAlternatingPolicy : public Policy {
+ public:
+  LowAlternatingPolicy() {}
+  ~LowAlternatingPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    return (sysno < 256 && (sysno & 1)) ? Error(EPERM) : Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LowAlternatingPolicy);
+};
+
+TEST(PolicyCompiler, BitmapDispatch) {
+  LowAlternatingPolicy policy;
+
+  TestTrapRegistry bitmap_traps;
+  CodeGen::Program bitmap = PolicyCompiler(&policy, &bitmap_traps).Compile();
+
+  // The action cache layout never uses bitmap tests.
+  TestTrapRegistry search_traps;
+  PolicyCompiler compiler(&policy, &search_traps);
+  compiler.SetOptimizeForActionCache(true);
+  CodeGen::Program search = compiler.Compile();
+
+  size_t bitmap_tests = 0;
+  for (const struct sock_filter& insn : bitmap) {
+    if (insn.code == BPF_MISC + BPF_TAX) {
+      ++bitmap_tests;
+    }
+  }
+  EXPECT_LT(0U, bitmap_tests);
+  EXPECT_LT(bitmap.size() * 2, search.size());
+
+  // Both must implement the same policy, and the bitmap tests must not
+  // lengthen the worst-case path.
+  size_t bitmap_longest = 0;
+  size_t search_longest = 0;
+  for (uint32_t sysnum : SyscallSet::All()) {
+    const struct arch_seccomp_data data =
+        FakeSyscall(static_cast<int>(sysnum));
+    const char* err = nullptr;
+    const uint32_t expected = Verifier::EvaluateBPF(search, data, &err);
+    ASSERT_FALSE(err) << err;
+    EXPECT_EQ(expected, Verifier::EvaluateBPF(bitmap, data, &err))
+        << "sysnum " << sysnum;
+    ASSERT_FALSE(err) << err;
+    bitmap_longest =
+        std::max(bitmap_longest, CountInstructions(bitmap, data));
+    search_longest =
+        std::max(search_longest, CountInstructions(search, data));
+  }
+  EXPECT_LE(bitmap_longest, search_longest);
+}
+
+// UnsafeTrapRegistry is like TestTrapRegistry, except that it allows
+// enabling unsafe traps.
+class UnsafeTrapRegistry : public TrapRegistry {
+ public:
+  UnsafeTrapRegistry() : map_() {}
+  ~UnsafeTrapRegistry() {}
+
+  uint16_t Add(TrapFnc fnc, const void* aux, bool safe) override {
+    const uint16_t next_id = map_.size() + 1;
+    return map_.insert(std::make_pair(Key(fnc, aux), next_id)).first->second;
+  }
+  bool EnableUnsafeTraps() override { return true; }
+
+ private:
+  using Key = std::pair<TrapFnc, const void*>;
+
+  std::map<Key, uint16_t> map_;
+
+  DISALLOW_COPY_AND_ASSIGN(UnsafeTrapRegistry);
+};
+
+intptr_t DummyTrap(const struct arch_seccomp_data& data, void* aux) {
+  return 0;
+}
+
+class UnsafeTrapPolicy : public Policy {
+ public:
+  UnsafeTrapPolicy() {}
+  ~UnsafeTrapPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_getpid) {
+      return UnsafeTrap(DummyTrap, nullptr);
+    }
+    if (sysno == __NR_setuid) {
+      const Arg<uid_t> uid(0);
+      return If(uid == 0, Error(EPERM)).Else(Allow());
+    }
+    if (sysno == __NR_mount) {
+      return Error(EPERM);
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(UnsafeTrapPolicy);
+};
+
+TEST(PolicyCompiler, OptimizeForActionCache) {
+  const uint64_t kEscapePC = 0x123456789aULL;
+  UnsafeTrapPolicy policy;
+
+  UnsafeTrapRegistry default_traps;
+  PolicyCompiler default_compiler(&policy, &default_traps);
+  default_compiler.DangerousSetEscapePC(kEscapePC);
+  CodeGen::Program default_program = default_compiler.Compile();
+
+  UnsafeTrapRegistry cache_traps;
+  PolicyCompiler cache_compiler(&policy, &cache_traps);
+  cache_compiler.DangerousSetEscapePC(kEscapePC);
+  cache_compiler.SetOptimizeForActionCache(true);
+  CodeGen::Program cache_program = cache_compiler.Compile();
+
+  // The default layout loads the instruction pointer before dispatching
+  // on the system call number, so nothing is cacheable.
+  EXPECT_TRUE(
+      Verifier::ConstantAllowSyscalls(default_program, SECCOMP_ARCH).empty());
+
+  // Otherwise, exactly the unconditionally allowed system calls should be
+  // cacheable.
+  const std::vector<uint32_t> cacheable =
+      Verifier::ConstantAllowSyscalls(cache_program, SECCOMP_ARCH);
+  std::vector<uint32_t> expected;
+  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+    if (policy.EvaluateSyscall(sysnum)->IsAllow()) {
+      expected.push_back(sysnum);
+    }
+  }
+  EXPECT_EQ(expected, cacheable);
+  EXPECT_FALSE(Verifier::IsConstantAllow(cache_program, SECCOMP_ARCH,
+                                         __NR_setuid));
+  EXPECT_FALSE(
+      Verifier::IsConstantAllow(cache_program, SECCOMP_ARCH, __NR_mount));
+
+  // Both layouts must behave identically, including for system calls
+  // issued from the escape PC.
+  for (uint64_t pc : {static_cast<uint64_t>(0), kEscapePC}) {
+    for (uint32_t sysnum : SyscallSet::All()) {
+      for (uint64_t uid : {0, 1}) {
+        struct arch_seccomp_data data = FakeSyscall(static_cast<int>(sysnum));
+        data.instruction_pointer = pc;
+        data.args[0] = uid;
+        const char* err = nullptr;
+        const uint32_t res =
+            Verifier::EvaluateBPF(default_program, data, &err);
+        ASSERT_FALSE(err) << err;
+        EXPECT_EQ(res, Verifier::EvaluateBPF(cache_program, data, &err))
+            << "sysnum " << sysnum;
+        ASSERT_FALSE(err) << err;
+      }
+    }
+  }
+}
+
+// IntSwitchPolicy switches over a 32-bit argument with many cases.
+class IntSwitchPolicy : public Policy {
+ public:
+  IntSwitchPolicy() {}
+  ~IntSwitchPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_fcntl) {
+      const Arg<int> cmd(1);
+      return Switch(cmd)
+          .CASES((1, 3, 5, 7), Allow())
+          .CASES((11, 13, 17), Error(EINVAL))
+          .Case(19, Error(EPERM))
+          .Default(Error(ENOSYS));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(IntSwitchPolicy);
+};
+
+TEST(PolicyCompiler, ArgumentWidthCheckedOnce) {
+  IntSwitchPolicy policy;
+  TestTrapRegistry traps;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  // The upper half of the argument should be loaded by a single check,
+  // rather than once per case.
+  size_t upper_loads = 0;
+  for (const struct sock_filter& insn : program) {
+    if (insn.code == BPF_LD + BPF_W + BPF_ABS &&
+        insn.k == SECCOMP_ARG_MSB_IDX(1)) {
+      ++upper_loads;
+    }
+  }
+  EXPECT_EQ(1U, upper_loads);
+
+  const struct {
+    uint64_t arg;
+    uint32_t result;
+  } kTestCases[] = {
+      {1, SECCOMP_RET_ALLOW},
+      {7, SECCOMP_RET_ALLOW},
+      {13, SECCOMP_RET_ERRNO + EINVAL},
+      {19, SECCOMP_RET_ERRNO + EPERM},
+      {2, SECCOMP_RET_ERRNO + ENOSYS},
+      {0x100000001ULL, SECCOMP_RET_KILL},
+#if defined(__LP64__)
+      {0xffffffff00000001ULL, SECCOMP_RET_KILL},
+      {0xffffffff80000001ULL, SECCOMP_RET_ERRNO + ENOSYS},
+#endif
+  };
+  for (const auto& test : kTestCases) {
+    struct arch_seccomp_data data = FakeSyscall(__NR_fcntl);
+    data.args[1] = test.arg;
+    const char* err = nullptr;
+    EXPECT_EQ(test.result, Verifier::EvaluateBPF(program, data, &err))
+        << "arg " << test.arg;
+    EXPECT_FALSE(err) << err;
+  }
+}
+
+TEST(PolicyCompiler, Stats) {
+  IntSwitchPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler::Stats stats;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile(&stats);
+
+  EXPECT_EQ(program.size(), stats.instructions);
+  EXPECT_EQ(0U, stats.jump_trampolines);
+  // fcntl, the allowed system calls before and after it, and the invalid
+  // ones.
+  EXPECT_LE(4U, stats.ranges);
+
+  size_t num_syscalls = 0;
+  for (uint32_t sysnum : SyscallSet::All()) {
+    ++num_syscalls;
+    ASSERT_EQ(1U, stats.path_lengths.count(sysnum));
+    const PolicyCompiler::Stats::PathLength& length =
+        stats.path_lengths[sysnum];
+
+    // Only fcntl's path depends on its arguments.
+    if (sysnum == __NR_fcntl) {
+      EXPECT_LT(length.min, length.max);
+    } else {
+      EXPECT_EQ(length.min, length.max) << "sysnum " << sysnum;
+    }
+
+    const size_t insns = CountInstructions(
+        program, FakeSyscall(static_cast<int>(sysnum)));
+    EXPECT_LE(length.min, insns);
+    EXPECT_GE(length.max, insns);
+  }
+  EXPECT_EQ(num_syscalls, stats.path_lengths.size());
+}
+
+TEST(PolicyCompiler, StatsCountTrampolines) {
+  AlternatingPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler::Stats stats;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile(&stats);
+
+  // The jump table is too large for all of its branches to reach their
+  // targets directly.
+  size_t trampolines = 0;
+  for (const struct sock_filter& insn : program) {
+    if (insn.code == BPF_JMP + BPF_JA) {
+      ++trampolines;
+    }
+  }
+  EXPECT_LT(0U, trampolines);
+  EXPECT_EQ(trampolines, stats.jump_trampolines);
+  EXPECT_LT(stats.ranges, stats.instructions);
+}
+
+// IoctlPolicy switches over many ioctl request codes, mixing runs of
+// consecutive codes with isolated ones.
+const uint32_t kIoctlBase = 0x5400;
+const int kNumIoctls = 60;
+
+class IoctlPolicy : public Policy {
+ public:
+  IoctlPolicy() {}
+  ~IoctlPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_ioctl) {
+      const Arg<uint32_t> request(1);
+      return AddCases(Switch(request), 0).Default(Error(ENOTTY));
+    }
+    return Allow();
+  }
+
+  // Caser doesn't support assignment, so add the cases recursively.
+  static Caser<uint32_t> AddCases(const Caser<uint32_t>& caser, int i) {
+    if (i == kNumIoctls) {
+      return caser;
+    }
+    return AddCases(caser.Case(Request(i), Result(i)), i + 1);
+  }
+
+  static uint32_t Request(int i) {
+    // The first half are consecutive, the second half are spread out.
+    return i < kNumIoctls / 2 ? kIoctlBase + i : kIoctlBase + 4 * i;
+  }
+
+  static ResultExpr Result(int i) {
+    return i < kNumIoctls / 2 || i % 3 ? Allow() : Error(EPERM);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(IoctlPolicy);
+};
+
+TEST(PolicyCompiler, SwitchBinarySearch) {
+  IoctlPolicy policy;
+  TestTrapRegistry traps;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  std::map<uint32_t, uint32_t> expected;
+  for (int i = 0; i < kNumIoctls; ++i) {
+    expected[IoctlPolicy::Request(i)] =
+        i < kNumIoctls / 2 || i % 3 ? SECCOMP_RET_ALLOW
+                                    : SECCOMP_RET_ERRNO + EPERM;
+  }
+
+  size_t max_insns = 0;
+  for (uint32_t request = kIoctlBase - 2;
+       request < kIoctlBase + 4 * kNumIoctls + 2; ++request) {
+    struct arch_seccomp_data data = FakeSyscall(__NR_ioctl);
+    data.args[1] = request;
+    const auto it = expected.find(request);
+    const uint32_t result =
+        it != expected.end() ? it->second : SECCOMP_RET_ERRNO + ENOTTY;
+    const char* err = nullptr;
+    EXPECT_EQ(result, Verifier::EvaluateBPF(program, data, &err))
+        << "request " << request;
+    EXPECT_FALSE(err) << err;
+    max_insns = std::max(max_insns, CountInstructions(program, data));
+  }
+
+  // The run of consecutive codes is merged into a single range, and the
+  // remaining codes are found by binary search, so no request should
+  // need anywhere near one comparison per case.
+  EXPECT_LT(max_insns, 30U);
+  EXPECT_LT(program.size(), 2U * kNumIoctls);
+}
+
+#if defined(__LP64__)
+class WideSwitchPolicy : public Policy {
+ public:
+  WideSwitchPolicy() {}
+  ~WideSwitchPolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_mmap) {
+      const Arg<uint64_t> addr(0);
+      return Switch(addr)
+          .CASES((0x100000000ULL, 0x100000001ULL), Allow())
+          .CASES((1, 2, 3, 4), Error(EPERM))
+          .Case(0x200000002ULL, Error(EINVAL))
+          .Default(Error(ENOMEM));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WideSwitchPolicy);
+};
+
+TEST(PolicyCompiler, WideSwitch) {
+  WideSwitchPolicy policy;
+  TestTrapRegistry traps;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  const struct {
+    uint64_t arg;
+    uint32_t result;
+  } kTestCases[] = {
+      {0x100000000ULL, SECCOMP_RET_ALLOW},
+      {0x100000001ULL, SECCOMP_RET_ALLOW},
+      {0x100000002ULL, SECCOMP_RET_ERRNO + ENOMEM},
+      {0x1, SECCOMP_RET_ERRNO + EPERM},
+      {0x4, SECCOMP_RET_ERRNO + EPERM},
+      {0x5, SECCOMP_RET_ERRNO + ENOMEM},
+      {0x200000002ULL, SECCOMP_RET_ERRNO + EINVAL},
+      {0x300000002ULL, SECCOMP_RET_ERRNO + ENOMEM},
+      {0x200000001ULL, SECCOMP_RET_ERRNO + ENOMEM},
+  };
+  for (const auto& test : kTestCases) {
+    struct arch_seccomp_data data = FakeSyscall(__NR_mmap);
+    data.args[0] = test.arg;
+    const char* err = nullptr;
+    EXPECT_EQ(test.result, Verifier::EvaluateBPF(program, data, &err))
+        << "arg " << test.arg;
+    EXPECT_FALSE(err) << err;
+  }
+}
+#endif  // defined(__LP64__)
+
+// ClassPolicy denies system calls with an odd number and allows the
+// rest, except for ioctl, which is decided individually. Unless
+// |use_classes| is false, the two classes are evaluated as a whole.
+class ClassPolicy : public Policy {
+ public:
+  explicit ClassPolicy(bool use_classes)
+      : use_classes_(use_classes), class_evaluations_(0) {}
+  ~ClassPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_ioctl) {
+      const Arg<int> request(1);
+      return If(request == 0, Allow()).Else(Error(ENOTTY));
+    }
+    return sysno % 2 ? Error(EPERM) : Allow();
+  }
+
+  int ClassifySyscall(int sysno) const override {
+    if (!use_classes_ || sysno == __NR_ioctl) {
+      return -1;
+    }
+    return sysno % 2;
+  }
+
+  ResultExpr EvaluateSyscallClass(int syscall_class) const override {
+    ++class_evaluations_;
+    return syscall_class ? Error(EPERM) : Allow();
+  }
+
+  int class_evaluations() const { return class_evaluations_; }
+
+ private:
+  bool use_classes_;
+  mutable int class_evaluations_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClassPolicy);
+};
+
+TEST(PolicyCompiler, SyscallClasses) {
+  ClassPolicy plain_policy(false);
+  TestTrapRegistry plain_registry;
+  PolicyCompiler plain_compiler(&plain_policy, &plain_registry);
+  const CodeGen::Program expected = plain_compiler.Compile();
+  EXPECT_EQ(0, plain_policy.class_evaluations());
+
+  // Each class is evaluated just once, and the program is the same.
+  ClassPolicy policy(true);
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+  const CodeGen::Program program = compiler.Compile();
+  EXPECT_EQ(2, policy.class_evaluations());
+
+  ExpectSamePrograms(expected, program);
+}
+
+intptr_t PerSyscallTrap(const struct arch_seccomp_data&, void*) {
+  return 0;
+}
+
+// Distinct auxiliary data for PerSyscallTrap, so that the policy
+// registers several trap handlers.
+const char kPerSyscallTrapAux[7] = {};
+
+// PerSyscallPolicy gives the first 128 system calls results of their own.
+class PerSyscallPolicy : public Policy {
+ public:
+  PerSyscallPolicy() {}
+  ~PerSyscallPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno >= 128) {
+      return Allow();
+    }
+    const Arg<int> arg(0);
+    const void* aux = &kPerSyscallTrapAux[sysno % 7];
+    return If(arg == sysno, Error(1 + sysno % 100))
+        .ElseIf(arg == -sysno, Trap(PerSyscallTrap, aux))
+        .Else(Allow());
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PerSyscallPolicy);
+};
+
+TEST(PolicyCompiler, MultiThreaded) {
+  PerSyscallPolicy policy;
+  TestTrapRegistry serial_traps;
+  const CodeGen::Program expected =
+      PolicyCompiler(&policy, &serial_traps).Compile();
+
+  for (size_t num_threads : {2, 3, 8}) {
+    TestTrapRegistry traps;
+    PolicyCompiler compiler(&policy, &traps);
+    compiler.SetNumThreads(num_threads);
+    ExpectSamePrograms(expected, compiler.Compile());
+  }
+}
+
+// VariantBasePolicy denies every other system call below 64.
+class VariantBasePolicy : public Policy {
+ public:
+  VariantBasePolicy() {}
+  ~VariantBasePolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno < 64 && sysno % 2 == 0) {
+      return Error(EPERM);
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(VariantBasePolicy);
+};
+
+// VariantDeltaPolicy overrides system calls [first, last] with an
+// argument check, and all of |denied| with an error.
+class VariantDeltaPolicy : public Policy {
+ public:
+  VariantDeltaPolicy(int first, int last, const std::vector<int>& denied)
+      : first_(first), last_(last), denied_(denied) {}
+  ~VariantDeltaPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (std::find(denied_.begin(), denied_.end(), sysno) != denied_.end()) {
+      return Error(EACCES);
+    }
+    if (sysno >= first_ && sysno <= last_) {
+      const Arg<int> arg(1);
+      return If(arg == first_, Error(EINVAL)).Else(Allow());
+    }
+    return ResultExpr();
+  }
+
+ private:
+  const int first_;
+  const int last_;
+  const std::vector<int> denied_;
+
+  DISALLOW_COPY_AND_ASSIGN(VariantDeltaPolicy);
+};
+
+// MergedPolicy is |delta| applied to |base|, as CompileVariant does.
+class MergedPolicy : public Policy {
+ public:
+  MergedPolicy(const Policy* base, const Policy* delta)
+      : base_(base), delta_(delta) {}
+  ~MergedPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    ResultExpr result = delta_->EvaluateSyscall(sysno);
+    return result ? result : base_->EvaluateSyscall(sysno);
+  }
+
+ private:
+  const Policy* base_;
+  const Policy* delta_;
+
+  DISALLOW_COPY_AND_ASSIGN(MergedPolicy);
+};
+
+TEST(PolicyCompiler, CompileVariant) {
+  VariantBasePolicy base;
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&base, &traps);
+  const CodeGen::Program base_program = compiler.Compile();
+
+  const int kLastSyscall = static_cast<int>(MAX_PUBLIC_SYSCALL) - 1;
+  const VariantDeltaPolicy deltas[] = {
+      {10, 20, std::vector<int>()},
+      {0, 0, std::vector<int>{1, 3, 5}},
+      {63, 64, std::vector<int>{kLastSyscall}},
+      {100, 99, std::vector<int>()},  // Overrides nothing.
+      {30, 40, std::vector<int>{0, 2, 4, 6}},
+  };
+  for (const VariantDeltaPolicy& delta : deltas) {
+    MergedPolicy merged(&base, &delta);
+    TestTrapRegistry merged_traps;
+    const CodeGen::Program expected =
+        PolicyCompiler(&merged, &merged_traps).Compile();
+    const CodeGen::Program variant = compiler.CompileVariant(&delta);
+
+    // The variant's nodes are laid out in the order the compiler first
+    // emitted them, so the programs only need to behave the same.
+    for (uint32_t sysnum : SyscallSet::All()) {
+      for (uint64_t arg : {0, 10, 30, 63}) {
+        struct arch_seccomp_data data = FakeSyscall(static_cast<int>(sysnum));
+        data.args[1] = arg;
+        const char* err = nullptr;
+        const uint32_t want = Verifier::EvaluateBPF(expected, data, &err);
+        ASSERT_FALSE(err) << err;
+        EXPECT_EQ(want, Verifier::EvaluateBPF(variant, data, &err))
+            << "sysnum " << sysnum << ", arg " << arg;
+        ASSERT_FALSE(err) << err;
+      }
+    }
+  }
+
+  // Variants don't affect the policy itself.
+  ExpectSamePrograms(base_program, compiler.Compile());
+}
+
+// RotatedErrorsPolicy fails each system call below 200 with its own
+// error, shifted by |rotation|, unless its first argument is its number.
+// It allows all other system calls.
+class RotatedErrorsPolicy : public Policy {
+ public:
+  explicit RotatedErrorsPolicy(int rotation) : rotation_(rotation) {}
+  ~RotatedErrorsPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno >= 200) {
+      return Allow();
+    }
+    const Arg<int> fd(0);
+    return If(fd == sysno, Allow())
+        .Else(Error((sysno + rotation_) % 1000 + 1));
+  }
+
+  // Returns what the policy with |rotation| returns for |sysno| when its
+  // first argument isn't |sysno|.
+  static uint32_t Expected(uint32_t sysno, int rotation) {
+    if (sysno >= 200) {
+      return SECCOMP_RET_ALLOW;
+    }
+    return SECCOMP_RET_ERRNO + (sysno + rotation) % 1000 + 1;
+  }
+
+ private:
+  const int rotation_;
+
+  DISALLOW_COPY_AND_ASSIGN(RotatedErrorsPolicy);
+};
+
+TEST(PolicyCompiler, CompileManyVariants) {
+  RotatedErrorsPolicy base(0);
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&base, &traps);
+  const CodeGen::Program base_program = compiler.Compile();
+  ASSERT_LT(1000U, base_program.size());
+
+  // Every variant overrides every system call, so if the compiler kept
+  // the variants' nodes, they would add up to more than it can hold.
+  for (int rotation = 1; rotation <= 60; ++rotation) {
+    const RotatedErrorsPolicy delta(rotation);
+    const CodeGen::Program variant = compiler.CompileVariant(&delta);
+    for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+      struct arch_seccomp_data data = FakeSyscall(static_cast<int>(sysnum));
+      data.args[0] = sysnum;
+      const char* err = nullptr;
+      EXPECT_EQ(SECCOMP_RET_ALLOW, Verifier::EvaluateBPF(variant, data, &err))
+          << "sysnum " << sysnum << ", rotation " << rotation;
+      ASSERT_FALSE(err) << err;
+
+      data.args[0] = sysnum + 1;
+      EXPECT_EQ(RotatedErrorsPolicy::Expected(sysnum, rotation),
+                Verifier::EvaluateBPF(variant, data, &err))
+          << "sysnum " << sysnum << ", rotation " << rotation;
+      ASSERT_FALSE(err) << err;
+    }
+  }
+
+  ExpectSamePrograms(base_program, compiler.Compile());
+}
+
+TEST(PolicyCompiler, StatsCountSavedTrampolines) {
+  // The results are compiled before the jump table that dispatches to
+  // them, so many of them are out of its range unless the program is
+  // laid out again.
+  PerSyscallPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler::Stats stats;
+  PolicyCompiler(&policy, &traps).Compile(&stats);
+  EXPECT_LT(stats.jump_trampolines, stats.jump_trampolines_saved);
+}
+
+// Returns the result of running |filters| as stacked seccomp filters:
+// the kernel runs all of them, and picks the result with the most
+// restrictive action, which SECCOMP_RET_ALLOW is the least of.
+uint32_t RunFilters(const std::vector<PolicyCompiler::Filter>& filters,
+                    const struct arch_seccomp_data& data) {
+  uint32_t result = SECCOMP_RET_ALLOW;
+  for (const PolicyCompiler::Filter& filter : filters) {
+    const char* err = nullptr;
+    const uint32_t ret = Verifier::EvaluateBPF(filter.program, data, &err);
+    EXPECT_FALSE(err) << err;
+    if ((ret & SECCOMP_RET_ACTION) < (result & SECCOMP_RET_ACTION)) {
+      result = ret;
+    }
+  }
+  return result;
+}
+
+TEST(PolicyCompiler, CompileSplit) {
+  PerSyscallPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&policy, &traps);
+  const CodeGen::Program program = compiler.Compile();
+
+  // Programs that fit aren't split.
+  std::vector<PolicyCompiler::Filter> filters =
+      compiler.CompileSplit(program.size());
+  ASSERT_EQ(1U, filters.size());
+  EXPECT_EQ(0U, filters[0].first);
+  EXPECT_EQ(std::numeric_limits<uint32_t>::max(), filters[0].last);
+  ExpectSamePrograms(program, filters[0].program);
+
+  const size_t kMaxInstructions = 400;
+  filters = compiler.CompileSplit(kMaxInstructions);
+  ASSERT_LT(1U, filters.size());
+  EXPECT_EQ(0U, filters.front().first);
+  EXPECT_EQ(std::numeric_limits<uint32_t>::max(), filters.back().last);
+  for (size_t i = 0; i < filters.size(); ++i) {
+    EXPECT_GE(kMaxInstructions, filters[i].program.size());
+    EXPECT_LE(filters[i].first, filters[i].last);
+    if (i > 0) {
+      EXPECT_EQ(filters[i - 1].last + 1, filters[i].first);
+    }
+  }
+
+  // Together, they must implement the same policy.
+  for (uint32_t sysnum : SyscallSet::All()) {
+    for (uint64_t arg : {0, 1, 64}) {
+      struct arch_seccomp_data data = FakeSyscall(static_cast<int>(sysnum));
+      data.args[0] = arg;
+      const char* err = nullptr;
+      const uint32_t expected = Verifier::EvaluateBPF(program, data, &err);
+      ASSERT_FALSE(err) << err;
+      EXPECT_EQ(expected, RunFilters(filters, data))
+          << "sysnum " << sysnum << ", arg " << arg;
+    }
+  }
+
+  // So must they for other architectures.
+  struct arch_seccomp_data data = FakeSyscall(0);
+  data.arch = ~data.arch;
+  const char* err = nullptr;
+  EXPECT_EQ(Verifier::EvaluateBPF(program, data, &err),
+            RunFilters(filters, data));
+}
+
+// LargePolicy gives every system call an argument check of its own,
+// which adds up to more instructions than fit into a single program.
+class LargePolicy : public Policy {
+ public:
+  LargePolicy() {}
+  ~LargePolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> arg0(0);
+    const Arg<int> arg1(1);
+    return If(arg0 == sysno, Error(1 + sysno % 100))
+        .ElseIf(arg1 == sysno, Error(1 + sysno % 99))
+        .Else(Allow());
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LargePolicy);
+};
+
+TEST(PolicyCompiler, CompileSplitLargePolicy) {
+  LargePolicy policy;
+  TestTrapRegistry traps;
+  const std::vector<PolicyCompiler::Filter> filters =
+      PolicyCompiler(&policy, &traps).CompileSplit(BPF_MAXINSNS);
+  ASSERT_LT(1U, filters.size());
+
+  size_t total = 0;
+  for (const PolicyCompiler::Filter& filter : filters) {
+    EXPECT_GE(static_cast<size_t>(BPF_MAXINSNS), filter.program.size());
+    total += filter.program.size();
+  }
+  // Greedy splitting shouldn't use many more filters than needed.
+  EXPECT_GE(total / BPF_MAXINSNS + 2, filters.size());
+
+  for (uint32_t sysnum : SyscallSet::All()) {
+    // Intel's system call number check is covered by CompileSplit above.
+    if (sysnum & 0x40000000) {
+      continue;
+    }
+    for (uint64_t arg : {0U, sysnum}) {
+      struct arch_seccomp_data data = FakeSyscall(static_cast<int>(sysnum));
+      data.args[0] = sysnum + 1;
+      data.args[1] = arg;
+      const uint32_t expected =
+          !SyscallSet::IsValid(sysnum)
+              ? SECCOMP_RET_ERRNO + ENOSYS
+              : arg == sysnum ? SECCOMP_RET_ERRNO + 1 + sysnum % 99
+                              : SECCOMP_RET_ALLOW;
+      EXPECT_EQ(expected, RunFilters(filters, data))
+          << "sysnum " << sysnum << ", arg " << arg;
+    }
+  }
+}
+
+#if defined(SECCOMP_COMPAT_ARCH)
+TEST(PolicyCompiler, CompatPolicy) {
+  PerSyscallPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program native = PolicyCompiler(&policy, &traps).Compile();
+
+  // Both ABIs' jump tables lead to the same results.
+  PolicyCompiler compiler(&policy, &traps);
+  compiler.SetCompatPolicy(&policy);
+  const CodeGen::Program program = compiler.Compile();
+  EXPECT_LT(program.size(), native.size() * 5 / 4);
+
+  const uint32_t kArgs[] = {0, 1, 5, 127, 0xffffff81, 0xfffffffb};
+  for (uint32_t sysnum : SyscallSet::All(SyscallSet::Abi::COMPAT)) {
+    for (uint32_t arg : kArgs) {
+      struct arch_seccomp_data data = FakeSyscall(sysnum);
+      data.arch = SECCOMP_COMPAT_ARCH;
+      data.args[0] = arg;
+      uint32_t expected = SECCOMP_RET_ERRNO + ENOSYS;
+      if (SyscallSet::IsValid(sysnum, SyscallSet::Abi::COMPAT)) {
+        struct arch_seccomp_data native_data = data;
+        native_data.arch = SECCOMP_ARCH;
+        // All system calls from 128 on are allowed.
+        native_data.nr = std::min(sysnum, 128U);
+        const char* err = nullptr;
+        expected = Verifier::EvaluateBPF(native, native_data, &err);
+        ASSERT_FALSE(err) << err;
+      }
+#if defined(__x86_64__)
+      // Like on i386, bit 30 of the system call number must be clear.
+      if (sysnum & 0x40000000) {
+        expected = SECCOMP_RET_KILL;
+      }
+#endif
+      const char* err = nullptr;
+      EXPECT_EQ(expected, Verifier::EvaluateBPF(program, data, &err))
+          << "system call " << sysnum << " arg " << arg;
+      EXPECT_FALSE(err) << err;
+    }
+  }
+}
+#endif  // defined(SECCOMP_COMPAT_ARCH)
+
+#if defined(__LP64__)
+class WideRangePolicy : public Policy {
+ public:
+  WideRangePolicy() {}
+  ~WideRangePolicy() override {}
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_mmap) {
+      const Arg<uint64_t> addr(0);
+      const Arg<int64_t> offset(5);
+      return If(addr.InRange(0x1fffffff0ULL, 0x300000005ULL), Allow())
+          .ElseIf(offset < -0x100000000LL, Error(EPERM))
+          .ElseIf(offset >= 0x200000000LL, Error(EINVAL))
+          .Else(Error(ENOMEM));
+    }
+    return Allow();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WideRangePolicy);
+};
+
+TEST(PolicyCompiler, WideRanges) {
+  WideRangePolicy policy;
+  TestTrapRegistry traps;
+  CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  const uint64_t kValues[] = {
+      0,
+      1,
+      0xffffffffULL,
+      0x100000000ULL,
+      0x1ffffffefULL,
+      0x1fffffff0ULL,
+      0x200000000ULL,
+      0x2ffffffffULL,
+      0x300000005ULL,
+      0x300000006ULL,
+      0x7fffffffffffffffULL,
+      0x8000000000000000ULL,
+      0xfffffffeffffffffULL,
+      0xffffffff00000000ULL,
+      0xffffffffffffffffULL,
+  };
+  for (uint64_t addr : kValues) {
+    for (uint64_t offset : kValues) {
+      struct arch_seccomp_data data = FakeSyscall(__NR_mmap);
+      data.args[0] = addr;
+      data.args[5] = offset;
+      uint32_t expected = SECCOMP_RET_ERRNO + ENOMEM;
+      if (addr >= 0x1fffffff0ULL && addr <= 0x300000005ULL) {
+        expected = SECCOMP_RET_ALLOW;
+      } else if (static_cast<int64_t>(offset) < -0x100000000LL) {
+        expected = SECCOMP_RET_ERRNO + EPERM;
+      } else if (static_cast<int64_t>(offset) >= 0x200000000LL) {
+        expected = SECCOMP_RET_ERRNO + EINVAL;
+      }
+      const char* err = nullptr;
+      EXPECT_EQ(expected, Verifier::EvaluateBPF(program, data, &err))
+          << "addr " << addr << " offset " << offset;
+      EXPECT_FALSE(err) << err;
+    }
+  }
+}
+#endif  // defined(__LP64__)
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
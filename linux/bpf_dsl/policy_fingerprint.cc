@@ -0,0 +1,90 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_fingerprint.h"
+
+#include <string.h>
+
+#include "base/logging.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+const size_t PolicyFingerprint::kDigestLength;
+
+PolicyFingerprint::PolicyFingerprint()
+    : context_(), results_(), bools_(), trap_indices_(), traps_() {
+  base::MD5Init(&context_);
+}
+
+PolicyFingerprint::~PolicyFingerprint() {
+}
+
+void PolicyFingerprint::AddResult(const ResultExpr& res) {
+  // Expressions are identified by the order in which they're first
+  // added. Keeping a reference to them ensures that their addresses
+  // aren't reused for other expressions in the meantime.
+  auto it = results_.find(res);
+  if (it != results_.end()) {
+    AddKind("ResultRef");
+    AddInteger(it->second);
+    return;
+  }
+  const uint64_t id = results_.size();
+  results_.insert(std::make_pair(res, id));
+  res->Fingerprint(this);
+}
+
+void PolicyFingerprint::AddBool(const BoolExpr& cond) {
+  auto it = bools_.find(cond);
+  if (it != bools_.end()) {
+    AddKind("BoolRef");
+    AddInteger(it->second);
+    return;
+  }
+  const uint64_t id = bools_.size();
+  bools_.insert(std::make_pair(cond, id));
+  cond->Fingerprint(this);
+}
+
+void PolicyFingerprint::AddKind(const char* kind) {
+  // Include the terminating NUL so that kinds can't run into each other.
+  Add(kind, strlen(kind) + 1);
+}
+
+void PolicyFingerprint::AddInteger(uint64_t value) {
+  Add(&value, sizeof(value));
+}
+
+void PolicyFingerprint::AddTrap(TrapRegistry::TrapFnc fnc,
+                                const void* aux,
+                                bool safe) {
+  auto res = trap_indices_.insert(
+      std::make_pair(std::make_tuple(fnc, aux, safe), traps_.size()));
+  if (res.second) {
+    traps_.push_back(Trap{fnc, aux, safe});
+  }
+  AddInteger(res.first->second);
+  AddInteger(safe);
+}
+
+std::string PolicyFingerprint::Digest() const {
+  // MD5Final consumes the context, so finish a copy of it instead.
+  base::MD5Context context;
+  memcpy(&context, &context_, sizeof(context));
+  base::MD5Digest digest;
+  base::MD5Final(&digest, &context);
+  const std::string res = base::MD5DigestToBase16(digest);
+  DCHECK_EQ(kDigestLength, res.size());
+  return res;
+}
+
+void PolicyFingerprint::Add(const void* data, size_t size) {
+  base::MD5Update(&context_,
+                  base::StringPiece(static_cast<const char*>(data), size));
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,84 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_POLICY_FINGERPRINT_H_
+#define SANDBOX_LINUX_BPF_DSL_POLICY_FINGERPRINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/md5.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// PolicyFingerprint computes a digest of bpf_dsl expressions that is
+// stable across processes running the same code, for use as a cache key
+// for compiled programs (see PolicyCompiler::Fingerprint). Addresses
+// differ between processes, so trap handlers are identified by the order
+// in which they are first encountered instead; the handlers themselves
+// are available from traps().
+class SANDBOX_EXPORT PolicyFingerprint {
+ public:
+  struct Trap {
+    TrapRegistry::TrapFnc fnc;
+    const void* aux;
+    bool safe;
+  };
+
+  PolicyFingerprint();
+  ~PolicyFingerprint();
+
+  // AddResult and AddBool add a description of |res| (resp. |cond|). An
+  // expression that was already added is only referred back to.
+  void AddResult(const ResultExpr& res);
+  void AddBool(const BoolExpr& cond);
+
+  // Functions below are meant for use within bpf_dsl itself.
+
+  // AddKind starts the description of an expression of kind |kind|.
+  void AddKind(const char* kind);
+
+  // AddInteger adds |value| to the description of an expression.
+  void AddInteger(uint64_t value);
+
+  // AddTrap adds a trap handler to the description of an expression.
+  void AddTrap(TrapRegistry::TrapFnc fnc, const void* aux, bool safe);
+
+  // Digest returns the fingerprint of everything added so far, as a
+  // string of kDigestLength hexadecimal digits.
+  std::string Digest() const;
+
+  // traps returns the distinct trap handlers added so far, in order of
+  // their first appearance.
+  const std::vector<Trap>& traps() const { return traps_; }
+
+  static const size_t kDigestLength = 32;
+
+ private:
+  void Add(const void* data, size_t size);
+
+  base::MD5Context context_;
+  std::map<ResultExpr, uint64_t> results_;
+  std::map<BoolExpr, uint64_t> bools_;
+  std::map<std::tuple<TrapRegistry::TrapFnc, const void*, bool>, uint64_t>
+      trap_indices_;
+  std::vector<Trap> traps_;
+
+  DISALLOW_COPY_AND_ASSIGN(PolicyFingerprint);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_POLICY_FINGERPRINT_H_
@@ -0,0 +1,312 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_oracle.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tuple>
+#include <utility>
+
+#include "base/logging.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_impl.h"
+#include "sandbox/linux/bpf_dsl/linux_syscall_ranges.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+#if defined(__i386__) || defined(__x86_64__)
+const bool kIsIntel = true;
+#else
+const bool kIsIntel = false;
+#endif
+#if defined(__x86_64__) && defined(__ILP32__)
+const bool kIsX32 = true;
+#else
+const bool kIsX32 = false;
+#endif
+
+// The bit that x32 system call numbers have set, and others don't.
+const uint32_t kX32Bit = 0x40000000;
+
+const uint64_t kUpperHalf = 0xffffffff00000000ULL;
+const uint64_t kSignBit = 0x80000000ULL;
+
+// Node operations. A return node returns |lo|. A range node continues to
+// |passed| if argument |argno| bitwise-AND'd with |mask| is within [lo,
+// hi], and to |failed| otherwise. A switch node looks up argument |argno|
+// bitwise-AND'd with |mask| in cases [lo, hi), and continues to |failed|
+// if it isn't there. An extended node continues to |passed| if argument
+// |argno| passes PolicyCompiler's check of 32-bit arguments, and to
+// |failed| otherwise.
+enum Op : uint8_t {
+  kReturn,
+  kRange,
+  kSwitch,
+  kExtended,
+};
+
+// Returns whether a 32-bit argument's upper half passes PolicyCompiler's
+// check; see PolicyCompiler::CheckArgumentWidth.
+bool IsExtended(uint64_t arg) {
+  if (sizeof(void*) == 4) {
+    return (arg & kUpperHalf) == 0;
+  }
+  return (arg & kUpperHalf) == 0 ||
+         ((arg & kUpperHalf) == kUpperHalf && (arg & kSignBit));
+}
+
+void CheckArgument(int argno, size_t width, uint64_t mask) {
+  CHECK(argno >= 0 && argno < 6) << "Invalid argument number " << argno;
+  CHECK(width == 4 || width == 8) << "Invalid argument width " << width;
+  CHECK_NE(0U, mask) << "Zero mask is invalid";
+  if (width == 4) {
+    CHECK_EQ(0U, mask >> 32) << "Mask exceeds argument size";
+  }
+}
+
+}  // namespace
+
+bool PolicyOracle::Node::operator<(const Node& other) const {
+  return std::tie(op, argno, mask, lo, hi, passed, failed) <
+         std::tie(other.op, other.argno, other.mask, other.lo, other.hi,
+                  other.passed, other.failed);
+}
+
+PolicyOracle::PolicyOracle(const Policy* policy, TrapRegistry* registry)
+    : PolicyOracle(policy, registry, PolicyCompiler::DefaultPanic) {}
+
+PolicyOracle::PolicyOracle(const Policy* policy,
+                           TrapRegistry* registry,
+                           PolicyCompiler::PanicFunc panic_func)
+    : registry_(registry),
+      panic_func_(panic_func),
+      narrow_args_(0),
+      nodes_(),
+      cases_(),
+      node_indices_(),
+      switch_indices_(),
+      results_(),
+      invalid_arch_(0),
+      invalid_x32_(0),
+      unexpected_64bit_(0),
+      table_(),
+      ranges_() {
+  Build(policy);
+}
+
+PolicyOracle::~PolicyOracle() {}
+
+uint32_t PolicyOracle::Evaluate(const struct arch_seccomp_data& data) const {
+  const uint32_t nr = static_cast<uint32_t>(data.nr);
+  size_t node;
+  if (data.arch != SECCOMP_ARCH) {
+    node = invalid_arch_;
+  } else if (kIsIntel && !!(nr & kX32Bit) != kIsX32) {
+    node = invalid_x32_;
+  } else {
+    node = FindSyscall(nr);
+  }
+
+  for (;;) {
+    const Node& n = nodes_[node];
+    switch (n.op) {
+      case kReturn:
+        return static_cast<uint32_t>(n.lo);
+      case kRange: {
+        const uint64_t value = data.args[n.argno] & n.mask;
+        node = (n.lo <= value && value <= n.hi) ? n.passed : n.failed;
+        break;
+      }
+      case kSwitch: {
+        const uint64_t value = data.args[n.argno] & n.mask;
+        size_t lo = n.lo;
+        size_t hi = n.hi;
+        node = n.failed;
+        while (lo < hi) {
+          const size_t mid = lo + (hi - lo) / 2;
+          if (cases_[mid].value < value) {
+            lo = mid + 1;
+          } else if (cases_[mid].value > value) {
+            hi = mid;
+          } else {
+            node = cases_[mid].node;
+            break;
+          }
+        }
+        break;
+      }
+      case kExtended:
+        node = IsExtended(data.args[n.argno]) ? n.passed : n.failed;
+        break;
+    }
+  }
+}
+
+size_t PolicyOracle::Return(uint32_t ret) {
+  return AddNode(Node{kReturn, 0, 0, ret, 0, 0, 0});
+}
+
+size_t PolicyOracle::Trap(TrapRegistry::TrapFnc fnc,
+                          const void* aux,
+                          bool safe) {
+  CHECK(safe) << "PolicyOracle doesn't support unsafe traps";
+  return Return(SECCOMP_RET_TRAP + registry_->Add(fnc, aux, safe));
+}
+
+size_t PolicyOracle::MaskedInRange(int argno,
+                                   size_t width,
+                                   uint64_t mask,
+                                   uint64_t lo,
+                                   uint64_t hi,
+                                   size_t passed,
+                                   size_t failed) {
+  CheckArgument(argno, width, mask);
+  CHECK_LE(lo, hi) << "Empty range";
+  // Like PolicyCompiler, don't test or check the width of an argument for
+  // a range of all values.
+  const uint64_t max = width == 4 ? 0xffffffffULL : ~0ULL;
+  if (lo == 0 && hi == max) {
+    return passed;
+  }
+  if (width == 4) {
+    narrow_args_ |= 1U << argno;
+  }
+  if (passed == failed) {
+    return passed;
+  }
+  return AddNode(Node{kRange, static_cast<uint8_t>(argno), mask, lo, hi,
+                      passed, failed});
+}
+
+size_t PolicyOracle::MaskedSwitch(int argno,
+                                  size_t width,
+                                  uint64_t mask,
+                                  const std::map<uint64_t, size_t>& cases,
+                                  size_t default_node) {
+  CheckArgument(argno, width, mask);
+  if (cases.empty()) {
+    return default_node;
+  }
+  if (width == 4) {
+    narrow_args_ |= 1U << argno;
+  }
+
+  // Cases that continue to the default node are left out, and switches
+  // with identical cases are only added once.
+  std::vector<uint64_t> key = {static_cast<uint64_t>(argno), mask,
+                               default_node};
+  for (const auto& c : cases) {
+    CHECK_EQ(c.first, c.first & mask) << "Value contains masked out bits";
+    if (c.second != default_node) {
+      key.push_back(c.first);
+      key.push_back(c.second);
+    }
+  }
+  if (key.size() == 3) {
+    return default_node;
+  }
+  auto it = switch_indices_.find(key);
+  if (it != switch_indices_.end()) {
+    return it->second;
+  }
+
+  const size_t first = cases_.size();
+  for (size_t i = 3; i < key.size(); i += 2) {
+    cases_.push_back(Case{key[i], static_cast<size_t>(key[i + 1])});
+  }
+  nodes_.push_back(Node{kSwitch, static_cast<uint8_t>(argno), mask, first,
+                        cases_.size(), 0, default_node});
+  switch_indices_.insert(std::make_pair(key, nodes_.size() - 1));
+  return nodes_.size() - 1;
+}
+
+void PolicyOracle::Build(const Policy* policy) {
+  // The panic results are added first, since the checks of 32-bit
+  // arguments continue to unexpected_64bit_.
+  unexpected_64bit_ =
+      AddResult(panic_func_(PolicyCompiler::kUnexpected64bitMessage));
+  invalid_arch_ = AddResult(panic_func_(PolicyCompiler::kInvalidArchMessage));
+  invalid_x32_ = AddResult(panic_func_(PolicyCompiler::kInvalidX32Message));
+
+  // SyscallSet::All() includes the first and last numbers of each range
+  // of invalid system call numbers, which all have the same result, so
+  // every number up to the next one has the same result as the current
+  // one.
+  table_.resize(MAX_PUBLIC_SYSCALL - MIN_SYSCALL + 1);
+  for (uint32_t nr : SyscallSet::All()) {
+    const int sysno = static_cast<int>(nr);
+    const size_t node = AddResult(SyscallSet::IsValid(nr)
+                                      ? policy->EvaluateSyscall(sysno)
+                                      : policy->InvalidSyscall());
+    // As in FindSyscall, numbers below MIN_SYSCALL wrap around.
+    if (nr - MIN_SYSCALL < table_.size()) {
+      table_[nr - MIN_SYSCALL] = node;
+    }
+    if (ranges_.empty() || ranges_.back().node != node) {
+      ranges_.push_back(Range{nr, node});
+    }
+  }
+  CHECK(!ranges_.empty() && ranges_.front().first == 0);
+}
+
+size_t PolicyOracle::AddResult(const ResultExpr& result) {
+  auto it = results_.find(result);
+  if (it != results_.end()) {
+    return it->second;
+  }
+
+  narrow_args_ = 0;
+  size_t node = result->AddToOracle(this);
+
+  // Like PolicyCompiler::CompileResult, check the upper halves of all
+  // 32-bit arguments before anything else.
+  for (int argno = 5; argno >= 0; --argno) {
+    if (narrow_args_ & (1U << argno)) {
+      node = AddNode(Node{kExtended, static_cast<uint8_t>(argno), 0, 0, 0,
+                          node, unexpected_64bit_});
+    }
+  }
+  results_.insert(std::make_pair(result, node));
+  return node;
+}
+
+size_t PolicyOracle::AddNode(const Node& node) {
+  auto it = node_indices_.find(node);
+  if (it != node_indices_.end()) {
+    return it->second;
+  }
+  nodes_.push_back(node);
+  node_indices_.insert(std::make_pair(node, nodes_.size() - 1));
+  return nodes_.size() - 1;
+}
+
+size_t PolicyOracle::FindSyscall(uint32_t nr) const {
+  // Numbers below MIN_SYSCALL wrap around, and are searched for too.
+  if (nr - MIN_SYSCALL < table_.size()) {
+    return table_[nr - MIN_SYSCALL];
+  }
+  size_t lo = 0;
+  size_t hi = ranges_.size();
+  while (hi - lo > 1) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (ranges_[mid].first <= nr) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return ranges_[lo].node;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
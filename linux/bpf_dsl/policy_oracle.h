@@ -0,0 +1,159 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_POLICY_ORACLE_H_
+#define SANDBOX_LINUX_BPF_DSL_POLICY_ORACLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+struct arch_seccomp_data;
+
+namespace bpf_dsl {
+class Policy;
+
+// PolicyOracle answers what a program compiled from a policy returns for
+// a system call, without compiling or interpreting BPF. On construction,
+// it evaluates the policy for every system call number, and flattens
+// each result into a decision tree of argument tests, shared between
+// system calls with identical results. Numbers up to MAX_PUBLIC_SYSCALL
+// are then looked up in a table, and the rest by binary search among the
+// ranges of numbers that share a tree, so a query only takes as many
+// steps as the tree is deep (switches take a binary search).
+//
+// Evaluate doesn't allocate memory or take locks, so it's safe to call
+// from signal handlers, e.g. a SIGSYS handler that wants to know what the
+// sandbox does with a system call it's about to make. Like the compiled
+// program, the oracle includes the checks of the architecture, x32
+// system call numbers and 32-bit arguments. Unsafe traps aren't
+// supported, since they depend on the instruction pointer; neither are
+// compatibility ABI policies.
+class SANDBOX_EXPORT PolicyOracle {
+ public:
+  // |registry| must be the one that the policy's programs are compiled
+  // with, so that trap handlers have the same IDs. Any trap handlers are
+  // registered here, not by Evaluate.
+  PolicyOracle(const Policy* policy, TrapRegistry* registry);
+
+  // Same as above, for programs that were compiled with |panic_func|; see
+  // PolicyCompiler::SetPanicFunc.
+  PolicyOracle(const Policy* policy,
+               TrapRegistry* registry,
+               PolicyCompiler::PanicFunc panic_func);
+
+  ~PolicyOracle();
+
+  // Evaluate returns the seccomp return value of the policy's programs
+  // for |data|. It is async-signal-safe.
+  uint32_t Evaluate(const struct arch_seccomp_data& data) const;
+
+  // num_nodes returns the number of nodes in all decision trees.
+  size_t num_nodes() const { return nodes_.size(); }
+
+  // Functions below are meant for use within bpf_dsl itself. Nodes are
+  // identified by their index, and identical nodes are only added once.
+
+  // Return returns a node that returns the seccomp return value |ret|.
+  size_t Return(uint32_t ret);
+
+  // Trap returns a node that invokes a trap handler, which it registers.
+  size_t Trap(TrapRegistry::TrapFnc fnc, const void* aux, bool safe);
+
+  // MaskedInRange returns a node that continues to |passed| if argument
+  // |argno| bitwise-AND'd with |mask| is within the inclusive range [lo,
+  // hi], and to |failed| otherwise. |width| is handled the same as by
+  // PolicyCompiler::MaskedEqual.
+  size_t MaskedInRange(int argno,
+                       size_t width,
+                       uint64_t mask,
+                       uint64_t lo,
+                       uint64_t hi,
+                       size_t passed,
+                       size_t failed);
+
+  // MaskedSwitch returns a node that continues to the node in |cases|
+  // keyed by argument |argno| bitwise-AND'd with |mask|, or to
+  // |default_node| if there is none. |width| is handled the same as by
+  // PolicyCompiler::MaskedEqual.
+  size_t MaskedSwitch(int argno,
+                      size_t width,
+                      uint64_t mask,
+                      const std::map<uint64_t, size_t>& cases,
+                      size_t default_node);
+
+ private:
+  // Node is a node of a decision tree. The meaning of its fields depends
+  // on |op|; see Evaluate.
+  struct Node {
+    bool operator<(const Node& other) const;
+
+    uint8_t op;
+    uint8_t argno;
+    uint64_t mask;
+    uint64_t lo;
+    uint64_t hi;
+    size_t passed;
+    size_t failed;
+  };
+
+  // Case is one of the cases of a switch node, which are sorted by value.
+  struct Case {
+    uint64_t value;
+    size_t node;
+  };
+
+  // Range is a range of system call numbers that share a decision tree,
+  // from |first| up to the next range's.
+  struct Range {
+    uint32_t first;
+    size_t node;
+  };
+
+  // Evaluates the policy for every system call number and builds the
+  // decision trees and the tables.
+  void Build(const Policy* policy);
+
+  // Returns the root of the decision tree for |result|, including the
+  // checks of the 32-bit arguments that it tests.
+  size_t AddResult(const ResultExpr& result);
+
+  // Returns the index of |node|, adding it if necessary.
+  size_t AddNode(const Node& node);
+
+  // Returns the root of the decision tree for system call number |nr|.
+  size_t FindSyscall(uint32_t nr) const;
+
+  TrapRegistry* registry_;
+  PolicyCompiler::PanicFunc panic_func_;
+  uint32_t narrow_args_;
+
+  std::vector<Node> nodes_;
+  std::vector<Case> cases_;
+  std::map<Node, size_t> node_indices_;
+  std::map<std::vector<uint64_t>, size_t> switch_indices_;
+  std::map<ResultExpr, size_t> results_;
+
+  size_t invalid_arch_;
+  size_t invalid_x32_;
+  size_t unexpected_64bit_;
+  std::vector<size_t> table_;
+  std::vector<Range> ranges_;
+
+  DISALLOW_COPY_AND_ASSIGN(PolicyOracle);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_POLICY_ORACLE_H_
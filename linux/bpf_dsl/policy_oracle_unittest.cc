@@ -0,0 +1,192 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/policy_oracle.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+intptr_t TrapHandler(const struct arch_seccomp_data&, void*) {
+  return -1;
+}
+
+ResultExpr TrapPanic(const char* error) {
+  return Trap(TrapHandler, error);
+}
+
+// OracleTestPolicy uses every kind of result and argument test, with
+// 32-bit and 64-bit arguments, and returns the same results for many
+// system calls.
+class OracleTestPolicy : public Policy {
+ public:
+  OracleTestPolicy() {}
+  ~OracleTestPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> fd(0);
+    const Arg<int> flags(1);
+    const Arg<uint64_t> addr(2);
+    if (sysno >= 40) {
+      return sysno % 2 ? Allow() : Error(ENOSYS);
+    }
+    switch (sysno % 8) {
+      case 0:
+        return Trap(TrapHandler, nullptr);
+      case 1:
+        return If(AnyOf(fd == sysno % 8, fd == -1), Allow()).Else(Error(EPERM));
+      case 2:
+        return If((flags & 0xff00) == 0x100, Error(EACCES))
+            .ElseIf((flags & 0x3) != 0, Allow())
+            .Else(Kill());
+      case 3:
+        return Switch(fd)
+            .CASES((1, 2, 3, 5), Allow())
+            .CASES((7, 1000), Error(EPERM))
+            .Default(Error(EBADF));
+      case 4:
+        return If(AllOf(fd >= 3, fd < 100, (flags & 0x40) == 0), Allow())
+            .Else(Error(EMFILE));
+      case 5:
+        return If(addr.In({0, 0x1000, 0x100000000ULL}), Allow())
+            .ElseIf(addr > 0x7fffffffffffULL, Error(EFAULT))
+            .Else(Error(EINVAL));
+      case 6:
+        return If(flags.In({1, 3, 4, 9, 10, 11, 17, 20}), Allow())
+            .Else(Error(EINVAL));
+      default:
+        // A range of all values isn't a test, so the upper half of |fd|
+        // isn't checked either.
+        return If(fd >= 0U, Allow()).Else(Kill());
+    }
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(OracleTestPolicy);
+};
+
+// Returns system calls for every system call number in SyscallSet::All(),
+// with arguments that all of OracleTestPolicy's tests tell apart, and
+// with the wrong architecture and x32 bit.
+std::vector<struct arch_seccomp_data> TestSyscalls() {
+  const uint64_t kArgs[] = {0,
+                            1,
+                            3,
+                            7,
+                            20,
+                            0x100,
+                            0x141,
+                            0x1000,
+                            1000,
+                            0xffffffff,
+                            0x80000000,
+                            0x100000000ULL,
+                            0x800000000000ULL,
+                            0xffffffff80000000ULL,
+                            0xffffffffffffffffULL};
+  std::vector<struct arch_seccomp_data> data;
+  for (uint32_t nr : SyscallSet::All()) {
+    for (uint64_t arg : kArgs) {
+      data.push_back({static_cast<int>(nr), SECCOMP_ARCH, 0,
+                      {arg, arg ^ 0x40, arg, 0, 0, 0}});
+    }
+  }
+  data.push_back({0, ~SECCOMP_ARCH, 0, {}});
+  data.push_back({0x40000001, SECCOMP_ARCH, 0, {}});
+  return data;
+}
+
+TEST(PolicyOracle, CompiledPolicy) {
+  OracleTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+  const PolicyOracle oracle(&policy, &traps);
+
+  for (const struct arch_seccomp_data& data : TestSyscalls()) {
+    const char* err = nullptr;
+    EXPECT_EQ(Verifier::EvaluateBPF(program, data, &err),
+              oracle.Evaluate(data))
+        << "system call " << data.nr << " args " << data.args[0];
+    EXPECT_EQ(nullptr, err);
+  }
+}
+
+TEST(PolicyOracle, PanicFunc) {
+  OracleTestPolicy policy;
+  TestTrapRegistry traps;
+  PolicyCompiler compiler(&policy, &traps);
+  compiler.SetPanicFunc(TrapPanic);
+  const CodeGen::Program program = compiler.Compile();
+  const PolicyOracle oracle(&policy, &traps, TrapPanic);
+
+  for (const struct arch_seccomp_data& data : TestSyscalls()) {
+    const char* err = nullptr;
+    EXPECT_EQ(Verifier::EvaluateBPF(program, data, &err),
+              oracle.Evaluate(data))
+        << "system call " << data.nr << " args " << data.args[0];
+  }
+}
+
+TEST(PolicyOracle, SharedTrees) {
+  OracleTestPolicy policy;
+  TestTrapRegistry traps;
+  const PolicyOracle oracle(&policy, &traps);
+
+  // System calls with the same result share a tree, and identical tests
+  // within trees are only added once, so the oracle doesn't grow with the
+  // number of system calls.
+  EXPECT_LT(oracle.num_nodes(), 60U);
+}
+
+const PolicyOracle* g_oracle;
+uint32_t g_result;
+
+void OracleSignalHandler(int signo) {
+  const struct arch_seccomp_data data = {3, SECCOMP_ARCH, 0, {5}};
+  g_result = g_oracle->Evaluate(data);
+}
+
+TEST(PolicyOracle, SignalHandler) {
+  OracleTestPolicy policy;
+  TestTrapRegistry traps;
+  const PolicyOracle oracle(&policy, &traps);
+
+  struct sigaction sa;
+  struct sigaction old_sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OracleSignalHandler;
+  ASSERT_EQ(0, sigaction(SIGUSR2, &sa, &old_sa));
+  g_oracle = &oracle;
+  g_result = 0;
+  ASSERT_EQ(0, raise(SIGUSR2));
+  ASSERT_EQ(0, sigaction(SIGUSR2, &old_sa, nullptr));
+  g_oracle = nullptr;
+  EXPECT_EQ(SECCOMP_RET_ALLOW, g_result);
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
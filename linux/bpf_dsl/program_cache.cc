@@ -0,0 +1,226 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/program_cache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/posix/eintr_wrapper.h"
+#include "base/sha1.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+const uint32_t kMagic = 0x43465042;  // "BPFC"
+const uint32_t kVersion = 2;
+const size_t kKeyLength = 32;
+
+// Each cache entry is a Header followed by |num_insns| instructions.
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_insns;
+  uint32_t num_traps;
+  char key[kKeyLength];
+  // HMAC-SHA1 of the header (with |mac| zeroed) and the instructions.
+  uint8_t mac[base::kSHA1Length];
+};
+static_assert(sizeof(Header) == 68, "unexpected cache entry header size");
+
+// Keys become file names, so only allow lowercase hexadecimal digits.
+bool IsValidKey(const std::string& key) {
+  if (key.size() != kKeyLength) {
+    return false;
+  }
+  for (char c : key) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Computes the HMAC (RFC 2104) of |header| and its instructions.
+void ComputeMac(const std::string& secret,
+                const Header& header,
+                const struct sock_filter* insns,
+                uint8_t mac[base::kSHA1Length]) {
+  const size_t kBlockSize = 64;
+  std::string key = secret;
+  if (key.size() > kBlockSize) {
+    key = base::SHA1HashString(key);
+  }
+  key.resize(kBlockSize, '\0');
+
+  Header copy = header;
+  memset(copy.mac, 0, sizeof(copy.mac));
+  std::string inner(key);
+  for (char& c : inner) {
+    c ^= 0x36;
+  }
+  inner.append(reinterpret_cast<const char*>(&copy), sizeof(copy));
+  inner.append(reinterpret_cast<const char*>(insns),
+               header.num_insns * sizeof(*insns));
+
+  std::string outer(key);
+  for (char& c : outer) {
+    c ^= 0x5c;
+  }
+  outer += base::SHA1HashString(inner);
+  base::SHA1HashBytes(reinterpret_cast<const unsigned char*>(outer.data()),
+                      outer.size(), mac);
+}
+
+// Compares MACs in constant time, so as not to reveal how much of a
+// forged one is right.
+bool MacsEqual(const uint8_t* a, const uint8_t* b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < base::kSHA1Length; ++i) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
+
+bool WriteFully(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = HANDLE_EINTR(write(fd, p, size));
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+const size_t ProgramCache::kMinSecretLength;
+
+ProgramCache::Entry::Entry() : program(), num_traps(0) {
+}
+
+ProgramCache::Entry::~Entry() {
+}
+
+ProgramCache::ProgramCache(base::ScopedFD directory,
+                           const std::string& secret)
+    : directory_(std::move(directory)), secret_(secret) {
+  CHECK_GE(secret_.size(), kMinSecretLength);
+}
+
+ProgramCache::~ProgramCache() {
+}
+
+bool ProgramCache::Load(const std::string& key, Entry* entry) {
+  if (!directory_.is_valid() || !IsValidKey(key) ||
+      !IsTrusted(directory_.get(), S_IFDIR)) {
+    return false;
+  }
+
+  base::ScopedFD fd(HANDLE_EINTR(openat(directory_.get(), key.c_str(),
+                                        O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+  if (!fd.is_valid() || !IsTrusted(fd.get(), S_IFREG)) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd.get(), &st) != 0 || st.st_size < 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    return false;
+  }
+  const size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  bool valid = false;
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  const struct sock_filter* insns = reinterpret_cast<const struct sock_filter*>(
+      static_cast<const char*>(data) + sizeof(Header));
+  if (header.magic == kMagic && header.version == kVersion &&
+      header.num_insns > 0 && header.num_insns <= BPF_MAXINSNS &&
+      size == sizeof(Header) + header.num_insns * sizeof(*insns) &&
+      memcmp(header.key, key.data(), kKeyLength) == 0) {
+    uint8_t mac[base::kSHA1Length];
+    ComputeMac(secret_, header, insns, mac);
+    valid = MacsEqual(mac, header.mac);
+  }
+  if (valid) {
+    entry->program.assign(insns, insns + header.num_insns);
+    entry->num_traps = header.num_traps;
+  }
+
+  munmap(data, size);
+  return valid;
+}
+
+bool ProgramCache::Store(const std::string& key, const Entry& entry) {
+  if (!directory_.is_valid() || !IsValidKey(key) || entry.program.empty() ||
+      entry.program.size() > BPF_MAXINSNS ||
+      !IsTrusted(directory_.get(), S_IFDIR)) {
+    return false;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.num_insns = entry.program.size();
+  header.num_traps = entry.num_traps;
+  memcpy(header.key, key.data(), kKeyLength);
+  ComputeMac(secret_, header, &entry.program[0], header.mac);
+
+  // Write to a file name that Load never looks at, so that a concurrent
+  // reader either sees the old entry or the complete new one.
+  const std::string tmp_name = key + ".tmp." + std::to_string(getpid());
+  base::ScopedFD fd(HANDLE_EINTR(
+      openat(directory_.get(), tmp_name.c_str(),
+             O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600)));
+  if (!fd.is_valid()) {
+    return false;
+  }
+
+  const bool written =
+      WriteFully(fd.get(), &header, sizeof(header)) &&
+      WriteFully(fd.get(), &entry.program[0],
+                 entry.program.size() * sizeof(entry.program[0]));
+  fd.reset();
+  if (!written ||
+      renameat(directory_.get(), tmp_name.c_str(), directory_.get(),
+               key.c_str()) != 0) {
+    unlinkat(directory_.get(), tmp_name.c_str(), 0);
+    return false;
+  }
+  return true;
+}
+
+// static
+bool ProgramCache::IsTrusted(int fd, mode_t type) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  return (st.st_mode & S_IFMT) == type && st.st_uid == geteuid() &&
+         (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
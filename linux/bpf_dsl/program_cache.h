@@ -0,0 +1,88 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_PROGRAM_CACHE_H_
+#define SANDBOX_LINUX_BPF_DSL_PROGRAM_CACHE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "base/files/scoped_file.h"
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// ProgramCache stores compiled BPF programs in a directory, so that
+// processes that repeatedly install the same policy can skip compiling
+// it. Entries are keyed by PolicyFingerprint digests; see
+// PolicyCompiler::CompileCached.
+//
+// Whoever can write to the cache could make other processes install
+// arbitrary filters, so every entry is authenticated with an HMAC keyed
+// by a secret that the cache is created with. The secret must be
+// generated randomly by whoever launches the processes that share the
+// cache (e.g. with base::RandBytesAsString), and must be kept from
+// anyone that can write to the cache directory but isn't trusted to pick
+// the processes' filters -- in particular from those processes once
+// they're sandboxed, if they can still write to the directory. Entries
+// that don't carry a valid HMAC are ignored.
+//
+// In addition, entries are only ever loaded from a directory and files
+// that are owned by the effective user and that neither the group nor
+// others can write to. Files are opened without following symbolic
+// links, and entries are written to a temporary file first and then
+// renamed into place, so readers never observe a partial entry.
+//
+// Any error is treated as a cache miss; the cache is merely an
+// optimization.
+class SANDBOX_EXPORT ProgramCache {
+ public:
+  struct SANDBOX_EXPORT Entry {
+    Entry();
+    ~Entry();
+
+    // The compiled program, with trap handlers referred to by canonical
+    // IDs instead of process-specific ones.
+    CodeGen::Program program;
+
+    // Number of distinct trap handlers that |program| may refer to.
+    size_t num_traps;
+  };
+
+  // Minimum length of the secret, in bytes.
+  static const size_t kMinSecretLength = 16;
+
+  // Uses the directory that |directory| refers to as the cache, with
+  // entries authenticated using |secret|.
+  ProgramCache(base::ScopedFD directory, const std::string& secret);
+  ~ProgramCache();
+
+  // Load looks up the entry for |key| and stores it in |entry|. Returns
+  // false if there is no valid entry for |key|.
+  bool Load(const std::string& key, Entry* entry);
+
+  // Store stores |entry| under |key|, replacing any existing entry.
+  // Returns false if the entry couldn't be written.
+  bool Store(const std::string& key, const Entry& entry);
+
+ private:
+  // Returns true if |fd| refers to a file of |type| that is owned by the
+  // effective user and not writable by anyone else.
+  static bool IsTrusted(int fd, mode_t type);
+
+  base::ScopedFD directory_;
+  const std::string secret_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProgramCache);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_PROGRAM_CACHE_H_
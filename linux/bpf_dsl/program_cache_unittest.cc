@@ -0,0 +1,270 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/program_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "base/files/scoped_file.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/policy_fingerprint.h"
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+intptr_t FirstTrap(const struct arch_seccomp_data&, void*) {
+  return 1;
+}
+
+intptr_t SecondTrap(const struct arch_seccomp_data&, void*) {
+  return 2;
+}
+
+class TrapPolicy : public Policy {
+ public:
+  explicit TrapPolicy(int err) : err_(err) {}
+  ~TrapPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    if (sysno == __NR_getpid) {
+      const Arg<int> fd(0);
+      return If(fd == 0, Trap(FirstTrap, nullptr))
+          .ElseIf(fd == 1, Trap(SecondTrap, nullptr))
+          .Else(Error(err_));
+    }
+    if (sysno == __NR_getppid) {
+      return Trap(SecondTrap, nullptr);
+    }
+    return Allow();
+  }
+
+ private:
+  int err_;
+
+  DISALLOW_COPY_AND_ASSIGN(TrapPolicy);
+};
+
+const char kSecret[] = "0123456789abcdef";
+
+std::string Fingerprint(const Policy& policy) {
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+  PolicyFingerprint fp;
+  compiler.Fingerprint(&fp);
+  return fp.Digest();
+}
+
+class ProgramCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(dir_.CreateUniqueTempDir());
+    ASSERT_EQ(0, chmod(dir_.path().value().c_str(), 0700));
+  }
+
+  base::ScopedFD OpenDir() {
+    return base::ScopedFD(
+        open(dir_.path().value().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  }
+
+  std::string EntryPath(const std::string& key) {
+    return dir_.path().value() + "/" + key;
+  }
+
+  base::ScopedTempDir dir_;
+};
+
+TEST(PolicyFingerprintTest, Deterministic) {
+  const TrapPolicy policy(EPERM);
+  const TrapPolicy same_policy(EPERM);
+  const TrapPolicy other_policy(EACCES);
+
+  const std::string key = Fingerprint(policy);
+  EXPECT_EQ(PolicyFingerprint::kDigestLength, key.size());
+  EXPECT_EQ(key, Fingerprint(same_policy));
+  EXPECT_NE(key, Fingerprint(other_policy));
+}
+
+TEST(PolicyFingerprintTest, CompilerSettings) {
+  const TrapPolicy policy(EPERM);
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+
+  PolicyFingerprint fp;
+  compiler.Fingerprint(&fp);
+  compiler.SetOptimizeForActionCache(true);
+  PolicyFingerprint optimized_fp;
+  compiler.Fingerprint(&optimized_fp);
+  EXPECT_NE(fp.Digest(), optimized_fp.Digest());
+  if (SyscallSet::HasCompatAbi()) {
+    const TrapPolicy compat_policy(EPERM);
+    compiler.SetCompatPolicy(&compat_policy);
+    PolicyFingerprint compat_fp;
+    compiler.Fingerprint(&compat_fp);
+    EXPECT_NE(optimized_fp.Digest(), compat_fp.Digest());
+  }
+
+  // Traps are listed in order of their first appearance.
+  ASSERT_LE(2U, fp.traps().size());
+  size_t first = fp.traps().size(), second = fp.traps().size();
+  for (size_t i = 0; i < fp.traps().size(); ++i) {
+    if (fp.traps()[i].fnc == FirstTrap) {
+      first = i;
+    } else if (fp.traps()[i].fnc == SecondTrap) {
+      second = i;
+    }
+  }
+  EXPECT_LT(first, second);
+  ASSERT_LT(second, fp.traps().size());
+}
+
+TEST_F(ProgramCacheTest, RoundTrip) {
+  const TrapPolicy policy(EPERM);
+
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+  ProgramCache cache(OpenDir(), kSecret);
+  const CodeGen::Program program = compiler.CompileCached(&cache);
+
+  PolicyFingerprint fp;
+  compiler.Fingerprint(&fp);
+  ProgramCache::Entry entry;
+  ASSERT_TRUE(cache.Load(fp.Digest(), &entry));
+  EXPECT_EQ(program.size(), entry.program.size());
+  EXPECT_EQ(fp.traps().size(), entry.num_traps);
+
+  // A registry with other traps already registered assigns different IDs
+  // to the policy's traps, which the cached program must be adjusted to.
+  TestTrapRegistry other_registry;
+  other_registry.Add(SecondTrap, &registry, true);
+  other_registry.Add(SecondTrap, nullptr, true);
+  PolicyCompiler cached_compiler(&policy, &other_registry);
+  const CodeGen::Program cached = cached_compiler.CompileCached(&cache);
+  PolicyCompiler fresh_compiler(&policy, &other_registry);
+  const CodeGen::Program fresh = fresh_compiler.Compile();
+  ExpectSamePrograms(fresh, cached);
+}
+
+TEST_F(ProgramCacheTest, UsesCachedProgram) {
+  const TrapPolicy policy(EPERM);
+  TestTrapRegistry registry;
+  PolicyCompiler compiler(&policy, &registry);
+  PolicyFingerprint fp;
+  compiler.Fingerprint(&fp);
+
+  // Plant a program that returns the policy's second trap handler, by
+  // its canonical ID.
+  ProgramCache::Entry entry;
+  entry.program.push_back(
+      {BPF_RET + BPF_K, 0, 0, SECCOMP_RET_TRAP + 2});
+  entry.num_traps = fp.traps().size();
+  ProgramCache cache(OpenDir(), kSecret);
+  ASSERT_TRUE(cache.Store(fp.Digest(), entry));
+
+  const CodeGen::Program program = compiler.CompileCached(&cache);
+  ASSERT_EQ(1U, program.size());
+  EXPECT_EQ(SECCOMP_RET_TRAP + registry.Add(fp.traps()[1].fnc,
+                                            fp.traps()[1].aux,
+                                            fp.traps()[1].safe),
+            program[0].k);
+
+  // Canonical IDs that are out of range are ignored.
+  entry.program[0].k = SECCOMP_RET_TRAP + fp.traps().size() + 1;
+  ASSERT_TRUE(cache.Store(fp.Digest(), entry));
+  EXPECT_LT(1U, compiler.CompileCached(&cache).size());
+}
+
+TEST_F(ProgramCacheTest, RejectsCorruptEntries) {
+  const std::string key(PolicyFingerprint::kDigestLength, 'a');
+  ProgramCache::Entry entry;
+  entry.program.push_back({BPF_RET + BPF_K, 0, 0, SECCOMP_RET_ALLOW});
+
+  ProgramCache cache(OpenDir(), kSecret);
+  EXPECT_FALSE(cache.Load(key, &entry));
+  ASSERT_TRUE(cache.Store(key, entry));
+  ASSERT_TRUE(cache.Load(key, &entry));
+  EXPECT_FALSE(cache.Load(std::string(key.size(), 'b'), &entry));
+  EXPECT_FALSE(cache.Store("../" + key.substr(3), entry));
+
+  // Flip a bit of the program.
+  base::ScopedFD fd(open(EntryPath(key).c_str(), O_RDWR | O_CLOEXEC));
+  ASSERT_TRUE(fd.is_valid());
+  struct stat st;
+  ASSERT_EQ(0, fstat(fd.get(), &st));
+  char c;
+  ASSERT_EQ(1, pread(fd.get(), &c, 1, st.st_size - 1));
+  c ^= 1;
+  ASSERT_EQ(1, pwrite(fd.get(), &c, 1, st.st_size - 1));
+  EXPECT_FALSE(cache.Load(key, &entry));
+
+  // Truncate it.
+  ASSERT_TRUE(cache.Store(key, entry));
+  ASSERT_EQ(0, truncate(EntryPath(key).c_str(), st.st_size - 1));
+  EXPECT_FALSE(cache.Load(key, &entry));
+}
+
+TEST_F(ProgramCacheTest, RejectsEntriesWithOtherSecret) {
+  const std::string key(PolicyFingerprint::kDigestLength, 'a');
+  ProgramCache::Entry entry;
+  entry.program.push_back({BPF_RET + BPF_K, 0, 0, SECCOMP_RET_ALLOW});
+
+  ProgramCache cache(OpenDir(), kSecret);
+  ASSERT_TRUE(cache.Store(key, entry));
+  ASSERT_TRUE(cache.Load(key, &entry));
+
+  // Whoever doesn't know the secret can't forge entries, even with
+  // write access to the directory.
+  ProgramCache other_cache(OpenDir(), "fedcba9876543210");
+  EXPECT_FALSE(other_cache.Load(key, &entry));
+  ASSERT_TRUE(other_cache.Store(key, entry));
+  EXPECT_FALSE(cache.Load(key, &entry));
+}
+
+TEST_F(ProgramCacheTest, RejectsWritableFiles) {
+  const std::string key(PolicyFingerprint::kDigestLength, 'a');
+  ProgramCache::Entry entry;
+  entry.program.push_back({BPF_RET + BPF_K, 0, 0, SECCOMP_RET_ALLOW});
+
+  ProgramCache cache(OpenDir(), kSecret);
+  ASSERT_TRUE(cache.Store(key, entry));
+  ASSERT_TRUE(cache.Load(key, &entry));
+
+  ASSERT_EQ(0, chmod(EntryPath(key).c_str(), 0620));
+  EXPECT_FALSE(cache.Load(key, &entry));
+  ASSERT_EQ(0, chmod(EntryPath(key).c_str(), 0600));
+  ASSERT_TRUE(cache.Load(key, &entry));
+
+  ASSERT_EQ(0, chmod(dir_.path().value().c_str(), 0702));
+  EXPECT_FALSE(cache.Load(key, &entry));
+  EXPECT_FALSE(cache.Store(key, entry));
+  ASSERT_EQ(0, chmod(dir_.path().value().c_str(), 0700));
+
+  // Symbolic links aren't followed.
+  const std::string link_key(key.size(), 'b');
+  ASSERT_EQ(0, symlink(key.c_str(), EntryPath(link_key).c_str()));
+  EXPECT_FALSE(cache.Load(link_key, &entry));
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
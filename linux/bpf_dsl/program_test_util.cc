@@ -0,0 +1,55 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+
+#include <stddef.h>
+
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+struct arch_seccomp_data FakeSyscall(int nr,
+                                     uintptr_t p0,
+                                     uintptr_t p1,
+                                     uintptr_t p2,
+                                     uintptr_t p3,
+                                     uintptr_t p4,
+                                     uintptr_t p5) {
+  // Made up program counter for syscall address.
+  const uint64_t kFakePC = 0x543210;
+
+  struct arch_seccomp_data data = {
+      nr,
+      SECCOMP_ARCH,
+      kFakePC,
+      {
+       p0, p1, p2, p3, p4, p5,
+      },
+  };
+
+  return data;
+}
+
+struct sock_filter Insn(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+  return sock_filter{code, jt, jf, k};
+}
+
+void ExpectSamePrograms(const CodeGen::Program& expected,
+                        const CodeGen::Program& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].code, actual[i].code) << "instruction " << i;
+    EXPECT_EQ(expected[i].jt, actual[i].jt) << "instruction " << i;
+    EXPECT_EQ(expected[i].jf, actual[i].jf) << "instruction " << i;
+    EXPECT_EQ(expected[i].k, actual[i].k) << "instruction " << i;
+  }
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
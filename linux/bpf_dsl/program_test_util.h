@@ -0,0 +1,46 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_PROGRAM_TEST_UTIL_H_
+#define SANDBOX_LINUX_BPF_DSL_PROGRAM_TEST_UTIL_H_
+
+#include <stdint.h>
+
+#include "sandbox/linux/bpf_dsl/codegen.h"
+
+struct sock_filter;
+
+namespace sandbox {
+struct arch_seccomp_data;
+
+namespace bpf_dsl {
+
+// FakeSyscall constructs the arch_seccomp_data that the kernel would pass
+// to a filter for system call |nr| with arguments |p0| to |p5| on the
+// native architecture. The arguments are uintptr_t, so negative values
+// are sign-extended to 64 bits only if the host is 64-bit, as for real
+// system calls.
+struct arch_seccomp_data FakeSyscall(int nr,
+                                     uintptr_t p0 = 0,
+                                     uintptr_t p1 = 0,
+                                     uintptr_t p2 = 0,
+                                     uintptr_t p3 = 0,
+                                     uintptr_t p4 = 0,
+                                     uintptr_t p5 = 0);
+
+// Insn constructs a BPF instruction.
+struct sock_filter Insn(uint16_t code,
+                        uint32_t k,
+                        uint8_t jt = 0,
+                        uint8_t jf = 0);
+
+// ExpectSamePrograms expects |actual| to consist of exactly the same
+// instructions as |expected|, and reports the index of any that differ.
+void ExpectSamePrograms(const CodeGen::Program& expected,
+                        const CodeGen::Program& actual);
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_PROGRAM_TEST_UTIL_H_
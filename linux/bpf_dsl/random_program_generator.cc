@@ -0,0 +1,125 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/random_program_generator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+// linux_filter.h doesn't define the sizes, modes and sources that
+// seccomp doesn't support, so some codes are spelled out: 0x08 is BPF_H,
+// 0x80 is BPF_LEN, 0x10 + 0xa0 is BPF_B + BPF_MSH, and 0x10 is BPF_A for
+// BPF_RET.
+const uint16_t kCodes[] = {
+    BPF_LD + BPF_W + BPF_ABS,  BPF_LD + BPF_W + BPF_IMM,
+    BPF_LD + BPF_W + BPF_MEM,  BPF_LD + 0x08 + BPF_ABS,
+    BPF_LD + BPF_W + 0x80,     BPF_LDX + BPF_W + BPF_IMM,
+    BPF_LDX + BPF_W + BPF_MEM, BPF_LDX + 0x10 + 0xa0,
+    BPF_ST,                    BPF_STX,
+    BPF_MISC + BPF_TAX,        BPF_MISC + BPF_TXA,
+    BPF_JMP + BPF_JA,          BPF_JMP + BPF_JEQ + BPF_K,
+    BPF_JMP + BPF_JGT + BPF_K, BPF_JMP + BPF_JGE + BPF_K,
+    BPF_JMP + BPF_JSET + BPF_K, BPF_JMP + BPF_JEQ + BPF_X,
+    BPF_JMP + BPF_JGT + BPF_X, BPF_JMP + BPF_JGE + BPF_X,
+    BPF_JMP + BPF_JSET + BPF_X, BPF_JMP + 0x60 + BPF_K,
+    BPF_ALU + BPF_ADD + BPF_K, BPF_ALU + BPF_SUB + BPF_X,
+    BPF_ALU + BPF_MUL + BPF_K, BPF_ALU + BPF_DIV + BPF_X,
+    BPF_ALU + BPF_MOD + BPF_K, BPF_ALU + BPF_OR + BPF_X,
+    BPF_ALU + BPF_AND + BPF_K, BPF_ALU + BPF_XOR + BPF_X,
+    BPF_ALU + BPF_LSH + BPF_K, BPF_ALU + BPF_RSH + BPF_X,
+    BPF_ALU + BPF_NEG,         BPF_ALU + 0xf0 + BPF_K,
+    BPF_RET + BPF_K,           BPF_RET + 0x10,
+};
+
+// Operands, data offsets, scratch memory indices, shift amounts and
+// return values, valid or not.
+const uint32_t kValues[] = {0,
+                            1,
+                            2,
+                            3,
+                            4,
+                            5,
+                            15,
+                            16,
+                            31,
+                            32,
+                            33,
+                            SECCOMP_ARG_LSB_IDX(0),
+                            SECCOMP_ARG_MSB_IDX(0),
+                            SECCOMP_ARG_LSB_IDX(1),
+                            SECCOMP_NR_IDX,
+                            SECCOMP_ARCH_IDX,
+                            0x80000000,
+                            0xffffffff,
+                            SECCOMP_RET_ALLOW,
+                            SECCOMP_RET_ERRNO + 1,
+                            SECCOMP_RET_INVALID};
+
+struct sock_filter Insn(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+  return sock_filter{code, jt, jf, k};
+}
+
+}  // namespace
+
+RandomProgramGenerator::RandomProgramGenerator(uint32_t seed) : seed_(seed) {}
+
+RandomProgramGenerator::~RandomProgramGenerator() {}
+
+std::vector<struct sock_filter> RandomProgramGenerator::Program() {
+  std::vector<struct sock_filter> program(3 + Random(24));
+  program[0] =
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(Random(2)), 0, 0);
+  program[1] = Insn(BPF_LDX + BPF_W + BPF_IMM, Random(6), 0, 0);
+  program.back() =
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO + Random(6), 0, 0);
+  const size_t first = Random(8) ? 2 : 0;
+  const size_t last = program.size() - (Random(8) ? 1 : 0);
+  for (size_t pc = first; pc < last; ++pc) {
+    // Jumps usually stay within the program.
+    const uint32_t range = program.size() - pc - (Random(8) ? 1 : 0);
+    const auto offset = [&]() { return range ? Random(range) : 0; };
+    const uint16_t code = kCodes[Random(arraysize(kCodes))];
+    if (BPF_CLASS(code) != BPF_JMP) {
+      program[pc] = Insn(code, kValues[Random(arraysize(kValues))], 0, 0);
+    } else if (BPF_OP(code) == BPF_JA) {
+      program[pc] = Insn(code, offset(), 0, 0);
+    } else {
+      program[pc] = Insn(code, kValues[Random(arraysize(kValues))], offset(),
+                         offset());
+    }
+  }
+  return program;
+}
+
+struct arch_seccomp_data RandomProgramGenerator::Syscall() {
+  struct arch_seccomp_data data = {static_cast<int>(Random(6)),
+                                   SECCOMP_ARCH,
+                                   0,
+                                   {Random(6), 0, 0, 0, 0, 0}};
+  data.args[1] = kValues[Random(arraysize(kValues))];
+  return data;
+}
+
+uint32_t RandomProgramGenerator::Random(uint32_t n) {
+  // A linear congruential generator is good enough, and keeps tests
+  // deterministic.
+  seed_ = seed_ * 1103515245 + 12345;
+  return (seed_ >> 16) % n;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,50 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_RANDOM_PROGRAM_GENERATOR_H_
+#define SANDBOX_LINUX_BPF_DSL_RANDOM_PROGRAM_GENERATOR_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// RandomProgramGenerator generates random BPF programs and system calls,
+// for tests that compare other ways of evaluating programs against
+// Verifier::EvaluateBPF. The programs use every instruction, including
+// invalid ones, so they exercise every kind of failure; but most of
+// them initialize the registers and end with a return, so that they get
+// far enough to return something. The output only depends on the seed.
+class RandomProgramGenerator {
+ public:
+  explicit RandomProgramGenerator(uint32_t seed);
+  ~RandomProgramGenerator();
+
+  // Returns a program of 3 to 26 instructions.
+  std::vector<struct sock_filter> Program();
+
+  // Returns a system call on this architecture, with small values for
+  // "nr" and the first argument, and a value that's interesting to the
+  // programs' instructions for the second one.
+  struct arch_seccomp_data Syscall();
+
+ private:
+  // Returns a number in [0, n).
+  uint32_t Random(uint32_t n);
+
+  uint32_t seed_;
+
+  DISALLOW_COPY_AND_ASSIGN(RandomProgramGenerator);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_RANDOM_PROGRAM_GENERATOR_H_
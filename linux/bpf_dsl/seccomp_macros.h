@@ -90,6 +90,8 @@ typedef user_regs_struct regs_struct;
 
 #elif defined(__x86_64__)
 #define SECCOMP_ARCH        AUDIT_ARCH_X86_64
+// System calls made through the i386 compatibility ABI.
+#define SECCOMP_COMPAT_ARCH AUDIT_ARCH_I386
 
 #define SECCOMP_REG(_ctx, _reg) ((_ctx)->uc_mcontext.gregs[(_reg)])
 #define SECCOMP_RESULT(_ctx)    SECCOMP_REG(_ctx, REG_RAX)
@@ -253,6 +255,8 @@ struct regs_struct {
 };
 
 #define SECCOMP_ARCH AUDIT_ARCH_AARCH64
+// System calls made through the ARM EABI compatibility ABI.
+#define SECCOMP_COMPAT_ARCH AUDIT_ARCH_ARM
 
 #define SECCOMP_REG(_ctx, _reg) ((_ctx)->uc_mcontext.regs[_reg])
 
@@ -0,0 +1,83 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/static_program.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/strings/stringprintf.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+namespace {
+
+// NoTrapRegistry refuses to register any traps.
+class NoTrapRegistry : public TrapRegistry {
+ public:
+  NoTrapRegistry() {}
+
+  uint16_t Add(TrapFnc fnc, const void* aux, bool safe) override {
+    LOG(FATAL) << "Static programs can't use Trap()";
+    return 0;
+  }
+
+  bool EnableUnsafeTraps() override { return false; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NoTrapRegistry);
+};
+
+}  // namespace
+
+CodeGen::Program CompileStaticProgram(const Policy* policy) {
+  NoTrapRegistry registry;
+  return PolicyCompiler(policy, &registry).Compile();
+}
+
+std::string GenerateStaticProgramHeader(const std::string& guard,
+                                        const std::string& name,
+                                        const CodeGen::Program& program) {
+  std::string header =
+      "// Generated by sandbox::bpf_dsl::GenerateStaticProgramHeader.\n\n";
+  base::StringAppendF(&header, "#ifndef %s\n#define %s\n\n", guard.c_str(),
+                      guard.c_str());
+  header +=
+      "#include \"sandbox/linux/bpf_dsl/seccomp_macros.h\"\n"
+      "#include \"sandbox/linux/bpf_dsl/static_program.h\"\n"
+      "#include \"sandbox/linux/system_headers/linux_filter.h\"\n"
+      "#include \"sandbox/linux/system_headers/linux_seccomp.h\"\n\n";
+  base::StringAppendF(&header,
+                      "static_assert(SECCOMP_ARCH == 0x%" PRIx32 "u,\n"
+                      "              \"%s was compiled for a different "
+                      "architecture\");\n\n",
+                      static_cast<uint32_t>(SECCOMP_ARCH), name.c_str());
+
+  base::StringAppendF(&header, "constexpr struct sock_filter %s[] = {\n",
+                      name.c_str());
+  for (const struct sock_filter& insn : program) {
+    base::StringAppendF(&header, "    {0x%02x, %u, %u, 0x%" PRIx32 "},\n",
+                        insn.code, insn.jt, insn.jf, insn.k);
+  }
+  header += "};\n\n";
+
+  base::StringAppendF(&header,
+                      "constexpr sandbox::bpf_dsl::StaticProgram %sProgram = "
+                      "{\n    %s, sizeof(%s) / sizeof(%s[0])};\n\n",
+                      name.c_str(), name.c_str(), name.c_str(), name.c_str());
+  base::StringAppendF(&header, "#endif  // %s\n", guard.c_str());
+  return header;
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,50 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_H_
+#define SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/sandbox_export.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+class Policy;
+
+// StaticProgram refers to a BPF program in static storage that was
+// compiled from a fixed policy when building, so that processes can
+// install it without compiling the policy (or allocating anything) at
+// run time. Such programs are defined by headers that a generator
+// program writes with GenerateStaticProgramHeader.
+struct StaticProgram {
+  const struct sock_filter* filter;
+  size_t length;
+};
+
+// CompileStaticProgram compiles |policy| like PolicyCompiler::Compile,
+// with the default panic function. The program mustn't depend on the
+// process that installs it, so it's a fatal error for the policy to use
+// traps, whose IDs are only assigned at run time.
+SANDBOX_EXPORT CodeGen::Program CompileStaticProgram(const Policy* policy);
+
+// GenerateStaticProgramHeader returns the contents of a header file
+// that defines |name| as a constexpr array holding |program|, and
+// |name| + "Program" as a constexpr StaticProgram that refers to it.
+// |guard| is the header's include guard. The program is only valid for
+// the architecture that it was compiled for (i.e., the generator
+// program's), which the header checks with a static_assert.
+SANDBOX_EXPORT std::string GenerateStaticProgramHeader(
+    const std::string& guard,
+    const std::string& name,
+    const CodeGen::Program& program);
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_H_
@@ -0,0 +1,29 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Writes the header that defines kStaticTestProgram, which is compiled
+// from StaticTestPolicy, to the file named by its only argument.
+
+#include <string>
+
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/static_program.h"
+#include "sandbox/linux/bpf_dsl/static_program_test_policy.h"
+
+int main(int argc, char** argv) {
+  CHECK_EQ(2, argc) << "Usage: " << argv[0] << " <output header>";
+
+  sandbox::bpf_dsl::StaticTestPolicy policy;
+  const std::string header = sandbox::bpf_dsl::GenerateStaticProgramHeader(
+      "SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_TEST_PROGRAM_H_",
+      "kStaticTest",
+      sandbox::bpf_dsl::CompileStaticProgram(&policy));
+
+  const int size = static_cast<int>(header.size());
+  CHECK_EQ(size, base::WriteFile(base::FilePath(argv[1]), header.data(), size));
+  return 0;
+}
@@ -0,0 +1,44 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/static_program_test_policy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+
+StaticTestPolicy::StaticTestPolicy() {
+}
+
+StaticTestPolicy::~StaticTestPolicy() {
+}
+
+ResultExpr StaticTestPolicy::EvaluateSyscall(int sysno) const {
+  if (sysno == __NR_getpgid) {
+    const Arg<pid_t> pid(0);
+    return If(pid == 0, Allow()).Else(Error(EPERM));
+  }
+  if (sysno == __NR_fcntl) {
+    const Arg<int> cmd(1);
+    return Switch(cmd)
+        .CASES((F_GETFL, F_GETFD), Allow())
+        .Case(F_SETFD, Error(EACCES))
+        .Default(Kill());
+  }
+  if (sysno == __NR_ptrace) {
+    return Kill();
+  }
+  return Allow();
+}
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,31 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_TEST_POLICY_H_
+#define SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_TEST_POLICY_H_
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl_forward.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+
+// StaticTestPolicy is compiled into a static program when building the
+// tests, by static_program_test_generator.cc.
+class StaticTestPolicy : public Policy {
+ public:
+  StaticTestPolicy();
+  ~StaticTestPolicy() override;
+
+  ResultExpr EvaluateSyscall(int sysno) const override;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(StaticTestPolicy);
+};
+
+}  // namespace bpf_dsl
+}  // namespace sandbox
+
+#endif  // SANDBOX_LINUX_BPF_DSL_STATIC_PROGRAM_TEST_POLICY_H_
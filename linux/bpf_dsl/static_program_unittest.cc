@@ -0,0 +1,105 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/static_program.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+#include <string>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/static_program_test_policy.h"
+#include "sandbox/linux/bpf_dsl/static_program_test_program.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/bpf_dsl/verifier.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// The generated program is usable in constant expressions.
+static_assert(kStaticTestProgram.length > 0, "Program is empty");
+static_assert(kStaticTest[0].code == BPF_LD + BPF_W + BPF_ABS,
+              "Program doesn't start by loading the architecture");
+
+TEST(StaticProgram, MatchesPolicyCompiler) {
+  StaticTestPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program expected = PolicyCompiler(&policy, &traps).Compile();
+
+  ASSERT_EQ(expected.size(), kStaticTestProgram.length);
+  EXPECT_EQ(kStaticTest, kStaticTestProgram.filter);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].code, kStaticTest[i].code) << "insn " << i;
+    EXPECT_EQ(expected[i].jt, kStaticTest[i].jt) << "insn " << i;
+    EXPECT_EQ(expected[i].jf, kStaticTest[i].jf) << "insn " << i;
+    EXPECT_EQ(expected[i].k, kStaticTest[i].k) << "insn " << i;
+  }
+}
+
+TEST(StaticProgram, Evaluate) {
+  const CodeGen::Program program(kStaticTest,
+                                 kStaticTest + kStaticTestProgram.length);
+
+  struct {
+    int nr;
+    uint64_t arg0;
+    uint64_t arg1;
+    uint32_t expected;
+  } const kCases[] = {
+      {__NR_getpgid, 0, 0, SECCOMP_RET_ALLOW},
+      {__NR_getpgid, 1, 0, SECCOMP_RET_ERRNO + EPERM},
+      {__NR_fcntl, 0, F_GETFD, SECCOMP_RET_ALLOW},
+      {__NR_fcntl, 0, F_SETFD, SECCOMP_RET_ERRNO + EACCES},
+      {__NR_fcntl, 0, F_SETFL, SECCOMP_RET_KILL},
+      {__NR_ptrace, 0, 0, SECCOMP_RET_KILL},
+      {__NR_getpid, 0, 0, SECCOMP_RET_ALLOW},
+  };
+  for (const auto& c : kCases) {
+    const struct arch_seccomp_data data = {
+        c.nr, SECCOMP_ARCH, 0, {c.arg0, c.arg1, 0, 0, 0, 0}};
+    const char* err = nullptr;
+    EXPECT_EQ(c.expected, Verifier::EvaluateBPF(program, data, &err))
+        << "system call " << c.nr;
+    EXPECT_FALSE(err) << err;
+  }
+}
+
+TEST(StaticProgram, GenerateHeader) {
+  CodeGen::Program program(2);
+  program[0].code = BPF_LD + BPF_W + BPF_ABS;
+  program[0].k = SECCOMP_ARCH_IDX;
+  program[1].code = BPF_RET + BPF_K;
+  program[1].k = SECCOMP_RET_ALLOW;
+
+  const std::string header =
+      GenerateStaticProgramHeader("TEST_PROGRAM_H_", "kTest", program);
+  const char* const kExpected[] = {
+      "#ifndef TEST_PROGRAM_H_\n#define TEST_PROGRAM_H_\n",
+      "static_assert(SECCOMP_ARCH == ",
+      "constexpr struct sock_filter kTest[] = {\n"
+      "    {0x20, 0, 0, 0x4},\n"
+      "    {0x06, 0, 0, 0x7fff0000},\n"
+      "};\n",
+      "constexpr sandbox::bpf_dsl::StaticProgram kTestProgram = {\n"
+      "    kTest, sizeof(kTest) / sizeof(kTest[0])};\n",
+      "#endif  // TEST_PROGRAM_H_\n",
+  };
+  for (const char* expected : kExpected) {
+    EXPECT_NE(std::string::npos, header.find(expected)) << header;
+  }
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -42,33 +42,74 @@ const SyscallRange kValidSyscallRanges[] = {
 #endif
 };
 
+#if defined(MAX_COMPAT_SYSCALL)
+const SyscallRange kValidCompatSyscallRanges[] = {
+    {MIN_COMPAT_SYSCALL, MAX_PUBLIC_COMPAT_SYSCALL},
+#if defined(MIN_PRIVATE_COMPAT_SYSCALL)
+    {MIN_PRIVATE_COMPAT_SYSCALL, MAX_PRIVATE_COMPAT_SYSCALL},
+    {MIN_GHOST_COMPAT_SYSCALL, MAX_COMPAT_SYSCALL},
+#endif
+};
+#endif
+
+// Returns the ranges of valid system call numbers for |abi| in [*begin,
+// *end).
+void GetValidSyscallRanges(SyscallSet::Abi abi,
+                           const SyscallRange** begin,
+                           const SyscallRange** end) {
+  if (abi == SyscallSet::Abi::NATIVE) {
+    *begin = kValidSyscallRanges;
+    *end = kValidSyscallRanges + arraysize(kValidSyscallRanges);
+    return;
+  }
+#if defined(MAX_COMPAT_SYSCALL)
+  *begin = kValidCompatSyscallRanges;
+  *end = kValidCompatSyscallRanges + arraysize(kValidCompatSyscallRanges);
+#else
+  NOTREACHED() << "No compatibility ABI on this architecture";
+  *begin = *end = kValidSyscallRanges;
+#endif
+}
+
 }  // namespace
 
 SyscallSet::Iterator SyscallSet::begin() const {
-  return Iterator(set_, false);
+  return Iterator(set_, abi_, false);
 }
 
 SyscallSet::Iterator SyscallSet::end() const {
-  return Iterator(set_, true);
+  return Iterator(set_, abi_, true);
 }
 
-bool SyscallSet::IsValid(uint32_t num) {
-  for (const SyscallRange& range : kValidSyscallRanges) {
-    if (num >= range.first && num <= range.last) {
+bool SyscallSet::IsValid(uint32_t num, Abi abi) {
+  const SyscallRange* begin;
+  const SyscallRange* end;
+  GetValidSyscallRanges(abi, &begin, &end);
+  for (const SyscallRange* range = begin; range != end; ++range) {
+    if (num >= range->first && num <= range->last) {
       return true;
     }
   }
   return false;
 }
 
+bool SyscallSet::HasCompatAbi() {
+#if defined(MAX_COMPAT_SYSCALL)
+  return true;
+#else
+  return false;
+#endif
+}
+
 bool operator==(const SyscallSet& lhs, const SyscallSet& rhs) {
-  return (lhs.set_ == rhs.set_);
+  return (lhs.set_ == rhs.set_) && (lhs.abi_ == rhs.abi_);
 }
 
-SyscallSet::Iterator::Iterator(Set set, bool done)
-    : set_(set), done_(done), num_(0) {
+SyscallSet::Iterator::Iterator(Set set, Abi abi, bool done)
+    : set_(set), abi_(abi), done_(done), num_(0) {
   // If the set doesn't contain 0, we need to skip to the next element.
-  if (!done && set_ == (IsValid(num_) ? Set::INVALID_ONLY : Set::VALID_ONLY)) {
+  if (!done &&
+      set_ == (IsValid(num_, abi_) ? Set::INVALID_ONLY : Set::VALID_ONLY)) {
     ++*this;
   }
 }
@@ -95,20 +136,23 @@ uint32_t SyscallSet::Iterator::NextSyscall() const {
   const bool want_valid = (set_ != Set::INVALID_ONLY);
   const bool want_invalid = (set_ != Set::VALID_ONLY);
 
-  for (const SyscallRange& range : kValidSyscallRanges) {
-    if (want_invalid && range.first > 0 && num_ < range.first - 1) {
+  const SyscallRange* begin;
+  const SyscallRange* end;
+  GetValidSyscallRanges(abi_, &begin, &end);
+  for (const SyscallRange* range = begin; range != end; ++range) {
+    if (want_invalid && range->first > 0 && num_ < range->first - 1) {
       // Even when iterating invalid syscalls, we only include the end points;
       // so skip directly to just before the next (valid) range.
-      return range.first - 1;
+      return range->first - 1;
     }
-    if (want_valid && num_ < range.first) {
-      return range.first;
+    if (want_valid && num_ < range->first) {
+      return range->first;
     }
-    if (want_valid && num_ < range.last) {
+    if (want_valid && num_ < range->last) {
       return num_ + 1;
     }
-    if (want_invalid && num_ <= range.last) {
-      return range.last + 1;
+    if (want_invalid && num_ <= range->last) {
+      return range->last + 1;
     }
   }
 
@@ -134,7 +178,7 @@ uint32_t SyscallSet::Iterator::NextSyscall() const {
 
 bool operator==(const SyscallSet::Iterator& lhs,
                 const SyscallSet::Iterator& rhs) {
-  DCHECK(lhs.set_ == rhs.set_);
+  DCHECK(lhs.set_ == rhs.set_ && lhs.abi_ == rhs.abi_);
   return (lhs.done_ == rhs.done_) && (lhs.num_ == rhs.num_);
 }
 
@@ -31,7 +31,12 @@ class SANDBOX_EXPORT SyscallSet {
  public:
   class Iterator;
 
-  SyscallSet(const SyscallSet& ss) : set_(ss.set_) {}
+  // Abi selects whose system call numbers a SyscallSet describes: the
+  // native ABI's, or those of the architecture's compatibility ABI (see
+  // SECCOMP_COMPAT_ARCH), if it has one.
+  enum class Abi { NATIVE, COMPAT };
+
+  SyscallSet(const SyscallSet& ss) : set_(ss.set_), abi_(ss.abi_) {}
   ~SyscallSet() {}
 
   Iterator begin() const;
@@ -39,27 +44,40 @@ class SANDBOX_EXPORT SyscallSet {
 
   // All returns a SyscallSet that contains both valid and invalid
   // system call numbers.
-  static SyscallSet All() { return SyscallSet(Set::ALL); }
+  static SyscallSet All() { return All(Abi::NATIVE); }
+  static SyscallSet All(Abi abi) { return SyscallSet(Set::ALL, abi); }
 
   // ValidOnly returns a SyscallSet that contains only valid system
   // call numbers.
-  static SyscallSet ValidOnly() { return SyscallSet(Set::VALID_ONLY); }
+  static SyscallSet ValidOnly() { return ValidOnly(Abi::NATIVE); }
+  static SyscallSet ValidOnly(Abi abi) {
+    return SyscallSet(Set::VALID_ONLY, abi);
+  }
 
   // InvalidOnly returns a SyscallSet that contains only invalid
   // system call numbers, but still omits numbers in the middle of a
   // range of invalid system call numbers.
-  static SyscallSet InvalidOnly() { return SyscallSet(Set::INVALID_ONLY); }
+  static SyscallSet InvalidOnly() { return InvalidOnly(Abi::NATIVE); }
+  static SyscallSet InvalidOnly(Abi abi) {
+    return SyscallSet(Set::INVALID_ONLY, abi);
+  }
 
   // IsValid returns whether |num| specifies a valid system call
   // number.
-  static bool IsValid(uint32_t num);
+  static bool IsValid(uint32_t num) { return IsValid(num, Abi::NATIVE); }
+  static bool IsValid(uint32_t num, Abi abi);
+
+  // HasCompatAbi returns whether the architecture has a compatibility
+  // ABI. If not, Abi::COMPAT must not be used.
+  static bool HasCompatAbi();
 
  private:
   enum class Set { ALL, VALID_ONLY, INVALID_ONLY };
 
-  explicit SyscallSet(Set set) : set_(set) {}
+  SyscallSet(Set set, Abi abi) : set_(set), abi_(abi) {}
 
   Set set_;
+  Abi abi_;
 
   friend bool operator==(const SyscallSet&, const SyscallSet&);
   DISALLOW_ASSIGN(SyscallSet);
@@ -73,18 +91,19 @@ class SyscallSet::Iterator
     : public std::iterator<std::input_iterator_tag, uint32_t> {
  public:
   Iterator(const Iterator& it)
-      : set_(it.set_), done_(it.done_), num_(it.num_) {}
+      : set_(it.set_), abi_(it.abi_), done_(it.done_), num_(it.num_) {}
   ~Iterator() {}
 
   uint32_t operator*() const;
   Iterator& operator++();
 
  private:
-  Iterator(Set set, bool done);
+  Iterator(Set set, Abi abi, bool done);
 
   uint32_t NextSyscall() const;
 
   Set set_;
+  Abi abi_;
   bool done_;
   uint32_t num_;
 
@@ -0,0 +1,52 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/time/time.h"
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_test.h"
+
+namespace sandbox {
+namespace {
+
+// Number of times each set is iterated over per run.
+const int kIterations = 100;
+
+// Reports the time it takes to iterate over |set|, per system call
+// number.
+void MeasureIteration(const char* trace, const SyscallSet& set) {
+  size_t count = 0;
+  uint32_t sum = 0;
+  const base::TimeDelta elapsed = bpf_dsl::FastestRun([&]() {
+    count = 0;
+    for (int i = 0; i < kIterations; ++i) {
+      for (uint32_t sysnum : set) {
+        sum += sysnum;
+        ++count;
+      }
+    }
+  });
+  ASSERT_LT(0U, count);
+  // Make sure the loop isn't optimized away.
+  EXPECT_NE(0U, sum);
+  perf_test::PrintResult("syscall_set_iteration", "", trace,
+                         elapsed.InMicrosecondsF() * 1000 / count, "ns", true);
+}
+
+TEST(SyscallSetPerfTest, Iterate) {
+  MeasureIteration("all", SyscallSet::All());
+  MeasureIteration("valid_only", SyscallSet::ValidOnly());
+  MeasureIteration("invalid_only", SyscallSet::InvalidOnly());
+  if (SyscallSet::HasCompatAbi()) {
+    MeasureIteration("compat_all", SyscallSet::All(SyscallSet::Abi::COMPAT));
+  }
+}
+
+}  // namespace
+}  // namespace sandbox
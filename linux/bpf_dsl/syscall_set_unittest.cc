@@ -107,6 +107,31 @@ SANDBOX_TEST(SyscallSet, InvalidOnlyIsOnlyInvalid) {
   }
 }
 
+SANDBOX_TEST(SyscallSet, CompatAbi) {
+#if defined(MAX_COMPAT_SYSCALL)
+  SANDBOX_ASSERT(SyscallSet::HasCompatAbi());
+  const SyscallSet::Abi kCompat = SyscallSet::Abi::COMPAT;
+  SANDBOX_ASSERT(!(SyscallSet::All() == SyscallSet::All(kCompat)));
+
+  uint32_t prev = MIN_COMPAT_SYSCALL - 1;
+  for (uint32_t sysnum : SyscallSet::ValidOnly(kCompat)) {
+    SANDBOX_ASSERT(SyscallSet::IsValid(sysnum, kCompat));
+    if (sysnum <= MAX_PUBLIC_COMPAT_SYSCALL) {
+      SANDBOX_ASSERT(prev == sysnum - 1);
+    }
+    prev = sysnum;
+  }
+  SANDBOX_ASSERT(prev == MAX_COMPAT_SYSCALL);
+
+  for (uint32_t sysnum : SyscallSet::InvalidOnly(kCompat)) {
+    SANDBOX_ASSERT(!SyscallSet::IsValid(sysnum, kCompat));
+  }
+  SANDBOX_ASSERT(!SyscallSet::IsValid(MAX_PUBLIC_COMPAT_SYSCALL + 1, kCompat));
+#else
+  SANDBOX_ASSERT(!SyscallSet::HasCompatAbi());
+#endif
+}
+
 SANDBOX_TEST(SyscallSet, AllIsValidOnlyPlusInvalidOnly) {
   std::vector<uint32_t> merged;
   const SyscallSet valid_only = SyscallSet::ValidOnly();
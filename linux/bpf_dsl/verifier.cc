@@ -4,11 +4,20 @@
 
 #include "sandbox/linux/bpf_dsl/verifier.h"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
+#include <array>
+#include <map>
+#include <tuple>
+#include <utility>
+
+#include "base/logging.h"
 #include "base/macros.h"
 #include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
 #include "sandbox/linux/bpf_dsl/trap_registry.h"
 #include "sandbox/linux/system_headers/linux_filter.h"
 #include "sandbox/linux/system_headers/linux_seccomp.h"
@@ -21,20 +30,57 @@ namespace {
 struct State {
   State(const std::vector<struct sock_filter>& p,
         const struct arch_seccomp_data& d)
-      : program(p), data(d), ip(0), accumulator(0), acc_is_valid(false) {}
+      : program(p),
+        data(d),
+        ip(0),
+        accumulator(0),
+        acc_is_valid(false),
+        index(0),
+        index_is_valid(false),
+        mem(),
+        mem_is_valid(0) {}
   const std::vector<struct sock_filter>& program;
   const struct arch_seccomp_data& data;
   unsigned int ip;
   uint32_t accumulator;
   bool acc_is_valid;
+  uint32_t index;
+  bool index_is_valid;
+  uint32_t mem[BPF_MEMWORDS];
+  uint32_t mem_is_valid;  // Bitmask of initialized |mem| slots.
 
  private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(State);
 };
 
+// Like the kernel, we reject reads from uninitialized scratch memory.
+bool LoadMem(const State& state, uint32_t k, uint32_t* value) {
+  if (k >= BPF_MEMWORDS || !(state.mem_is_valid & (1U << k))) {
+    return false;
+  }
+  *value = state.mem[k];
+  return true;
+}
+
 void Ld(State* state, const struct sock_filter& insn, const char** err) {
-  if (BPF_SIZE(insn.code) != BPF_W || BPF_MODE(insn.code) != BPF_ABS ||
-      insn.jt != 0 || insn.jf != 0) {
+  if (BPF_SIZE(insn.code) != BPF_W || insn.jt != 0 || insn.jf != 0) {
+    *err = "Invalid BPF_LD instruction";
+    return;
+  }
+  if (BPF_MODE(insn.code) == BPF_IMM) {
+    state->accumulator = insn.k;
+    state->acc_is_valid = true;
+    return;
+  }
+  if (BPF_MODE(insn.code) == BPF_MEM) {
+    if (!LoadMem(*state, insn.k, &state->accumulator)) {
+      *err = "Invalid operand in BPF_LD instruction";
+      return;
+    }
+    state->acc_is_valid = true;
+    return;
+  }
+  if (BPF_MODE(insn.code) != BPF_ABS) {
     *err = "Invalid BPF_LD instruction";
     return;
   }
@@ -50,6 +96,54 @@ void Ld(State* state, const struct sock_filter& insn, const char** err) {
   return;
 }
 
+void Ldx(State* state, const struct sock_filter& insn, const char** err) {
+  if (BPF_SIZE(insn.code) != BPF_W || insn.jt != 0 || insn.jf != 0) {
+    *err = "Invalid BPF_LDX instruction";
+    return;
+  }
+  if (BPF_MODE(insn.code) == BPF_IMM) {
+    state->index = insn.k;
+  } else if (BPF_MODE(insn.code) != BPF_MEM ||
+             !LoadMem(*state, insn.k, &state->index)) {
+    *err = "Invalid BPF_LDX instruction";
+    return;
+  }
+  state->index_is_valid = true;
+}
+
+void St(State* state, const struct sock_filter& insn, const char** err) {
+  const bool is_stx = BPF_CLASS(insn.code) == BPF_STX;
+  if (insn.code != (is_stx ? BPF_STX : BPF_ST) || insn.k >= BPF_MEMWORDS ||
+      insn.jt != 0 || insn.jf != 0 ||
+      !(is_stx ? state->index_is_valid : state->acc_is_valid)) {
+    *err = is_stx ? "Invalid BPF_STX instruction"
+                  : "Invalid BPF_ST instruction";
+    return;
+  }
+  state->mem[insn.k] = is_stx ? state->index : state->accumulator;
+  state->mem_is_valid |= 1U << insn.k;
+}
+
+void Misc(State* state, const struct sock_filter& insn, const char** err) {
+  switch (BPF_MISCOP(insn.code)) {
+    case BPF_TAX:
+      if (!state->acc_is_valid) {
+        break;
+      }
+      state->index = state->accumulator;
+      state->index_is_valid = true;
+      return;
+    case BPF_TXA:
+      if (!state->index_is_valid) {
+        break;
+      }
+      state->accumulator = state->index;
+      state->acc_is_valid = true;
+      return;
+  }
+  *err = "Invalid BPF_MISC instruction";
+}
+
 void Jmp(State* state, const struct sock_filter& insn, const char** err) {
   if (BPF_OP(insn.code) == BPF_JA) {
     if (state->ip + insn.k + 1 >= state->program.size() ||
@@ -60,35 +154,37 @@ void Jmp(State* state, const struct sock_filter& insn, const char** err) {
     }
     state->ip += insn.k;
   } else {
-    if (BPF_SRC(insn.code) != BPF_K || !state->acc_is_valid ||
+    if ((BPF_SRC(insn.code) == BPF_X && !state->index_is_valid) ||
+        !state->acc_is_valid ||
         state->ip + insn.jt + 1 >= state->program.size() ||
         state->ip + insn.jf + 1 >= state->program.size()) {
       goto compilation_failure;
     }
+    const uint32_t k = BPF_SRC(insn.code) == BPF_X ? state->index : insn.k;
     switch (BPF_OP(insn.code)) {
       case BPF_JEQ:
-        if (state->accumulator == insn.k) {
+        if (state->accumulator == k) {
           state->ip += insn.jt;
         } else {
           state->ip += insn.jf;
         }
         break;
       case BPF_JGT:
-        if (state->accumulator > insn.k) {
+        if (state->accumulator > k) {
           state->ip += insn.jt;
         } else {
           state->ip += insn.jf;
         }
         break;
       case BPF_JGE:
-        if (state->accumulator >= insn.k) {
+        if (state->accumulator >= k) {
           state->ip += insn.jt;
         } else {
           state->ip += insn.jf;
         }
         break;
       case BPF_JSET:
-        if (state->accumulator & insn.k) {
+        if (state->accumulator & k) {
           state->ip += insn.jt;
         } else {
           state->ip += insn.jf;
@@ -113,56 +209,57 @@ void Alu(State* state, const struct sock_filter& insn, const char** err) {
     state->accumulator = -state->accumulator;
     return;
   } else {
-    if (BPF_SRC(insn.code) != BPF_K) {
+    if (BPF_SRC(insn.code) == BPF_X && !state->index_is_valid) {
       *err = "Unexpected source operand in arithmetic operation";
       return;
     }
+    const uint32_t k = BPF_SRC(insn.code) == BPF_X ? state->index : insn.k;
     switch (BPF_OP(insn.code)) {
       case BPF_ADD:
-        state->accumulator += insn.k;
+        state->accumulator += k;
         break;
       case BPF_SUB:
-        state->accumulator -= insn.k;
+        state->accumulator -= k;
         break;
       case BPF_MUL:
-        state->accumulator *= insn.k;
+        state->accumulator *= k;
         break;
       case BPF_DIV:
-        if (!insn.k) {
+        if (!k) {
           *err = "Illegal division by zero";
           break;
         }
-        state->accumulator /= insn.k;
+        state->accumulator /= k;
         break;
       case BPF_MOD:
-        if (!insn.k) {
+        if (!k) {
           *err = "Illegal division by zero";
           break;
         }
-        state->accumulator %= insn.k;
+        state->accumulator %= k;
         break;
       case BPF_OR:
-        state->accumulator |= insn.k;
+        state->accumulator |= k;
         break;
       case BPF_XOR:
-        state->accumulator ^= insn.k;
+        state->accumulator ^= k;
         break;
       case BPF_AND:
-        state->accumulator &= insn.k;
+        state->accumulator &= k;
         break;
       case BPF_LSH:
-        if (insn.k > 32) {
+        if (k >= 32) {
           *err = "Illegal shift operation";
           break;
         }
-        state->accumulator <<= insn.k;
+        state->accumulator <<= k;
         break;
       case BPF_RSH:
-        if (insn.k > 32) {
+        if (k >= 32) {
           *err = "Illegal shift operation";
           break;
         }
-        state->accumulator >>= insn.k;
+        state->accumulator >>= k;
         break;
       default:
         *err = "Invalid operator in arithmetic operation";
@@ -171,6 +268,225 @@ void Alu(State* state, const struct sock_filter& insn, const char** err) {
   }
 }
 
+// PathState is the state of a path walked by PathLengths. Unlike State,
+// it also tracks which registers and scratch memory words are known,
+// i.e. don't depend on fields other than "nr" and "arch".
+struct PathState {
+  static const uint32_t kAcc = 1U << 0;
+  static const uint32_t kIndex = 1U << 1;
+  static uint32_t Mem(uint32_t k) { return 1U << (2 + k); }
+
+  bool operator<(const PathState& other) const {
+    return std::tie(ip, valid, known, accumulator, index, mem) <
+           std::tie(other.ip, other.valid, other.known, other.accumulator,
+                    other.index, other.mem);
+  }
+
+  unsigned int ip;
+  uint32_t accumulator;
+  uint32_t index;
+  std::array<uint32_t, BPF_MEMWORDS> mem;
+  uint32_t valid;  // Bitmask of kAcc, kIndex and Mem(k).
+  uint32_t known;  // Same, but only for known values.
+};
+
+// PathWalker implements Verifier::PathLengths. It executes instructions
+// on known values with the same functions as EvaluateBPF, and follows
+// both branches of conditional jumps on unknown values.
+class PathWalker {
+ public:
+  PathWalker(const std::vector<struct sock_filter>& program,
+             uint32_t arch,
+             uint32_t nr)
+      : program_(program), data_(), memo_() {
+    data_.nr = static_cast<int>(nr);
+    data_.arch = arch;
+  }
+
+  // Returns the shortest and longest number of instructions executed
+  // from |path| on.
+  std::pair<size_t, size_t> Walk(PathState path, const char** err) {
+    // Forget about unknown values, so that they don't spoil |memo_|.
+    if (!(path.known & PathState::kAcc)) {
+      path.accumulator = 0;
+    }
+    if (!(path.known & PathState::kIndex)) {
+      path.index = 0;
+    }
+    for (uint32_t k = 0; k < BPF_MEMWORDS; ++k) {
+      if (!(path.known & PathState::Mem(k))) {
+        path.mem[k] = 0;
+      }
+    }
+    auto it = memo_.find(path);
+    if (it != memo_.end()) {
+      return it->second;
+    }
+
+    if (path.ip >= program_.size()) {
+      *err = "Invalid instruction pointer in BPF program";
+      return std::make_pair(0, 0);
+    }
+    const struct sock_filter& insn = program_[path.ip];
+    std::pair<size_t, size_t> res(0, 0);
+    if (BPF_CLASS(insn.code) == BPF_RET) {
+      State state(program_, data_);
+      Ret(&state, insn, err);
+      res = std::make_pair(1, 1);
+    } else if (BPF_CLASS(insn.code) == BPF_JMP &&
+               BPF_OP(insn.code) != BPF_JA &&
+               (!(path.known & PathState::kAcc) ||
+                (BPF_SRC(insn.code) == BPF_X &&
+                 !(path.known & PathState::kIndex)))) {
+      // The branch depends on unknown values; try both ways.
+      State state(program_, data_);
+      Restore(path, &state);
+      Jmp(&state, insn, err);
+      if (!*err) {
+        PathState taken = path;
+        taken.ip += insn.jt + 1;
+        PathState not_taken = path;
+        not_taken.ip += insn.jf + 1;
+        const std::pair<size_t, size_t> jt = Walk(taken, err);
+        const std::pair<size_t, size_t> jf = *err ? jt : Walk(not_taken, err);
+        res = std::make_pair(1 + std::min(jt.first, jf.first),
+                             1 + std::max(jt.second, jf.second));
+      }
+    } else {
+      PathState next = path;
+      next.known = Known(path, insn);
+      if (BPF_CLASS(insn.code) == BPF_ALU && BPF_SRC(insn.code) == BPF_X &&
+          !(path.known & PathState::kIndex)) {
+        // Don't compute on unknown operands, which might be invalid
+        // (e.g., a zero divisor).
+        if (!(path.valid & PathState::kIndex)) {
+          *err = "Unexpected source operand in arithmetic operation";
+        }
+      } else {
+        State state(program_, data_);
+        Restore(path, &state);
+        Execute(&state, insn, err);
+        Save(state, &next);
+      }
+      if (!*err) {
+        ++next.ip;
+        res = Walk(next, err);
+        ++res.first;
+        ++res.second;
+      }
+    }
+
+    memo_[path] = res;
+    return res;
+  }
+
+ private:
+  // Returns which values will be known after executing |insn|.
+  static uint32_t Known(const PathState& path,
+                        const struct sock_filter& insn) {
+    const bool acc_known = path.known & PathState::kAcc;
+    const bool index_known = path.known & PathState::kIndex;
+    const bool mem_known =
+        insn.k < BPF_MEMWORDS && (path.known & PathState::Mem(insn.k));
+    uint32_t known = path.known;
+    bool value_known;
+    uint32_t value;
+    switch (BPF_CLASS(insn.code)) {
+      case BPF_LD:
+        value = PathState::kAcc;
+        value_known = BPF_MODE(insn.code) == BPF_IMM ||
+                      (BPF_MODE(insn.code) == BPF_MEM && mem_known) ||
+                      (BPF_MODE(insn.code) == BPF_ABS &&
+                       (insn.k == SECCOMP_NR_IDX ||
+                        insn.k == SECCOMP_ARCH_IDX));
+        break;
+      case BPF_LDX:
+        value = PathState::kIndex;
+        value_known = BPF_MODE(insn.code) == BPF_IMM ||
+                      (BPF_MODE(insn.code) == BPF_MEM && mem_known);
+        break;
+      case BPF_ST:
+        value = insn.k < BPF_MEMWORDS ? PathState::Mem(insn.k) : 0;
+        value_known = acc_known;
+        break;
+      case BPF_STX:
+        value = insn.k < BPF_MEMWORDS ? PathState::Mem(insn.k) : 0;
+        value_known = index_known;
+        break;
+      case BPF_MISC:
+        value = BPF_MISCOP(insn.code) == BPF_TAX ? PathState::kIndex
+                                                 : PathState::kAcc;
+        value_known =
+            BPF_MISCOP(insn.code) == BPF_TAX ? acc_known : index_known;
+        break;
+      case BPF_ALU:
+        value = PathState::kAcc;
+        value_known =
+            acc_known && (BPF_SRC(insn.code) == BPF_K || index_known);
+        break;
+      default:
+        return known;
+    }
+    return value_known ? (known | value) : (known & ~value);
+  }
+
+  void Restore(const PathState& path, State* state) const {
+    state->ip = path.ip;
+    state->accumulator = path.accumulator;
+    state->acc_is_valid = path.valid & PathState::kAcc;
+    state->index = path.index;
+    state->index_is_valid = path.valid & PathState::kIndex;
+    std::copy(path.mem.begin(), path.mem.end(), state->mem);
+    state->mem_is_valid = path.valid >> 2;
+  }
+
+  void Save(const State& state, PathState* path) const {
+    path->accumulator = state.accumulator;
+    path->index = state.index;
+    std::copy(state.mem, state.mem + BPF_MEMWORDS, path->mem.begin());
+    path->valid = (state.acc_is_valid ? PathState::kAcc : 0) |
+                  (state.index_is_valid ? PathState::kIndex : 0) |
+                  (state.mem_is_valid << 2);
+    path->ip = state.ip;
+  }
+
+  // Executes a non-returning instruction, like EvaluateBPF.
+  static void Execute(State* state,
+                      const struct sock_filter& insn,
+                      const char** err) {
+    switch (BPF_CLASS(insn.code)) {
+      case BPF_LD:
+        Ld(state, insn, err);
+        break;
+      case BPF_JMP:
+        Jmp(state, insn, err);
+        break;
+      case BPF_ALU:
+        Alu(state, insn, err);
+        break;
+      case BPF_LDX:
+        Ldx(state, insn, err);
+        break;
+      case BPF_ST:
+      case BPF_STX:
+        St(state, insn, err);
+        break;
+      case BPF_MISC:
+        Misc(state, insn, err);
+        break;
+      default:
+        *err = "Unexpected instruction in BPF program";
+        break;
+    }
+  }
+
+  const std::vector<struct sock_filter>& program_;
+  struct arch_seccomp_data data_;
+  std::map<PathState, std::pair<size_t, size_t>> memo_;
+
+  DISALLOW_COPY_AND_ASSIGN(PathWalker);
+};
+
 }  // namespace
 
 uint32_t Verifier::EvaluateBPF(const std::vector<struct sock_filter>& program,
@@ -213,6 +529,16 @@ uint32_t Verifier::EvaluateBPF(const std::vector<struct sock_filter>& program,
       case BPF_ALU:
         Alu(&state, insn, err);
         break;
+      case BPF_LDX:
+        Ldx(&state, insn, err);
+        break;
+      case BPF_ST:
+      case BPF_STX:
+        St(&state, insn, err);
+        break;
+      case BPF_MISC:
+        Misc(&state, insn, err);
+        break;
       default:
         *err = "Unexpected instruction in BPF program";
         break;
@@ -221,5 +547,84 @@ uint32_t Verifier::EvaluateBPF(const std::vector<struct sock_filter>& program,
   return 0;
 }
 
+bool Verifier::IsConstantAllow(const std::vector<struct sock_filter>& program,
+                               uint32_t arch,
+                               uint32_t nr) {
+  uint32_t accumulator = 0;
+  for (size_t pc = 0; pc < program.size(); ++pc) {
+    const struct sock_filter& insn = program[pc];
+    switch (insn.code) {
+      case BPF_LD + BPF_W + BPF_ABS:
+        if (insn.k == SECCOMP_NR_IDX) {
+          accumulator = nr;
+        } else if (insn.k == SECCOMP_ARCH_IDX) {
+          accumulator = arch;
+        } else {
+          // The result depends on other fields, so it can't be cached.
+          return false;
+        }
+        break;
+      case BPF_RET + BPF_K:
+        return insn.k == SECCOMP_RET_ALLOW;
+      case BPF_JMP + BPF_JA:
+        pc += insn.k;
+        break;
+      case BPF_JMP + BPF_JEQ + BPF_K:
+        pc += accumulator == insn.k ? insn.jt : insn.jf;
+        break;
+      case BPF_JMP + BPF_JGE + BPF_K:
+        pc += accumulator >= insn.k ? insn.jt : insn.jf;
+        break;
+      case BPF_JMP + BPF_JGT + BPF_K:
+        pc += accumulator > insn.k ? insn.jt : insn.jf;
+        break;
+      case BPF_JMP + BPF_JSET + BPF_K:
+        pc += (accumulator & insn.k) ? insn.jt : insn.jf;
+        break;
+      case BPF_ALU + BPF_AND + BPF_K:
+        accumulator &= insn.k;
+        break;
+      default:
+        // The kernel's emulator gives up on anything else.
+        return false;
+    }
+  }
+  return false;
+}
+
+void Verifier::PathLengths(const std::vector<struct sock_filter>& program,
+                           uint32_t arch,
+                           uint32_t nr,
+                           size_t* min,
+                           size_t* max,
+                           const char** err) {
+  *err = NULL;
+  *min = 0;
+  *max = 0;
+  if (program.size() < 1 || program.size() >= SECCOMP_MAX_PROGRAM_SIZE) {
+    *err = "Invalid program length";
+    return;
+  }
+  PathState start = {};
+  const std::pair<size_t, size_t> res =
+      PathWalker(program, arch, nr).Walk(start, err);
+  if (!*err) {
+    *min = res.first;
+    *max = res.second;
+  }
+}
+
+std::vector<uint32_t> Verifier::ConstantAllowSyscalls(
+    const std::vector<struct sock_filter>& program,
+    uint32_t arch) {
+  std::vector<uint32_t> res;
+  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+    if (IsConstantAllow(program, arch, sysnum)) {
+      res.push_back(sysnum);
+    }
+  }
+  return res;
+}
+
 }  // namespace bpf_dsl
 }  // namespace sandbox
@@ -5,6 +5,7 @@
 #ifndef SANDBOX_LINUX_BPF_DSL_VERIFIER_H__
 #define SANDBOX_LINUX_BPF_DSL_VERIFIER_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <vector>
@@ -35,6 +36,37 @@ class SANDBOX_EXPORT Verifier {
                               const struct arch_seccomp_data& data,
                               const char** err);
 
+  // IsConstantAllow mirrors the kernel's seccomp action cache emulator
+  // (see seccomp_is_const_allow() in kernel/seccomp.c) and returns whether
+  // the kernel can cache |program| as always allowing system call |nr| on
+  // architecture |arch|; i.e., whether |program| returns
+  // SECCOMP_RET_ALLOW while only inspecting the "arch" and "nr" fields.
+  static bool IsConstantAllow(const std::vector<struct sock_filter>& program,
+                              uint32_t arch,
+                              uint32_t nr);
+
+  // PathLengths walks every path through |program| that system call |nr|
+  // on architecture |arch| may take, treating the remaining
+  // arch_seccomp_data fields (i.e., the instruction pointer and the
+  // arguments) as unknown. It stores the number of instructions executed
+  // by the shortest and the longest path in |min| and |max|. Branches on
+  // unknown values are assumed to go either way independently, so
+  // |max| is an upper bound if the program tests the same field twice.
+  // If the program is invalid, "err" will be set to a non-NULL error
+  // string.
+  static void PathLengths(const std::vector<struct sock_filter>& program,
+                          uint32_t arch,
+                          uint32_t nr,
+                          size_t* min,
+                          size_t* max,
+                          const char** err);
+
+  // ConstantAllowSyscalls returns the valid system call numbers for which
+  // IsConstantAllow() is true.
+  static std::vector<uint32_t> ConstantAllowSyscalls(
+      const std::vector<struct sock_filter>& program,
+      uint32_t arch);
+
  private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(Verifier);
 };
@@ -0,0 +1,158 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/verifier.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "base/time/time.h"
+#include "sandbox/linux/bpf_dsl/batch_verifier.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/jit.h"
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+#include "sandbox/linux/bpf_dsl/policy.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/policy_oracle.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/syscall_set.h"
+#include "sandbox/linux/bpf_dsl/test_trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_test.h"
+
+#define CASES SANDBOX_BPF_DSL_CASES
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+// Number of system calls that each run evaluates.
+const size_t kNumSyscalls = 1 << 18;
+
+// ArgumentPolicy allows some system calls outright and checks the
+// arguments of others, so that system calls take paths of different
+// lengths through the program.
+class ArgumentPolicy : public Policy {
+ public:
+  ArgumentPolicy() {}
+  ~ArgumentPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    const Arg<int> fd(0);
+    const Arg<int> cmd(1);
+    switch (sysno % 3) {
+      case 0:
+        return Allow();
+      case 1:
+        return If(fd == sysno % 8, Allow()).Else(Error(EPERM));
+      default:
+        return Switch(cmd).CASES((1, 2, 3, 5), Allow()).Default(Error(EACCES));
+    }
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ArgumentPolicy);
+};
+
+// Compares the ways of evaluating a program against many system calls:
+// the interpreter, the batch evaluator and JitProgram, and PolicyOracle,
+// which evaluates the policy without the program.
+TEST(VerifierPerfTest, Evaluate) {
+  ArgumentPolicy policy;
+  TestTrapRegistry traps;
+  const CodeGen::Program program = PolicyCompiler(&policy, &traps).Compile();
+
+  // Mostly valid system calls, with small arguments.
+  std::vector<uint32_t> sysnums;
+  for (uint32_t sysnum : SyscallSet::ValidOnly()) {
+    sysnums.push_back(sysnum);
+  }
+  std::vector<struct arch_seccomp_data> data(kNumSyscalls);
+  uint32_t seed = 1;
+  for (struct arch_seccomp_data& d : data) {
+    seed = seed * 1103515245 + 12345;
+    d.nr = sysnums[(seed >> 8) % sysnums.size()];
+    d.arch = SECCOMP_ARCH;
+    d.args[0] = (seed >> 4) % 8;
+    d.args[1] = (seed >> 12) % 8;
+  }
+
+  std::vector<uint32_t> expected(kNumSyscalls);
+  const base::TimeDelta scalar = FastestRun([&]() {
+    for (size_t i = 0; i < kNumSyscalls; ++i) {
+      const char* err = nullptr;
+      expected[i] = Verifier::EvaluateBPF(program, data[i], &err);
+    }
+  });
+  perf_test::PrintResult("verifier_evaluate", "", "scalar",
+                         scalar.InMicrosecondsF() * 1000 / kNumSyscalls, "ns",
+                         true);
+
+  const struct {
+    BatchVerifier::SimdLevel level;
+    const char* trace;
+  } kLevels[] = {
+      {BatchVerifier::SimdLevel::NONE, "batch_portable"},
+      {BatchVerifier::SimdLevel::SSE2, "batch_sse2"},
+      {BatchVerifier::SimdLevel::AVX2, "batch_avx2"},
+  };
+  for (const auto& level : kLevels) {
+    if (level.level > BatchVerifier::MaxSimdLevel()) {
+      continue;
+    }
+    std::vector<uint32_t> results(kNumSyscalls);
+    std::vector<const char*> errs(kNumSyscalls);
+    const base::TimeDelta batch = FastestRun([&]() {
+      BatchVerifier::EvaluateBPF(level.level, program, data.data(),
+                                 data.size(), results.data(), errs.data());
+    });
+    perf_test::PrintResult("verifier_evaluate", "", level.trace,
+                           batch.InMicrosecondsF() * 1000 / kNumSyscalls, "ns",
+                           true);
+    perf_test::PrintResult("verifier_evaluate_speedup", "", level.trace,
+                           scalar.InMicrosecondsF() / batch.InMicrosecondsF(),
+                           "x", false);
+    EXPECT_EQ(expected, results);
+  }
+
+  const JitProgram jit(program);
+  std::vector<uint32_t> results(kNumSyscalls);
+  const base::TimeDelta native = FastestRun([&]() {
+    for (size_t i = 0; i < kNumSyscalls; ++i) {
+      const char* err = nullptr;
+      results[i] = jit.Evaluate(data[i], &err);
+    }
+  });
+  perf_test::PrintResult("verifier_evaluate", "", "jit",
+                         native.InMicrosecondsF() * 1000 / kNumSyscalls, "ns",
+                         true);
+  perf_test::PrintResult("verifier_evaluate_speedup", "", "jit",
+                         scalar.InMicrosecondsF() / native.InMicrosecondsF(),
+                         "x", false);
+  EXPECT_EQ(expected, results);
+
+  const PolicyOracle oracle(&policy, &traps);
+  const base::TimeDelta lookup = FastestRun([&]() {
+    for (size_t i = 0; i < kNumSyscalls; ++i) {
+      results[i] = oracle.Evaluate(data[i]);
+    }
+  });
+  perf_test::PrintResult("verifier_evaluate", "", "oracle",
+                         lookup.InMicrosecondsF() * 1000 / kNumSyscalls, "ns",
+                         true);
+  perf_test::PrintResult("verifier_evaluate_speedup", "", "oracle",
+                         scalar.InMicrosecondsF() / lookup.InMicrosecondsF(),
+                         "x", false);
+  EXPECT_EQ(expected, results);
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
@@ -0,0 +1,181 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/bpf_dsl/verifier.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "sandbox/linux/bpf_dsl/program_test_util.h"
+#include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/trap_registry.h"
+#include "sandbox/linux/system_headers/linux_filter.h"
+#include "sandbox/linux/system_headers/linux_seccomp.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace sandbox {
+namespace bpf_dsl {
+namespace {
+
+TEST(Verifier, IndexRegister) {
+  // Allows the system call iff bit arg0 of 0x14 is set, computing
+  // (1 << arg0) via the index register.
+  const std::vector<sock_filter> program = {
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+      Insn(BPF_MISC + BPF_TAX, 0),
+      Insn(BPF_LD + BPF_W + BPF_IMM, 1),
+      Insn(BPF_ALU + BPF_LSH + BPF_X, 0),
+      Insn(BPF_ALU + BPF_AND + BPF_K, 0x14),
+      Insn(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO + 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+  };
+
+  for (uint32_t arg = 0; arg < 8; ++arg) {
+    const char* err = nullptr;
+    const uint32_t expected =
+        ((1U << arg) & 0x14) ? SECCOMP_RET_ALLOW : SECCOMP_RET_ERRNO + 1;
+    EXPECT_EQ(expected,
+              Verifier::EvaluateBPF(program, FakeSyscall(0, arg), &err))
+        << "arg " << arg;
+    EXPECT_FALSE(err) << err;
+  }
+}
+
+TEST(Verifier, Shifts) {
+  // Like the kernel, shifting by 32 or more is an error, whether the
+  // amount is a constant or in the index register.
+  for (uint16_t op : {BPF_LSH, BPF_RSH}) {
+    for (uint32_t amount : {31U, 32U, 33U}) {
+      const char* err = nullptr;
+      Verifier::EvaluateBPF({Insn(BPF_LD + BPF_W + BPF_IMM, 0x80000001),
+                             Insn(BPF_ALU + op + BPF_K, amount),
+                             Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW)},
+                            FakeSyscall(0, 0), &err);
+      EXPECT_EQ(amount >= 32, err != nullptr) << "amount " << amount;
+
+      err = nullptr;
+      Verifier::EvaluateBPF({Insn(BPF_LD + BPF_W + BPF_ABS,
+                                  SECCOMP_ARG_LSB_IDX(0)),
+                             Insn(BPF_MISC + BPF_TAX, 0),
+                             Insn(BPF_LD + BPF_W + BPF_IMM, 0x80000001),
+                             Insn(BPF_ALU + op + BPF_X, 0),
+                             Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW)},
+                            FakeSyscall(0, amount), &err);
+      EXPECT_EQ(amount >= 32, err != nullptr) << "amount " << amount;
+    }
+  }
+}
+
+TEST(Verifier, ScratchMemory) {
+  // Stores arg0 in M[3], clobbers A and X, and then compares M[3]
+  // against X after reloading it.
+  const std::vector<sock_filter> program = {
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+      Insn(BPF_ST, 3),
+      Insn(BPF_LDX + BPF_W + BPF_IMM, 42),
+      Insn(BPF_STX, 4),
+      Insn(BPF_LD + BPF_W + BPF_IMM, 0),
+      Insn(BPF_LDX + BPF_W + BPF_MEM, 3),
+      Insn(BPF_LD + BPF_W + BPF_MEM, 4),
+      Insn(BPF_JMP + BPF_JEQ + BPF_X, 0, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+      Insn(BPF_MISC + BPF_TXA, 0),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO),
+  };
+
+  const char* err = nullptr;
+  EXPECT_EQ(SECCOMP_RET_ALLOW,
+            Verifier::EvaluateBPF(program, FakeSyscall(0, 42), &err));
+  EXPECT_FALSE(err) << err;
+  EXPECT_EQ(SECCOMP_RET_ERRNO,
+            Verifier::EvaluateBPF(program, FakeSyscall(0, 41), &err));
+  EXPECT_FALSE(err) << err;
+}
+
+TEST(Verifier, UninitializedRegisters) {
+  const std::vector<std::vector<sock_filter>> programs = {
+      // Reading uninitialized scratch memory.
+      {Insn(BPF_LD + BPF_W + BPF_MEM, 0), Insn(BPF_RET + BPF_K, 0)},
+      {Insn(BPF_LDX + BPF_W + BPF_MEM, 1), Insn(BPF_RET + BPF_K, 0)},
+      // Out of bounds scratch memory.
+      {Insn(BPF_LD + BPF_W + BPF_IMM, 0), Insn(BPF_ST, BPF_MEMWORDS),
+       Insn(BPF_RET + BPF_K, 0)},
+      // Using X before it's loaded.
+      {Insn(BPF_LD + BPF_W + BPF_IMM, 0), Insn(BPF_ALU + BPF_ADD + BPF_X, 0),
+       Insn(BPF_RET + BPF_K, 0)},
+      {Insn(BPF_MISC + BPF_TXA, 0), Insn(BPF_RET + BPF_K, 0)},
+      {Insn(BPF_STX, 0), Insn(BPF_RET + BPF_K, 0)},
+  };
+
+  for (const auto& program : programs) {
+    const char* err = nullptr;
+    Verifier::EvaluateBPF(program, FakeSyscall(0, 0), &err);
+    EXPECT_TRUE(err);
+  }
+}
+
+TEST(Verifier, PathLengths) {
+  // Only system call 1 inspects its argument, which takes one of two
+  // paths of different lengths.
+  const std::vector<sock_filter> program = {
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_NR_IDX),
+      Insn(BPF_JMP + BPF_JEQ + BPF_K, 1, 0, 4),
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+      Insn(BPF_JMP + BPF_JEQ + BPF_K, 0, 2, 0),
+      Insn(BPF_ALU + BPF_AND + BPF_K, 1),
+      Insn(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+  };
+
+  size_t min = 0;
+  size_t max = 0;
+  const char* err = nullptr;
+  Verifier::PathLengths(program, SECCOMP_ARCH, 0, &min, &max, &err);
+  EXPECT_FALSE(err) << err;
+  EXPECT_EQ(3U, min);
+  EXPECT_EQ(3U, max);
+
+  Verifier::PathLengths(program, SECCOMP_ARCH, 1, &min, &max, &err);
+  EXPECT_FALSE(err) << err;
+  EXPECT_EQ(5U, min);
+  EXPECT_EQ(7U, max);
+}
+
+TEST(Verifier, PathLengthsOfKnownValues) {
+  // Values computed from the system call number are known, so only one
+  // way of each branch is taken, even through scratch memory and X.
+  const std::vector<sock_filter> program = {
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_NR_IDX),
+      Insn(BPF_ST, 0),
+      Insn(BPF_LDX + BPF_W + BPF_MEM, 0),
+      Insn(BPF_LD + BPF_W + BPF_IMM, 1),
+      Insn(BPF_ALU + BPF_LSH + BPF_X, 0),
+      Insn(BPF_JMP + BPF_JSET + BPF_K, 0x6, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+      Insn(BPF_LD + BPF_W + BPF_ABS, SECCOMP_ARG_LSB_IDX(0)),
+      Insn(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+      Insn(BPF_RET + BPF_K, SECCOMP_RET_ERRNO),
+  };
+
+  size_t min = 0;
+  size_t max = 0;
+  const char* err = nullptr;
+  Verifier::PathLengths(program, SECCOMP_ARCH, 2, &min, &max, &err);
+  EXPECT_FALSE(err) << err;
+  EXPECT_EQ(7U, min);
+  EXPECT_EQ(7U, max);
+
+  Verifier::PathLengths(program, SECCOMP_ARCH, 3, &min, &max, &err);
+  EXPECT_FALSE(err) << err;
+  EXPECT_EQ(9U, min);
+  EXPECT_EQ(9U, max);
+}
+
+}  // namespace
+}  // namespace bpf_dsl
+}  // namespace sandbox
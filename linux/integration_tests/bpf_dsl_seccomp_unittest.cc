@@ -33,10 +33,12 @@
 #include "base/threading/thread.h"
 #include "build/build_config.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/codegen.h"
 #include "sandbox/linux/bpf_dsl/errorcode.h"
 #include "sandbox/linux/bpf_dsl/linux_syscall_ranges.h"
 #include "sandbox/linux/bpf_dsl/policy.h"
 #include "sandbox/linux/bpf_dsl/seccomp_macros.h"
+#include "sandbox/linux/bpf_dsl/static_program.h"
 #include "sandbox/linux/seccomp-bpf/bpf_tests.h"
 #include "sandbox/linux/seccomp-bpf/die.h"
 #include "sandbox/linux/seccomp-bpf/sandbox_bpf.h"
@@ -396,6 +398,115 @@ BPF_TEST_C(SandboxBPF, StackingPolicy, StackingPolicyPartOne) {
   BPF_ASSERT(errno == EPERM);
 }
 
+// A policy that's too large to compile into a single BPF program, as every
+// system call compares its arguments against values of its own.
+const int kOversizedMagic = 0x5eed0000;
+
+class OversizedPolicy : public Policy {
+ public:
+  OversizedPolicy() {}
+  ~OversizedPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    DCHECK(SandboxBPF::IsValidSyscallNumber(sysno));
+    // Other system calls pass pointers, so check full-width arguments.
+    const Arg<uintptr_t> arg0(0);
+    const Arg<uintptr_t> arg1(1);
+    return If(arg0 == kOversizedMagic + sysno, Error(EPERM))
+        .ElseIf(arg1 == kOversizedMagic + sysno, Error(EACCES))
+        .Else(Allow());
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(OversizedPolicy);
+};
+
+SANDBOX_TEST(SandboxBPF, DISABLE_ON_TSAN(SplitOversizedPolicy)) {
+  if (SandboxBPF::SupportsSeccompSandbox(
+          SandboxBPF::SeccompLevel::SINGLE_THREADED)) {
+    SandboxBPF sandbox(new OversizedPolicy());
+    sandbox.SetSplitOversizedPolicy(true);
+    BPF_ASSERT(sandbox.StartSandbox(SandboxBPF::SeccompLevel::SINGLE_THREADED));
+
+    errno = 0;
+    BPF_ASSERT(syscall(__NR_getppid, 0, 0) > 0);
+    BPF_ASSERT(errno == 0);
+
+    BPF_ASSERT(syscall(__NR_getppid, kOversizedMagic + __NR_getppid, 0) == -1);
+    BPF_ASSERT(errno == EPERM);
+    BPF_ASSERT(syscall(__NR_getppid, 0, kOversizedMagic + __NR_getppid) == -1);
+    BPF_ASSERT(errno == EACCES);
+
+    // The filter that decides prctl() must still have been installed.
+    BPF_ASSERT(syscall(__NR_prctl, kOversizedMagic + __NR_prctl, 0) == -1);
+    BPF_ASSERT(errno == EPERM);
+  }
+}
+
+// A policy that builds its expressions lazily and reuses them across
+// calls, which is only allowed when it isn't compiled in an arena.
+class MemoizingPolicy : public Policy {
+ public:
+  MemoizingPolicy() {}
+  ~MemoizingPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    DCHECK(SandboxBPF::IsValidSyscallNumber(sysno));
+    if (sysno != __NR_getppid) {
+      return Allow();
+    }
+    if (!getppid_result_) {
+      const Arg<int> arg0(0);
+      getppid_result_ = If(arg0 == 1, Error(EPERM)).Else(Allow());
+    }
+    return getppid_result_;
+  }
+
+ private:
+  mutable ResultExpr getppid_result_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoizingPolicy);
+};
+
+BPF_TEST_C(SandboxBPF, MemoizingPolicy, MemoizingPolicy) {
+  BPF_ASSERT(syscall(__NR_getppid, 0) > 0);
+  BPF_ASSERT(syscall(__NR_getppid, 1) == -1);
+  BPF_ASSERT(errno == EPERM);
+}
+
+SANDBOX_TEST(SandboxBPF, DISABLE_ON_TSAN(CompileInArena)) {
+  if (SandboxBPF::SupportsSeccompSandbox(
+          SandboxBPF::SeccompLevel::SINGLE_THREADED)) {
+    SandboxBPF sandbox(new OversizedPolicy());
+    sandbox.SetSplitOversizedPolicy(true);
+    sandbox.SetCompileInArena(true);
+    BPF_ASSERT(sandbox.StartSandbox(SandboxBPF::SeccompLevel::SINGLE_THREADED));
+
+    BPF_ASSERT(syscall(__NR_getppid, kOversizedMagic + __NR_getppid, 0) == -1);
+    BPF_ASSERT(errno == EPERM);
+  }
+}
+
+SANDBOX_TEST(SandboxBPF, DISABLE_ON_TSAN(StaticProgram)) {
+  if (SandboxBPF::SupportsSeccompSandbox(
+          SandboxBPF::SeccompLevel::SINGLE_THREADED)) {
+    // Static programs are usually compiled when building; see
+    // bpf_dsl/static_program_test_generator.cc.
+    StackingPolicyPartTwo policy;
+    const CodeGen::Program program = CompileStaticProgram(&policy);
+    const StaticProgram static_program = {&program[0], program.size()};
+    SandboxBPF sandbox(static_program);
+    BPF_ASSERT(sandbox.StartSandbox(SandboxBPF::SeccompLevel::SINGLE_THREADED));
+
+    errno = 0;
+    BPF_ASSERT(syscall(__NR_getppid, 1) > 0);
+    BPF_ASSERT(errno == 0);
+
+    BPF_ASSERT(syscall(__NR_getppid, 0) == -1);
+    BPF_ASSERT(errno == EINVAL);
+  }
+}
+
 // A more complex, but synthetic policy. This tests the correctness of the BPF
 // program by iterating through all syscalls and checking for an errno that
 // depends on the syscall number. Unlike the Verifier, this exercises the BPF
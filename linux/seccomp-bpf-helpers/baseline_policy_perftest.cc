@@ -0,0 +1,70 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sandbox/linux/seccomp-bpf-helpers/baseline_policy.h"
+
+#include <sys/types.h>
+
+#include "base/macros.h"
+#include "sandbox/linux/bpf_dsl/bpf_dsl.h"
+#include "sandbox/linux/bpf_dsl/perf_test_util.h"
+#include "sandbox/linux/seccomp-bpf-helpers/syscall_parameters_restrictions.h"
+#include "sandbox/linux/services/syscall_wrappers.h"
+#include "sandbox/linux/system_headers/linux_syscalls.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+using sandbox::bpf_dsl::ResultExpr;
+
+namespace sandbox {
+namespace {
+
+// HelperRestrictionsPolicy layers the parameter restrictions that
+// process-specific policies commonly add on top of BaselinePolicy.
+class HelperRestrictionsPolicy : public BaselinePolicy {
+ public:
+  HelperRestrictionsPolicy() : pid_(sys_getpid()) {}
+  ~HelperRestrictionsPolicy() override {}
+
+  ResultExpr EvaluateSyscall(int sysno) const override {
+    switch (sysno) {
+      case __NR_ioctl:
+        return RestrictIoctl();
+      case __NR_prctl:
+        return RestrictPrctl();
+      case __NR_mprotect:
+        return RestrictMprotectFlags();
+      case __NR_getpriority:
+      case __NR_setpriority:
+        return RestrictGetSetpriority(pid_);
+      case __NR_prlimit64:
+        return RestrictPrlimit64(pid_);
+      case __NR_kill:
+      case __NR_tgkill:
+        return RestrictKillTarget(pid_, sysno);
+      case __NR_sched_getaffinity:
+      case __NR_sched_getparam:
+      case __NR_sched_getscheduler:
+      case __NR_sched_setscheduler:
+        return RestrictSchedTarget(pid_, sysno);
+      default:
+        return BaselinePolicy::EvaluateSyscall(sysno);
+    }
+  }
+
+ private:
+  const pid_t pid_;
+
+  DISALLOW_COPY_AND_ASSIGN(HelperRestrictionsPolicy);
+};
+
+TEST(BaselinePolicyPerfTest, Baseline) {
+  bpf_dsl::MeasurePolicy("baseline", BaselinePolicy());
+}
+
+TEST(BaselinePolicyPerfTest, HelperRestrictions) {
+  bpf_dsl::MeasurePolicy("helper_restrictions", HelperRestrictionsPolicy());
+}
+
+}  // namespace
+}  // namespace sandbox
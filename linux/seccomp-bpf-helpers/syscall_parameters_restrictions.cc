@@ -110,7 +110,9 @@ inline bool IsBuggyGlibcSemPost() {
 
 #define CASES SANDBOX_BPF_DSL_CASES
 
+using sandbox::bpf_dsl::AllOf;
 using sandbox::bpf_dsl::Allow;
+using sandbox::bpf_dsl::AnyOf;
 using sandbox::bpf_dsl::Arg;
 using sandbox::bpf_dsl::BoolExpr;
 using sandbox::bpf_dsl::Error;
@@ -150,8 +152,8 @@ ResultExpr RestrictPrctl() {
   // Will need to add seccomp compositing in the future. PR_SET_PTRACER is
   // used by breakpad but not needed anymore.
   const Arg<int> option(0);
-  return Switch(option)
-      .CASES((PR_GET_NAME, PR_SET_NAME, PR_GET_DUMPABLE, PR_SET_DUMPABLE
+  return If(option.In({PR_GET_NAME, PR_SET_NAME, PR_GET_DUMPABLE,
+                        PR_SET_DUMPABLE
 #if defined(OS_ANDROID)
               , PR_SET_VMA, PR_SET_PTRACER
 
@@ -182,9 +184,9 @@ ResultExpr RestrictPrctl() {
               , PR_SET_TIMERSLACK_PID_2
               , PR_SET_TIMERSLACK_PID_3
 #endif  // defined(OS_ANDROID)
-              ),
-             Allow())
-      .Default(CrashSIGSYSPrctl());
+                       }),
+            Allow())
+      .Else(CrashSIGSYSPrctl());
 }
 
 ResultExpr RestrictIoctl() {
@@ -231,19 +233,14 @@ ResultExpr RestrictFcntlCommands() {
 
   const uint64_t kAllowedMask = O_ACCMODE | O_APPEND | O_NONBLOCK | O_SYNC |
                                 kOLargeFileFlag | O_CLOEXEC | O_NOATIME;
-  return Switch(cmd)
-      .CASES((F_GETFL,
-              F_GETFD,
-              F_SETFD,
-              F_SETLK,
-              F_SETLKW,
-              F_GETLK,
-              F_DUPFD,
-              F_DUPFD_CLOEXEC),
-             Allow())
-      .Case(F_SETFL,
-            If((long_arg & ~kAllowedMask) == 0, Allow()).Else(CrashSIGSYS()))
-      .Default(CrashSIGSYS());
+  // F_DUPFD_CLOEXEC is checked separately so that the remaining commands fit
+  // into a single membership bitmap.
+  return If(AnyOf(cmd.In({F_GETFL, F_GETFD, F_SETFD, F_SETLK, F_SETLKW,
+                          F_GETLK, F_DUPFD}),
+                  cmd == F_DUPFD_CLOEXEC),
+            Allow())
+      .ElseIf(AllOf(cmd == F_SETFL, (long_arg & ~kAllowedMask) == 0), Allow())
+      .Else(CrashSIGSYS());
 }
 
 #if defined(__i386__) || defined(__mips__)
@@ -336,19 +333,18 @@ ResultExpr RestrictGetrusage() {
 ResultExpr RestrictClockID() {
   static_assert(4 == sizeof(clockid_t), "clockid_t is not 32bit");
   const Arg<clockid_t> clockid(0);
-  return Switch(clockid)
-      .CASES((
+  return If(clockid.In({
 #if defined(OS_ANDROID)
-              CLOCK_BOOTTIME,
+                CLOCK_BOOTTIME,
 #endif
-              CLOCK_MONOTONIC,
-              CLOCK_MONOTONIC_COARSE,
-              CLOCK_PROCESS_CPUTIME_ID,
-              CLOCK_REALTIME,
-              CLOCK_REALTIME_COARSE,
-              CLOCK_THREAD_CPUTIME_ID),
-             Allow())
-      .Default(CrashSIGSYS());
+                CLOCK_MONOTONIC,
+                CLOCK_MONOTONIC_COARSE,
+                CLOCK_PROCESS_CPUTIME_ID,
+                CLOCK_REALTIME,
+                CLOCK_REALTIME_COARSE,
+                CLOCK_THREAD_CPUTIME_ID}),
+            Allow())
+      .Else(CrashSIGSYS());
 }
 
 #if !defined(GRND_NONBLOCK)
@@ -6,10 +6,16 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
 #include "base/compiler_specific.h"
 #include "base/files/scoped_file.h"
 #include "base/logging.h"
@@ -18,8 +24,10 @@
 #include "base/third_party/valgrind/valgrind.h"
 #include "sandbox/linux/bpf_dsl/bpf_dsl.h"
 #include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/expr_arena.h"
 #include "sandbox/linux/bpf_dsl/policy.h"
 #include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/program_cache.h"
 #include "sandbox/linux/bpf_dsl/seccomp_macros.h"
 #include "sandbox/linux/bpf_dsl/syscall_set.h"
 #include "sandbox/linux/seccomp-bpf/die.h"
@@ -121,7 +129,26 @@ bpf_dsl::ResultExpr SandboxPanic(const char* error) {
 }  // namespace
 
 SandboxBPF::SandboxBPF(bpf_dsl::Policy* policy)
-    : proc_fd_(), sandbox_has_started_(false), policy_(policy) {
+    : proc_fd_(),
+      sandbox_has_started_(false),
+      policy_(policy),
+      static_program_(),
+      program_cache_(),
+      split_oversized_policy_(false),
+      compile_in_arena_(false) {
+}
+
+SandboxBPF::SandboxBPF(const bpf_dsl::StaticProgram& program)
+    : proc_fd_(),
+      sandbox_has_started_(false),
+      policy_(),
+      static_program_(program),
+      program_cache_(),
+      split_oversized_policy_(false),
+      compile_in_arena_(false) {
+  CHECK(program.filter);
+  CHECK_GT(program.length, 0U);
+  CHECK_LE(program.length, static_cast<size_t>(BPF_MAXINSNS));
 }
 
 SandboxBPF::~SandboxBPF() {
@@ -146,7 +173,7 @@ bool SandboxBPF::SupportsSeccompSandbox(SeccompLevel level) {
 }
 
 bool SandboxBPF::StartSandbox(SeccompLevel seccomp_level) {
-  DCHECK(policy_);
+  DCHECK(policy_ || static_program_.filter);
   CHECK(seccomp_level == SeccompLevel::SINGLE_THREADED ||
         seccomp_level == SeccompLevel::MULTI_THREADED);
 
@@ -198,6 +225,19 @@ void SandboxBPF::SetProcFd(base::ScopedFD proc_fd) {
   proc_fd_.swap(proc_fd);
 }
 
+void SandboxBPF::SetProgramCache(
+    std::unique_ptr<bpf_dsl::ProgramCache> cache) {
+  program_cache_ = std::move(cache);
+}
+
+void SandboxBPF::SetSplitOversizedPolicy(bool split) {
+  split_oversized_policy_ = split;
+}
+
+void SandboxBPF::SetCompileInArena(bool compile_in_arena) {
+  compile_in_arena_ = compile_in_arena;
+}
+
 // static
 bool SandboxBPF::IsValidSyscallNumber(int sysnum) {
   return SyscallSet::IsValid(sysnum);
@@ -217,59 +257,123 @@ intptr_t SandboxBPF::ForwardSyscall(const struct arch_seccomp_data& args) {
       static_cast<intptr_t>(args.args[5]));
 }
 
-CodeGen::Program SandboxBPF::AssembleFilter() {
+std::vector<bpf_dsl::PolicyCompiler::Filter> SandboxBPF::AssembleFilters() {
   DCHECK(policy_);
 
-  bpf_dsl::PolicyCompiler compiler(policy_.get(), Trap::Registry());
-  if (Trap::SandboxDebuggingAllowedByUser()) {
-    compiler.DangerousSetEscapePC(EscapePC());
+  // If requested, build the policy's expressions in an arena that's
+  // released in one go once they've been compiled.
+  std::unique_ptr<bpf_dsl::ExprArena> arena;
+  if (compile_in_arena_) {
+    arena.reset(new bpf_dsl::ExprArena);
   }
-  compiler.SetPanicFunc(SandboxPanic);
-  return compiler.Compile();
+  std::vector<bpf_dsl::PolicyCompiler::Filter> filters;
+  {
+    std::unique_ptr<bpf_dsl::ExprArena::Scope> scope;
+    if (arena) {
+      scope.reset(new bpf_dsl::ExprArena::Scope(arena.get()));
+    }
+    bpf_dsl::PolicyCompiler compiler(policy_.get(), Trap::Registry());
+    if (Trap::SandboxDebuggingAllowedByUser()) {
+      compiler.DangerousSetEscapePC(EscapePC());
+    }
+    compiler.SetPanicFunc(SandboxPanic);
+    if (split_oversized_policy_) {
+      filters = compiler.CompileSplit(BPF_MAXINSNS);
+    } else {
+      filters.resize(1);
+      filters[0].first = 0;
+      filters[0].last = std::numeric_limits<uint32_t>::max();
+      if (program_cache_) {
+        filters[0].program = compiler.CompileCached(program_cache_.get());
+      } else {
+        filters[0].program = compiler.Compile();
+      }
+    }
+  }
+  return filters;
 }
 
 void SandboxBPF::InstallFilter(bool must_sync_threads) {
+  if (static_program_.filter) {
+    struct sock_fprog prog = {
+        static_cast<unsigned short>(static_program_.length),
+        const_cast<struct sock_filter*>(static_program_.filter)};
+    InstallPrograms(&prog, 1, must_sync_threads);
+    return;
+  }
+
   // We want to be very careful in not imposing any requirements on the
   // policies that are set with SetSandboxPolicy(). This means, as soon as
   // the sandbox is active, we shouldn't be relying on libraries that could
   // be making system calls. This, for example, means we should avoid
   // using the heap and we should avoid using STL functions.
-  // Temporarily copy the contents of the "program" vector into a
-  // stack-allocated array; and then explicitly destroy that object.
+  // Temporarily copy the contents of the "program" vectors into a
+  // stack-allocated array; and then explicitly destroy those objects.
   // This makes sure we don't ex- or implicitly call new/delete after we
   // installed the BPF filter program in the kernel. Depending on the
   // system memory allocator that is in effect, these operators can result
   // in system calls to things like munmap() or brk().
-  CodeGen::Program program = AssembleFilter();
-
-  struct sock_filter bpf[program.size()];
-  const struct sock_fprog prog = {static_cast<unsigned short>(program.size()),
-                                  bpf};
-  memcpy(bpf, &program[0], sizeof(bpf));
-  CodeGen::Program().swap(program);  // vector swap trick
+  std::vector<bpf_dsl::PolicyCompiler::Filter> filters = AssembleFilters();
+
+  // Each filter only restricts its own system calls, so installing the
+  // one that decides the system call that installs them must come last.
+  const uint32_t install_sysnum = must_sync_threads ? __NR_seccomp : __NR_prctl;
+  std::stable_partition(
+      filters.begin(), filters.end(),
+      [install_sysnum](const bpf_dsl::PolicyCompiler::Filter& filter) {
+        return install_sysnum < filter.first || install_sysnum > filter.last;
+      });
+
+  size_t num_insns = 0;
+  for (const bpf_dsl::PolicyCompiler::Filter& filter : filters) {
+    num_insns += filter.program.size();
+  }
+  const size_t num_progs = filters.size();
+  struct sock_filter bpf[num_insns];
+  struct sock_fprog progs[num_progs];
+  size_t offset = 0;
+  for (size_t i = 0; i < num_progs; ++i) {
+    const CodeGen::Program& program = filters[i].program;
+    progs[i].len = static_cast<unsigned short>(program.size());
+    progs[i].filter = bpf + offset;
+    memcpy(bpf + offset, &program[0], program.size() * sizeof(bpf[0]));
+    offset += program.size();
+  }
+  std::vector<bpf_dsl::PolicyCompiler::Filter>().swap(filters);
 
   // Make an attempt to release memory that is no longer needed here, rather
   // than in the destructor. Try to avoid as much as possible to presume of
   // what will be possible to do in the new (sandboxed) execution environment.
   policy_.reset();
+  program_cache_.reset();
+
+  InstallPrograms(progs, num_progs, must_sync_threads);
+}
 
+void SandboxBPF::InstallPrograms(struct sock_fprog* progs,
+                                 size_t num_progs,
+                                 bool must_sync_threads) {
   if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
     SANDBOX_DIE("Kernel refuses to enable no-new-privs");
   }
 
-  // Install BPF filter program. If the thread state indicates multi-threading
-  // support, then the kernel hass the seccomp system call. Otherwise, fall
-  // back on prctl, which requires the process to be single-threaded.
-  if (must_sync_threads) {
-    int rv =
-        sys_seccomp(SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, &prog);
-    if (rv) {
-      SANDBOX_DIE(
-          "Kernel refuses to turn on and synchronize threads for BPF filters");
-    }
-  } else {
-    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog)) {
-      SANDBOX_DIE("Kernel refuses to turn on BPF filters");
+  // Install BPF filter programs. If the thread state indicates
+  // multi-threading support, then the kernel hass the seccomp system call.
+  // Otherwise, fall back on prctl, which requires the process to be
+  // single-threaded.
+  for (size_t i = 0; i < num_progs; ++i) {
+    if (must_sync_threads) {
+      int rv = sys_seccomp(SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC,
+                           &progs[i]);
+      if (rv) {
+        SANDBOX_DIE(
+            "Kernel refuses to turn on and synchronize threads for BPF "
+            "filters");
+      }
+    } else {
+      if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &progs[i])) {
+        SANDBOX_DIE("Kernel refuses to turn on BPF filters");
+      }
     }
   }
 
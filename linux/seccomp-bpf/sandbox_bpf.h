@@ -5,19 +5,24 @@
 #ifndef SANDBOX_LINUX_SECCOMP_BPF_SANDBOX_BPF_H_
 #define SANDBOX_LINUX_SECCOMP_BPF_SANDBOX_BPF_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <memory>
+#include <vector>
 
 #include "base/files/scoped_file.h"
 #include "base/macros.h"
 #include "sandbox/linux/bpf_dsl/codegen.h"
+#include "sandbox/linux/bpf_dsl/policy_compiler.h"
+#include "sandbox/linux/bpf_dsl/static_program.h"
 #include "sandbox/sandbox_export.h"
 
 namespace sandbox {
 struct arch_seccomp_data;
 namespace bpf_dsl {
 class Policy;
+class ProgramCache;
 }
 
 // This class can be used to apply a syscall sandboxing policy expressed in a
@@ -34,6 +39,11 @@ class SANDBOX_EXPORT SandboxBPF {
   // Ownership of |policy| is transfered here to the sandbox object.
   // nullptr is allowed for unit tests.
   explicit SandboxBPF(bpf_dsl::Policy* policy);
+  // Installs |program| as is, instead of compiling a policy; see
+  // bpf_dsl::StaticProgram. Since nothing needs to be compiled or
+  // allocated, starting the sandbox only costs the system call that
+  // installs the filter. The program must outlive StartSandbox().
+  explicit SandboxBPF(const bpf_dsl::StaticProgram& program);
   // NOTE: Setting a policy and starting the sandbox is a one-way operation.
   // The kernel does not provide any option for unloading a loaded sandbox. The
   // sandbox remains engaged even when the object is destructed.
@@ -74,6 +84,29 @@ class SANDBOX_EXPORT SandboxBPF {
   // disappears.
   void SetProcFd(base::ScopedFD proc_fd);
 
+  // Makes "StartSandbox()" look up the compiled policy in |cache|, and
+  // store it there if it's missing, instead of always compiling it. See
+  // bpf_dsl::ProgramCache for the requirements on the cache directory and
+  // on the secret that entries are authenticated with.
+  void SetProgramCache(std::unique_ptr<bpf_dsl::ProgramCache> cache);
+
+  // Makes "StartSandbox()" split the compiled policy into several
+  // stacked filters if it's too large for the kernel to accept as a
+  // single one, rather than crashing. Each of the filters decides a range
+  // of system call numbers like the single one would and allows all
+  // others, so together they behave the same; but every system call
+  // passes through all of them, so it's still worth keeping policies
+  // small. Split policies aren't looked up in the program cache.
+  void SetSplitOversizedPolicy(bool split);
+
+  // Makes "StartSandbox()" build the policy's expressions in a
+  // bpf_dsl::ExprArena that's released as soon as the policy is compiled,
+  // which is cheaper for large policies than allocating them one by one.
+  // Only enable this if the policy doesn't keep any expression it
+  // returns from EvaluateSyscall() and friends beyond the call (e.g. in a
+  // static or a member), since the arena CHECKs that it outlives them.
+  void SetCompileInArena(bool compile_in_arena);
+
   // Checks whether a particular system call number is valid on the current
   // architecture.
   static bool IsValidSyscallNumber(int sysnum);
@@ -95,17 +128,27 @@ class SANDBOX_EXPORT SandboxBPF {
  private:
   friend class SandboxBPFTestRunner;
 
-  // Assembles a BPF filter program from the current policy. After calling this
+  // Assembles BPF filter programs from the current policy: just one,
+  // unless it's split as per SetSplitOversizedPolicy(). After calling this
   // function, you must not call any other sandboxing function.
-  CodeGen::Program AssembleFilter();
+  std::vector<bpf_dsl::PolicyCompiler::Filter> AssembleFilters();
 
-  // Assembles and installs a filter based on the policy that has previously
-  // been configured with SetSandboxPolicy().
+  // Assembles and installs the filters based on the policy that has
+  // previously been configured with SetSandboxPolicy().
   void InstallFilter(bool must_sync_threads);
 
+  // Installs the |num_progs| filter programs in |progs|, in order.
+  void InstallPrograms(struct sock_fprog* progs,
+                       size_t num_progs,
+                       bool must_sync_threads);
+
   base::ScopedFD proc_fd_;
   bool sandbox_has_started_;
   std::unique_ptr<bpf_dsl::Policy> policy_;
+  bpf_dsl::StaticProgram static_program_;
+  std::unique_ptr<bpf_dsl::ProgramCache> program_cache_;
+  bool split_oversized_policy_;
+  bool compile_in_arena_;
 
   DISALLOW_COPY_AND_ASSIGN(SandboxBPF);
 };
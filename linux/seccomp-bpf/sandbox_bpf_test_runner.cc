@@ -52,7 +52,7 @@ void SandboxBPFTestRunner::Run() {
     // Call the compiler and verify the policy. That's the least we can do,
     // if we don't have kernel support.
     sandbox::SandboxBPF sandbox(policy.release());
-    sandbox.AssembleFilter();
+    sandbox.AssembleFilters();
     sandbox::UnitTests::IgnoreThisTest();
   }
 }
@@ -29,6 +29,18 @@ struct sock_fprog {
 #define BPF_LD 0x00
 #endif
 
+#ifndef BPF_LDX
+#define BPF_LDX 0x01
+#endif
+
+#ifndef BPF_ST
+#define BPF_ST 0x02
+#endif
+
+#ifndef BPF_STX
+#define BPF_STX 0x03
+#endif
+
 #ifndef BPF_ALU
 #define BPF_ALU 0x04
 #endif
@@ -41,6 +53,10 @@ struct sock_fprog {
 #define BPF_RET 0x06
 #endif
 
+#ifndef BPF_MISC
+#define BPF_MISC 0x07
+#endif
+
 #ifndef BPF_SIZE
 #define BPF_SIZE(code) ((code) & 0x18)
 #endif
@@ -57,6 +73,14 @@ struct sock_fprog {
 #define BPF_ABS 0x20
 #endif
 
+#ifndef BPF_IMM
+#define BPF_IMM 0x00
+#endif
+
+#ifndef BPF_MEM
+#define BPF_MEM 0x60
+#endif
+
 #ifndef BPF_OP
 #define BPF_OP(code) ((code) & 0xf0)
 #endif
@@ -133,6 +157,26 @@ struct sock_fprog {
 #define BPF_K 0x00
 #endif
 
+#ifndef BPF_X
+#define BPF_X 0x08
+#endif
+
+#ifndef BPF_MISCOP
+#define BPF_MISCOP(code) ((code) & 0xf8)
+#endif
+
+#ifndef BPF_TAX
+#define BPF_TAX 0x00
+#endif
+
+#ifndef BPF_TXA
+#define BPF_TXA 0x80
+#endif
+
+#ifndef BPF_MEMWORDS
+#define BPF_MEMWORDS 16
+#endif
+
 #ifndef BPF_MAXINSNS
 #define BPF_MAXINSNS 4096
 #endif